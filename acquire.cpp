@@ -0,0 +1,351 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file acquire.cpp
+ * @brief Synchronised acquisition from several ports on a common time base.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "acquire.h"
+
+#include <algorithm>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+//Floor of the restart threshold of the arrival model
+#define FOH_ACQ_MIN_GAP_NS 2000000ULL
+
+/**
+ *  @param blockNs Length of a sample block
+ *  @param holdNs How long to wait for a silent port before closing a block
+ */
+FOHAcquisition::FOHAcquisition(uint64_t blockNs, uint64_t holdNs)
+	: _blockNs(blockNs ? blockNs : 1), _holdNs(holdNs), _blockStart(0),
+	  _fn(NULL), _ctx(NULL), _sink(NULL), _running(false) {
+}
+
+FOHAcquisition::~FOHAcquisition() {
+	stop();
+	for (size_t i = 0; i < _ports.size(); i++) {
+		delete _ports[i]->decoder;
+		delete _ports[i];
+	}
+}
+
+/**
+ *  @brief Add a port (before start())
+ *
+ *  @param port Open port
+ *  @param id Port number put into samples and sink chunks
+ *  @param latencyNs Transport latency (-1: detect)
+ *
+ *  @return Index of the port, -1 on error
+ */
+int FOHAcquisition::addPort(FOHSerial* port, int id, int64_t latencyNs) {
+	if (port == NULL || _running)
+		return -1;
+
+	_port* p = new _port;
+	memset(p, 0, sizeof(*p));
+	p->port = port;
+	p->id = id;
+	p->decoder = new FOHLineDecoder(id);
+	p->ct = port->charTimeNs();
+	p->latency = latencyNs < 0 ? _detectLatency(port) : (uint64_t)latencyNs;
+	p->gap = std::max<uint64_t>(2 * p->latency, FOH_ACQ_MIN_GAP_NS);
+	p->period = p->ct;
+	p->st.latencyNs = p->latency;
+
+	_ports.push_back(p);
+	return _ports.size() - 1;
+}
+
+/**
+ *  @brief Receive sample blocks (called on the acquisition thread)
+ */
+void FOHAcquisition::setBlockHandler(void (*fn)(void* ctx, const FOHAcqBlock* block), void* ctx) {
+	_fn = fn;
+	_ctx = ctx;
+}
+
+/**
+ *  @brief Start the acquisition thread
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHAcquisition::start() {
+	if (_running || _ports.empty() || _cancel.getFd() < 0)
+		return -1;
+
+	_cancel.reset();
+	_thread = std::thread(&FOHAcquisition::_run, this);
+	_running = true;
+	return 0;
+}
+
+/**
+ *  @brief Stop the acquisition thread and emit what is left
+ */
+void FOHAcquisition::stop() {
+	if (_running == false)
+		return;
+
+	_cancel.cancel();
+	_thread.join();
+	_running = false;
+	_emit(fohMonoNs(), true);
+}
+
+/**
+ *  @brief Timing statistics of a port (thread-safe)
+ */
+FOHAcqPortStats FOHAcquisition::stats(int idx) {
+	FOHAcqPortStats s;
+	memset(&s, 0, sizeof(s));
+	if (idx < 0 || (size_t)idx >= _ports.size())
+		return s;
+
+	std::lock_guard<std::mutex> l(_statLock);
+	_port* p = _ports[idx];
+	s = p->st;
+	s.bytePeriodNs = p->period;
+	s.meanJitterNs = p->jMean;
+	uint64_t n = p->st.chunks - p->st.bursts;
+	s.stdJitterNs = n > 1 ? sqrt(p->jM2 / (n - 1)) : 0.0;
+	return s;
+}
+
+/**
+ *  @brief Read and process once without the thread
+ *
+ *  @param timeoutMs Longest wait for data
+ *
+ *	@return Number of chunks read when successful, -1 otherwise.
+ */
+int FOHAcquisition::pollOnce(int timeoutMs) {
+	std::vector<struct pollfd> fds(_ports.size() + 1);
+	for (size_t i = 0; i < _ports.size(); i++) {
+		//poll() skips negative descriptors
+		fds[i].fd = _ports[i]->st.hungUp ? -1 : _ports[i]->port->getFd();
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+	}
+	fds[_ports.size()].fd = _cancel.getFd();
+	fds[_ports.size()].events = POLLIN;
+	fds[_ports.size()].revents = 0;
+
+	int r = poll(fds.data(), fds.size(), timeoutMs);
+	if (r < 0)
+		return errno == EINTR ? 0 : -1;
+
+	char buf[4096];
+	int chunks = 0;
+	for (size_t i = 0; i < _ports.size(); i++) {
+		if ((fds[i].revents & (POLLIN | POLLERR | POLLHUP)) == 0)
+			continue;
+
+		_port& p = *_ports[i];
+		int n = p.port->readChunk(buf, sizeof(buf), 0);
+		//Stamp right after the read, before any processing
+		uint64_t readTs = fohMonoNs();
+		if (n <= 0) {
+			//Hung up with nothing left to read: polling it again would spin
+			if (fds[i].revents & (POLLERR | POLLHUP)) {
+				std::lock_guard<std::mutex> l(_statLock);
+				p.st.hungUp = true;
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> l(_statLock);
+		uint64_t ts = _stamp(p, readTs, n);
+		l.unlock();
+		if (_sink != NULL)
+			_sink->push(p.id, FOH_DIR_RX, ts, buf, n);
+
+		size_t first = _pending.size();
+		p.decoder->decode(ts, buf, n, _pending, p.period);
+		l.lock();
+		for (size_t k = first; k < _pending.size(); k++)
+			if (_blockStart != 0 && _pending[k].hostNs < _blockStart)
+				p.st.lateSamples++;
+		l.unlock();
+		chunks++;
+	}
+
+	_emit(fohMonoNs(), false);
+	return chunks;
+}
+
+/**
+ *  @brief Stamp a chunk: corrected arrival time of its last byte
+ *
+ *  Bytes arrive no faster than one per period, so every chunk gives an
+ *  upper bound ts - cum * period on the start of the burst. The smallest
+ *  bound over the history is the envelope; delivery later than that is
+ *  buffering in the adapter or the scheduler.
+ */
+uint64_t FOHAcquisition::_stamp(_port& p, uint64_t readTs, size_t n) {
+	p.st.chunks++;
+	p.st.bytes += n;
+
+	for (int pass = 0; pass < 2; pass++) {
+		bool fresh = pass == 1 || p.histLen == 0;
+		if (fresh) {
+			//(Re)start the model at this chunk
+			p.histLen = 0;
+			p.histHead = 0;
+			p.cum = 0;
+			p.period = p.ct;
+			p.st.bursts++;
+		}
+
+		p.cum += n;
+		size_t slot = (p.histHead + p.histLen) % FOH_ACQ_HISTORY;
+		if (p.histLen == FOH_ACQ_HISTORY)
+			p.histHead = (p.histHead + 1) % FOH_ACQ_HISTORY;
+		else
+			p.histLen++;
+		p.hist[slot].ts = readTs;
+		p.hist[slot].cum = p.cum;
+
+		//Actual byte rate: the line may not be saturated
+		const _point& first = p.hist[p.histHead];
+		if (p.histLen >= 8 && p.cum > first.cum)
+			p.period = std::max<uint64_t>(p.ct, (readTs - first.ts) / (p.cum - first.cum));
+
+		int64_t minOff = INT64_MAX;
+		for (size_t i = 0; i < p.histLen; i++) {
+			const _point& h = p.hist[(p.histHead + i) % FOH_ACQ_HISTORY];
+			minOff = std::min(minOff, (int64_t)h.ts - (int64_t)(h.cum * p.period));
+		}
+		uint64_t arrival = std::min<uint64_t>(readTs, minOff + (int64_t)(p.cum * p.period));
+		uint64_t jitter = readTs - arrival;
+
+		if (jitter > p.gap && pass == 0)
+			continue;
+
+		//Jitter is only defined against an existing model
+		if (fresh == false) {
+			double d = jitter - p.jMean;
+			uint64_t cnt = p.st.chunks - p.st.bursts;
+			p.jMean += d / cnt;
+			p.jM2 += d * (jitter - p.jMean);
+			p.st.maxJitterNs = std::max(p.st.maxJitterNs, jitter);
+		}
+
+		uint64_t ts = arrival > p.latency ? arrival - p.latency : 0;
+		ts = std::max(ts, p.watermark);
+		p.watermark = ts;
+		return ts;
+	}
+	return readTs;
+}
+
+/**
+ *  @brief Emit every block all ports have moved past
+ *
+ *  @param now Current time
+ *  @param all Flush everything pending (on stop)
+ */
+void FOHAcquisition::_emit(uint64_t now, bool all) {
+	if (_blockStart == 0) {
+		if (_pending.empty())
+			return;
+		uint64_t first = UINT64_MAX;
+		for (size_t i = 0; i < _pending.size(); i++)
+			first = std::min(first, _pending[i].hostNs);
+		_blockStart = first - first % _blockNs;
+	}
+
+	uint64_t low = UINT64_MAX;
+	if (all == false) {
+		for (size_t i = 0; i < _ports.size(); i++) {
+			uint64_t idle = now - std::min(now, _ports[i]->latency + _holdNs);
+			low = std::min(low, std::max(_ports[i]->watermark, idle));
+		}
+	}
+
+	while (_blockStart + _blockNs <= low) {
+		if (all && _pending.empty())
+			break;
+
+		uint64_t end = _blockStart + _blockNs;
+		_out.clear();
+		size_t keep = 0;
+		for (size_t i = 0; i < _pending.size(); i++) {
+			if (_pending[i].hostNs < end)
+				_out.push_back(_pending[i]);
+			else
+				_pending[keep++] = _pending[i];
+		}
+		_pending.resize(keep);
+
+		std::stable_sort(_out.begin(), _out.end(), [](const FOHSample& a, const FOHSample& b) {
+			return a.hostNs < b.hostNs;
+		});
+
+		if (_fn != NULL) {
+			FOHAcqBlock b = { _blockStart, end, _out.data(), _out.size() };
+			_fn(_ctx, &b);
+		}
+		_blockStart = end;
+	}
+}
+
+/**
+ *  @brief Transport latency of a USB serial adapter
+ *
+ *  Sparse data waits in the adapter until its latency timer runs out.
+ *
+ *  @return Latency in ns, 0 if the port has no latency timer
+ */
+uint64_t FOHAcquisition::_detectLatency(FOHSerial* port) {
+	char link[64], dev[256], path[320];
+	snprintf(link, sizeof(link), "/proc/self/fd/%d", port->getFd());
+	ssize_t n = readlink(link, dev, sizeof(dev) - 1);
+	if (n <= 0)
+		return 0;
+	dev[n] = '\0';
+
+	const char* name = strrchr(dev, '/');
+	name = name ? name + 1 : dev;
+	snprintf(path, sizeof(path), "/sys/class/tty/%s/device/latency_timer", name);
+
+	FILE* f = fopen(path, "r");
+	if (f == NULL)
+		return 0;
+	unsigned ms = 0;
+	if (fscanf(f, "%u", &ms) != 1)
+		ms = 0;
+	fclose(f);
+	return ms * 1000000ULL;
+}
+
+void FOHAcquisition::_run() {
+	int tick = std::max<int>(1, _holdNs / 1000000ULL);
+	while (_cancel.cancelled() == false)
+		if (pollOnce(tick) < 0)
+			break;
+}
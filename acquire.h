@@ -0,0 +1,193 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file acquire.h
+ * @brief Synchronised acquisition from several ports on a common time base.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_ACQUIRE_H
+#define FOH_ACQUIRE_H
+
+#include "serial.h"
+#include "decode.h"
+#include "cancel.h"
+#include "sink.h"
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Chunk history used for the arrival model of a port
+#define FOH_ACQ_HISTORY 128
+
+/**
+ *  @brief Timing statistics of one acquired port (snapshot)
+ */
+struct FOHAcqPortStats {
+	uint64_t chunks; /**< Chunks read */
+	uint64_t bytes; /**< Bytes read */
+	uint64_t latencyNs; /**< Transport latency subtracted from every stamp */
+	uint64_t bytePeriodNs; /**< Current byte arrival period of the model */
+	double meanJitterNs; /**< Mean buffering delay removed by the model */
+	double stdJitterNs; /**< Its standard deviation (alignment jitter) */
+	uint64_t maxJitterNs; /**< Largest buffering delay seen */
+	uint64_t bursts; /**< Times the model restarted after a gap */
+	uint64_t lateSamples; /**< Samples that missed their block */
+	bool hungUp; /**< Port hung up and is no longer polled */
+};
+
+/**
+ *  @brief Samples of all ports for one time slot
+ */
+struct FOHAcqBlock {
+	uint64_t startNs; /**< Slot start (corrected host time) */
+	uint64_t endNs; /**< Slot end, exclusive */
+	const FOHSample* samples; /**< Samples of all ports, sorted by time */
+	size_t count; /**< Number of samples */
+};
+
+/**
+ *  @brief Reads several ports and aligns their samples in time
+ *
+ *  One thread polls all ports and stamps every chunk with fohMonoNs().
+ *  Read time is not arrival time: USB adapters hold data for their latency
+ *  timer and deliver it in frames. Per port, a linear arrival model is fit
+ *  to the recent chunks (byte count against read time); its lower envelope
+ *  is the earliest consistent delivery, so the delay above it is buffering
+ *  and is taken out of the stamp. A fixed transport latency, read from the
+ *  USB serial latency_timer in sysfs if not given, is subtracted as well.
+ *  After a pause in the data the model starts over. A port that hangs up
+ *  (unplugged adapter) is no longer polled.
+ *
+ *  Lines are decoded into samples stamped at their terminator and handed
+ *  out in blocks of blockNs, once every port has moved past the block end
+ *  (silent ports count as moved on after holdNs).
+ */
+class FOHAcquisition {
+public:
+	/**
+	 *  @param blockNs Length of a sample block
+	 *  @param holdNs How long to wait for a silent port before closing a block
+	 */
+	FOHAcquisition(uint64_t blockNs, uint64_t holdNs = 50000000ULL);
+	~FOHAcquisition();
+
+	/**
+	 *  @brief Add a port (before start())
+	 *
+	 *  @param port Open port
+	 *  @param id Port number put into samples and sink chunks
+	 *  @param latencyNs Transport latency (-1: detect)
+	 *
+	 *  @return Index of the port, -1 on error
+	 */
+	int addPort(FOHSerial* port, int id, int64_t latencyNs = -1);
+
+	/**
+	 *  @brief Receive sample blocks (called on the acquisition thread)
+	 */
+	void setBlockHandler(void (*fn)(void* ctx, const FOHAcqBlock* block), void* ctx);
+
+	/**
+	 *  @brief Also pass raw chunks with corrected stamps to a sink
+	 */
+	void setSink(FOHSink* sink) { _sink = sink; }
+
+	/**
+	 *  @brief Start the acquisition thread
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int start();
+
+	/**
+	 *  @brief Stop the acquisition thread and emit what is left
+	 */
+	void stop();
+
+	/**
+	 *  @brief Read and process once without the thread
+	 *
+	 *  @param timeoutMs Longest wait for data
+	 *
+	 *	@return Number of chunks read when successful, -1 otherwise.
+	 */
+	int pollOnce(int timeoutMs);
+
+	/**
+	 *  @brief Timing statistics of a port (thread-safe)
+	 */
+	FOHAcqPortStats stats(int idx);
+
+private:
+	struct _point {
+		uint64_t ts; /**< Read time */
+		uint64_t cum; /**< Bytes received up to and including this chunk */
+	};
+
+	struct _port {
+		FOHSerial* port; /**< Port */
+		int id; /**< Port number */
+		FOHLineDecoder* decoder; /**< Line state */
+		uint64_t ct; /**< Character time */
+		uint64_t latency; /**< Transport latency */
+		uint64_t gap; /**< Buffering delay that restarts the model */
+		_point hist[FOH_ACQ_HISTORY]; /**< Recent chunks */
+		size_t histLen; /**< Valid entries */
+		size_t histHead; /**< Oldest entry */
+		uint64_t cum; /**< Bytes in the current burst */
+		uint64_t period; /**< Byte arrival period */
+		uint64_t watermark; /**< Corrected time up to which data is stamped */
+		double jMean; /**< Jitter mean (Welford) */
+		double jM2; /**< Jitter sum of squares (Welford) */
+		FOHAcqPortStats st; /**< Counters */
+	};
+
+	/**
+	 *  @brief Stamp a chunk: corrected arrival time of its last byte
+	 */
+	uint64_t _stamp(_port& p, uint64_t readTs, size_t n);
+
+	/**
+	 *  @brief Emit every block all ports have moved past
+	 */
+	void _emit(uint64_t now, bool all);
+
+	static uint64_t _detectLatency(FOHSerial* port);
+	void _run();
+
+	uint64_t _blockNs; /**< Block length */
+	uint64_t _holdNs; /**< Wait for silent ports */
+	uint64_t _blockStart; /**< Start of the next block, 0 before the first sample */
+	std::vector<_port*> _ports; /**< Ports */
+	std::vector<FOHSample> _pending; /**< Samples not yet emitted */
+	std::vector<FOHSample> _out; /**< Block being emitted */
+	void (*_fn)(void*, const FOHAcqBlock*); /**< Block handler */
+	void* _ctx; /**< Handler context */
+	FOHSink* _sink; /**< Raw chunk sink */
+	FOHCancelToken _cancel; /**< Stops the thread */
+	std::thread _thread; /**< Acquisition thread */
+	std::mutex _statLock; /**< Protects the counters and model figures of the ports */
+	bool _running; /**< Thread started */
+};
+
+#endif
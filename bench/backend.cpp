@@ -0,0 +1,369 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file bench/backend.cpp
+ * @brief Receive backends compared by the scaling benchmarks.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "backend.h"
+#include "../decode.h"
+#include "../eventloop.h"
+#include "../acquire.h"
+
+#include <string.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define FOH_BENCH_CHUNK 4096
+#define FOH_BENCH_TX_BUF 65536 /**< Per port send buffer of the non-blocking backends */
+
+/**
+ *  @brief One blocking thread per port, sending from the caller
+ */
+class _threadBackend : public FOHBenchBackend {
+public:
+	const char* name() const { return "thread"; }
+
+	int start(FOHSerial** ports, int n, FOHBenchRxFn fn, void* ctx) {
+		_stop = false;
+		_ports.assign(ports, ports + n);
+		for (int i = 0; i < n; i++)
+			_threads.push_back(std::thread(&_threadBackend::_run, this, ports[i], i, fn, ctx));
+		return 0;
+	}
+
+	void stop() {
+		_stop = true;
+		for (size_t i = 0; i < _threads.size(); i++)
+			_threads[i].join();
+		_threads.clear();
+	}
+
+	int send(int port, const void* data, size_t len) {
+		struct iovec iov;
+		iov.iov_base = (void*)data;
+		iov.iov_len = len;
+		return _ports[port]->writeToSerialPortv(&iov, 1) == (int)len ? (int)len : -1;
+	}
+
+private:
+	void _run(FOHSerial* port, int idx, FOHBenchRxFn fn, void* ctx) {
+		FOHLineDecoder dec(idx);
+		std::vector<FOHSample> out;
+		char buf[FOH_BENCH_CHUNK];
+
+		while (_stop == false) {
+			int n = port->readChunk(buf, sizeof(buf), 50);
+			if (n < 0)
+				break;
+			if (n == 0)
+				continue;
+			out.clear();
+			dec.decode(fohMonoNs(), buf, n, out);
+			if (out.empty() == false)
+				fn(ctx, out.data(), out.size());
+		}
+	}
+
+	std::atomic<bool> _stop;
+	std::vector<FOHSerial*> _ports;
+	std::vector<std::thread> _threads;
+};
+
+/**
+ *  @brief Receive and transmit state of a port in the non-blocking backends
+ */
+struct _txPort {
+	FOHSerial* port;
+	int fd;
+	FOHLineDecoder* dec;
+	std::mutex lock; /**< Protects out */
+	std::string out; /**< Bytes taken by send() */
+
+	_txPort(FOHSerial* p, int idx) : port(p), fd(p->getFd()), dec(new FOHLineDecoder(idx)) {}
+	~_txPort() { delete dec; }
+
+	//Read what's there and hand out the samples
+	int receive(std::vector<FOHSample>& samples, FOHBenchRxFn fn, void* ctx) {
+		char buf[FOH_BENCH_CHUNK];
+		int total = 0;
+		for (;;) {
+			int n = port->readChunk(buf, sizeof(buf), 0);
+			if (n < 0)
+				return -1;
+			if (n == 0)
+				break;
+			total += n;
+			samples.clear();
+			dec->decode(fohMonoNs(), buf, n, samples);
+			if (samples.empty() == false)
+				fn(ctx, samples.data(), samples.size());
+			if ((size_t)n < sizeof(buf))
+				break;
+		}
+		return total;
+	}
+
+	//Write what fits, true if bytes are left
+	bool flush() {
+		std::lock_guard<std::mutex> l(lock);
+		if (out.empty())
+			return false;
+		struct iovec iov;
+		iov.iov_base = &out[0];
+		iov.iov_len = out.size();
+		int w = port->writeNow(&iov, 1);
+		if (w > 0)
+			out.erase(0, w);
+		return out.empty() == false;
+	}
+
+	//Take bytes, true if the buffer was empty before
+	int take(const void* data, size_t len, bool& wasEmpty) {
+		std::lock_guard<std::mutex> l(lock);
+		if (out.size() + len > FOH_BENCH_TX_BUF)
+			return 0;
+		wasEmpty = out.empty();
+		out.append((const char*)data, len);
+		return len;
+	}
+
+	size_t queued() {
+		std::lock_guard<std::mutex> l(lock);
+		return out.size();
+	}
+};
+
+/**
+ *  @brief All ports on one FOHEventLoop thread
+ */
+class _epollBackend : public FOHBenchBackend {
+public:
+	const char* name() const { return "epoll"; }
+
+	int start(FOHSerial** ports, int n, FOHBenchRxFn fn, void* ctx) {
+		_fn = fn;
+		_ctx = ctx;
+		for (int i = 0; i < n; i++) {
+			_port* p = new _port(ports[i], i);
+			p->self = this;
+			p->watch.fn = _ready;
+			p->watch.ctx = p;
+			_ports.push_back(p);
+			if (_loop.watch(p->fd, &p->watch) < 0 || _loop.arm(p->fd, &p->watch, EPOLLIN) < 0) {
+				_cleanup();
+				return -1;
+			}
+		}
+		_thread = std::thread(&FOHEventLoop::run, &_loop);
+		return 0;
+	}
+
+	void stop() {
+		if (_thread.joinable()) {
+			_loop.stop();
+			_thread.join();
+		}
+		_cleanup();
+	}
+
+	int send(int port, const void* data, size_t len) {
+		_port* p = _ports[port];
+		bool wasEmpty = false;
+		int r = p->take(data, len, wasEmpty);
+
+		//On the loop thread write right away, otherwise let the loop know
+		if (r > 0 && _inLoop == this)
+			_service(p);
+		else if (r > 0 && wasEmpty)
+			_loop.post(_kick, p);
+		return r;
+	}
+
+	size_t unsent() {
+		size_t n = 0;
+		for (size_t i = 0; i < _ports.size(); i++)
+			n += _ports[i]->queued();
+		return n;
+	}
+
+private:
+	struct _port : _txPort {
+		_epollBackend* self;
+		FOHLoopWatch watch;
+
+		_port(FOHSerial* p, int idx) : _txPort(p, idx) {}
+	};
+
+	static void _service(_port* p) {
+		bool more = p->flush();
+		p->self->_loop.arm(p->fd, &p->watch, EPOLLIN | (more ? (uint32_t)EPOLLOUT : 0));
+	}
+
+	static void _ready(void* ctx, uint32_t events) {
+		_port* p = (_port*)ctx;
+		_epollBackend* b = p->self;
+
+		//Only read on EPOLLIN, a hung up port stays disarmed
+		_inLoop = b;
+		int r = (events & EPOLLIN) ? p->receive(b->_samples, b->_fn, b->_ctx) : 0;
+		if (r >= 0 && (events & (EPOLLHUP | EPOLLERR)) == 0)
+			_service(p);
+		_inLoop = NULL;
+	}
+
+	static void _kick(void* ctx) {
+		_port* p = (_port*)ctx;
+		_inLoop = p->self;
+		_service(p);
+		_inLoop = NULL;
+	}
+
+	void _cleanup() {
+		for (size_t i = 0; i < _ports.size(); i++) {
+			_loop.unwatch(_ports[i]->fd);
+			delete _ports[i];
+		}
+		_ports.clear();
+	}
+
+	static thread_local _epollBackend* _inLoop; /**< Backend whose callback runs on this thread */
+
+	FOHEventLoop _loop;
+	std::vector<_port*> _ports;
+	std::vector<FOHSample> _samples;
+	FOHBenchRxFn _fn;
+	void* _ctx;
+	std::thread _thread;
+};
+
+thread_local _epollBackend* _epollBackend::_inLoop = NULL;
+
+/**
+ *  @brief One thread spinning over all ports without ever sleeping
+ */
+class _busyBackend : public FOHBenchBackend {
+public:
+	const char* name() const { return "busy"; }
+
+	int start(FOHSerial** ports, int n, FOHBenchRxFn fn, void* ctx) {
+		for (int i = 0; i < n; i++)
+			_ports.push_back(new _txPort(ports[i], i));
+		_stop = false;
+		_thread = std::thread(&_busyBackend::_run, this, fn, ctx);
+		return 0;
+	}
+
+	void stop() {
+		if (_thread.joinable()) {
+			_stop = true;
+			_thread.join();
+		}
+		for (size_t i = 0; i < _ports.size(); i++)
+			delete _ports[i];
+		_ports.clear();
+	}
+
+	int send(int port, const void* data, size_t len) {
+		bool wasEmpty;
+		return _ports[port]->take(data, len, wasEmpty);
+	}
+
+	size_t unsent() {
+		size_t n = 0;
+		for (size_t i = 0; i < _ports.size(); i++)
+			n += _ports[i]->queued();
+		return n;
+	}
+
+private:
+	void _run(FOHBenchRxFn fn, void* ctx) {
+		std::vector<FOHSample> samples;
+		while (_stop.load(std::memory_order_relaxed) == false) {
+			for (size_t i = 0; i < _ports.size(); i++) {
+				_ports[i]->receive(samples, fn, ctx);
+				_ports[i]->flush();
+			}
+		}
+	}
+
+	std::atomic<bool> _stop;
+	std::vector<_txPort*> _ports;
+	std::thread _thread;
+};
+
+/**
+ *  @brief FOHAcquisition: one polling thread, time aligned blocks, receive only
+ */
+class _acquireBackend : public FOHBenchBackend {
+public:
+	_acquireBackend() : _acq(1000000ULL, 10000000ULL) {}
+
+	const char* name() const { return "acquire"; }
+
+	int start(FOHSerial** ports, int n, FOHBenchRxFn fn, void* ctx) {
+		for (int i = 0; i < n; i++)
+			if (_acq.addPort(ports[i], i, 0) < 0)
+				return -1;
+		_fn = fn;
+		_ctx = ctx;
+		_acq.setBlockHandler(_block, this);
+		return _acq.start();
+	}
+
+	void stop() {
+		_acq.stop();
+	}
+
+private:
+	static void _block(void* ctx, const FOHAcqBlock* b) {
+		_acquireBackend* self = (_acquireBackend*)ctx;
+		if (b->count)
+			self->_fn(self->_ctx, b->samples, b->count);
+	}
+
+	FOHAcquisition _acq;
+	FOHBenchRxFn _fn;
+	void* _ctx;
+};
+
+static const char* const _names[] = { "thread", "epoll", "busy", "acquire", NULL };
+
+FOHBenchBackend* fohBenchBackend(const char* name) {
+	if (strcmp(name, "thread") == 0)
+		return new _threadBackend;
+	if (strcmp(name, "epoll") == 0)
+		return new _epollBackend;
+	if (strcmp(name, "busy") == 0)
+		return new _busyBackend;
+	if (strcmp(name, "acquire") == 0)
+		return new _acquireBackend;
+	return NULL;
+}
+
+const char* const* fohBenchBackends() {
+	return _names;
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file bench/backend.h
+ * @brief Receive backends compared by the scaling benchmarks.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_BENCH_BACKEND_H
+#define FOH_BENCH_BACKEND_H
+
+#include "../serial.h"
+#include "../sink.h"
+
+/**
+ *  @brief Decoded samples, called from a backend thread
+ */
+typedef void (*FOHBenchRxFn)(void* ctx, const FOHSample* samples, size_t n);
+
+/**
+ *  @brief A way of reading many ports: read, decode into samples, deliver
+ *
+ *  Sample port numbers are the port's index. Samples of one port are
+ *  never delivered from two threads at once.
+ */
+class FOHBenchBackend {
+public:
+	virtual ~FOHBenchBackend() {}
+
+	virtual const char* name() const = 0;
+
+	/**
+	 *  @brief Start reading
+	 *
+	 *  @param ports Open ports
+	 *  @param n Number of ports
+	 *  @param fn Receives the samples
+	 *  @param ctx Passed to fn
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	virtual int start(FOHSerial** ports, int n, FOHBenchRxFn fn, void* ctx) = 0;
+
+	/**
+	 *  @brief Stop reading, fn isn't called any more afterwards
+	 */
+	virtual void stop() = 0;
+
+	/**
+	 *  @brief Send bytes on a port, after start() (also from fn)
+	 *
+	 *  Blocking backends write before returning, the others buffer the
+	 *  bytes up to a limit and write them from their own thread.
+	 *
+	 *  @return len when taken, 0 when the buffer is full, -1 if the backend can't send.
+	 */
+	virtual int send(int /*port*/, const void* /*data*/, size_t /*len*/) { return -1; }
+
+	/**
+	 *  @brief Bytes taken by send() and not written yet
+	 */
+	virtual size_t unsent() { return 0; }
+};
+
+/**
+ *  @brief Create a backend by name (NULL if unknown)
+ */
+FOHBenchBackend* fohBenchBackend(const char* name);
+
+/**
+ *  @brief Names of the backends, NULL terminated
+ */
+const char* const* fohBenchBackends();
+
+#endif
@@ -0,0 +1,674 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file bench/bench.cpp
+ * @brief Benchmark harness: resource accounting and pty peers.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "bench.h"
+#include "../serial.h"
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+static std::atomic<int64_t> _syscalls(0);
+static std::atomic<int64_t> _allocs(0);
+static std::atomic<int64_t> _allocBytes(0);
+
+int64_t fohBenchSyscalls() {
+	return _syscalls.load(std::memory_order_relaxed);
+}
+
+int64_t fohBenchAllocs() {
+	return _allocs.load(std::memory_order_relaxed);
+}
+
+int64_t fohBenchAllocBytes() {
+	return _allocBytes.load(std::memory_order_relaxed);
+}
+
+//Counting wrappers, the Makefile links with -Wl,--wrap=<name> for each
+#define _SYSCALL() _syscalls.fetch_add(1, std::memory_order_relaxed)
+
+extern "C" {
+ssize_t __real_read(int fd, void* buf, size_t n);
+ssize_t __real_write(int fd, const void* buf, size_t n);
+ssize_t __real_readv(int fd, const struct iovec* iov, int cnt);
+ssize_t __real_writev(int fd, const struct iovec* iov, int cnt);
+int __real_poll(struct pollfd* fds, nfds_t n, int timeout);
+int __real_ioctl(int fd, unsigned long req, ...);
+int __real_tcflush(int fd, int q);
+int __real_tcdrain(int fd);
+int __real_usleep(useconds_t us);
+int __real_nanosleep(const struct timespec* req, struct timespec* rem);
+int __real_epoll_wait(int epfd, struct epoll_event* ev, int max, int timeout);
+int __real_epoll_ctl(int epfd, int op, int fd, struct epoll_event* ev);
+
+ssize_t __wrap_read(int fd, void* buf, size_t n) { _SYSCALL(); return __real_read(fd, buf, n); }
+ssize_t __wrap_write(int fd, const void* buf, size_t n) { _SYSCALL(); return __real_write(fd, buf, n); }
+ssize_t __wrap_readv(int fd, const struct iovec* iov, int cnt) { _SYSCALL(); return __real_readv(fd, iov, cnt); }
+ssize_t __wrap_writev(int fd, const struct iovec* iov, int cnt) { _SYSCALL(); return __real_writev(fd, iov, cnt); }
+int __wrap_poll(struct pollfd* fds, nfds_t n, int timeout) { _SYSCALL(); return __real_poll(fds, n, timeout); }
+int __wrap_ioctl(int fd, unsigned long req, void* arg) { _SYSCALL(); return __real_ioctl(fd, req, arg); }
+int __wrap_tcflush(int fd, int q) { _SYSCALL(); return __real_tcflush(fd, q); }
+int __wrap_tcdrain(int fd) { _SYSCALL(); return __real_tcdrain(fd); }
+int __wrap_usleep(useconds_t us) { _SYSCALL(); return __real_usleep(us); }
+int __wrap_nanosleep(const struct timespec* req, struct timespec* rem) { _SYSCALL(); return __real_nanosleep(req, rem); }
+int __wrap_epoll_wait(int epfd, struct epoll_event* ev, int max, int timeout) { _SYSCALL(); return __real_epoll_wait(epfd, ev, max, timeout); }
+int __wrap_epoll_ctl(int epfd, int op, int fd, struct epoll_event* ev) { _SYSCALL(); return __real_epoll_ctl(epfd, op, fd, ev); }
+}
+
+//Counting allocator
+static void* _alloc(size_t n) {
+	_allocs.fetch_add(1, std::memory_order_relaxed);
+	_allocBytes.fetch_add(n, std::memory_order_relaxed);
+	void* p = malloc(n ? n : 1);
+	return p;
+}
+
+void* operator new(size_t n) {
+	void* p = _alloc(n);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t n) {
+	void* p = _alloc(n);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new(size_t n, const std::nothrow_t&) noexcept { return _alloc(n); }
+void* operator new[](size_t n, const std::nothrow_t&) noexcept { return _alloc(n); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+static int _perfOpen(uint32_t type, uint64_t config, bool kernel) {
+	struct perf_event_attr a;
+	memset(&a, 0, sizeof(a));
+	a.size = sizeof(a);
+	a.type = type;
+	a.config = config;
+	a.disabled = 1;
+	//Not inherited: the pty peers are forked children and must not count
+	a.exclude_hv = 1;
+	a.exclude_kernel = kernel ? 0 : 1;
+	return syscall(SYS_perf_event_open, &a, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+//Id of the raw_syscalls:sys_enter tracepoint, or -1
+static int64_t _sysEnterId() {
+	static const char* paths[] = {
+		"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+		"/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+	};
+	for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+		FILE* f = fopen(paths[i], "r");
+		if (f == NULL)
+			continue;
+		long long id = -1;
+		if (fscanf(f, "%lld", &id) != 1)
+			id = -1;
+		fclose(f);
+		if (id >= 0)
+			return id;
+	}
+	return -1;
+}
+
+static int64_t _perfRead(int fd) {
+	uint64_t v;
+	if (fd < 0 || read(fd, &v, sizeof(v)) != sizeof(v))
+		return -1;
+	return v;
+}
+
+static void _usage(uint64_t& cpuNs, int64_t& ctx, int64_t& flt) {
+	struct rusage u;
+	getrusage(RUSAGE_SELF, &u);
+	cpuNs = (u.ru_utime.tv_sec + u.ru_stime.tv_sec) * 1000000000ULL
+			+ (u.ru_utime.tv_usec + u.ru_stime.tv_usec) * 1000ULL;
+	ctx = u.ru_nvcsw + u.ru_nivcsw;
+	flt = u.ru_minflt + u.ru_majflt;
+}
+
+FOHBenchMeter::FOHBenchMeter() {
+	//Cycles including the kernel if allowed, user space only otherwise
+	_cycFd = _perfOpen(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, true);
+	if (_cycFd < 0)
+		_cycFd = _perfOpen(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, false);
+
+	_sysFd = -1;
+	int64_t id = _sysEnterId();
+	if (id >= 0)
+		_sysFd = _perfOpen(PERF_TYPE_TRACEPOINT, id, true);
+
+	_t0 = _cpu0 = 0;
+	_ctx0 = _flt0 = _sys0 = _alloc0 = _allocBytes0 = 0;
+}
+
+FOHBenchMeter::~FOHBenchMeter() {
+	if (_cycFd >= 0)
+		close(_cycFd);
+	if (_sysFd >= 0)
+		close(_sysFd);
+}
+
+void FOHBenchMeter::start() {
+	if (_cycFd >= 0) {
+		ioctl(_cycFd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(_cycFd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	if (_sysFd >= 0) {
+		ioctl(_sysFd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(_sysFd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	_usage(_cpu0, _ctx0, _flt0);
+	_sys0 = fohBenchSyscalls();
+	_alloc0 = fohBenchAllocs();
+	_allocBytes0 = fohBenchAllocBytes();
+	_t0 = fohMonoNs();
+}
+
+void FOHBenchMeter::stop(FOHBenchResult& r) {
+	r.wallNs = fohMonoNs() - _t0;
+	r.allocs = fohBenchAllocs() - _alloc0;
+	r.allocBytes = fohBenchAllocBytes() - _allocBytes0;
+	r.syscalls = fohBenchSyscalls() - _sys0;
+
+	uint64_t cpu;
+	int64_t ctx, flt;
+	_usage(cpu, ctx, flt);
+	r.cpuNs = cpu - _cpu0;
+	r.ctxSwitches = ctx - _ctx0;
+	r.pageFaults = flt - _flt0;
+
+	r.cycles = -1;
+	if (_cycFd >= 0) {
+		ioctl(_cycFd, PERF_EVENT_IOC_DISABLE, 0);
+		r.cycles = _perfRead(_cycFd);
+	}
+	if (_sysFd >= 0) {
+		ioctl(_sysFd, PERF_EVENT_IOC_DISABLE, 0);
+		r.syscalls = _perfRead(_sysFd);
+	}
+}
+
+double fohBenchMBps(const FOHBenchResult& r) {
+	if (r.wallNs == 0)
+		return -1;
+	return r.bytes * 1e3 / r.wallNs;
+}
+
+double fohBenchPerKiB(const FOHBenchResult& r, int64_t v) {
+	if (v < 0 || r.bytes == 0)
+		return -1;
+	return v * 1024.0 / r.bytes;
+}
+
+double fohBenchCyclesPerByte(const FOHBenchResult& r) {
+	if (r.cycles < 0 || r.bytes == 0)
+		return -1;
+	return (double)r.cycles / r.bytes;
+}
+
+FOHBenchPeer::FOHBenchPeer() {
+	_pid = -1;
+	_go = -1;
+	_master = -1;
+	_path[0] = '\0';
+}
+
+FOHBenchPeer::~FOHBenchPeer() {
+	stop();
+}
+
+static void _peerRun(int master, int mode, uint64_t bytes, const char* line) {
+	char buf[65536];
+
+	if (mode == FOH_PEER_SOURCE) {
+		//Fill the buffer with whole lines and send it until done
+		size_t ll = strlen(line), fill = 0;
+		while (ll && fill + ll <= sizeof(buf)) {
+			memcpy(buf + fill, line, ll);
+			fill += ll;
+		}
+		while (bytes > 0 && fill > 0) {
+			size_t n = bytes < fill ? bytes : fill;
+			ssize_t w = write(master, buf, n);
+			if (w < 0 && errno == EINTR)
+				continue;
+			if (w <= 0)
+				return;
+			bytes -= w;
+		}
+		//Keep the pty open until we're stopped
+		pause();
+		return;
+	}
+
+	for (;;) {
+		ssize_t n = read(master, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		if (mode != FOH_PEER_ECHO)
+			continue;
+		for (ssize_t off = 0; off < n;) {
+			ssize_t w = write(master, buf + off, n - off);
+			if (w < 0 && errno == EINTR)
+				continue;
+			if (w <= 0)
+				return;
+			off += w;
+		}
+	}
+}
+
+/**
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHBenchPeer::start(int mode, uint64_t bytes, const char* line) {
+	if (_pid >= 0)
+		return -1;
+
+	_master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (_master < 0)
+		return -1;
+	if (grantpt(_master) < 0 || unlockpt(_master) < 0 || ptsname_r(_master, _path, sizeof(_path)) != 0
+			|| fohBenchRaw(_master) < 0) {
+		stop();
+		return -1;
+	}
+
+	int p[2];
+	if (pipe2(p, O_CLOEXEC) < 0) {
+		stop();
+		return -1;
+	}
+
+	fflush(NULL);
+	_pid = fork();
+	if (_pid < 0) {
+		close(p[0]);
+		close(p[1]);
+		stop();
+		return -1;
+	}
+	if (_pid == 0) {
+		//Wait for go(), then act as the device
+		char c;
+		close(p[1]);
+		if (read(p[0], &c, 1) == 1)
+			_peerRun(_master, mode, bytes, line);
+		_exit(0);
+	}
+
+	close(p[0]);
+	_go = p[1];
+	return 0;
+}
+
+/**
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHBenchPeer::go(int slaveFd) {
+	if (_go < 0 || fohBenchRaw(slaveFd) < 0)
+		return -1;
+
+	tcflush(slaveFd, TCIOFLUSH);
+	char c = 1;
+	int r = write(_go, &c, 1) == 1 ? 0 : -1;
+	close(_go);
+	_go = -1;
+	return r;
+}
+
+void FOHBenchPeer::stop() {
+	if (_go >= 0) {
+		close(_go);
+		_go = -1;
+	}
+	if (_pid > 0) {
+		kill(_pid, SIGKILL);
+		waitpid(_pid, NULL, 0);
+	}
+	_pid = -1;
+	if (_master >= 0)
+		close(_master);
+	_master = -1;
+}
+
+FOHBenchPeerGroup::FOHBenchPeerGroup() {
+	_pid = -1;
+	_go = -1;
+}
+
+FOHBenchPeerGroup::~FOHBenchPeerGroup() {
+	stop();
+}
+
+static size_t _groupLine(char* line, size_t lineLen, uint64_t ts, uint64_t seq) {
+	size_t n = snprintf(line, lineLen, "%llu %llu", (unsigned long long)ts, (unsigned long long)seq);
+	while (n + 3 <= lineLen) {
+		line[n++] = ' ';
+		line[n++] = '0';
+	}
+	line[n++] = '\n';
+	return n;
+}
+
+//Drain or echo on all masters
+static void _groupServe(const std::vector<int>& masters, int mode) {
+	std::vector<struct pollfd> pfd(masters.size());
+	char buf[65536];
+
+	for (size_t i = 0; i < masters.size(); i++) {
+		pfd[i].fd = masters[i];
+		pfd[i].events = POLLIN;
+	}
+
+	for (;;) {
+		if (poll(pfd.data(), pfd.size(), -1) < 0 && errno != EINTR)
+			return;
+		for (size_t i = 0; i < pfd.size(); i++) {
+			if ((pfd[i].revents & POLLIN) == 0)
+				continue;
+			ssize_t n = read(pfd[i].fd, buf, sizeof(buf));
+			if (n <= 0 || mode != FOH_PEER_ECHO)
+				continue;
+			for (ssize_t off = 0; off < n;) {
+				ssize_t w = write(pfd[i].fd, buf + off, n - off);
+				if (w < 0 && errno == EINTR)
+					continue;
+				if (w <= 0)
+					break;
+				off += w;
+			}
+		}
+	}
+}
+
+static void _groupRun(const std::vector<int>& masters, double rate, size_t lineLen, int burst) {
+	size_t n = masters.size();
+	std::vector<uint64_t> sent(n, 0);
+	char line[256];
+
+	for (size_t i = 0; i < n; i++)
+		fcntl(masters[i], F_SETFL, fcntl(masters[i], F_GETFL) | O_NONBLOCK);
+
+	uint64_t t0 = fohMonoNs();
+	struct timespec tick;
+	clock_gettime(CLOCK_MONOTONIC, &tick);
+
+	for (;;) {
+		uint64_t now = fohMonoNs();
+		for (size_t i = 0; i < n; i++) {
+			//Ports are phase shifted so they don't all send at once
+			uint64_t due = (uint64_t)((now - t0) * 1e-9 * rate / burst + (double)i / n) * burst;
+			while (sent[i] < due) {
+				size_t len = _groupLine(line, lineLen, now, sent[i]);
+				if (write(masters[i], line, len) != (ssize_t)len) {
+					sent[i] = due;
+					break;
+				}
+				sent[i]++;
+			}
+		}
+
+		tick.tv_nsec += 1000000;
+		if (tick.tv_nsec >= 1000000000) {
+			tick.tv_nsec -= 1000000000;
+			tick.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tick, NULL);
+	}
+}
+
+/**
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHBenchPeerGroup::start(int ports, int mode, double rate, size_t lineLen, int burst) {
+	if (_pid >= 0 || ports < 1)
+		return -1;
+	if (mode == FOH_PEER_SOURCE && (rate <= 0 || lineLen < 24 || lineLen > 256 || burst < 1))
+		return -1;
+
+	for (int i = 0; i < ports; i++) {
+		char path[64];
+		int m = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+		if (m < 0) {
+			stop();
+			return -1;
+		}
+		_masters.push_back(m);
+		if (grantpt(m) < 0 || unlockpt(m) < 0 || ptsname_r(m, path, sizeof(path)) != 0 || fohBenchRaw(m) < 0) {
+			stop();
+			return -1;
+		}
+		_paths.push_back(path);
+	}
+
+	int p[2];
+	if (pipe2(p, O_CLOEXEC) < 0) {
+		stop();
+		return -1;
+	}
+
+	fflush(NULL);
+	_pid = fork();
+	if (_pid < 0) {
+		close(p[0]);
+		close(p[1]);
+		stop();
+		return -1;
+	}
+	if (_pid == 0) {
+		char c;
+		close(p[1]);
+		if (read(p[0], &c, 1) == 1) {
+			if (mode == FOH_PEER_SOURCE)
+				_groupRun(_masters, rate, lineLen, burst);
+			else
+				_groupServe(_masters, mode);
+		}
+		_exit(0);
+	}
+
+	//The slaves stay valid as long as the child holds the masters
+	close(p[0]);
+	_go = p[1];
+	for (size_t i = 0; i < _masters.size(); i++)
+		close(_masters[i]);
+	_masters.clear();
+	return 0;
+}
+
+/**
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHBenchPeerGroup::go(const int* slaveFds, int n) {
+	if (_go < 0)
+		return -1;
+
+	for (int i = 0; i < n; i++) {
+		if (fohBenchRaw(slaveFds[i]) < 0)
+			return -1;
+		tcflush(slaveFds[i], TCIOFLUSH);
+	}
+
+	char c = 1;
+	int r = write(_go, &c, 1) == 1 ? 0 : -1;
+	close(_go);
+	_go = -1;
+	return r;
+}
+
+void FOHBenchPeerGroup::stop() {
+	if (_go >= 0) {
+		close(_go);
+		_go = -1;
+	}
+	if (_pid > 0) {
+		kill(_pid, SIGKILL);
+		waitpid(_pid, NULL, 0);
+	}
+	_pid = -1;
+	for (size_t i = 0; i < _masters.size(); i++)
+		close(_masters[i]);
+	_masters.clear();
+	_paths.clear();
+}
+
+void FOHBenchLatency::reset(int ports, size_t perPort, uint64_t startNs, uint64_t endNs) {
+	_startNs = startNs;
+	_endNs = endNs;
+	_lat.resize(ports);
+	_count.assign(ports, 0);
+	for (int i = 0; i < ports; i++)
+		_lat[i].assign(perPort, 0);
+	_all.clear();
+}
+
+void FOHBenchLatency::rx(void* ctx, const FOHSample* samples, size_t n) {
+	FOHBenchLatency* l = (FOHBenchLatency*)ctx;
+	uint64_t now = fohMonoNs();
+	for (size_t i = 0; i < n; i++)
+		if (samples[i].channel == 0)
+			l->record(samples[i].port, (uint64_t)samples[i].value, now);
+}
+
+void FOHBenchLatency::finish() {
+	_all.clear();
+	for (size_t i = 0; i < _lat.size(); i++) {
+		std::sort(_lat[i].begin(), _lat[i].begin() + _count[i]);
+		_all.insert(_all.end(), _lat[i].begin(), _lat[i].begin() + _count[i]);
+	}
+	std::sort(_all.begin(), _all.end());
+}
+
+static double _quantile(const uint64_t* v, size_t n, double q) {
+	if (n == 0)
+		return -1;
+	return v[(size_t)(q * (n - 1) + 0.5)] / 1000.0;
+}
+
+double FOHBenchLatency::quantile(double q) const {
+	return _quantile(_all.data(), _all.size(), q);
+}
+
+double FOHBenchLatency::worstQuantile(double q) const {
+	double worst = -1;
+	for (size_t i = 0; i < _lat.size(); i++) {
+		double v = _quantile(_lat[i].data(), _count[i], q);
+		if (v > worst)
+			worst = v;
+	}
+	return worst;
+}
+
+uint64_t fohBenchCpuNs() {
+	uint64_t cpu;
+	int64_t ctx, flt;
+	_usage(cpu, ctx, flt);
+	return cpu;
+}
+
+long fohBenchRssKiB() {
+	long pages = 0, rss = 0;
+	FILE* f = fopen("/proc/self/statm", "r");
+	if (f == NULL)
+		return 0;
+	if (fscanf(f, "%ld %ld", &pages, &rss) != 2)
+		rss = 0;
+	fclose(f);
+	return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void fohBenchSleepUntil(uint64_t ns) {
+	uint64_t now = fohMonoNs();
+	if (ns <= now)
+		return;
+	struct timespec ts;
+	ts.tv_sec = (ns - now) / 1000000000ULL;
+	ts.tv_nsec = (ns - now) % 1000000000ULL;
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+/**
+ *	@return 0 on success, -1 otherwise.
+ */
+int fohBenchRaw(int fd) {
+	struct termios t;
+	if (tcgetattr(fd, &t) < 0)
+		return -1;
+	cfmakeraw(&t);
+	t.c_cc[VMIN] = 1;
+	t.c_cc[VTIME] = 0;
+	return tcsetattr(fd, TCSANOW, &t);
+}
+
+static void _num(FILE* f, double v, const char* fmt) {
+	if (v < 0)
+		fprintf(f, " %10s", "-");
+	else
+		fprintf(f, fmt, v);
+}
+
+void fohBenchHeader(FILE* f) {
+	fprintf(f, "%-20s %10s %10s %10s %10s %10s %10s %10s\n", "scenario", "MB/s", "sysc/KiB", "ctxsw", "faults",
+			"allocs/KiB", "cyc/B", "cpu/wall");
+}
+
+void fohBenchPrint(FILE* f, const FOHBenchResult& r) {
+	fprintf(f, "%-20s", r.name.c_str());
+	_num(f, fohBenchMBps(r), " %10.1f");
+	_num(f, fohBenchPerKiB(r, r.syscalls), " %10.2f");
+	_num(f, r.ctxSwitches, " %10.0f");
+	_num(f, r.pageFaults, " %10.0f");
+	_num(f, fohBenchPerKiB(r, r.allocs), " %10.3f");
+	_num(f, fohBenchCyclesPerByte(r), " %10.1f");
+	_num(f, r.wallNs ? (double)r.cpuNs / r.wallNs : -1, " %10.2f");
+	fprintf(f, "\n");
+}
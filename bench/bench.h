@@ -0,0 +1,312 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file bench/bench.h
+ * @brief Benchmark harness: resource accounting and pty peers.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_BENCH_H
+#define FOH_BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+#include "../sink.h"
+
+/**
+ *  @brief Measurements of one scenario run
+ *
+ *  Counters that couldn't be gathered are -1.
+ */
+struct FOHBenchResult {
+	std::string name; /**< Scenario */
+	uint64_t bytes; /**< Payload bytes moved */
+	uint64_t ops; /**< Operations (frames, chunks, lines) */
+	uint64_t wallNs; /**< Elapsed time */
+	uint64_t cpuNs; /**< User + system time of the process */
+	int64_t syscalls; /**< System calls */
+	int64_t ctxSwitches; /**< Voluntary + involuntary context switches */
+	int64_t pageFaults; /**< Minor + major page faults */
+	int64_t allocs; /**< operator new calls */
+	int64_t allocBytes; /**< Bytes requested from operator new */
+	int64_t cycles; /**< CPU cycles */
+};
+
+/**
+ *  @brief Per-KiB and per-byte figures of a result (-1 if unknown)
+ */
+double fohBenchMBps(const FOHBenchResult& r);
+double fohBenchPerKiB(const FOHBenchResult& r, int64_t v);
+double fohBenchCyclesPerByte(const FOHBenchResult& r);
+
+/**
+ *  @brief Resource accounting around a measured section
+ *
+ *  Context switches and page faults come from getrusage(), cycles and
+ *  system calls from perf_event_open() on the measuring thread, which
+ *  runs the scenarios.
+ *  Where perf isn't allowed, system calls are counted by the wrappers
+ *  the benchmark is linked with (-Wl,--wrap, see the Makefile), which
+ *  see every I/O call of the library, and cycles stay unknown.
+ *  Allocations are counted by the replaced operator new.
+ *
+ *  Work done by FOHBenchPeer runs in another process and isn't counted.
+ */
+class FOHBenchMeter {
+public:
+	FOHBenchMeter();
+	~FOHBenchMeter();
+
+	/**
+	 *  @brief Begin a measured section
+	 */
+	void start();
+
+	/**
+	 *  @brief End the section and fill the counters of r
+	 */
+	void stop(FOHBenchResult& r);
+
+	/**
+	 *  @brief Where the system call count comes from: "perf" or "wrap"
+	 */
+	const char* syscallSource() const { return _sysFd >= 0 ? "perf" : "wrap"; }
+	bool haveCycles() const { return _cycFd >= 0; }
+
+private:
+	int _cycFd; /**< perf counter for cycles, or -1 */
+	int _sysFd; /**< perf counter for raw_syscalls:sys_enter, or -1 */
+	uint64_t _t0; /**< Start time */
+	uint64_t _cpu0; /**< CPU time at start */
+	int64_t _ctx0; /**< Context switches at start */
+	int64_t _flt0; /**< Page faults at start */
+	int64_t _sys0; /**< Wrapped system calls at start */
+	int64_t _alloc0; /**< Allocations at start */
+	int64_t _allocBytes0; /**< Allocated bytes at start */
+};
+
+/**
+ *  @brief Counters kept by the wrappers and operator new
+ */
+int64_t fohBenchSyscalls();
+int64_t fohBenchAllocs();
+int64_t fohBenchAllocBytes();
+
+/**
+ *  @brief What the far end of a pty does
+ */
+enum FOHBenchPeerMode {
+	FOH_PEER_DRAIN = 0, /**< Read and discard everything */
+	FOH_PEER_SOURCE = 1, /**< Send lines until the byte count is reached */
+	FOH_PEER_ECHO = 2 /**< Send back what arrives */
+};
+
+/**
+ *  @brief The device side of a pseudo terminal, run in a child process
+ */
+class FOHBenchPeer {
+public:
+	FOHBenchPeer();
+	~FOHBenchPeer();
+
+	/**
+	 *  @brief Create a pty pair and start the peer on the master side
+	 *
+	 *  @param mode What the peer does
+	 *  @param bytes Bytes to send (FOH_PEER_SOURCE)
+	 *  @param line Line sent repeatedly (FOH_PEER_SOURCE)
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int start(int mode, uint64_t bytes = 0, const char* line = "12.5 -3.25 1000 0.001\n");
+
+	/**
+	 *  @brief Put the opened slave into raw mode and let the peer begin
+	 *
+	 *  FOHSerial's setup echoes and flushes, so the peer waits for this.
+	 *
+	 *  @param slaveFd Descriptor of the opened slave (FOHSerial::getFd())
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int go(int slaveFd);
+
+	/**
+	 *  @brief Stop the peer and close the pty
+	 */
+	void stop();
+
+	/**
+	 *  @brief Path of the slave side, to be opened with FOHSerial
+	 */
+	const char* path() const { return _path; }
+
+private:
+	pid_t _pid; /**< Child process, or -1 */
+	int _go; /**< Write end of the start pipe, or -1 */
+	int _master; /**< Master side, or -1 */
+	char _path[64]; /**< Slave device */
+};
+
+/**
+ *  @brief Many devices served by one child process
+ *
+ *  As FOH_PEER_SOURCE, every port gets rate lines per second, in bursts
+ *  of burst lines, phase shifted across the ports. A line is
+ *  "<fohMonoNs() at sending> <sequence> 0 0 ...\n", padded to the line
+ *  length, so the receiver can measure delivery latency from the first
+ *  field. Lines that don't fit into a full pty buffer are dropped.
+ *  FOH_PEER_DRAIN and FOH_PEER_ECHO work as with FOHBenchPeer.
+ */
+class FOHBenchPeerGroup {
+public:
+	FOHBenchPeerGroup();
+	~FOHBenchPeerGroup();
+
+	/**
+	 *  @brief Create the pty pairs and the child
+	 *
+	 *  @param ports Number of pty pairs
+	 *  @param mode What the peers do
+	 *  @param rate Lines per second and port (FOH_PEER_SOURCE)
+	 *  @param lineLen Bytes per line, at least 24 (FOH_PEER_SOURCE)
+	 *  @param burst Lines sent back to back (FOH_PEER_SOURCE)
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int start(int ports, int mode, double rate = 0, size_t lineLen = 32, int burst = 1);
+
+	/**
+	 *  @brief Raw mode for all opened slaves, then start sending
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int go(const int* slaveFds, int n);
+
+	/**
+	 *  @brief Stop the child and close the pty pairs
+	 */
+	void stop();
+
+	const char* path(int i) const { return _paths[i].c_str(); }
+	int ports() const { return (int)_paths.size(); }
+
+private:
+	pid_t _pid; /**< Child process, or -1 */
+	int _go; /**< Write end of the start pipe, or -1 */
+	std::vector<int> _masters; /**< Master sides (closed in the parent after fork) */
+	std::vector<std::string> _paths; /**< Slave devices */
+};
+
+/**
+ *  @brief Delivery latency of timestamped lines sent inside a window
+ *
+ *  Storage is allocated and touched by reset(), so recording neither
+ *  allocates nor page faults. Each port must be recorded from one thread
+ *  at a time.
+ */
+class FOHBenchLatency {
+public:
+	/**
+	 *  @param ports Number of ports
+	 *  @param perPort Most samples kept per port
+	 *  @param startNs Window start (fohMonoNs() of sending)
+	 *  @param endNs Window end, exclusive
+	 */
+	void reset(int ports, size_t perPort, uint64_t startNs, uint64_t endNs);
+
+	/**
+	 *  @brief Record a line sent at tsNs (ignored outside the window)
+	 */
+	void record(uint32_t port, uint64_t tsNs, uint64_t nowNs) {
+		if (tsNs < _startNs || tsNs >= _endNs || port >= _lat.size())
+			return;
+		size_t& c = _count[port];
+		if (c < _lat[port].size())
+			_lat[port][c++] = nowNs - tsNs;
+	}
+
+	/**
+	 *  @brief FOHBenchRxFn: records channel 0 of the samples as the send time
+	 */
+	static void rx(void* ctx, const FOHSample* samples, size_t n);
+
+	/**
+	 *  @brief Sort the samples, after the run
+	 */
+	void finish();
+
+	size_t count() const { return _all.size(); }
+
+	/**
+	 *  @brief Latency quantile over all ports in µs (-1 without samples)
+	 */
+	double quantile(double q) const;
+
+	/**
+	 *  @brief Largest per-port quantile in µs
+	 */
+	double worstQuantile(double q) const;
+
+	uint64_t startNs() const { return _startNs; }
+	uint64_t endNs() const { return _endNs; }
+
+private:
+	uint64_t _startNs; /**< Window start */
+	uint64_t _endNs; /**< Window end */
+	std::vector<std::vector<uint64_t>> _lat; /**< Per port samples */
+	std::vector<size_t> _count; /**< Per port sample count */
+	std::vector<uint64_t> _all; /**< All samples, sorted by finish() */
+};
+
+/**
+ *  @brief User + system time of the process
+ */
+uint64_t fohBenchCpuNs();
+
+/**
+ *  @brief Resident memory of the process
+ */
+long fohBenchRssKiB();
+
+/**
+ *  @brief Sleep until a fohMonoNs() time
+ */
+void fohBenchSleepUntil(uint64_t ns);
+
+/**
+ *  @brief Put a terminal into raw mode (the pty slave after FOHSerial set it up)
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int fohBenchRaw(int fd);
+
+/**
+ *  @brief Print the column titles and one line per result
+ */
+void fohBenchHeader(FILE* f);
+void fohBenchPrint(FILE* f, const FOHBenchResult& r);
+
+#endif
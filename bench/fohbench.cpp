@@ -0,0 +1,385 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file bench/fohbench.cpp
+ * @brief Throughput benchmark with syscall, allocation and cycle accounting.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "bench.h"
+#include "report.h"
+#include "../serial.h"
+#include "../txqueue.h"
+#include "../decode.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <vector>
+
+#define FOH_BENCH_BAUD 460800
+#define FOH_BENCH_PARAM 3 /**< 8N1, no flow control */
+#define FOH_BENCH_FRAME 64
+#define FOH_BENCH_BUF 65536 /**< Buffer handed to writeToSerialPort() */
+
+/**
+ *  @brief A scenario sets up, runs the measured section between
+ *  m.start() and m.stop() and fills bytes and ops of r
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+struct _scenario {
+	const char* name;
+	const char* help;
+	double threshold; /**< Relative change flagged by -c */
+	int (*fn)(FOHBenchResult& r, FOHBenchMeter& m, uint64_t bytes);
+};
+
+//Frames of FOH_BENCH_FRAME bytes to a draining peer, in segs pieces
+static int _write(FOHBenchResult& r, FOHBenchMeter& m, uint64_t bytes, int segs) {
+	FOHBenchPeer peer;
+	if (peer.start(FOH_PEER_DRAIN) < 0)
+		return -1;
+	FOHSerial port(peer.path(), FOH_BENCH_BAUD, FOH_BENCH_PARAM);
+	if (port.getFd() < 0 || peer.go(port.getFd()) < 0)
+		return -1;
+
+	char frame[FOH_BENCH_FRAME];
+	memset(frame, 'x', sizeof(frame));
+	struct iovec iov[3];
+	if (segs == 1) {
+		iov[0].iov_base = frame;
+		iov[0].iov_len = sizeof(frame);
+	} else {
+		//Header, payload, CRC
+		iov[0].iov_base = frame;
+		iov[0].iov_len = 4;
+		iov[1].iov_base = frame + 4;
+		iov[1].iov_len = sizeof(frame) - 8;
+		iov[2].iov_base = frame + sizeof(frame) - 4;
+		iov[2].iov_len = 4;
+	}
+
+	m.start();
+	while (r.bytes < bytes) {
+		int w = port.writeToSerialPortv(iov, segs);
+		if (w <= 0)
+			break;
+		r.bytes += w;
+		r.ops++;
+	}
+	m.stop(r);
+	return 0;
+}
+
+static int _write64(FOHBenchResult& r, FOHBenchMeter& m, uint64_t bytes) {
+	return _write(r, m, bytes, 1);
+}
+
+static int _writev3(FOHBenchResult& r, FOHBenchMeter& m, uint64_t bytes) {
+	return _write(r, m, bytes, 3);
+}
+
+//Large buffers through writeToSerialPort(), catches a per-byte _serialPut()
+static int _writeBuf(FOHBenchResult& r, FOHBenchMeter& m, uint64_t bytes) {
+	FOHBenchPeer peer;
+	if (peer.start(FOH_PEER_DRAIN) < 0)
+		return -1;
+	FOHSerial port(peer.path(), FOH_BENCH_BAUD, FOH_BENCH_PARAM);
+	if (port.getFd() < 0 || peer.go(port.getFd()) < 0)
+		return -1;
+
+	std::vector<char> buf(FOH_BENCH_BUF, 'x');
+	char* p = buf.data();
+
+	m.start();
+	while (r.bytes < bytes) {
+		int w = port.writeToSerialPort(&p, buf.size());
+		if (w <= 0)
+			break;
+		r.bytes += w;
+		r.ops++;
+	}
+	m.stop(r);
+	return 0;
+}
+
+static int _txqueue(FOHBenchResult& r, FOHBenchMeter& m, uint64_t bytes) {
+	FOHBenchPeer peer;
+	if (peer.start(FOH_PEER_DRAIN) < 0)
+		return -1;
+	FOHSerial port(peer.path(), FOH_BENCH_BAUD, FOH_BENCH_PARAM);
+	if (port.getFd() < 0 || peer.go(port.getFd()) < 0)
+		return -1;
+
+	FOHTxQueue q(&port, 4096);
+	char frame[FOH_BENCH_FRAME];
+	memset(frame, 'x', sizeof(frame));
+
+	m.start();
+	while (r.bytes < bytes) {
+		for (int i = 0; i < 64; i++)
+			if (q.enqueue(FOH_TX_NORMAL, frame, sizeof(frame)) < 0)
+				break;
+		while (q.pendingTotal() > 0) {
+			int w = q.service(100);
+			if (w <= 0)
+				break;
+			r.bytes += w;
+		}
+		r.ops += 64;
+	}
+	m.stop(r);
+	return 0;
+}
+
+//Lines from a sending peer, read with readChunk() and optionally decoded
+static int _read(FOHBenchResult& r, FOHBenchMeter& m, uint64_t bytes, bool decode) {
+	FOHBenchPeer peer;
+	if (peer.start(FOH_PEER_SOURCE, bytes) < 0)
+		return -1;
+	FOHSerial port(peer.path(), FOH_BENCH_BAUD, FOH_BENCH_PARAM);
+	if (port.getFd() < 0)
+		return -1;
+
+	FOHLineDecoder dec(0);
+	std::vector<FOHSample> out;
+	out.reserve(4096);
+	char buf[4096];
+
+	if (peer.go(port.getFd()) < 0)
+		return -1;
+
+	m.start();
+	while (r.bytes < bytes) {
+		int n = port.readChunk(buf, sizeof(buf), 1000);
+		if (n <= 0)
+			break;
+		r.bytes += n;
+		if (decode) {
+			out.clear();
+			r.ops += dec.decode(fohMonoNs(), buf, n, out);
+		} else {
+			r.ops++;
+		}
+	}
+	m.stop(r);
+	return 0;
+}
+
+static int _readChunk(FOHBenchResult& r, FOHBenchMeter& m, uint64_t bytes) {
+	return _read(r, m, bytes, false);
+}
+
+static int _readDecode(FOHBenchResult& r, FOHBenchMeter& m, uint64_t bytes) {
+	return _read(r, m, bytes, true);
+}
+
+static int _decodeMem(FOHBenchResult& r, FOHBenchMeter& m, uint64_t bytes) {
+	static const char line[] = "12.5 -3.25 1000 0.001\n";
+	std::string data;
+	while (data.size() < 65536)
+		data += line;
+
+	FOHLineDecoder dec(0);
+	std::vector<FOHSample> out;
+	out.reserve(4096);
+
+	m.start();
+	for (size_t off = 0; r.bytes < bytes; off = (off + 4096) % data.size()) {
+		size_t n = data.size() - off < 4096 ? data.size() - off : 4096;
+		out.clear();
+		r.ops += dec.decode(fohMonoNs(), data.data() + off, n, out);
+		r.bytes += n;
+	}
+	m.stop(r);
+	return 0;
+}
+
+//pty scenarios depend on the scheduler and get wider thresholds
+static const _scenario _scenarios[] = {
+	{ "write-64", "64 byte frames with writeToSerialPortv()", 0.10, _write64 },
+	{ "writev-3seg", "64 byte frames in 3 segments (header, payload, CRC)", 0.10, _writev3 },
+	{ "write-64k", "64 KiB buffers with writeToSerialPort() (it sleeps 10 ms per call)", 0.10, _writeBuf },
+	{ "txqueue-64", "64 byte frames through FOHTxQueue", 0.10, _txqueue },
+	{ "read-chunk", "readChunk() of streamed lines", 0.10, _readChunk },
+	{ "read-decode", "readChunk() and FOHLineDecoder", 0.10, _readDecode },
+	{ "decode-mem", "FOHLineDecoder on memory, no I/O", 0.05, _decodeMem },
+};
+
+static void _usage(const char* argv0) {
+	fprintf(stderr, "Usage: %s [-b bytes] [-r runs] [-s scenario]... [-o out.json] [-c base.json] [-i in.json]\n"
+			"       [-t scenario=threshold]... [-l]\n", argv0);
+	fprintf(stderr, "  -b bytes     Payload per run (default 4194304)\n");
+	fprintf(stderr, "  -r runs      Runs per scenario (default 5)\n");
+	fprintf(stderr, "  -s scenario  Run only scenarios containing this name\n");
+	fprintf(stderr, "  -o file      Save the results with machine data as JSON\n");
+	fprintf(stderr, "  -c file      Compare with a baseline, exit status 1 on regressions\n");
+	fprintf(stderr, "  -i file      Use saved results instead of running\n");
+	fprintf(stderr, "  -t name=x    Flag changes above x (e.g. 0.05) for scenarios containing name\n");
+	fprintf(stderr, "  -l           List scenarios\n");
+}
+
+static bool _selected(const char* name, const std::vector<const char*>& only) {
+	if (only.empty())
+		return true;
+	for (size_t k = 0; k < only.size(); k++)
+		if (strstr(name, only[k]) != NULL)
+			return true;
+	return false;
+}
+
+int main(int argc, char** argv) {
+	uint64_t bytes = 4 << 20;
+	int runs = 5;
+	const char* outPath = NULL;
+	const char* basePath = NULL;
+	const char* inPath = NULL;
+	std::vector<const char*> only;
+	std::vector<std::pair<std::string, double>> thresholds;
+	int c;
+
+	while ((c = getopt(argc, argv, "b:r:s:o:c:i:t:lh")) != -1) {
+		switch (c) {
+		case 'b':
+			bytes = strtoull(optarg, NULL, 0);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 's':
+			only.push_back(optarg);
+			break;
+		case 'o':
+			outPath = optarg;
+			break;
+		case 'c':
+			basePath = optarg;
+			break;
+		case 'i':
+			inPath = optarg;
+			break;
+		case 't': {
+			const char* eq = strchr(optarg, '=');
+			if (eq == NULL || atof(eq + 1) <= 0) {
+				_usage(argv[0]);
+				return 2;
+			}
+			thresholds.push_back(std::make_pair(std::string(optarg, eq - optarg), atof(eq + 1)));
+			break;
+		}
+		case 'l':
+			for (size_t i = 0; i < sizeof(_scenarios) / sizeof(_scenarios[0]); i++)
+				printf("%-20s %s\n", _scenarios[i].name, _scenarios[i].help);
+			return 0;
+		default:
+			_usage(argv[0]);
+			return c == 'h' ? 0 : 2;
+		}
+	}
+	if (bytes == 0 || runs < 1) {
+		_usage(argv[0]);
+		return 2;
+	}
+
+	FOHBenchMeta meta;
+	std::vector<FOHBenchSeries> series;
+	int ret = 0;
+
+	if (inPath != NULL) {
+		if (fohBenchLoad(inPath, meta, series) < 0) {
+			fprintf(stderr, "%s: can't read results\n", inPath);
+			return 1;
+		}
+		for (size_t i = series.size(); i-- > 0;)
+			if (_selected(series[i].name.c_str(), only) == false)
+				series.erase(series.begin() + i);
+	} else {
+		FOHBenchMeter m;
+		fohBenchMachine(meta);
+		meta.bytes = bytes;
+		meta.runs = runs;
+		meta.syscalls = m.syscallSource();
+		meta.cycles = m.haveCycles();
+
+		printf("# syscalls: %s, cycles: %s\n", m.syscallSource(), m.haveCycles() ? "perf" : "n/a");
+		fohBenchHeader(stdout);
+
+		for (size_t i = 0; i < sizeof(_scenarios) / sizeof(_scenarios[0]); i++) {
+			if (_selected(_scenarios[i].name, only) == false)
+				continue;
+
+			FOHBenchSeries s;
+			s.name = _scenarios[i].name;
+			s.threshold = _scenarios[i].threshold;
+			for (int k = 0; k < runs; k++) {
+				FOHBenchResult r = {};
+				r.name = s.name;
+				if (_scenarios[i].fn(r, m, bytes) < 0 || r.bytes == 0) {
+					fprintf(stderr, "%s: failed\n", s.name.c_str());
+					ret = 1;
+					break;
+				}
+				fohBenchPrint(stdout, r);
+				fflush(stdout);
+				s.runs.push_back(r);
+			}
+			if (s.runs.empty() == false)
+				series.push_back(s);
+		}
+
+		if (runs > 1) {
+			printf("\n");
+			fohBenchSummary(stdout, series);
+		}
+	}
+
+	for (size_t i = 0; i < series.size(); i++)
+		for (size_t k = 0; k < thresholds.size(); k++)
+			if (strstr(series[i].name.c_str(), thresholds[k].first.c_str()) != NULL)
+				series[i].threshold = thresholds[k].second;
+
+	if (outPath != NULL && fohBenchSave(outPath, meta, series) < 0) {
+		fprintf(stderr, "%s: can't write results\n", outPath);
+		ret = 1;
+	}
+
+	if (basePath != NULL) {
+		FOHBenchMeta baseMeta;
+		std::vector<FOHBenchSeries> base;
+		if (fohBenchLoad(basePath, baseMeta, base) < 0) {
+			fprintf(stderr, "%s: can't read baseline\n", basePath);
+			return 1;
+		}
+		//Only the scenarios that ran take part
+		std::vector<FOHBenchSeries> wanted;
+		for (size_t i = 0; i < base.size(); i++)
+			if (_selected(base[i].name.c_str(), only))
+				wanted.push_back(base[i]);
+
+		printf("\n");
+		if (fohBenchCompare(stdout, baseMeta, wanted, meta, series) > 0)
+			ret = 1;
+	}
+
+	return ret;
+}
@@ -0,0 +1,263 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file bench/fohscale.cpp
+ * @brief Port count scaling benchmark over pty pairs.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "bench.h"
+#include "backend.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <termios.h>
+#include <vector>
+
+#define FOH_SCALE_BAUD 460800
+#define FOH_SCALE_PARAM 3 /**< 8N1, no flow control */
+#define FOH_SCALE_GRACE_NS 300000000ULL /**< Lines sent in the window may arrive this much later */
+#define FOH_SCALE_MIN_DELIVERED 0.95 /**< Below this share of the offered lines a run is saturated */
+#define FOH_SCALE_SLOWDOWN 10 /**< p99 this many times the smallest run's p99 is saturated too */
+
+struct _result {
+	int ports;
+	const char* backend;
+	double offered;
+	size_t delivered;
+	double mbps;
+	double p50, p99, p999, max, worstP99; //µs
+	double cpu; //Cores used
+	double kibPerPort;
+	bool saturated;
+};
+
+//One backend on already opened ports
+static int _measure(_result& r, FOHSerial** ports, const int* fds, int n, const char* backend,
+		double rate, size_t lineLen, uint64_t warmupNs, uint64_t durNs, long rssPorts) {
+	FOHBenchBackend* b = fohBenchBackend(backend);
+	if (b == NULL)
+		return -1;
+
+	//Lines that piled up while nobody was reading don't count
+	for (int i = 0; i < n; i++)
+		tcflush(fds[i], TCIFLUSH);
+
+	FOHBenchLatency lat;
+	uint64_t start = fohMonoNs() + warmupNs;
+	lat.reset(n, (size_t)(rate * durNs * 1e-9 * 1.2) + 16, start, start + durNs);
+
+	long rss0 = fohBenchRssKiB();
+	if (b->start(ports, n, FOHBenchLatency::rx, &lat) < 0) {
+		delete b;
+		return -1;
+	}
+
+	fohBenchSleepUntil(lat.startNs());
+	long rss1 = fohBenchRssKiB();
+	uint64_t cpu0 = fohBenchCpuNs(), t0 = fohMonoNs();
+	fohBenchSleepUntil(lat.endNs() + FOH_SCALE_GRACE_NS);
+	uint64_t cpu1 = fohBenchCpuNs(), t1 = fohMonoNs();
+	b->stop();
+	delete b;
+	lat.finish();
+
+	r.ports = n;
+	r.backend = backend;
+	r.offered = rate * n * durNs * 1e-9;
+	r.delivered = lat.count();
+	r.mbps = r.delivered * (double)lineLen / (durNs * 1e-3);
+	r.p50 = lat.quantile(0.5);
+	r.p99 = lat.quantile(0.99);
+	r.p999 = lat.quantile(0.999);
+	r.max = lat.quantile(1);
+	r.worstP99 = lat.worstQuantile(0.99);
+	r.cpu = (double)(cpu1 - cpu0) / (t1 - t0);
+	r.kibPerPort = (double)(rssPorts + rss1 - rss0) / n;
+	r.saturated = r.delivered < r.offered * FOH_SCALE_MIN_DELIVERED;
+	return 0;
+}
+
+static void _print(const _result& r, const char* note) {
+	printf("%6d %-8s %9.3f %10.0f %6.1f%% %9.0f %9.0f %9.0f %9.0f %9.0f %6.0f%% %9.1f  %s\n", r.ports, r.backend,
+			r.mbps, r.delivered / 1.0, r.offered > 0 ? 100.0 * r.delivered / r.offered : 0, r.p50, r.p99, r.p999,
+			r.max, r.worstP99, r.cpu * 100, r.kibPerPort, note);
+	fflush(stdout);
+}
+
+static std::vector<std::string> _split(const char* s) {
+	std::vector<std::string> v;
+	const char* p = s;
+	while (*p) {
+		size_t n = strcspn(p, ",");
+		if (n)
+			v.push_back(std::string(p, n));
+		p += n;
+		if (*p == ',')
+			p++;
+	}
+	return v;
+}
+
+static void _usage(const char* argv0) {
+	fprintf(stderr, "Usage: %s [-n counts] [-b backends] [-r rate] [-l bytes] [-d ms] [-w ms]\n", argv0);
+	fprintf(stderr, "  -n counts    Port counts, comma separated (default 1,4,16,64,256,1024)\n");
+	fprintf(stderr, "  -b backends  Comma separated, default all of:");
+	for (const char* const* b = fohBenchBackends(); *b; b++)
+		fprintf(stderr, " %s", *b);
+	fprintf(stderr, "\n  -r rate      Lines per second and port (default 100)\n");
+	fprintf(stderr, "  -l bytes     Line length (default 32)\n");
+	fprintf(stderr, "  -d ms        Measuring window (default 2000)\n");
+	fprintf(stderr, "  -w ms        Warm-up before the window (default 300)\n");
+}
+
+int main(int argc, char** argv) {
+	std::vector<std::string> counts = _split("1,4,16,64,256,1024");
+	std::vector<std::string> backends;
+	double rate = 100;
+	size_t lineLen = 32;
+	uint64_t durNs = 2000000000ULL, warmupNs = 300000000ULL;
+	int c;
+
+	for (const char* const* b = fohBenchBackends(); *b; b++)
+		backends.push_back(*b);
+
+	while ((c = getopt(argc, argv, "n:b:r:l:d:w:h")) != -1) {
+		switch (c) {
+		case 'n': counts = _split(optarg); break;
+		case 'b': backends = _split(optarg); break;
+		case 'r': rate = atof(optarg); break;
+		case 'l': lineLen = atoi(optarg); break;
+		case 'd': durNs = strtoull(optarg, NULL, 0) * 1000000ULL; break;
+		case 'w': warmupNs = strtoull(optarg, NULL, 0) * 1000000ULL; break;
+		default:
+			_usage(argv[0]);
+			return c == 'h' ? 0 : 2;
+		}
+	}
+	if (rate <= 0 || lineLen < 24 || lineLen > 256 || durNs == 0 || counts.empty()) {
+		_usage(argv[0]);
+		return 2;
+	}
+	for (size_t i = 0; i < backends.size(); i++) {
+		FOHBenchBackend* b = fohBenchBackend(backends[i].c_str());
+		if (b == NULL) {
+			fprintf(stderr, "%s: unknown backend\n", backends[i].c_str());
+			return 2;
+		}
+		delete b;
+	}
+
+	//Every port costs a slave here and a master in the peer
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	printf("# %g lines/s per port, %zu byte lines, %llu ms window, %ld CPUs; latency in us\n", rate, lineLen,
+			(unsigned long long)(durNs / 1000000), sysconf(_SC_NPROCESSORS_ONLN));
+	printf("%6s %-8s %9s %10s %7s %9s %9s %9s %9s %9s %7s %9s\n", "ports", "backend", "MB/s", "lines", "deliv",
+			"p50", "p99", "p99.9", "max", "worst-p99", "CPU", "KiB/port");
+
+	std::vector<double> firstP99(backends.size(), -1);
+	std::vector<int> scales(backends.size(), 0);
+	std::vector<bool> stopped(backends.size(), false);
+	int ret = 0;
+
+	for (size_t k = 0; k < counts.size(); k++) {
+		int n = atoi(counts[k].c_str());
+		if (n < 1)
+			continue;
+
+		long rssBase = fohBenchRssKiB();
+		FOHBenchPeerGroup group;
+		if (group.start(n, FOH_PEER_SOURCE, rate, lineLen) < 0) {
+			fprintf(stderr, "%d ports: can't create pty pairs\n", n);
+			ret = 1;
+			break;
+		}
+
+		std::vector<FOHSerial*> ports;
+		std::vector<int> fds;
+		for (int i = 0; i < n; i++) {
+			FOHSerial* p = new FOHSerial(group.path(i), FOH_SCALE_BAUD, FOH_SCALE_PARAM);
+			if (p->getFd() < 0) {
+				delete p;
+				break;
+			}
+			ports.push_back(p);
+			fds.push_back(p->getFd());
+		}
+		if ((int)ports.size() == n && group.go(fds.data(), n) == 0) {
+			long rssPorts = fohBenchRssKiB() - rssBase;
+
+			for (size_t j = 0; j < backends.size(); j++) {
+				_result r;
+				if (_measure(r, ports.data(), fds.data(), n, backends[j].c_str(), rate, lineLen, warmupNs, durNs,
+						rssPorts) < 0) {
+					fprintf(stderr, "%d ports, %s: failed\n", n, backends[j].c_str());
+					ret = 1;
+					continue;
+				}
+
+				if (firstP99[j] < 0)
+					firstP99[j] = r.p99;
+				const char* note = "";
+				if (r.saturated) {
+					note = "lines lost";
+				} else if (firstP99[j] > 0 && r.p99 > FOH_SCALE_SLOWDOWN * firstP99[j] && r.p99 > 1000) {
+					r.saturated = true;
+					note = "latency";
+				}
+				if (r.saturated)
+					stopped[j] = true;
+				else if (stopped[j] == false)
+					scales[j] = n;
+				_print(r, note);
+			}
+		} else {
+			fprintf(stderr, "%d ports: can't open the pty slaves\n", n);
+			ret = 1;
+		}
+
+		for (size_t i = 0; i < ports.size(); i++) {
+			ports[i]->closeSerialPort();
+			delete ports[i];
+		}
+		group.stop();
+		if (ret)
+			break;
+	}
+
+	printf("\n");
+	for (size_t j = 0; j < backends.size(); j++) {
+		if (scales[j] == 0)
+			printf("# %-8s saturated from the first count\n", backends[j].c_str());
+		else
+			printf("# %-8s keeps up to %d ports%s\n", backends[j].c_str(), scales[j],
+					stopped[j] ? "" : " (largest count tried)");
+	}
+
+	return ret;
+}
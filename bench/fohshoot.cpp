@@ -0,0 +1,447 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file bench/fohshoot.cpp
+ * @brief Backend comparison over streaming, request/response and bursty traffic.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "bench.h"
+#include "backend.h"
+
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <termios.h>
+#include <thread>
+#include <vector>
+
+#define FOH_SHOOT_BAUD 460800
+#define FOH_SHOOT_PARAM 3 /**< 8N1, no flow control */
+#define FOH_SHOOT_GRACE_NS 300000000ULL /**< Lines sent in the window may arrive this much later */
+#define FOH_SHOOT_FRAME 64 /**< Frame size of the transmit workload */
+
+/**
+ *  @brief Workload parameters, the same for every backend
+ */
+struct _config {
+	int ports; /**< pty pairs */
+	uint64_t durNs; /**< Measuring window */
+	uint64_t warmupNs; /**< Before the window */
+	double rate; /**< Lines per second and port when streaming */
+	size_t lineLen; /**< Bytes per line */
+	int burst; /**< Lines per burst */
+	double burstRate; /**< Average lines per second and port when bursty */
+};
+
+/**
+ *  @brief One cell of the matrix
+ */
+struct _cell {
+	uint64_t ops; /**< Lines, round trips or frames */
+	uint64_t bytes; /**< Bytes moved */
+	uint64_t windowNs; /**< Time the operations were started in */
+	uint64_t spanNs; /**< Time the CPU was measured over */
+	uint64_t cpuNs; /**< Process CPU time in that span */
+	double p50, p99, p999, max; //µs, -1 if not measured
+	const char* note;
+};
+
+/**
+ *  @brief Ports on a peer group, opened and released
+ */
+struct _rig {
+	FOHBenchPeerGroup group;
+	std::vector<FOHSerial*> ports;
+
+	int open(const _config& cfg, int mode, double rate = 0, int burst = 1) {
+		if (group.start(cfg.ports, mode, rate, cfg.lineLen, burst) < 0)
+			return -1;
+		std::vector<int> fds;
+		for (int i = 0; i < cfg.ports; i++) {
+			FOHSerial* p = new FOHSerial(group.path(i), FOH_SHOOT_BAUD, FOH_SHOOT_PARAM);
+			if (p->getFd() < 0) {
+				delete p;
+				return -1;
+			}
+			ports.push_back(p);
+			fds.push_back(p->getFd());
+		}
+		return group.go(fds.data(), fds.size());
+	}
+
+	~_rig() {
+		for (size_t i = 0; i < ports.size(); i++) {
+			ports[i]->closeSerialPort();
+			delete ports[i];
+		}
+		group.stop();
+	}
+};
+
+//Device streams lines, possibly in bursts
+static int _receive(_cell& c, FOHBenchBackend* b, const _config& cfg, double rate, int burst) {
+	_rig rig;
+	if (rig.open(cfg, FOH_PEER_SOURCE, rate, burst) < 0)
+		return -1;
+
+	FOHBenchLatency lat;
+	uint64_t start = fohMonoNs() + cfg.warmupNs;
+	lat.reset(cfg.ports, (size_t)(rate * cfg.durNs * 1e-9 * 1.2) + burst + 16, start, start + cfg.durNs);
+	if (b->start(rig.ports.data(), cfg.ports, FOHBenchLatency::rx, &lat) < 0)
+		return -1;
+
+	fohBenchSleepUntil(lat.startNs());
+	uint64_t cpu0 = fohBenchCpuNs(), t0 = fohMonoNs();
+	fohBenchSleepUntil(lat.endNs() + FOH_SHOOT_GRACE_NS);
+	c.cpuNs = fohBenchCpuNs() - cpu0;
+	c.spanNs = fohMonoNs() - t0;
+	b->stop();
+
+	lat.finish();
+	c.windowNs = cfg.durNs;
+	c.ops = lat.count();
+	c.bytes = c.ops * cfg.lineLen;
+	c.p50 = lat.quantile(0.5);
+	c.p99 = lat.quantile(0.99);
+	c.p999 = lat.quantile(0.999);
+	c.max = lat.quantile(1);
+	if (c.ops < rate * cfg.ports * cfg.durNs * 1e-9 * 0.95)
+		c.note = "lines lost";
+	return 0;
+}
+
+static int _streamRx(_cell& c, FOHBenchBackend* b, const _config& cfg) {
+	return _receive(c, b, cfg, cfg.rate, 1);
+}
+
+static int _burstyRx(_cell& c, FOHBenchBackend* b, const _config& cfg) {
+	return _receive(c, b, cfg, cfg.burstRate, cfg.burst);
+}
+
+/**
+ *  @brief Closed loop: every response sends the next request on its port
+ */
+struct _pingPong {
+	FOHBenchLatency lat;
+	FOHBenchBackend* backend;
+	size_t lineLen;
+	std::atomic<bool> sending;
+	std::atomic<int> failed;
+	std::vector<uint64_t> seq;
+};
+
+static int _request(_pingPong* pp, int port) {
+	char line[256];
+	size_t n = snprintf(line, pp->lineLen, "%llu %llu", (unsigned long long)fohMonoNs(),
+			(unsigned long long)pp->seq[port]++);
+	while (n + 3 <= pp->lineLen) {
+		line[n++] = ' ';
+		line[n++] = '0';
+	}
+	line[n++] = '\n';
+	return pp->backend->send(port, line, n);
+}
+
+static void _response(void* ctx, const FOHSample* s, size_t n) {
+	_pingPong* pp = (_pingPong*)ctx;
+	uint64_t now = fohMonoNs();
+	for (size_t i = 0; i < n; i++) {
+		if (s[i].channel != 0)
+			continue;
+		pp->lat.record(s[i].port, (uint64_t)s[i].value, now);
+		if (pp->sending && _request(pp, s[i].port) <= 0)
+			pp->failed = 1;
+	}
+}
+
+static int _reqResp(_cell& c, FOHBenchBackend* b, const _config& cfg) {
+	_rig rig;
+	if (rig.open(cfg, FOH_PEER_ECHO) < 0)
+		return -1;
+
+	_pingPong pp;
+	uint64_t start = fohMonoNs() + cfg.warmupNs;
+	pp.lat.reset(cfg.ports, 1 << 20, start, start + cfg.durNs);
+	pp.backend = b;
+	pp.lineLen = cfg.lineLen;
+	pp.sending = true;
+	pp.failed = 0;
+	pp.seq.assign(cfg.ports, 0);
+	if (b->start(rig.ports.data(), cfg.ports, _response, &pp) < 0)
+		return -1;
+
+	for (int i = 0; i < cfg.ports; i++) {
+		if (_request(&pp, i) < 0) {
+			b->stop();
+			c.note = "receive only";
+			return 0;
+		}
+	}
+
+	fohBenchSleepUntil(pp.lat.startNs());
+	uint64_t cpu0 = fohBenchCpuNs(), t0 = fohMonoNs();
+	fohBenchSleepUntil(pp.lat.endNs());
+	pp.sending = false;
+	fohBenchSleepUntil(pp.lat.endNs() + FOH_SHOOT_GRACE_NS);
+	c.cpuNs = fohBenchCpuNs() - cpu0;
+	c.spanNs = fohMonoNs() - t0;
+	b->stop();
+
+	pp.lat.finish();
+	c.windowNs = cfg.durNs;
+	c.ops = pp.lat.count();
+	c.bytes = c.ops * cfg.lineLen * 2;
+	c.p50 = pp.lat.quantile(0.5);
+	c.p99 = pp.lat.quantile(0.99);
+	c.p999 = pp.lat.quantile(0.999);
+	c.max = pp.lat.quantile(1);
+	if (pp.failed)
+		c.note = "send failed";
+	return 0;
+}
+
+//Frames to draining devices as fast as the backend takes them, one producer per port
+static int _streamTx(_cell& c, FOHBenchBackend* b, const _config& cfg) {
+	_rig rig;
+	if (rig.open(cfg, FOH_PEER_DRAIN) < 0)
+		return -1;
+	if (b->start(rig.ports.data(), cfg.ports, FOHBenchLatency::rx, NULL) < 0)
+		return -1;
+
+	char frame[FOH_SHOOT_FRAME];
+	memset(frame, 'x', sizeof(frame));
+	frame[sizeof(frame) - 1] = '\n';
+	if (b->send(0, frame, sizeof(frame)) < 0) {
+		b->stop();
+		c.note = "receive only";
+		return 0;
+	}
+
+	std::atomic<uint64_t> frames(0);
+	std::atomic<bool> failed(false);
+	uint64_t t0 = fohMonoNs(), cpu0 = fohBenchCpuNs();
+	uint64_t end = t0 + cfg.durNs;
+	std::vector<std::thread> producers;
+	for (int i = 0; i < cfg.ports; i++) {
+		producers.push_back(std::thread([&, i]() {
+			uint64_t n = 0;
+			while (fohMonoNs() < end) {
+				int r = b->send(i, frame, sizeof(frame));
+				if (r < 0) {
+					failed = true;
+					break;
+				}
+				if (r == 0)
+					usleep(100);
+				else
+					n++;
+			}
+			frames += n;
+		}));
+	}
+	for (size_t i = 0; i < producers.size(); i++)
+		producers[i].join();
+
+	//Count the time until everything taken is written
+	while (b->unsent() > 0 && fohMonoNs() < end + 2000000000ULL)
+		usleep(100);
+	c.spanNs = c.windowNs = fohMonoNs() - t0;
+	c.cpuNs = fohBenchCpuNs() - cpu0;
+	b->stop();
+
+	c.ops = frames + 1;
+	c.bytes = c.ops * sizeof(frame);
+	c.p50 = c.p99 = c.p999 = c.max = -1;
+	if (failed)
+		c.note = "send failed";
+	return 0;
+}
+
+struct _workload {
+	const char* name;
+	const char* help;
+	int (*fn)(_cell& c, FOHBenchBackend* b, const _config& cfg);
+};
+
+static const _workload _workloads[] = {
+	{ "stream-rx", "Lines at a steady rate from every device", _streamRx },
+	{ "bursty-rx", "The same lines in back to back bursts", _burstyRx },
+	{ "req-resp", "One outstanding request per port, echoed by the device", _reqResp },
+	{ "stream-tx", "64 byte frames as fast as the backend takes them", _streamTx },
+};
+
+//Receive or transmit backends the library doesn't have
+static const char* const _missing[][2] = {
+	{ "io_uring", "not offered by the library (no io_uring path, liburing not in the build)" },
+};
+
+static void _num(double v, const char* fmt) {
+	if (v < 0)
+		printf(" %8s", "-");
+	else
+		printf(fmt, v);
+}
+
+static std::vector<std::string> _split(const char* s) {
+	std::vector<std::string> v;
+	const char* p = s;
+	while (*p) {
+		size_t n = strcspn(p, ",");
+		if (n)
+			v.push_back(std::string(p, n));
+		p += n;
+		if (*p == ',')
+			p++;
+	}
+	return v;
+}
+
+static bool _selected(const char* name, const std::vector<std::string>& only) {
+	if (only.empty())
+		return true;
+	for (size_t i = 0; i < only.size(); i++)
+		if (strstr(name, only[i].c_str()) != NULL)
+			return true;
+	return false;
+}
+
+static void _usage(const char* argv0) {
+	fprintf(stderr, "Usage: %s [-p ports] [-d ms] [-w ms] [-r rate] [-l bytes] [-B burst] [-b backends] [-W workloads]\n",
+			argv0);
+	fprintf(stderr, "  -p ports     pty pairs per run (default 4)\n");
+	fprintf(stderr, "  -d ms        Measuring window (default 2000)\n");
+	fprintf(stderr, "  -w ms        Warm-up before the window (default 300)\n");
+	fprintf(stderr, "  -r rate      Lines per second and port for stream-rx (default 2000)\n");
+	fprintf(stderr, "  -l bytes     Line length (default 32)\n");
+	fprintf(stderr, "  -B burst     Lines per burst for bursty-rx, at a tenth of the rate (default 100)\n");
+	fprintf(stderr, "  -b backends  Comma separated, default all of:");
+	for (const char* const* b = fohBenchBackends(); *b; b++)
+		fprintf(stderr, " %s", *b);
+	fprintf(stderr, "\n  -W workloads Comma separated, default all of:");
+	for (size_t i = 0; i < sizeof(_workloads) / sizeof(_workloads[0]); i++)
+		fprintf(stderr, " %s", _workloads[i].name);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+	_config cfg;
+	cfg.ports = 4;
+	cfg.durNs = 2000000000ULL;
+	cfg.warmupNs = 300000000ULL;
+	cfg.rate = 2000;
+	cfg.lineLen = 32;
+	cfg.burst = 100;
+	std::vector<std::string> backends, workloads;
+	int c;
+
+	for (const char* const* b = fohBenchBackends(); *b; b++)
+		backends.push_back(*b);
+
+	while ((c = getopt(argc, argv, "p:d:w:r:l:B:b:W:h")) != -1) {
+		switch (c) {
+		case 'p': cfg.ports = atoi(optarg); break;
+		case 'd': cfg.durNs = strtoull(optarg, NULL, 0) * 1000000ULL; break;
+		case 'w': cfg.warmupNs = strtoull(optarg, NULL, 0) * 1000000ULL; break;
+		case 'r': cfg.rate = atof(optarg); break;
+		case 'l': cfg.lineLen = atoi(optarg); break;
+		case 'B': cfg.burst = atoi(optarg); break;
+		case 'b': backends = _split(optarg); break;
+		case 'W': workloads = _split(optarg); break;
+		default:
+			_usage(argv[0]);
+			return c == 'h' ? 0 : 2;
+		}
+	}
+	cfg.burstRate = cfg.rate / 10;
+	if (cfg.ports < 1 || cfg.durNs == 0 || cfg.rate <= 0 || cfg.lineLen < 24 || cfg.lineLen > 256 || cfg.burst < 1) {
+		_usage(argv[0]);
+		return 2;
+	}
+
+	printf("# %d ports, %llu ms window, %ld CPUs; stream %g lines/s/port, bursts of %d at %g lines/s/port, "
+			"%zu byte lines\n", cfg.ports, (unsigned long long)(cfg.durNs / 1000000), sysconf(_SC_NPROCESSORS_ONLN),
+			cfg.rate, cfg.burst, cfg.burstRate, cfg.lineLen);
+	printf("# latency in us (req-resp: round trip), CPU in cores and in us per KiB moved\n");
+	printf("%-10s %-8s %8s %9s %8s %8s %8s %8s %8s %8s  %s\n", "workload", "backend", "MB/s", "ops/s", "p50", "p99",
+			"p99.9", "max", "CPU", "CPU/KiB", "note");
+
+	struct _best { std::string p99, cpu; double p99v, cpuv; };
+	int ret = 0;
+
+	for (size_t w = 0; w < sizeof(_workloads) / sizeof(_workloads[0]); w++) {
+		if (_selected(_workloads[w].name, workloads) == false)
+			continue;
+		_best bw = { "", "", -1, -1 };
+
+		for (size_t k = 0; k < backends.size(); k++) {
+			FOHBenchBackend* b = fohBenchBackend(backends[k].c_str());
+			if (b == NULL) {
+				fprintf(stderr, "%s: unknown backend\n", backends[k].c_str());
+				return 2;
+			}
+			_cell cell = {};
+			cell.p50 = cell.p99 = cell.p999 = cell.max = -1;
+			cell.note = "";
+			int r = _workloads[w].fn(cell, b, cfg);
+			delete b;
+			if (r < 0) {
+				fprintf(stderr, "%s, %s: failed\n", _workloads[w].name, backends[k].c_str());
+				ret = 1;
+				continue;
+			}
+
+			printf("%-10s %-8s", _workloads[w].name, backends[k].c_str());
+			if (cell.ops == 0 || cell.spanNs == 0) {
+				printf(" %8s %9s %8s %8s %8s %8s %8s %8s  %s\n", "-", "-", "-", "-", "-", "-", "-", "-", cell.note);
+				continue;
+			}
+			double secs = cell.windowNs * 1e-9;
+			double cpuPerKiB = cell.cpuNs * 1e-3 / (cell.bytes / 1024.0);
+			printf(" %8.3f %9.0f", cell.bytes / secs * 1e-6, cell.ops / secs);
+			_num(cell.p50, " %8.0f");
+			_num(cell.p99, " %8.0f");
+			_num(cell.p999, " %8.0f");
+			_num(cell.max, " %8.0f");
+			printf(" %8.2f %8.1f  %s\n", (double)cell.cpuNs / cell.spanNs, cpuPerKiB, cell.note);
+			fflush(stdout);
+
+			if (cell.note[0] != '\0')
+				continue;
+			if (cell.p99 >= 0 && (bw.p99v < 0 || cell.p99 < bw.p99v)) {
+				bw.p99v = cell.p99;
+				bw.p99 = backends[k];
+			}
+			if (bw.cpuv < 0 || cpuPerKiB < bw.cpuv) {
+				bw.cpuv = cpuPerKiB;
+				bw.cpu = backends[k];
+			}
+		}
+		printf("%-10s %-8s lowest p99: %s, lowest CPU/KiB: %s\n", "", "", bw.p99.empty() ? "-" : bw.p99.c_str(),
+				bw.cpu.empty() ? "-" : bw.cpu.c_str());
+	}
+
+	for (size_t i = 0; i < sizeof(_missing) / sizeof(_missing[0]); i++)
+		printf("# %s: %s\n", _missing[i][0], _missing[i][1]);
+
+	return ret;
+}
@@ -0,0 +1,522 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file bench/report.cpp
+ * @brief Benchmark result files and baseline comparison.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "report.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <map>
+
+#define FOH_BENCH_METRICS 5
+#define FOH_BENCH_FORMAT "fohbench-1"
+
+static const char* _metricName[FOH_BENCH_METRICS] = { "MB/s", "sysc/KiB", "ctxsw/KiB", "allocs/KiB", "cyc/B" };
+//Smallest change that counts, also when the baseline is (nearly) 0: a
+//context switch per 100 KiB is real, one per run is noise
+static const double _metricFloor[FOH_BENCH_METRICS] = { 0.1, 0.01, 0.01, 0.01, 0.01 };
+static const char* _metricKey[FOH_BENCH_METRICS] = { "mbps", "syscallsPerKiB", "ctxSwitchesPerKiB", "allocsPerKiB", "cyclesPerByte" };
+
+static double _value(const FOHBenchResult& r, int metric) {
+	switch (metric) {
+	case 0: return fohBenchMBps(r);
+	case 1: return fohBenchPerKiB(r, r.syscalls);
+	case 2: return fohBenchPerKiB(r, r.ctxSwitches);
+	case 3: return fohBenchPerKiB(r, r.allocs);
+	case 4: return fohBenchCyclesPerByte(r);
+	}
+	return -1;
+}
+
+//Two-sided 97.5% quantile of Student's t
+static double _t975(double df) {
+	static const double t[30] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+			2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+			2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+	if (df < 1)
+		df = 1;
+	if (df <= 30)
+		return t[(int)df - 1];
+	return 1.960 + 0.082 * 30 / df;
+}
+
+//Mean and sample variance of the known values
+static int _stat(const FOHBenchSeries& s, int metric, double& mean, double& var) {
+	int n = 0;
+	double sum = 0, sq = 0;
+
+	for (size_t i = 0; i < s.runs.size(); i++) {
+		double v = _value(s.runs[i], metric);
+		if (v < 0)
+			continue;
+		sum += v;
+		n++;
+	}
+	mean = n ? sum / n : 0;
+	for (size_t i = 0; i < s.runs.size(); i++) {
+		double v = _value(s.runs[i], metric);
+		if (v >= 0)
+			sq += (v - mean) * (v - mean);
+	}
+	var = n > 1 ? sq / (n - 1) : 0;
+	return n;
+}
+
+int fohBenchStat(const FOHBenchSeries& s, int metric, double& mean, double& ci) {
+	double var;
+	int n = _stat(s, metric, mean, var);
+	ci = n > 1 ? _t975(n - 1) * sqrt(var / n) : 0;
+	return n;
+}
+
+void fohBenchMachine(FOHBenchMeta& meta) {
+	struct utsname u;
+	if (uname(&u) == 0) {
+		meta.host = u.nodename;
+		meta.kernel = u.release;
+	}
+
+	meta.cpu = "";
+	FILE* f = fopen("/proc/cpuinfo", "r");
+	if (f != NULL) {
+		char line[256];
+		while (fgets(line, sizeof(line), f) != NULL) {
+			if (strncmp(line, "model name", 10) != 0 && strncmp(line, "Model", 5) != 0)
+				continue;
+			char* p = strchr(line, ':');
+			if (p == NULL)
+				continue;
+			for (p++; *p == ' ' || *p == '\t'; p++);
+			p[strcspn(p, "\n")] = '\0';
+			meta.cpu = p;
+			break;
+		}
+		fclose(f);
+	}
+	meta.cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+#ifdef __VERSION__
+	meta.compiler = __VERSION__;
+#endif
+
+	char d[32];
+	time_t now = time(NULL);
+	struct tm tm;
+	gmtime_r(&now, &tm);
+	strftime(d, sizeof(d), "%Y-%m-%dT%H:%M:%SZ", &tm);
+	meta.date = d;
+}
+
+static void _str(FILE* f, const std::string& s) {
+	fputc('"', f);
+	for (size_t i = 0; i < s.size(); i++) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+/**
+ *	@return 0 on success, -1 otherwise.
+ */
+int fohBenchSave(const char* path, const FOHBenchMeta& meta, const std::vector<FOHBenchSeries>& series) {
+	FILE* f = fopen(path, "w");
+	if (f == NULL)
+		return -1;
+
+	fprintf(f, "{\n\t\"format\": \"%s\",\n\t\"meta\": {\n", FOH_BENCH_FORMAT);
+	fprintf(f, "\t\t\"date\": "); _str(f, meta.date);
+	fprintf(f, ",\n\t\t\"host\": "); _str(f, meta.host);
+	fprintf(f, ",\n\t\t\"kernel\": "); _str(f, meta.kernel);
+	fprintf(f, ",\n\t\t\"cpu\": "); _str(f, meta.cpu);
+	fprintf(f, ",\n\t\t\"cpus\": %d", meta.cpus);
+	fprintf(f, ",\n\t\t\"compiler\": "); _str(f, meta.compiler);
+	fprintf(f, ",\n\t\t\"bytes\": %llu", (unsigned long long)meta.bytes);
+	fprintf(f, ",\n\t\t\"runs\": %d", meta.runs);
+	fprintf(f, ",\n\t\t\"syscalls\": "); _str(f, meta.syscalls);
+	fprintf(f, ",\n\t\t\"cycles\": %s\n\t},\n\t\"scenarios\": [", meta.cycles ? "true" : "false");
+
+	for (size_t i = 0; i < series.size(); i++) {
+		const FOHBenchSeries& s = series[i];
+		fprintf(f, "%s\n\t\t{\n\t\t\t\"name\": ", i ? "," : "");
+		_str(f, s.name);
+		fprintf(f, ",\n\t\t\t\"threshold\": %g,\n\t\t\t\"summary\": {", s.threshold);
+
+		//Derived figures for people reading the file, ignored when loading
+		bool first = true;
+		for (int m = 0; m < FOH_BENCH_METRICS; m++) {
+			double mean, ci;
+			if (fohBenchStat(s, m, mean, ci) == 0)
+				continue;
+			fprintf(f, "%s \"%s\": [%.6g, %.6g]", first ? "" : ",", _metricKey[m], mean, ci);
+			first = false;
+		}
+		fprintf(f, " },\n\t\t\t\"runs\": [");
+
+		for (size_t k = 0; k < s.runs.size(); k++) {
+			const FOHBenchResult& r = s.runs[k];
+			fprintf(f, "%s\n\t\t\t\t{ \"bytes\": %llu, \"ops\": %llu, \"wallNs\": %llu, \"cpuNs\": %llu, "
+					"\"syscalls\": %lld, \"ctxSwitches\": %lld, \"pageFaults\": %lld, \"allocs\": %lld, "
+					"\"allocBytes\": %lld, \"cycles\": %lld }",
+					k ? "," : "", (unsigned long long)r.bytes, (unsigned long long)r.ops,
+					(unsigned long long)r.wallNs, (unsigned long long)r.cpuNs, (long long)r.syscalls,
+					(long long)r.ctxSwitches, (long long)r.pageFaults, (long long)r.allocs,
+					(long long)r.allocBytes, (long long)r.cycles);
+		}
+		fprintf(f, "\n\t\t\t]\n\t\t}");
+	}
+	fprintf(f, "\n\t]\n}\n");
+
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+/**
+ *  @brief Just enough JSON to read our own files back
+ */
+struct _json {
+	enum { NUL, BOOL, NUM, STR, ARR, OBJ } type = NUL;
+	double num = 0;
+	std::string str;
+	std::vector<_json> arr;
+	std::vector<std::pair<std::string, _json>> obj;
+
+	const _json* get(const char* key) const {
+		for (size_t i = 0; i < obj.size(); i++)
+			if (obj[i].first == key)
+				return &obj[i].second;
+		return NULL;
+	}
+
+	double n(const char* key, double def = 0) const {
+		const _json* v = get(key);
+		return v != NULL && (v->type == NUM || v->type == BOOL) ? v->num : def;
+	}
+
+	std::string s(const char* key) const {
+		const _json* v = get(key);
+		return v != NULL && v->type == STR ? v->str : "";
+	}
+};
+
+static void _ws(const char*& p) {
+	while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+		p++;
+}
+
+static int _parse(const char*& p, _json& v, int depth);
+
+static int _parseStr(const char*& p, std::string& s) {
+	if (*p++ != '"')
+		return -1;
+	while (*p != '"') {
+		if (*p == '\0')
+			return -1;
+		if (*p != '\\') {
+			s += *p++;
+			continue;
+		}
+		p++;
+		switch (*p) {
+		case 'n': s += '\n'; break;
+		case 't': s += '\t'; break;
+		case 'r': s += '\r'; break;
+		case 'b': s += '\b'; break;
+		case 'f': s += '\f'; break;
+		case 'u': {
+			//Only what _str() writes (control characters) is needed
+			char h[5] = { 0 };
+			for (int i = 0; i < 4; i++)
+				if ((h[i] = p[1 + i]) == '\0')
+					return -1;
+			long c = strtol(h, NULL, 16);
+			s += c < 0x80 ? (char)c : '?';
+			p += 4;
+			break;
+		}
+		case '\0': return -1;
+		default: s += *p; break;
+		}
+		p++;
+	}
+	p++;
+	return 0;
+}
+
+static int _parse(const char*& p, _json& v, int depth) {
+	if (depth > 32)
+		return -1;
+	_ws(p);
+
+	if (*p == '{' || *p == '[') {
+		bool obj = *p++ == '{';
+		v.type = obj ? _json::OBJ : _json::ARR;
+		_ws(p);
+		if (*p == (obj ? '}' : ']')) {
+			p++;
+			return 0;
+		}
+		for (;;) {
+			_json e;
+			std::string key;
+			_ws(p);
+			if (obj) {
+				if (_parseStr(p, key) < 0)
+					return -1;
+				_ws(p);
+				if (*p++ != ':')
+					return -1;
+			}
+			if (_parse(p, e, depth + 1) < 0)
+				return -1;
+			if (obj)
+				v.obj.push_back(std::make_pair(key, e));
+			else
+				v.arr.push_back(e);
+			_ws(p);
+			if (*p == ',') {
+				p++;
+				continue;
+			}
+			if (*p++ != (obj ? '}' : ']'))
+				return -1;
+			return 0;
+		}
+	}
+	if (*p == '"') {
+		v.type = _json::STR;
+		return _parseStr(p, v.str);
+	}
+	if (strncmp(p, "true", 4) == 0 || strncmp(p, "false", 5) == 0) {
+		v.type = _json::BOOL;
+		v.num = *p == 't';
+		p += *p == 't' ? 4 : 5;
+		return 0;
+	}
+	if (strncmp(p, "null", 4) == 0) {
+		p += 4;
+		return 0;
+	}
+
+	char* end;
+	v.num = strtod(p, &end);
+	if (end == p)
+		return -1;
+	v.type = _json::NUM;
+	p = end;
+	return 0;
+}
+
+/**
+ *	@return 0 on success, -1 otherwise.
+ */
+int fohBenchLoad(const char* path, FOHBenchMeta& meta, std::vector<FOHBenchSeries>& series) {
+	FILE* f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+
+	std::string text;
+	char buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		text.append(buf, n);
+	fclose(f);
+
+	_json root;
+	const char* p = text.c_str();
+	if (_parse(p, root, 0) < 0 || root.type != _json::OBJ || root.s("format") != FOH_BENCH_FORMAT)
+		return -1;
+
+	const _json* m = root.get("meta");
+	const _json* sc = root.get("scenarios");
+	if (m == NULL || sc == NULL || sc->type != _json::ARR)
+		return -1;
+
+	meta.date = m->s("date");
+	meta.host = m->s("host");
+	meta.kernel = m->s("kernel");
+	meta.cpu = m->s("cpu");
+	meta.cpus = m->n("cpus");
+	meta.compiler = m->s("compiler");
+	meta.bytes = m->n("bytes");
+	meta.runs = m->n("runs");
+	meta.syscalls = m->s("syscalls");
+	meta.cycles = m->n("cycles") != 0;
+
+	series.clear();
+	for (size_t i = 0; i < sc->arr.size(); i++) {
+		const _json& e = sc->arr[i];
+		const _json* runs = e.get("runs");
+		if (runs == NULL || runs->type != _json::ARR)
+			return -1;
+
+		FOHBenchSeries s;
+		s.name = e.s("name");
+		s.threshold = e.n("threshold", 0.05);
+		for (size_t k = 0; k < runs->arr.size(); k++) {
+			const _json& j = runs->arr[k];
+			FOHBenchResult r = {};
+			r.name = s.name;
+			r.bytes = j.n("bytes");
+			r.ops = j.n("ops");
+			r.wallNs = j.n("wallNs");
+			r.cpuNs = j.n("cpuNs");
+			r.syscalls = j.n("syscalls", -1);
+			r.ctxSwitches = j.n("ctxSwitches", -1);
+			r.pageFaults = j.n("pageFaults", -1);
+			r.allocs = j.n("allocs", -1);
+			r.allocBytes = j.n("allocBytes", -1);
+			r.cycles = j.n("cycles", -1);
+			s.runs.push_back(r);
+		}
+		series.push_back(s);
+	}
+
+	return 0;
+}
+
+static void _meta(FILE* f, const char* what, const FOHBenchMeta& m) {
+	fprintf(f, "# %-9s %s  %s, %s (%d CPUs), %s, %d runs of %llu bytes\n", what, m.date.c_str(), m.host.c_str(),
+			m.cpu.c_str(), m.cpus, m.kernel.c_str(), m.runs, (unsigned long long)m.bytes);
+}
+
+int fohBenchCompare(FILE* f, const FOHBenchMeta& base, const std::vector<FOHBenchSeries>& baseSeries,
+		const FOHBenchMeta& cur, const std::vector<FOHBenchSeries>& curSeries) {
+	_meta(f, "baseline:", base);
+	_meta(f, "current:", cur);
+	if (base.host != cur.host || base.cpu != cur.cpu || base.kernel != cur.kernel)
+		fprintf(f, "# warning: different machine or kernel\n");
+	if (base.bytes != cur.bytes || base.syscalls != cur.syscalls || base.compiler != cur.compiler)
+		fprintf(f, "# warning: different configuration (bytes, syscall counting or compiler)\n");
+
+	std::map<std::string, const FOHBenchSeries*> now;
+	for (size_t i = 0; i < curSeries.size(); i++)
+		now[curSeries[i].name] = &curSeries[i];
+
+	fprintf(f, "%-16s %-10s %12s %12s %9s %20s  %s\n", "scenario", "metric", "baseline", "current", "change",
+			"95% CI", "verdict");
+
+	int regressions = 0;
+	for (size_t i = 0; i < baseSeries.size(); i++) {
+		const FOHBenchSeries& b = baseSeries[i];
+		auto it = now.find(b.name);
+		if (it == now.end()) {
+			fprintf(f, "%-16s missing in the current results\n", b.name.c_str());
+			continue;
+		}
+		const FOHBenchSeries& c = *it->second;
+		double thr = c.threshold > 0 ? c.threshold : b.threshold;
+		now.erase(it);
+
+		for (int m = 0; m < FOH_BENCH_METRICS; m++) {
+			double mb, vb, mc, vc;
+			int nb = _stat(b, m, mb, vb);
+			int nc = _stat(c, m, mc, vc);
+			if (nb == 0 || nc == 0)
+				continue;
+
+			//Welch interval of the difference of the means
+			double diff = mc - mb;
+			double eb = vb / nb, ec = vc / nc;
+			double se = sqrt(eb + ec);
+			double df = nb + nc - 2;
+			if (eb + ec > 0 && nb > 1 && nc > 1)
+				df = (eb + ec) * (eb + ec) / (eb * eb / (nb - 1) + ec * ec / (nc - 1));
+			double half = _t975(df) * se;
+
+			//One run has no spread, its interval would have zero width
+			bool enough = nb > 1 && nc > 1;
+			bool significant = enough && (diff - half > 0 || diff + half < 0);
+			bool worse = m == 0 ? diff < 0 : diff > 0;
+			char change[16], ci[32];
+			bool flagged;
+
+			if (mb != 0) {
+				double rel = diff / fabs(mb);
+				snprintf(change, sizeof(change), "%+.1f%%", rel * 100);
+				snprintf(ci, sizeof(ci), "[%+.1f%%, %+.1f%%]", (diff - half) / fabs(mb) * 100,
+						(diff + half) / fabs(mb) * 100);
+				flagged = significant && fabs(rel) > thr && fabs(diff) > _metricFloor[m];
+			} else {
+				snprintf(change, sizeof(change), "%s", diff != 0 ? "new" : "+0.0%");
+				snprintf(ci, sizeof(ci), "[%+.3g, %+.3g]", diff - half, diff + half);
+				flagged = significant && fabs(diff) > _metricFloor[m];
+			}
+
+			if (enough == false)
+				snprintf(ci, sizeof(ci), "-");
+
+			const char* verdict = "";
+			if (enough == false) {
+				verdict = "insufficient runs";
+			} else if (flagged && worse) {
+				verdict = "REGRESSION";
+				regressions++;
+			} else if (flagged) {
+				verdict = "improved";
+			} else if (significant) {
+				verdict = "(below threshold)";
+			}
+
+			fprintf(f, "%-16s %-10s %12.4g %12.4g %9s %20s  %s\n", b.name.c_str(), _metricName[m], mb, mc,
+					change, ci, verdict);
+		}
+	}
+	for (auto it = now.begin(); it != now.end(); ++it)
+		fprintf(f, "%-16s not in the baseline\n", it->first.c_str());
+
+	fprintf(f, "# %d regression%s (thresholds per scenario, 95%% confidence)\n", regressions,
+			regressions == 1 ? "" : "s");
+	return regressions;
+}
+
+void fohBenchSummary(FILE* f, const std::vector<FOHBenchSeries>& series) {
+	fprintf(f, "%-20s", "scenario");
+	for (int m = 0; m < FOH_BENCH_METRICS; m++)
+		fprintf(f, " %20s", _metricName[m]);
+	fprintf(f, "\n");
+
+	for (size_t i = 0; i < series.size(); i++) {
+		fprintf(f, "%-20s", series[i].name.c_str());
+		for (int m = 0; m < FOH_BENCH_METRICS; m++) {
+			double mean, ci;
+			char v[32];
+			if (fohBenchStat(series[i], m, mean, ci) == 0)
+				snprintf(v, sizeof(v), "-");
+			else
+				snprintf(v, sizeof(v), "%.4g +- %.2g", mean, ci);
+			fprintf(f, " %20s", v);
+		}
+		fprintf(f, "\n");
+	}
+}
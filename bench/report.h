@@ -0,0 +1,120 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file bench/report.h
+ * @brief Benchmark result files and baseline comparison.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_BENCH_REPORT_H
+#define FOH_BENCH_REPORT_H
+
+#include "bench.h"
+
+#include <vector>
+
+/**
+ *  @brief Machine and configuration a result file was made on
+ */
+struct FOHBenchMeta {
+	std::string date; /**< UTC, ISO 8601 */
+	std::string host; /**< Node name */
+	std::string kernel; /**< Release */
+	std::string cpu; /**< Model name */
+	int cpus; /**< Online CPUs */
+	std::string compiler; /**< Compiler version */
+	uint64_t bytes; /**< Payload per run */
+	int runs; /**< Runs per scenario */
+	std::string syscalls; /**< "perf" or "wrap" */
+	bool cycles; /**< Cycles were counted */
+};
+
+/**
+ *  @brief All runs of one scenario
+ */
+struct FOHBenchSeries {
+	std::string name; /**< Scenario */
+	double threshold; /**< Smallest relative change worth flagging */
+	std::vector<FOHBenchResult> runs; /**< One entry per run */
+};
+
+/**
+ *  @brief Fill the machine part of the metadata
+ */
+void fohBenchMachine(FOHBenchMeta& meta);
+
+/**
+ *  @brief Write results as JSON
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int fohBenchSave(const char* path, const FOHBenchMeta& meta, const std::vector<FOHBenchSeries>& series);
+
+/**
+ *  @brief Read results written by fohBenchSave()
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int fohBenchLoad(const char* path, FOHBenchMeta& meta, std::vector<FOHBenchSeries>& series);
+
+/**
+ *  @brief Compare results against a baseline
+ *
+ *  For every scenario in both sets and every metric (MB/s, system calls,
+ *  context switches and allocations per KiB, cycles per byte) the 95%
+ *  confidence interval of the difference of the means is computed
+ *  (Welch). A change is significant when the interval excludes zero and
+ *  flagged when it is also larger than the scenario's threshold (the
+ *  baseline's, unless the current one is set) and than a small absolute
+ *  floor per metric, which alone applies when the baseline is 0.
+ *  Counters of a fixed code path don't vary between runs, so any change
+ *  above the threshold shows. With a single run on either side there is
+ *  no spread to judge by and the verdict is "insufficient runs".
+ *
+ *  @param f Report output
+ *  @param base Baseline metadata
+ *  @param baseSeries Baseline results
+ *  @param cur Current metadata
+ *  @param curSeries Current results
+ *
+ *  @return Number of regressions
+ */
+int fohBenchCompare(FILE* f, const FOHBenchMeta& base, const std::vector<FOHBenchSeries>& baseSeries,
+		const FOHBenchMeta& cur, const std::vector<FOHBenchSeries>& curSeries);
+
+/**
+ *  @brief Mean and half width of the 95% confidence interval of one metric
+ *
+ *  @param s Runs
+ *  @param metric 0: MB/s, 1: syscalls/KiB, 2: context switches/KiB, 3: allocs/KiB, 4: cycles/byte
+ *  @param mean Mean
+ *  @param ci Half width of the interval
+ *
+ *  @return Number of runs with a value (0: metric unknown)
+ */
+int fohBenchStat(const FOHBenchSeries& s, int metric, double& mean, double& ci);
+
+/**
+ *  @brief Print mean ± interval of each scenario
+ */
+void fohBenchSummary(FILE* f, const std::vector<FOHBenchSeries>& series);
+
+#endif
@@ -0,0 +1,227 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file budget.cpp
+ * @brief Memory budgets and overflow policies for receive and transmit buffers.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "budget.h"
+#include "serial.h"
+
+/**
+ *  @brief Create a budget
+ *
+ *  @param limit Maximum bytes held
+ *  @param parent Enclosing budget that is charged as well, or NULL
+ */
+FOHMemBudget::FOHMemBudget(size_t limit, FOHMemBudget* parent)
+	: _limit(limit), _parent(parent), _used(0), _peak(0), _hits(0), _dropped(0), _blockedNs(0), _pauses(0) {
+}
+
+/**
+ *  @brief Charge this level only
+ */
+bool FOHMemBudget::_take(size_t n) {
+	size_t cur = _used.load(std::memory_order_relaxed);
+
+	do {
+		if (n > _limit || cur > _limit - n)
+			return false;
+	} while (!_used.compare_exchange_weak(cur, cur + n, std::memory_order_relaxed));
+
+	size_t peak = _peak.load(std::memory_order_relaxed);
+	while (cur + n > peak && !_peak.compare_exchange_weak(peak, cur + n, std::memory_order_relaxed));
+
+	return true;
+}
+
+/**
+ *  @brief Return bytes to this level only and wake waiters
+ */
+void FOHMemBudget::_give(size_t n) {
+	_used.fetch_sub(n, std::memory_order_relaxed);
+
+	//Taking the lock orders us after a waiter's last check
+	{
+		std::lock_guard<std::mutex> l(_lock);
+	}
+	_cond.notify_all();
+}
+
+/**
+ *  @brief Charge exactly n bytes if they fit
+ *
+ *	@return true on success, false if this or the parent budget is full.
+ */
+bool FOHMemBudget::tryCharge(size_t n) {
+	//Hits are counted at the level that was full
+	if (!_take(n)) {
+		noteHit();
+		return false;
+	}
+
+	if (_parent && !_parent->tryCharge(n)) {
+		_give(n);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ *  @brief Bytes that can be charged right now (including the parent's limit)
+ */
+size_t FOHMemBudget::room() const {
+	size_t u = used();
+	size_t r = u < _limit ? _limit - u : 0;
+
+	if (_parent) {
+		size_t p = _parent->room();
+		if (p < r)
+			r = p;
+	}
+
+	return r;
+}
+
+/**
+ *  @brief Charge between min and max bytes, waiting for room if necessary
+ *
+ *  @param min Bytes that must fit before anything is charged
+ *  @param max Bytes wanted
+ *  @param timeoutMs Longest wait (0: don't wait, -1: forever)
+ *
+ *  @return Bytes charged (0 if min bytes didn't fit in time)
+ */
+size_t FOHMemBudget::_wait(size_t min, size_t max, int timeoutMs) {
+	uint64_t start = 0;
+	bool waited = false;
+	size_t n;
+
+	for (;;) {
+		n = room();
+		if (n >= min) {
+			if (n > max)
+				n = max;
+			if (tryCharge(n))
+				break;
+			continue;
+		}
+
+		//Sleep on whichever level is short of room
+		FOHMemBudget* full = this;
+		while (full->_parent && full->used() + min <= full->_limit)
+			full = full->_parent;
+		if (!waited)
+			full->noteHit();
+
+		if (timeoutMs == 0) {
+			n = 0;
+			break;
+		}
+		if (!waited) {
+			start = fohMonoNs();
+			waited = true;
+		}
+
+		std::unique_lock<std::mutex> l(full->_lock);
+		if (full->used() + min <= full->_limit)
+			continue;
+
+		if (timeoutMs < 0) {
+			full->_cond.wait(l);
+		} else {
+			uint64_t elapsed = fohMonoNs() - start;
+			if (elapsed >= (uint64_t)timeoutMs * 1000000ULL) {
+				n = 0;
+				break;
+			}
+			full->_cond.wait_for(l, std::chrono::nanoseconds((uint64_t)timeoutMs * 1000000ULL - elapsed));
+		}
+	}
+
+	if (waited)
+		_blockedNs.fetch_add(fohMonoNs() - start, std::memory_order_relaxed);
+
+	return n;
+}
+
+/**
+ *  @brief Charge up to max bytes, waiting for room if necessary
+ *
+ *  @param max Bytes wanted
+ *  @param timeoutMs Longest wait for at least one byte (0: don't wait, -1: forever)
+ *
+ *  @return Bytes charged (0 if nothing fit in time)
+ */
+size_t FOHMemBudget::reserve(size_t max, int timeoutMs) {
+	if (max == 0)
+		return 0;
+
+	return _wait(1, max, timeoutMs);
+}
+
+/**
+ *  @brief Charge exactly n bytes, waiting for room if necessary
+ *
+ *  @param n Bytes to charge
+ *  @param timeoutMs Longest wait (0: don't wait, -1: forever)
+ *
+ *	@return true on success, false if they didn't fit in time.
+ */
+bool FOHMemBudget::charge(size_t n, int timeoutMs) {
+	if (n == 0)
+		return true;
+	if (n > _limit || (_parent && n > _parent->_limit)) {
+		noteHit();
+		return false;
+	}
+
+	return _wait(n, n, timeoutMs) == n;
+}
+
+/**
+ *  @brief Return bytes to this budget and its parent
+ */
+void FOHMemBudget::release(size_t n) {
+	if (n == 0)
+		return;
+
+	_give(n);
+	if (_parent)
+		_parent->release(n);
+}
+
+/**
+ *  @brief Snapshot of the counters
+ */
+FOHBudgetStats FOHMemBudget::stats() const {
+	FOHBudgetStats s;
+
+	s.limitHits = _hits.load(std::memory_order_relaxed);
+	s.droppedBytes = _dropped.load(std::memory_order_relaxed);
+	s.blockedNs = _blockedNs.load(std::memory_order_relaxed);
+	s.pauses = _pauses.load(std::memory_order_relaxed);
+	s.peakBytes = _peak.load(std::memory_order_relaxed);
+
+	return s;
+}
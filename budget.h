@@ -0,0 +1,163 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file budget.h
+ * @brief Memory budgets and overflow policies for receive and transmit buffers.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_BUDGET_H
+#define FOH_BUDGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ *  @brief What a buffer does when its budget is exhausted
+ */
+enum FOHBudgetPolicy {
+	FOH_BUDGET_BLOCK = 0, /**< Producer waits for the consumer */
+	FOH_BUDGET_DROP_OLDEST = 1, /**< Oldest buffered data is discarded */
+	FOH_BUDGET_DROP_NEWEST = 2, /**< Incoming data is discarded */
+	FOH_BUDGET_PAUSE_DEVICE = 3 /**< Device is paused via RTS or XOFF, overflow is discarded */
+};
+
+/**
+ *  @brief Counters of a budget (snapshot)
+ */
+struct FOHBudgetStats {
+	uint64_t limitHits; /**< Times a charge didn't fit */
+	uint64_t droppedBytes; /**< Bytes discarded by a drop policy */
+	uint64_t blockedNs; /**< Time producers spent waiting */
+	uint64_t pauses; /**< Times the device was paused */
+	uint64_t peakBytes; /**< Highest usage seen */
+};
+
+/**
+ *  @brief Byte budget, optionally nested in a parent budget
+ *
+ *  Give every port its own budget and make a single global budget their
+ *  parent: a charge has to fit into both, so one stuck consumer can fill
+ *  its own share but never the whole process. Charging is lock-free;
+ *  the mutex is only used to sleep in reserve().
+ */
+class FOHMemBudget {
+public:
+	/**
+	 *  @brief Create a budget
+	 *
+	 *  @param limit Maximum bytes held
+	 *  @param parent Enclosing budget that is charged as well, or NULL
+	 */
+	FOHMemBudget(size_t limit, FOHMemBudget* parent = NULL);
+
+	/**
+	 *  @brief Charge exactly n bytes if they fit
+	 *
+	 *	@return true on success, false if this or the parent budget is full.
+	 */
+	bool tryCharge(size_t n);
+
+	/**
+	 *  @brief Charge up to max bytes, waiting for room if necessary
+	 *
+	 *  @param max Bytes wanted
+	 *  @param timeoutMs Longest wait for at least one byte (0: don't wait, -1: forever)
+	 *
+	 *  @return Bytes charged (0 if nothing fit in time)
+	 */
+	size_t reserve(size_t max, int timeoutMs);
+
+	/**
+	 *  @brief Charge exactly n bytes, waiting for room if necessary
+	 *
+	 *  @param n Bytes to charge
+	 *  @param timeoutMs Longest wait (0: don't wait, -1: forever)
+	 *
+	 *	@return true on success, false if they didn't fit in time.
+	 */
+	bool charge(size_t n, int timeoutMs);
+
+	/**
+	 *  @brief Return bytes to this budget and its parent
+	 */
+	void release(size_t n);
+
+	size_t used() const { return _used.load(std::memory_order_relaxed); }
+	size_t limit() const { return _limit; }
+
+	/**
+	 *  @brief Bytes that can be charged right now (including the parent's limit)
+	 */
+	size_t room() const;
+
+	/**
+	 *  @brief Record discarded bytes
+	 */
+	void noteDropped(size_t n) { _dropped.fetch_add(n, std::memory_order_relaxed); }
+
+	/**
+	 *  @brief Record a device pause
+	 */
+	void notePause() { _pauses.fetch_add(1, std::memory_order_relaxed); }
+
+	/**
+	 *  @brief Record a charge that didn't fit
+	 */
+	void noteHit() { _hits.fetch_add(1, std::memory_order_relaxed); }
+
+	/**
+	 *  @brief Snapshot of the counters
+	 */
+	FOHBudgetStats stats() const;
+
+private:
+	/**
+	 *  @brief Charge this level only
+	 */
+	bool _take(size_t n);
+
+	/**
+	 *  @brief Return bytes to this level only and wake waiters
+	 */
+	void _give(size_t n);
+
+	/**
+	 *  @brief Charge between min and max bytes, waiting for room if necessary
+	 */
+	size_t _wait(size_t min, size_t max, int timeoutMs);
+
+	size_t _limit; /**< Maximum bytes */
+	FOHMemBudget* _parent; /**< Enclosing budget */
+	std::atomic<size_t> _used; /**< Bytes charged */
+	std::atomic<size_t> _peak; /**< Highest usage */
+	std::atomic<uint64_t> _hits; /**< Charges that didn't fit */
+	std::atomic<uint64_t> _dropped; /**< Discarded bytes */
+	std::atomic<uint64_t> _blockedNs; /**< Producer wait time */
+	std::atomic<uint64_t> _pauses; /**< Device pauses */
+	std::mutex _lock; /**< Only for waiting */
+	std::condition_variable _cond; /**< Signalled on release */
+};
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file cancel.cpp
+ * @brief Cancellation tokens for blocking serial operations.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "cancel.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdint.h>
+
+FOHCancelToken::FOHCancelToken() : _cancelled(false) {
+	_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+FOHCancelToken::~FOHCancelToken() {
+	if (_fd >= 0)
+		close(_fd);
+}
+
+/**
+ *  @brief Cancel all operations using this token (thread-safe)
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHCancelToken::cancel() {
+	uint64_t one = 1;
+
+	_cancelled.store(true, std::memory_order_release);
+
+	return write(_fd, &one, sizeof one) == sizeof one ? 0 : -1;
+}
+
+/**
+ *  @brief Make the token usable again
+ */
+void FOHCancelToken::reset() {
+	uint64_t cnt;
+
+	_cancelled.store(false, std::memory_order_release);
+
+	//Drain the counter so poll() blocks again
+	while (read(_fd, &cnt, sizeof cnt) == sizeof cnt);
+}
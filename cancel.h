@@ -0,0 +1,76 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file cancel.h
+ * @brief Cancellation tokens for blocking serial operations.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_CANCEL_H
+#define FOH_CANCEL_H
+
+#include <atomic>
+
+/**
+ *  @brief Wakes up blocking FOHSerial calls from another thread
+ *
+ *  Blocking operations that get a token poll its eventfd next to the port,
+ *  so cancel() ends the wait right away. The token stays cancelled (and
+ *  the eventfd readable) until reset(), which makes every operation using
+ *  it return. A cancelled operation returns the bytes it had already
+ *  transferred, or -1 with errno ECANCELED if there were none.
+ */
+class FOHCancelToken {
+public:
+	FOHCancelToken();
+	~FOHCancelToken();
+
+	/**
+	 *  @brief Cancel all operations using this token (thread-safe)
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int cancel();
+
+	/**
+	 *  @brief Make the token usable again
+	 */
+	void reset();
+
+	/**
+	 *  @brief Whether cancel() was called since the last reset()
+	 */
+	bool cancelled() const { return _cancelled.load(std::memory_order_acquire); }
+
+	/**
+	 *  @brief eventfd to poll, readable while cancelled
+	 */
+	int getFd() const { return _fd; }
+
+private:
+	FOHCancelToken(const FOHCancelToken&);
+	FOHCancelToken& operator=(const FOHCancelToken&);
+
+	int _fd; /**< eventfd */
+	std::atomic<bool> _cancelled; /**< cancel() was called */
+};
+
+#endif
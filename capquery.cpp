@@ -0,0 +1,399 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file capquery.cpp
+ * @brief Indexed time range and pattern queries over capture files.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "capquery.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+FOHCapQuery::FOHCapQuery()
+	: fromNs(0), toNs(UINT64_MAX), port(-1), dir(-1), channel(-1), minValue(-1e308), maxValue(1e308) {
+}
+
+FOHCapFile::FOHCapFile() : _covered(0) {
+}
+
+FOHCapFile::~FOHCapFile() {
+	close();
+}
+
+/**
+ *  @brief Open a capture and load or build its index
+ *
+ *  @param path Capture file
+ *  @param blockBytes Index granularity for a new index
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHCapFile::open(const char* path, size_t blockBytes) {
+	close();
+	if (_reader.open(path) < 0)
+		return -1;
+
+	std::string idx = std::string(path) + ".idx";
+	int loaded = _loadIndex(idx);
+	if (loaded > 0)
+		blockBytes = loaded;
+	if (blockBytes == 0)
+		blockBytes = FOH_IDX_BLOCK;
+
+	uint64_t before = _covered;
+	_extendIndex(blockBytes);
+	if (loaded <= 0 || _covered != before)
+		_saveIndex(idx, blockBytes);
+	return 0;
+}
+
+void FOHCapFile::close() {
+	_reader.close();
+	_index.clear();
+	_covered = 0;
+}
+
+/**
+ *  @brief Record at a file offset (from a hit)
+ *
+ *  @return Record, NULL if the offset is outside the indexed range
+ */
+const FOHCapRecord* FOHCapFile::record(uint64_t offset) const {
+	if (_reader.map() == NULL || offset < _reader.header()->headerSize
+			|| offset + sizeof(FOHCapRecord) > _covered)
+		return NULL;
+	return (const FOHCapRecord*)(_reader.map() + offset);
+}
+
+/**
+ *  @brief Load an index that belongs to the open capture
+ *
+ *  @return Block size of the index, 0 if there is no usable index
+ */
+int FOHCapFile::_loadIndex(const std::string& path) {
+	_index.clear();
+	_covered = _reader.header()->headerSize;
+
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f == NULL)
+		return 0;
+
+	FOHCapIndexHeader h;
+	int ret = 0;
+	if (fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, FOH_IDX_MAGIC, 8) == 0
+			&& h.version == FOH_IDX_VERSION && h.capMonoNs == _reader.header()->monoNs
+			&& h.capRealNs == _reader.header()->realNs && h.covered <= _reader.size()) {
+		_index.resize(h.count);
+		if (h.count == 0 || fread(_index.data(), sizeof(FOHCapIndexEntry), h.count, f) == h.count) {
+			_covered = h.covered;
+			ret = h.blockBytes;
+		} else {
+			_index.clear();
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+/**
+ *  @brief Index the records after the covered range
+ *
+ *  The last entry may have been cut short by the end of the file, so it
+ *  is redone.
+ */
+void FOHCapFile::_extendIndex(size_t blockBytes) {
+	uint64_t pos = _covered;
+	if (_index.empty() == false) {
+		pos = _index.back().offset;
+		_index.pop_back();
+	}
+
+	FOHCapIndexEntry e;
+	memset(&e, 0, sizeof(e));
+	e.offset = e.end = pos;
+	e.minTsNs = UINT64_MAX;
+
+	_reader.seek(pos);
+	const FOHCapRecord* rec;
+	const char* data;
+	while (_reader.next(&rec, &data) == 1) {
+		e.end = _reader.offset();
+		e.records++;
+		if (rec->tsNs < e.minTsNs)
+			e.minTsNs = rec->tsNs;
+		if (rec->tsNs > e.maxTsNs)
+			e.maxTsNs = rec->tsNs;
+
+		if (e.end - e.offset >= blockBytes) {
+			_index.push_back(e);
+			e.offset = e.end;
+			e.records = 0;
+			e.minTsNs = UINT64_MAX;
+			e.maxTsNs = 0;
+		}
+	}
+	if (e.records > 0)
+		_index.push_back(e);
+	_covered = e.end;
+}
+
+/**
+ *  @brief Write the index next to the capture (best effort)
+ */
+void FOHCapFile::_saveIndex(const std::string& path, size_t blockBytes) {
+	FOHCapIndexHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, FOH_IDX_MAGIC, 8);
+	h.version = FOH_IDX_VERSION;
+	h.blockBytes = blockBytes;
+	h.capMonoNs = _reader.header()->monoNs;
+	h.capRealNs = _reader.header()->realNs;
+	h.covered = _covered;
+	h.count = _index.size();
+
+	std::string tmp = path + ".tmp";
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if (f == NULL)
+		return;
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+			&& fwrite(_index.data(), sizeof(FOHCapIndexEntry), _index.size(), f) == _index.size();
+	if (fclose(f) != 0)
+		ok = false;
+
+	if (ok)
+		rename(tmp.c_str(), path.c_str());
+	else
+		remove(tmp.c_str());
+}
+
+/**
+ *  @brief Run a query
+ *
+ *  @param q Query
+ *  @param out Hits in file order
+ *  @param threads Worker threads (0: one per core)
+ *  @param limit Stop after about this many hits (0: all)
+ *
+ *  @return Number of hits, -1 on error
+ */
+long FOHCapFile::query(const FOHCapQuery& q, std::vector<FOHCapMatch>& out, int threads, size_t limit) {
+	out.clear();
+	if (_reader.map() == NULL)
+		return -1;
+
+	std::vector<size_t> todo;
+	for (size_t i = 0; i < _index.size(); i++)
+		if (_index[i].maxTsNs >= q.fromNs && _index[i].minTsNs <= q.toNs)
+			todo.push_back(i);
+
+	if (threads <= 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads <= 0)
+		threads = 1;
+	if ((size_t)threads > todo.size())
+		threads = todo.size();
+
+	std::vector<std::vector<FOHCapMatch>> parts(todo.size());
+	std::atomic<size_t> next(0), hits(0);
+	auto work = [&]() {
+		for (;;) {
+			if (limit > 0 && hits.load(std::memory_order_relaxed) >= limit)
+				break;
+			size_t i = next.fetch_add(1);
+			if (i >= todo.size())
+				break;
+			_scan(q, todo[i], parts[i]);
+			hits.fetch_add(parts[i].size(), std::memory_order_relaxed);
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; i++)
+		pool.push_back(std::thread(work));
+	work();
+	for (size_t i = 0; i < pool.size(); i++)
+		pool[i].join();
+
+	//Entries after a gap left by the limit are dropped, keeping a prefix
+	for (size_t i = 0; i < parts.size(); i++) {
+		if (limit > 0 && out.size() >= limit)
+			break;
+		out.insert(out.end(), parts[i].begin(), parts[i].end());
+	}
+	if (limit > 0 && out.size() > limit)
+		out.resize(limit);
+	return out.size();
+}
+
+/**
+ *  @brief Search one index entry
+ *
+ *  Pattern matches may span chunks of a port. The tail of each port's
+ *  data is carried along, seeded from the entry before, so only matches
+ *  spanning more than a whole entry are missed.
+ */
+void FOHCapFile::_scan(const FOHCapQuery& q, size_t entry, std::vector<FOHCapMatch>& out) {
+	const char* map = _reader.map();
+	const char* pat = q.pattern.data();
+	size_t pl = q.pattern.size();
+	bool list = pl == 0 && q.channel < 0;
+
+	//Tail of the last pl - 1 bytes per port: points into the map unless
+	//it had to be pieced together from short chunks. A pieced tail is
+	//only reached through data(), the string moves when carry grows.
+	struct tail {
+		const char* p;
+		size_t n;
+		std::string own;
+		bool owned;
+
+		const char* data() const { return owned ? own.data() : p; }
+	};
+	std::vector<tail> carry;
+
+	auto wanted = [&q](const FOHCapRecord* r) {
+		return (q.port < 0 || r->port == (uint32_t)q.port) && (q.dir < 0 || r->dir == q.dir);
+	};
+	auto keepTail = [&carry, pl](const FOHCapRecord* r) {
+		if (r->port >= carry.size())
+			carry.resize(r->port + 1, tail{ NULL, 0, std::string(), false });
+		tail& t = carry[r->port];
+		const char* d = (const char*)(r + 1);
+		if (r->len >= pl - 1) {
+			t.p = d + r->len - (pl - 1);
+			t.n = pl - 1;
+			t.owned = false;
+			return;
+		}
+		std::string s;
+		if (t.n > 0)
+			s.assign(t.data(), t.n);
+		s.append(d, r->len);
+		if (s.size() > pl - 1)
+			s.erase(0, s.size() - (pl - 1));
+		t.own.swap(s);
+		t.n = t.own.size();
+		t.owned = true;
+	};
+
+	if (pl > 1 && entry > 0) {
+		const FOHCapIndexEntry& prev = _index[entry - 1];
+		for (uint64_t pos = prev.offset; pos < prev.end;) {
+			const FOHCapRecord* r = (const FOHCapRecord*)(map + pos);
+			pos += fohCapRecordSize(r->len);
+			if (r->type == FOH_CAP_DATA && wanted(r))
+				keepTail(r);
+		}
+	}
+
+	const FOHCapIndexEntry& e = _index[entry];
+	for (uint64_t pos = e.offset; pos < e.end;) {
+		const FOHCapRecord* r = (const FOHCapRecord*)(map + pos);
+		uint64_t off = pos;
+		pos += fohCapRecordSize(r->len);
+
+		bool inTime = r->tsNs >= q.fromNs && r->tsNs <= q.toNs;
+		FOHCapMatch m;
+		memset(&m, 0, sizeof(m));
+		m.offset = off;
+		m.tsNs = r->tsNs;
+		m.port = r->port;
+		m.dir = r->dir;
+		m.type = r->type;
+
+		if (r->type == FOH_CAP_MARK) {
+			if (list && inTime && q.port < 0)
+				out.push_back(m);
+			continue;
+		}
+
+		if (r->type == FOH_CAP_SAMPLES) {
+			if (list) {
+				if (inTime && wanted(r))
+					out.push_back(m);
+				continue;
+			}
+			if (q.channel < 0)
+				continue;
+
+			const FOHSample* s = (const FOHSample*)(r + 1);
+			size_t n = r->len / sizeof(FOHSample);
+			for (size_t k = 0; k < n; k++) {
+				if (s[k].channel != (uint32_t)q.channel || s[k].hostNs < q.fromNs || s[k].hostNs > q.toNs)
+					continue;
+				if ((q.port >= 0 && s[k].port != (uint32_t)q.port) || s[k].value < q.minValue || s[k].value > q.maxValue)
+					continue;
+				m.tsNs = s[k].hostNs;
+				m.port = s[k].port;
+				m.at = k;
+				m.channel = s[k].channel;
+				m.value = s[k].value;
+				out.push_back(m);
+			}
+			continue;
+		}
+
+		if (r->type != FOH_CAP_DATA || wanted(r) == false)
+			continue;
+		if (list) {
+			if (inTime)
+				out.push_back(m);
+			continue;
+		}
+		if (pl == 0)
+			continue;
+
+		const char* d = (const char*)(r + 1);
+		if (inTime) {
+			//Matches starting in earlier chunks of the port; they have to end
+			//on the last pattern byte within the first pl - 1 bytes
+			size_t lead = r->len < pl - 1 ? r->len : pl - 1;
+			if (pl > 1 && r->port < carry.size() && carry[r->port].n > 0
+					&& memchr(d, pat[pl - 1], lead) != NULL) {
+				std::string edge(carry[r->port].data(), carry[r->port].n);
+				size_t head = edge.size();
+				edge.append(d, lead);
+				const char* p = edge.data();
+				const char* hit;
+				while ((hit = (const char*)memmem(p, edge.data() + edge.size() - p, pat, pl)) != NULL
+						&& (size_t)(hit - edge.data()) < head) {
+					m.at = (int64_t)(hit - edge.data()) - (int64_t)head;
+					out.push_back(m);
+					p = hit + 1;
+				}
+			}
+
+			const char* p = d;
+			const char* hit;
+			while ((hit = (const char*)memmem(p, d + r->len - p, pat, pl)) != NULL) {
+				m.at = hit - d;
+				out.push_back(m);
+				p = hit + 1;
+			}
+		}
+		if (pl > 1)
+			keepTail(r);
+	}
+}
@@ -0,0 +1,170 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file capquery.h
+ * @brief Indexed time range and pattern queries over capture files.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_CAPQUERY_H
+#define FOH_CAPQUERY_H
+
+#include "capture.h"
+#include "sink.h"
+
+#include <string>
+#include <vector>
+
+#define FOH_IDX_MAGIC "FOHIDX1\n"
+#define FOH_IDX_VERSION 1
+
+//Default bytes of capture covered by one index entry
+#define FOH_IDX_BLOCK (1 << 20)
+
+/**
+ *  @brief One index entry: a run of whole records
+ *
+ *  Records of different ports are not strictly in time order in a file,
+ *  so each entry carries the time range of its records.
+ */
+struct FOHCapIndexEntry {
+	uint64_t offset; /**< First record */
+	uint64_t end; /**< End of the last record */
+	uint64_t minTsNs; /**< Earliest record time */
+	uint64_t maxTsNs; /**< Latest record time */
+	uint64_t records; /**< Records in the run */
+};
+
+/**
+ *  @brief Index file header (<capture>.idx), entries follow
+ */
+struct FOHCapIndexHeader {
+	char magic[8]; /**< FOH_IDX_MAGIC */
+	uint32_t version; /**< FOH_IDX_VERSION */
+	uint32_t blockBytes; /**< Target size of an entry */
+	uint64_t capMonoNs; /**< monoNs of the indexed capture header */
+	uint64_t capRealNs; /**< realNs of the indexed capture header */
+	uint64_t covered; /**< Capture bytes indexed */
+	uint64_t count; /**< Number of entries */
+};
+
+/**
+ *  @brief What to look for
+ */
+struct FOHCapQuery {
+	uint64_t fromNs; /**< Earliest record time */
+	uint64_t toNs; /**< Latest record time */
+	int port; /**< Port, -1: all */
+	int dir; /**< FOHDirection, -1: both */
+	std::string pattern; /**< Byte pattern in raw data, empty: none */
+	int channel; /**< Sample channel to test, -1: no sample search */
+	double minValue; /**< Smallest matching sample value */
+	double maxValue; /**< Largest matching sample value */
+
+	FOHCapQuery();
+};
+
+/**
+ *  @brief A hit
+ *
+ *  Without pattern and channel every record in range is a hit. Pattern
+ *  hits name the record the match ends in; at is the start of the match
+ *  relative to that record's data, negative if it began in an earlier
+ *  chunk of the port. Sample hits name the sample index in at.
+ */
+struct FOHCapMatch {
+	uint64_t offset; /**< Record offset in the file */
+	uint64_t tsNs; /**< Record time, or sample time */
+	uint32_t port; /**< Port */
+	uint16_t dir; /**< FOHDirection */
+	uint16_t type; /**< FOHCapType */
+	int64_t at; /**< Match position, see above */
+	uint32_t channel; /**< Sample channel */
+	double value; /**< Sample value */
+};
+
+/**
+ *  @brief Capture file opened for queries
+ *
+ *  The file is mapped read-only and searched with one thread per index
+ *  entry at a time. The index is kept in <path>.idx; a missing or stale
+ *  one is rebuilt, and one covering only the start of a growing file is
+ *  extended. If the index can't be written it is kept in memory only.
+ *  Damaged or unfinished records end the indexed range (e.g. a live
+ *  journal).
+ */
+class FOHCapFile {
+public:
+	FOHCapFile();
+	~FOHCapFile();
+
+	/**
+	 *  @brief Open a capture and load or build its index
+	 *
+	 *  @param path Capture file
+	 *  @param blockBytes Index granularity for a new index
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int open(const char* path, size_t blockBytes = FOH_IDX_BLOCK);
+	void close();
+
+	/**
+	 *  @brief Run a query
+	 *
+	 *  @param q Query
+	 *  @param out Hits in file order
+	 *  @param threads Worker threads (0: one per core)
+	 *  @param limit Stop after about this many hits (0: all)
+	 *
+	 *  @return Number of hits, -1 on error
+	 */
+	long query(const FOHCapQuery& q, std::vector<FOHCapMatch>& out, int threads = 0, size_t limit = 0);
+
+	/**
+	 *  @brief Record at a file offset (from a hit)
+	 *
+	 *  @return Record, NULL if the offset is outside the indexed range
+	 */
+	const FOHCapRecord* record(uint64_t offset) const;
+
+	const FOHCapHeader* header() const { return _reader.header(); }
+	const std::vector<FOHCapIndexEntry>& index() const { return _index; }
+
+	uint64_t size() const { return _reader.size(); }
+
+	/**
+	 *  @brief Capture bytes covered by the index
+	 */
+	uint64_t covered() const { return _covered; }
+
+private:
+	int _loadIndex(const std::string& path);
+	void _extendIndex(size_t blockBytes);
+	void _saveIndex(const std::string& path, size_t blockBytes);
+	void _scan(const FOHCapQuery& q, size_t entry, std::vector<FOHCapMatch>& out);
+
+	FOHCapReader _reader; /**< Mapping */
+	std::vector<FOHCapIndexEntry> _index; /**< Entries */
+	uint64_t _covered; /**< Indexed bytes */
+};
+
+#endif
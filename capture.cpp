@@ -0,0 +1,202 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file capture.cpp
+ * @brief Capture file format: raw port data with timestamps.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "capture.h"
+#include "frame.h"
+#include "serial.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ *  @brief Fill in a file header for a file created now
+ */
+void fohCapHeader(FOHCapHeader* h) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, FOH_CAP_MAGIC, 8);
+	h->version = FOH_CAP_VERSION;
+	h->headerSize = sizeof(FOHCapHeader);
+	h->monoNs = fohMonoNs();
+	h->realNs = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *  @brief Check a file header
+ *
+ *	@return 0 when valid, -1 otherwise.
+ */
+int fohCapCheckHeader(const FOHCapHeader* h) {
+	if (memcmp(h->magic, FOH_CAP_MAGIC, 8) != 0 || h->version != FOH_CAP_VERSION)
+		return -1;
+	if (h->headerSize < sizeof(FOHCapHeader) || h->headerSize % FOH_CAP_ALIGN != 0)
+		return -1;
+	return 0;
+}
+
+/**
+ *  @brief Encode a filler record covering exactly size bytes
+ *
+ *  @param dst Destination
+ *  @param size Multiple of FOH_CAP_ALIGN, at least sizeof(FOHCapRecord)
+ */
+void fohCapPad(void* dst, size_t size) {
+	FOHCapRecord* rec = (FOHCapRecord*)dst;
+	memset(dst, 0, size);
+	rec->len = size - sizeof(FOHCapRecord);
+	rec->type = FOH_CAP_PAD;
+	rec->crc = fohCapCrc(rec, rec + 1);
+}
+
+/**
+ *  @brief CRC of a record from its header (crc field ignored) and data
+ */
+uint16_t fohCapCrc(const FOHCapRecord* rec, const void* data) {
+	FOHCapRecord h = *rec;
+	h.crc = 0;
+	uint16_t crc = fohCrc16(&h, sizeof(h));
+	return fohCrc16(data, rec->len, crc);
+}
+
+/**
+ *  @brief Encode a record
+ *
+ *  @param dst At least fohCapRecordSize(len) bytes
+ *
+ *  @return Bytes written
+ */
+size_t fohCapPut(void* dst, uint64_t tsNs, uint32_t port, uint16_t dir, uint16_t type, const void* data, uint32_t len) {
+	FOHCapRecord* rec = (FOHCapRecord*)dst;
+	rec->tsNs = tsNs;
+	rec->port = port;
+	rec->len = len;
+	rec->dir = dir;
+	rec->type = type;
+	rec->crc = 0;
+	rec->reserved = 0;
+
+	size_t size = fohCapRecordSize(len);
+	memcpy(rec + 1, data, len);
+	memset((char*)(rec + 1) + len, 0, size - sizeof(FOHCapRecord) - len);
+
+	rec->crc = fohCapCrc(rec, data);
+	return size;
+}
+
+/**
+ *  @brief Check the CRC of an encoded record
+ *
+ *  @return true if the record is intact
+ */
+bool fohCapValid(const FOHCapRecord* rec) {
+	return fohCapCrc(rec, rec + 1) == rec->crc;
+}
+
+FOHCapReader::FOHCapReader() : _map(NULL), _size(0), _pos(0) {
+}
+
+FOHCapReader::~FOHCapReader() {
+	close();
+}
+
+/**
+ *  @brief Open and map a capture file
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHCapReader::open(const char* path) {
+	close();
+
+	int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (uint64_t)st.st_size < sizeof(FOHCapHeader)) {
+		::close(fd);
+		return -1;
+	}
+
+	void* m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (m == MAP_FAILED)
+		return -1;
+
+	_map = (char*)m;
+	_size = st.st_size;
+	if (fohCapCheckHeader(header()) < 0) {
+		close();
+		return -1;
+	}
+
+	madvise(_map, _size, MADV_SEQUENTIAL);
+	_pos = header()->headerSize;
+	return 0;
+}
+
+void FOHCapReader::close() {
+	if (_map != NULL)
+		munmap(_map, _size);
+	_map = NULL;
+	_size = 0;
+	_pos = 0;
+}
+
+/**
+ *  @brief Next record (filler records are skipped)
+ *
+ *  @param rec Receives the record header
+ *  @param data Receives the record data
+ *
+ *  @return 1 for a record, 0 at the end, -1 for a damaged record
+ */
+int FOHCapReader::next(const FOHCapRecord** rec, const char** data) {
+	if (_map == NULL)
+		return -1;
+
+	for (;;) {
+		if (_pos + sizeof(FOHCapRecord) > _size)
+			return 0;
+
+		const FOHCapRecord* r = (const FOHCapRecord*)(_map + _pos);
+		uint64_t size = fohCapRecordSize(r->len);
+		if (r->len > _size || _pos + size > _size || fohCapValid(r) == false)
+			return -1;
+
+		_pos += size;
+		if (r->type == FOH_CAP_PAD)
+			continue;
+
+		*rec = r;
+		*data = (const char*)(r + 1);
+		return 1;
+	}
+}
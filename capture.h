@@ -0,0 +1,170 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file capture.h
+ * @brief Capture file format: raw port data with timestamps.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_CAPTURE_H
+#define FOH_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FOH_CAP_MAGIC "FOHCAP1\n"
+#define FOH_CAP_VERSION 1
+
+//Records start at multiples of this
+#define FOH_CAP_ALIGN 8
+
+/**
+ *  @brief Record types
+ */
+enum FOHCapType {
+	FOH_CAP_DATA = 0, /**< Port data */
+	FOH_CAP_MARK = 1, /**< Marker (trigger, commit), data is free form */
+	FOH_CAP_SAMPLES = 2, /**< Decoded samples, data is an array of FOHSample */
+	FOH_CAP_PAD = 3 /**< Filler for aligned writes, skipped by readers */
+};
+
+/**
+ *  @brief File header
+ *
+ *  Both clocks are read at creation, so record times (fohMonoNs() clock)
+ *  can be put on the wall clock.
+ */
+struct FOHCapHeader {
+	char magic[8]; /**< FOH_CAP_MAGIC */
+	uint32_t version; /**< FOH_CAP_VERSION */
+	uint32_t headerSize; /**< sizeof(FOHCapHeader), records follow */
+	uint64_t monoNs; /**< fohMonoNs() at creation */
+	uint64_t realNs; /**< CLOCK_REALTIME at creation */
+};
+
+/**
+ *  @brief Record header, followed by len bytes and padding to FOH_CAP_ALIGN
+ */
+struct FOHCapRecord {
+	uint64_t tsNs; /**< Timestamp (fohMonoNs() clock) */
+	uint32_t port; /**< Port number */
+	uint32_t len; /**< Data bytes */
+	uint16_t dir; /**< FOHDirection */
+	uint16_t type; /**< FOHCapType */
+	uint16_t crc; /**< CRC-16 over the header (crc = 0) and the data */
+	uint16_t reserved; /**< 0 */
+};
+
+/**
+ *  @brief Bytes a record with len data bytes takes in a file
+ */
+static inline size_t fohCapRecordSize(size_t len) {
+	return (sizeof(FOHCapRecord) + len + FOH_CAP_ALIGN - 1) & ~(size_t)(FOH_CAP_ALIGN - 1);
+}
+
+/**
+ *  @brief Fill in a file header for a file created now
+ */
+void fohCapHeader(FOHCapHeader* h);
+
+/**
+ *  @brief Check a file header
+ *
+ *	@return 0 when valid, -1 otherwise.
+ */
+int fohCapCheckHeader(const FOHCapHeader* h);
+
+/**
+ *  @brief Encode a record
+ *
+ *  @param dst At least fohCapRecordSize(len) bytes
+ *
+ *  @return Bytes written
+ */
+size_t fohCapPut(void* dst, uint64_t tsNs, uint32_t port, uint16_t dir, uint16_t type, const void* data, uint32_t len);
+
+/**
+ *  @brief Encode a filler record covering exactly size bytes
+ *
+ *  @param dst Destination
+ *  @param size Multiple of FOH_CAP_ALIGN, at least sizeof(FOHCapRecord)
+ */
+void fohCapPad(void* dst, size_t size);
+
+/**
+ *  @brief CRC of a record from its header (crc field ignored) and data
+ */
+uint16_t fohCapCrc(const FOHCapRecord* rec, const void* data);
+
+/**
+ *  @brief Check the CRC of an encoded record
+ *
+ *  @return true if the record is intact
+ */
+bool fohCapValid(const FOHCapRecord* rec);
+
+/**
+ *  @brief Sequential reader over a memory mapped capture file
+ */
+class FOHCapReader {
+public:
+	FOHCapReader();
+	~FOHCapReader();
+
+	/**
+	 *  @brief Open and map a capture file
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int open(const char* path);
+	void close();
+
+	/**
+	 *  @brief Next record (filler records are skipped)
+	 *
+	 *  @param rec Receives the record header
+	 *  @param data Receives the record data
+	 *
+	 *  @return 1 for a record, 0 at the end, -1 for a damaged record
+	 */
+	int next(const FOHCapRecord** rec, const char** data);
+
+	/**
+	 *  @brief Continue at a file offset (of a record)
+	 */
+	void seek(uint64_t offset) { _pos = offset; }
+
+	/**
+	 *  @brief File offset of the next record
+	 */
+	uint64_t offset() const { return _pos; }
+
+	const FOHCapHeader* header() const { return (const FOHCapHeader*)_map; }
+	const char* map() const { return _map; }
+	uint64_t size() const { return _size; }
+
+private:
+	char* _map; /**< File contents */
+	uint64_t _size; /**< File size */
+	uint64_t _pos; /**< Next record */
+};
+
+#endif
@@ -0,0 +1,309 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file clocksync.cpp
+ * @brief Device clock to host clock mapping for timestamped streams.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "clocksync.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+//Residual below which a bucket is never called an outlier
+#define FOH_SYNC_MIN_OUTLIER_NS 1000.0
+
+/**
+ *  @param unitNs Length of one device clock tick in ns
+ *  @param wrap Device counter modulus (0: does not wrap)
+ *  @param bucketNs Host time covered by one bucket
+ *  @param buckets Number of buckets in the window
+ */
+FOHClockSync::FOHClockSync(double unitNs, double wrap, uint64_t bucketNs, int buckets)
+	: _unitNs(unitNs > 0 ? unitNs : 1.0), _wrap(wrap > 0 ? wrap : 0), _bucketNs(bucketNs ? bucketNs : 1),
+	  _buckets(buckets >= 2 ? buckets : 2) {
+	memset(&_st, 0, sizeof(_st));
+	reset();
+}
+
+/**
+ *  @brief Forget the model
+ */
+void FOHClockSync::reset() {
+	_head = 0;
+	_count = 0;
+	_anchored = false;
+	_haveBest = false;
+	_a = 0;
+	_b = 1;
+	_st.locked = false;
+	_st.skewPpm = 0;
+	_st.residualNs = 0;
+	_st.outliers = 0;
+}
+
+/**
+ *  @brief Feed a timestamp pair
+ *
+ *  @param device Device timestamp (ticks)
+ *  @param hostNs Host receive time
+ *
+ *  @return Host time for the device timestamp
+ */
+uint64_t FOHClockSync::observe(double device, uint64_t hostNs) {
+	_st.observations++;
+
+	if (_anchored) {
+		double d = device - _lastRaw;
+		if (_wrap > 0) {
+			if (d < -_wrap / 2)
+				d += _wrap;
+			else if (d > _wrap / 2)
+				d -= _wrap;
+		}
+		//Device clocks don't run backwards: the device restarted
+		if (d < 0) {
+			_st.resets++;
+			reset();
+		} else {
+			_unwrapped += d;
+			_lastRaw = device;
+		}
+	}
+
+	if (_anchored == false) {
+		_anchored = true;
+		_lastRaw = device;
+		_unwrapped = device;
+		_devAnchor = device * _unitNs;
+		_hostAnchor = hostNs;
+		_bucketEnd = hostNs + _bucketNs;
+	}
+
+	_point p = { _unwrapped * _unitNs - _devAnchor, (double)(int64_t)(hostNs - _hostAnchor) };
+
+	if (hostNs >= _bucketEnd) {
+		if (_haveBest) {
+			_buckets[_head] = _best;
+			_head = (_head + 1) % _buckets.size();
+			_count = std::min(_count + 1, _buckets.size());
+			_fit();
+		}
+		_haveBest = false;
+		_bucketEnd = hostNs - (hostNs - _bucketEnd) % _bucketNs + _bucketNs;
+	}
+
+	//Earliest pair of the bucket: smallest delay under the current rate
+	if (_haveBest == false || p.y - _b * p.x < _best.y - _b * _best.x) {
+		_best = p;
+		_haveBest = true;
+	}
+
+	//Until there is a fit, follow the earliest pair at nominal rate
+	if (_st.locked == false)
+		_a = std::min(_a, p.y - p.x);
+
+	return _hostAnchor + (int64_t)llround(_a + _b * p.x);
+}
+
+/**
+ *  @brief Host time of a device timestamp without feeding it
+ *
+ *  @param device Device timestamp (ticks), close to the last observed one
+ */
+uint64_t FOHClockSync::toHost(double device) const {
+	if (_anchored == false)
+		return 0;
+
+	double d = device - _lastRaw;
+	if (_wrap > 0) {
+		if (d < -_wrap / 2)
+			d += _wrap;
+		else if (d > _wrap / 2)
+			d -= _wrap;
+	}
+	double x = (_unwrapped + d) * _unitNs - _devAnchor;
+	return _hostAnchor + (int64_t)llround(_a + _b * x);
+}
+
+FOHClockSyncStats FOHClockSync::stats() const {
+	return _st;
+}
+
+/**
+ *  @brief Fit the line through the bucket minima
+ *
+ *  Least squares, then once more without the buckets lying far above the
+ *  line (delayed as a whole). Only late outliers exist, so the threshold
+ *  only applies upwards.
+ */
+void FOHClockSync::_fit() {
+	if (_count < 2)
+		return;
+
+	std::vector<char> use(_count, 1);
+	double a = _a, b = _b;
+	size_t dropped = 0;
+
+	for (int pass = 0; pass < 2; pass++) {
+		double n = 0, sx = 0, sy = 0;
+		for (size_t i = 0; i < _count; i++) {
+			if (use[i] == 0)
+				continue;
+			n++;
+			sx += _buckets[i].x;
+			sy += _buckets[i].y;
+		}
+		double mx = sx / n, my = sy / n, sxx = 0, sxy = 0;
+		for (size_t i = 0; i < _count; i++) {
+			if (use[i] == 0)
+				continue;
+			sxx += (_buckets[i].x - mx) * (_buckets[i].x - mx);
+			sxy += (_buckets[i].x - mx) * (_buckets[i].y - my);
+		}
+		if (sxx <= 0)
+			return;
+		b = sxy / sxx;
+		a = my - b * mx;
+
+		if (pass == 1 || _count < 4)
+			break;
+
+		std::vector<double> r(_count);
+		for (size_t i = 0; i < _count; i++)
+			r[i] = fabs(_buckets[i].y - (a + b * _buckets[i].x));
+		std::vector<double> sorted(r);
+		std::nth_element(sorted.begin(), sorted.begin() + _count / 2, sorted.end());
+		double limit = std::max(3 * 1.4826 * sorted[_count / 2], FOH_SYNC_MIN_OUTLIER_NS);
+
+		for (size_t i = 0; i < _count; i++) {
+			if (_buckets[i].y - (a + b * _buckets[i].x) > limit) {
+				use[i] = 0;
+				dropped++;
+			}
+		}
+		if (dropped == 0 || _count - dropped < 2)
+			break;
+	}
+
+	double sq = 0, n = 0;
+	for (size_t i = 0; i < _count; i++) {
+		if (use[i] == 0)
+			continue;
+		double r = _buckets[i].y - (a + b * _buckets[i].x);
+		sq += r * r;
+		n++;
+	}
+
+	_a = a;
+	_b = b;
+	_st.fits++;
+	_st.outliers = dropped;
+	_st.skewPpm = (b - 1) * 1e6;
+	_st.residualNs = sqrt(sq / n);
+	_st.locked = true;
+}
+
+/**
+ *  @param out Next stage
+ */
+FOHClockSyncSink::FOHClockSyncSink(FOHSink* out) : _out(out) {
+}
+
+FOHClockSyncSink::~FOHClockSyncSink() {
+	for (size_t i = 0; i < _clocks.size(); i++)
+		delete _clocks[i];
+}
+
+/**
+ *  @brief Set up the clock of a port (before data flows)
+ *
+ *  @param port Port number
+ *  @param channel Channel holding the device timestamp
+ *  @param unitNs Length of one device clock tick in ns
+ *  @param wrap Device counter modulus (0: does not wrap)
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHClockSyncSink::addPort(int port, int channel, double unitNs, double wrap) {
+	if (port < 0 || channel < 0)
+		return -1;
+
+	if ((size_t)port >= _clocks.size())
+		_clocks.resize(port + 1, NULL);
+	delete _clocks[port];
+	_clocks[port] = new _clock{ FOHClockSync(unitNs, wrap), channel };
+	return 0;
+}
+
+/**
+ *  @brief Clock of a port, NULL if it has none
+ */
+FOHClockSync* FOHClockSyncSink::clock(int port) {
+	if (port < 0 || (size_t)port >= _clocks.size() || _clocks[port] == NULL)
+		return NULL;
+	return &_clocks[port]->sync;
+}
+
+int FOHClockSyncSink::push(int port, int dir, uint64_t tsNs, const void* data, size_t len) {
+	return _out->push(port, dir, tsNs, data, len);
+}
+
+/**
+ *  @brief Restamp samples with device time and pass them on
+ *
+ *  A line is a run of samples of one port with the same host time and
+ *  rising channel numbers.
+ */
+int FOHClockSyncSink::pushSamples(const FOHSample* s, size_t n) {
+	thread_local std::vector<FOHSample> buf;
+	buf.assign(s, s + n);
+
+	size_t i = 0;
+	while (i < n) {
+		size_t end = i + 1;
+		while (end < n && buf[end].port == buf[i].port && buf[end].hostNs == buf[i].hostNs
+				&& buf[end].channel > buf[end - 1].channel)
+			end++;
+
+		FOHClockSync* c = clock(buf[i].port);
+		if (c != NULL) {
+			int channel = _clocks[buf[i].port]->channel;
+			for (size_t k = i; k < end; k++) {
+				if (buf[k].channel != (uint32_t)channel)
+					continue;
+				uint64_t ts = c->observe(buf[k].value, buf[k].hostNs);
+				for (size_t j = i; j < end; j++)
+					buf[j].hostNs = ts;
+				break;
+			}
+		}
+		i = end;
+	}
+
+	return _out->pushSamples(buf.data(), n);
+}
+
+int FOHClockSyncSink::flush(int timeoutMs) {
+	return _out->flush(timeoutMs);
+}
@@ -0,0 +1,174 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file clocksync.h
+ * @brief Device clock to host clock mapping for timestamped streams.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_CLOCKSYNC_H
+#define FOH_CLOCKSYNC_H
+
+#include "sink.h"
+
+#include <vector>
+
+//Default number of buckets the fit runs over
+#define FOH_SYNC_BUCKETS 32
+
+/**
+ *  @brief State of a clock fit (snapshot)
+ */
+struct FOHClockSyncStats {
+	uint64_t observations; /**< Timestamp pairs seen */
+	uint64_t fits; /**< Model updates */
+	uint64_t resets; /**< Restarts after the device clock jumped back */
+	uint64_t outliers; /**< Buckets left out of the last fit */
+	double skewPpm; /**< Device clock rate error against the host */
+	double residualNs; /**< RMS deviation of the fitted buckets */
+	bool locked; /**< A fit is available */
+};
+
+/**
+ *  @brief Maps device timestamps to host time
+ *
+ *  Fits host = offset + (1 + skew) * device over a sliding window.
+ *  Host receive times are late by a varying amount (USB frames, latency
+ *  timers, scheduling) but never early, so only the earliest pair of each
+ *  host time bucket enters the fit; buckets still lying clearly above the
+ *  fit afterwards (a whole bucket delayed) are dropped and the line is
+ *  fitted again. The fit runs once per bucket; mapping a timestamp is a
+ *  multiply-add.
+ *
+ *  The mapped time includes the shortest transport delay seen, which a
+ *  fit against receive times cannot tell from an offset.
+ */
+class FOHClockSync {
+public:
+	/**
+	 *  @param unitNs Length of one device clock tick in ns
+	 *  @param wrap Device counter modulus (0: does not wrap)
+	 *  @param bucketNs Host time covered by one bucket
+	 *  @param buckets Number of buckets in the window
+	 */
+	FOHClockSync(double unitNs = 1.0, double wrap = 0, uint64_t bucketNs = 100000000ULL, int buckets = FOH_SYNC_BUCKETS);
+
+	/**
+	 *  @brief Feed a timestamp pair
+	 *
+	 *  @param device Device timestamp (ticks)
+	 *  @param hostNs Host receive time
+	 *
+	 *  @return Host time for the device timestamp
+	 */
+	uint64_t observe(double device, uint64_t hostNs);
+
+	/**
+	 *  @brief Host time of a device timestamp without feeding it
+	 *
+	 *  @param device Device timestamp (ticks), close to the last observed one
+	 */
+	uint64_t toHost(double device) const;
+
+	/**
+	 *  @brief Forget the model
+	 */
+	void reset();
+
+	FOHClockSyncStats stats() const;
+
+private:
+	struct _point {
+		double x; /**< Device time in ns since the anchor */
+		double y; /**< Host time in ns since the anchor */
+	};
+
+	void _fit();
+
+	double _unitNs; /**< Tick length */
+	double _wrap; /**< Counter modulus */
+	uint64_t _bucketNs; /**< Bucket length */
+	std::vector<_point> _buckets; /**< Earliest pair of each closed bucket (ring) */
+	size_t _head; /**< Next ring slot */
+	size_t _count; /**< Closed buckets in the ring */
+
+	bool _anchored; /**< Anchors are set */
+	double _lastRaw; /**< Last raw device timestamp */
+	double _unwrapped; /**< Last device time in ticks, unwrapped */
+	uint64_t _hostAnchor; /**< Host time of the first pair */
+	double _devAnchor; /**< Device ns of the first pair */
+
+	uint64_t _bucketEnd; /**< Host time the open bucket closes at */
+	_point _best; /**< Earliest pair of the open bucket */
+	bool _haveBest; /**< Open bucket has a pair */
+
+	double _a; /**< Fitted offset (ns) */
+	double _b; /**< Fitted rate */
+	FOHClockSyncStats _st; /**< Counters */
+};
+
+/**
+ *  @brief Sink stage putting device time onto samples
+ *
+ *  Takes the device timestamp from one channel of each line and replaces
+ *  the host time of all samples of that line by the mapped device time
+ *  before passing them on. Ports without a clock pass through unchanged.
+ */
+class FOHClockSyncSink : public FOHSink {
+public:
+	/**
+	 *  @param out Next stage
+	 */
+	FOHClockSyncSink(FOHSink* out);
+	~FOHClockSyncSink();
+
+	/**
+	 *  @brief Set up the clock of a port (before data flows)
+	 *
+	 *  @param port Port number
+	 *  @param channel Channel holding the device timestamp
+	 *  @param unitNs Length of one device clock tick in ns
+	 *  @param wrap Device counter modulus (0: does not wrap)
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int addPort(int port, int channel, double unitNs = 1.0, double wrap = 0);
+
+	/**
+	 *  @brief Clock of a port, NULL if it has none
+	 */
+	FOHClockSync* clock(int port);
+
+	int push(int port, int dir, uint64_t tsNs, const void* data, size_t len) override;
+	int pushSamples(const FOHSample* s, size_t n) override;
+	int flush(int timeoutMs) override;
+
+private:
+	struct _clock {
+		FOHClockSync sync; /**< Fit */
+		int channel; /**< Timestamp channel */
+	};
+
+	FOHSink* _out; /**< Next stage */
+	std::vector<_clock*> _clocks; /**< By port number */
+};
+
+#endif
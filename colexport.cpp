@@ -0,0 +1,522 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file colexport.cpp
+ * @brief Columnar export of decoded measurement streams.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "colexport.h"
+#include "frame.h"
+#include "gorilla.h"
+#include "serial.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static inline uint64_t _zigzag(int64_t v) {
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t _unzigzag(uint64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static void _putVarint(std::vector<char>& o, uint64_t v) {
+	while (v >= 0x80) {
+		o.push_back((char)(v | 0x80));
+		v >>= 7;
+	}
+	o.push_back((char)v);
+}
+
+static bool _getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+	v = 0;
+	for (int shift = 0; shift < 64 && p < end; shift += 7) {
+		uint8_t b = *p++;
+		v |= (uint64_t)(b & 0x7F) << shift;
+		if ((b & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+/**
+ *  @brief XOR encoding: per value a control byte (trailing zero bytes << 4
+ *  | significant bytes) and the significant bytes of value ^ previous
+ */
+static void _putXor(std::vector<char>& o, const double* v, size_t n) {
+	uint64_t prev = 0;
+	for (size_t i = 0; i < n; i++) {
+		uint64_t bits;
+		memcpy(&bits, &v[i], 8);
+		uint64_t x = bits ^ prev;
+		prev = bits;
+		if (x == 0) {
+			o.push_back(0);
+			continue;
+		}
+		int tz = __builtin_ctzll(x) / 8;
+		int lz = __builtin_clzll(x) / 8;
+		int len = 8 - tz - lz;
+		o.push_back((char)(tz << 4 | len));
+		x >>= tz * 8;
+		for (int k = 0; k < len; k++, x >>= 8)
+			o.push_back((char)x);
+	}
+}
+
+static bool _getXor(const uint8_t* p, const uint8_t* end, double* v, size_t n) {
+	uint64_t prev = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (p >= end)
+			return false;
+		int tz = *p >> 4, len = *p & 0x0F;
+		p++;
+		if (tz + len > 8 || p + len > end)
+			return false;
+		uint64_t x = 0;
+		for (int k = 0; k < len; k++)
+			x |= (uint64_t)p[k] << (8 * k);
+		p += len;
+		prev ^= x << (tz * 8);
+		memcpy(&v[i], &prev, 8);
+	}
+	return true;
+}
+
+/**
+ *  @param path Output file
+ *  @param chunkRows Samples per chunk
+ *  @param flushMs Longest time a sample waits in memory
+ *  @param maxBacklog Bytes of encoded chunks that may wait for the writer
+ */
+FOHColumnSink::FOHColumnSink(const char* path, int chunkRows, int flushMs, size_t maxBacklog)
+	: _chunkRows(chunkRows > 0 ? chunkRows : 4096), _flushNs((uint64_t)(flushMs > 0 ? flushMs : 1) * 1000000ULL),
+	  _maxBacklog(maxBacklog), _tsEnc(FOH_COL_TS_DOD), _valEnc(FOH_COL_VAL_GORILLA), _queued(0), _writing(false), _stop(false), _offset(0), _errorsSeen(0) {
+	memset(&_st, 0, sizeof(_st));
+
+	_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	_isValid = _fd >= 0;
+	if (_isValid) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		FOHColHeader h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, FOH_COL_MAGIC, 8);
+		h.version = FOH_COL_VERSION;
+		h.headerSize = sizeof(h);
+		h.monoNs = fohMonoNs();
+		h.realNs = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		_isValid = write(_fd, &h, sizeof(h)) == sizeof(h);
+		_offset = sizeof(h);
+	}
+
+	_thread = std::thread(&FOHColumnSink::_run, this);
+}
+
+FOHColumnSink::~FOHColumnSink() {
+	close();
+}
+
+/**
+ *  @brief Choose the encodings of chunks written from now on
+ *
+ *  Default is delta-of-delta and Gorilla, the byte aligned encodings
+ *  are faster to decode but larger.
+ */
+void FOHColumnSink::setEncoding(FOHColTsEnc ts, FOHColValEnc val) {
+	std::lock_guard<std::mutex> l(_lock);
+	_tsEnc = ts;
+	_valEnc = val;
+}
+
+int FOHColumnSink::pushSamples(const FOHSample* s, size_t n) {
+	if (_isValid == false)
+		return -1;
+
+	uint64_t now = fohMonoNs();
+	bool queued = false;
+	std::lock_guard<std::mutex> l(_lock);
+	for (size_t i = 0; i < n; i++) {
+		_column& c = _columns[(uint64_t)s[i].port << 32 | s[i].channel];
+		if (c.ts.empty())
+			c.since = now;
+		c.ts.push_back(s[i].hostNs);
+		c.v.push_back(s[i].value);
+		if (c.ts.size() >= _chunkRows) {
+			_encode(s[i].port, s[i].channel, c);
+			queued = true;
+		}
+	}
+	_st.samples += n;
+
+	if (queued)
+		_work.notify_one();
+	return 0;
+}
+
+/**
+ *  @brief Encode all collected samples and write them out
+ *
+ *  A chunk that couldn't be written since the previous call makes it
+ *  fail, its samples are counted in droppedSamples.
+ *
+ *	@return 0 when everything is out, 1 on timeout, -1 on error.
+ */
+int FOHColumnSink::flush(int timeoutMs) {
+	if (_isValid == false)
+		return -1;
+
+	std::unique_lock<std::mutex> l(_lock);
+	_encodeOld(true);
+	_work.notify_one();
+	bool done = _idle.wait_for(l, std::chrono::milliseconds(timeoutMs), [this] {
+		return _queue.empty() && _writing == false;
+	});
+	//Report chunks lost since the last flush() once
+	if (_st.writeErrors != _errorsSeen) {
+		_errorsSeen = _st.writeErrors;
+		return -1;
+	}
+	return done ? 0 : 1;
+}
+
+/**
+ *  @brief Flush and write the chunk directory
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHColumnSink::close() {
+	if (_thread.joinable() == false)
+		return _fd >= 0 ? 0 : -1;
+
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		_encodeOld(true);
+		_stop = true;
+	}
+	_work.notify_one();
+	_thread.join();
+
+	if (_fd < 0)
+		return -1;
+
+	FOHColTrailer t;
+	t.indexOffset = _offset;
+	t.count = _index.size();
+	memcpy(t.magic, FOH_COL_INDEX_MAGIC, 8);
+
+	size_t len = _index.size() * sizeof(FOHColIndex);
+	bool ok = write(_fd, _index.data(), len) == (ssize_t)len && write(_fd, &t, sizeof(t)) == sizeof(t);
+	if (::close(_fd) < 0)
+		ok = false;
+	_fd = -1;
+	_isValid = false;
+	return ok ? 0 : -1;
+}
+
+FOHColStats FOHColumnSink::stats() {
+	std::lock_guard<std::mutex> l(_lock);
+	return _st;
+}
+
+/**
+ *  @brief Turn a column into a chunk and queue it (lock held)
+ */
+void FOHColumnSink::_encode(uint32_t port, uint32_t channel, _column& c) {
+	size_t n = c.ts.size();
+	if (n == 0)
+		return;
+
+	FOHColChunk h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "CHNK", 4);
+	h.port = port;
+	h.channel = channel;
+	h.count = n;
+	h.minNs = UINT64_MAX;
+	h.minValue = c.v[0];
+	h.maxValue = c.v[0];
+	for (size_t i = 0; i < n; i++) {
+		if (c.ts[i] < h.minNs)
+			h.minNs = c.ts[i];
+		if (c.ts[i] > h.maxNs)
+			h.maxNs = c.ts[i];
+		if (c.v[i] < h.minValue)
+			h.minValue = c.v[i];
+		if (c.v[i] > h.maxValue)
+			h.maxValue = c.v[i];
+	}
+	h.tsEnc = _tsEnc;
+	h.valEnc = _valEnc;
+
+	std::vector<char> o(sizeof(h));
+	o.reserve(sizeof(h) + n * 4);
+	if (_tsEnc == FOH_COL_TS_DOD) {
+		fohDodEncode(c.ts.data(), n, o);
+	} else {
+		uint64_t prev = h.minNs;
+		for (size_t i = 0; i < n; i++) {
+			_putVarint(o, _zigzag((int64_t)(c.ts[i] - prev)));
+			prev = c.ts[i];
+		}
+	}
+	h.tsBytes = o.size() - sizeof(h);
+	if (_valEnc == FOH_COL_VAL_GORILLA)
+		fohGorillaEncode(c.v.data(), n, o);
+	else
+		_putXor(o, c.v.data(), n);
+	h.valBytes = o.size() - sizeof(h) - h.tsBytes;
+	h.crc = fohCrc16(o.data() + sizeof(h), o.size() - sizeof(h));
+	o.resize((o.size() + 7) & ~(size_t)7, 0);
+	memcpy(o.data(), &h, sizeof(h));
+
+	c.ts.clear();
+	c.v.clear();
+
+	if (_queued + o.size() > _maxBacklog) {
+		_st.droppedSamples += n;
+		return;
+	}
+	_st.rawBytes += n * sizeof(FOHSample);
+	_queued += o.size();
+	_queue.push_back(std::move(o));
+}
+
+/**
+ *  @brief Encode the columns that waited too long (lock held)
+ *
+ *  @param all Encode every non-empty column
+ */
+void FOHColumnSink::_encodeOld(bool all) {
+	uint64_t now = fohMonoNs();
+	for (auto it = _columns.begin(); it != _columns.end(); ++it) {
+		_column& c = it->second;
+		if (c.ts.empty() == false && (all || now - c.since >= _flushNs))
+			_encode(it->first >> 32, (uint32_t)it->first, c);
+	}
+}
+
+void FOHColumnSink::_run() {
+	std::unique_lock<std::mutex> l(_lock);
+	uint64_t tick = _flushNs / 4 < 100000000ULL ? _flushNs / 4 : 100000000ULL;
+	for (;;) {
+		if (_queue.empty() && _stop == false)
+			_work.wait_for(l, std::chrono::nanoseconds(tick));
+		_encodeOld(false);
+
+		if (_queue.empty()) {
+			_idle.notify_all();
+			if (_stop)
+				break;
+			continue;
+		}
+
+		std::vector<char> o = std::move(_queue.front());
+		_queue.pop_front();
+		_writing = true;
+		l.unlock();
+
+		const FOHColChunk* h = (const FOHColChunk*)o.data();
+		size_t done = 0;
+		while (_fd >= 0 && done < o.size()) {
+			ssize_t n = write(_fd, o.data() + done, o.size() - done);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			done += n;
+		}
+
+		FOHColIndex e;
+		memset(&e, 0, sizeof(e));
+		e.offset = _offset;
+		e.port = h->port;
+		e.channel = h->channel;
+		e.count = h->count;
+		e.minNs = h->minNs;
+		e.maxNs = h->maxNs;
+		e.minValue = h->minValue;
+		e.maxValue = h->maxValue;
+		_offset += done;
+
+		l.lock();
+		_queued -= o.size();
+		_writing = false;
+		_st.bytesWritten += done;
+		if (done == o.size()) {
+			_index.push_back(e);
+			_st.chunks++;
+		} else {
+			_st.droppedSamples += e.count;
+			_st.writeErrors++;
+		}
+	}
+}
+
+FOHColumnReader::FOHColumnReader() : _map(NULL), _size(0) {
+}
+
+FOHColumnReader::~FOHColumnReader() {
+	close();
+}
+
+/**
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHColumnReader::open(const char* path) {
+	close();
+
+	int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (uint64_t)st.st_size < sizeof(FOHColHeader)) {
+		::close(fd);
+		return -1;
+	}
+	void* m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (m == MAP_FAILED)
+		return -1;
+	_map = (char*)m;
+	_size = st.st_size;
+
+	const FOHColHeader* h = header();
+	if (memcmp(h->magic, FOH_COL_MAGIC, 8) != 0 || h->version != FOH_COL_VERSION) {
+		close();
+		return -1;
+	}
+
+	//Closed file: directory at the end
+	if (_size >= h->headerSize + sizeof(FOHColTrailer)) {
+		const FOHColTrailer* t = (const FOHColTrailer*)(_map + _size - sizeof(FOHColTrailer));
+		uint64_t room = _size - sizeof(FOHColTrailer);
+		if (memcmp(t->magic, FOH_COL_INDEX_MAGIC, 8) == 0 && t->indexOffset <= room
+				&& t->count <= (room - t->indexOffset) / sizeof(FOHColIndex)
+				&& t->indexOffset + t->count * sizeof(FOHColIndex) == room) {
+			const FOHColIndex* e = (const FOHColIndex*)(_map + t->indexOffset);
+			_chunks.assign(e, e + t->count);
+			return 0;
+		}
+	}
+
+	//File being written: walk the chunk headers
+	uint64_t pos = h->headerSize;
+	while (pos <= _size && _size - pos >= sizeof(FOHColChunk)) {
+		const FOHColChunk* c = (const FOHColChunk*)(_map + pos);
+		uint64_t len = (sizeof(FOHColChunk) + (uint64_t)c->tsBytes + c->valBytes + 7) & ~(uint64_t)7;
+		if (memcmp(c->magic, "CHNK", 4) != 0 || len > _size - pos)
+			break;
+
+		FOHColIndex e;
+		memset(&e, 0, sizeof(e));
+		e.offset = pos;
+		e.port = c->port;
+		e.channel = c->channel;
+		e.count = c->count;
+		e.minNs = c->minNs;
+		e.maxNs = c->maxNs;
+		e.minValue = c->minValue;
+		e.maxValue = c->maxValue;
+		_chunks.push_back(e);
+		pos += len;
+	}
+	return 0;
+}
+
+void FOHColumnReader::close() {
+	if (_map != NULL)
+		munmap(_map, _size);
+	_map = NULL;
+	_size = 0;
+	_chunks.clear();
+}
+
+/**
+ *  @brief Samples of one channel within a time range
+ *
+ *  Only chunks overlapping the range are decoded.
+ *
+ *  @return Number of samples appended, -1 for a damaged chunk
+ */
+long FOHColumnReader::read(int port, int channel, uint64_t fromNs, uint64_t toNs, std::vector<FOHSample>& out) {
+	if (_map == NULL)
+		return -1;
+
+	long added = 0;
+	std::vector<uint64_t> ts;
+	std::vector<double> v;
+	for (size_t i = 0; i < _chunks.size(); i++) {
+		const FOHColIndex& e = _chunks[i];
+		if (e.port != (uint32_t)port || e.channel != (uint32_t)channel || e.maxNs < fromNs || e.minNs > toNs)
+			continue;
+
+		//The directory comes from the file, check it before touching the chunk
+		if (e.offset > _size || _size - e.offset < sizeof(FOHColChunk))
+			return -1;
+		const FOHColChunk* c = (const FOHColChunk*)(_map + e.offset);
+		const uint8_t* p = (const uint8_t*)(c + 1);
+		if ((uint64_t)c->tsBytes + c->valBytes > _size - e.offset - sizeof(*c)
+				|| fohCrc16(p, c->tsBytes + c->valBytes) != c->crc)
+			return -1;
+
+		ts.resize(c->count);
+		v.resize(c->count);
+		if (c->tsEnc == FOH_COL_TS_DOD) {
+			if (fohDodDecode(p, c->tsBytes, ts.data(), c->count) == false)
+				return -1;
+		} else if (c->tsEnc == FOH_COL_TS_DELTA) {
+			const uint8_t* tp = p;
+			uint64_t prev = c->minNs;
+			for (uint32_t k = 0; k < c->count; k++) {
+				uint64_t d;
+				if (_getVarint(tp, p + c->tsBytes, d) == false)
+					return -1;
+				prev += _unzigzag(d);
+				ts[k] = prev;
+			}
+		} else {
+			return -1;
+		}
+
+		const uint8_t* vp = p + c->tsBytes;
+		if (c->valEnc == FOH_COL_VAL_GORILLA) {
+			if (fohGorillaDecode(vp, c->valBytes, v.data(), c->count) == false)
+				return -1;
+		} else if (c->valEnc != FOH_COL_VAL_XOR || _getXor(vp, vp + c->valBytes, v.data(), c->count) == false) {
+			return -1;
+		}
+
+		for (uint32_t k = 0; k < c->count; k++) {
+			if (ts[k] < fromNs || ts[k] > toNs)
+				continue;
+			FOHSample s = { ts[k], (uint32_t)port, (uint32_t)channel, v[k] };
+			out.push_back(s);
+			added++;
+		}
+	}
+	return added;
+}
@@ -0,0 +1,249 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file colexport.h
+ * @brief Columnar export of decoded measurement streams.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_COLEXPORT_H
+#define FOH_COLEXPORT_H
+
+#include "sink.h"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define FOH_COL_MAGIC "FOHCOL1\n"
+#define FOH_COL_INDEX_MAGIC "FOHCOLIX"
+#define FOH_COL_VERSION 1
+
+/**
+ *  @brief Timestamp column encodings
+ */
+enum FOHColTsEnc {
+	FOH_COL_TS_DELTA = 0, /**< Zigzag varint of the difference to the previous time */
+	FOH_COL_TS_DOD = 1 /**< Delta-of-delta bit packing (fohDodEncode) */
+};
+
+/**
+ *  @brief Value column encodings
+ */
+enum FOHColValEnc {
+	FOH_COL_VAL_XOR = 0, /**< XOR with the previous value, zero bytes stripped */
+	FOH_COL_VAL_GORILLA = 1 /**< Gorilla XOR bit packing (fohGorillaEncode) */
+};
+
+/**
+ *  @brief File header
+ */
+struct FOHColHeader {
+	char magic[8]; /**< FOH_COL_MAGIC */
+	uint32_t version; /**< FOH_COL_VERSION */
+	uint32_t headerSize; /**< sizeof(FOHColHeader), chunks follow */
+	uint64_t monoNs; /**< fohMonoNs() at creation */
+	uint64_t realNs; /**< CLOCK_REALTIME at creation */
+};
+
+/**
+ *  @brief Column chunk header: samples of one channel, then the time
+ *  column (tsBytes) and the value column (valBytes), padded to 8 bytes
+ */
+struct FOHColChunk {
+	char magic[4]; /**< "CHNK" */
+	uint32_t port; /**< Port */
+	uint32_t channel; /**< Channel */
+	uint32_t count; /**< Samples */
+	uint64_t minNs; /**< Earliest sample time */
+	uint64_t maxNs; /**< Latest sample time */
+	double minValue; /**< Smallest value */
+	double maxValue; /**< Largest value */
+	uint32_t tsBytes; /**< Encoded time column size */
+	uint32_t valBytes; /**< Encoded value column size */
+	uint16_t tsEnc; /**< FOHColTsEnc */
+	uint16_t valEnc; /**< FOHColValEnc */
+	uint16_t crc; /**< CRC-16 of both columns */
+	uint16_t reserved; /**< 0 */
+};
+
+/**
+ *  @brief Chunk directory entry, written at the end of a closed file
+ */
+struct FOHColIndex {
+	uint64_t offset; /**< Chunk header offset */
+	uint32_t port; /**< Port */
+	uint32_t channel; /**< Channel */
+	uint32_t count; /**< Samples */
+	uint32_t reserved; /**< 0 */
+	uint64_t minNs; /**< Earliest sample time */
+	uint64_t maxNs; /**< Latest sample time */
+	double minValue; /**< Smallest value */
+	double maxValue; /**< Largest value */
+};
+
+/**
+ *  @brief Last bytes of a closed file
+ */
+struct FOHColTrailer {
+	uint64_t indexOffset; /**< First FOHColIndex */
+	uint64_t count; /**< Number of entries */
+	char magic[8]; /**< FOH_COL_INDEX_MAGIC */
+};
+
+/**
+ *  @brief Column export counters (snapshot)
+ */
+struct FOHColStats {
+	uint64_t samples; /**< Samples accepted */
+	uint64_t chunks; /**< Chunks written */
+	uint64_t rawBytes; /**< Size of the written samples as FOHSample */
+	uint64_t bytesWritten; /**< File bytes written */
+	uint64_t droppedSamples; /**< Samples lost to a full backlog or write errors */
+	uint64_t writeErrors; /**< Chunks that couldn't be written */
+};
+
+/**
+ *  @brief Sink writing decoded samples as compressed column chunks
+ *
+ *  Samples are collected per port and channel. A column is encoded into
+ *  a chunk when it has chunkRows samples or its oldest sample is older
+ *  than flushMs, so the file grows while acquisition runs and a reader
+ *  can follow it. Every chunk carries time and value ranges; closing the
+ *  file appends a directory of them, so readers seek straight to the
+ *  channels and times they need. File writes are done by a thread.
+ */
+class FOHColumnSink : public FOHSink {
+public:
+	/**
+	 *  @param path Output file
+	 *  @param chunkRows Samples per chunk
+	 *  @param flushMs Longest time a sample waits in memory
+	 *  @param maxBacklog Bytes of encoded chunks that may wait for the writer
+	 */
+	FOHColumnSink(const char* path, int chunkRows = 4096, int flushMs = 1000, size_t maxBacklog = 64 << 20);
+	~FOHColumnSink();
+
+	/**
+	 *  @brief Choose the encodings of chunks written from now on
+	 *
+	 *  Default is delta-of-delta and Gorilla, the byte aligned encodings
+	 *  are faster to decode but larger.
+	 */
+	void setEncoding(FOHColTsEnc ts, FOHColValEnc val);
+
+	int pushSamples(const FOHSample* s, size_t n) override;
+
+	/**
+	 *  @brief Encode all collected samples and write them out
+	 *
+	 *  A chunk that couldn't be written since the previous call makes it
+	 *  fail, its samples are counted in droppedSamples.
+	 *
+	 *	@return 0 when everything is out, 1 on timeout, -1 on error.
+	 */
+	int flush(int timeoutMs) override;
+
+	/**
+	 *  @brief Flush and write the chunk directory
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int close();
+
+	FOHColStats stats();
+
+	bool isValid() const { return _isValid; }
+
+private:
+	struct _column {
+		std::vector<uint64_t> ts; /**< Times */
+		std::vector<double> v; /**< Values */
+		uint64_t since; /**< fohMonoNs() of the oldest sample */
+	};
+
+	void _encode(uint32_t port, uint32_t channel, _column& c);
+	void _encodeOld(bool all);
+	void _run();
+
+	int _fd; /**< Output */
+	bool _isValid; /**< File is open */
+	size_t _chunkRows; /**< Samples per chunk */
+	uint64_t _flushNs; /**< Column age limit */
+	size_t _maxBacklog; /**< Queue limit */
+	FOHColTsEnc _tsEnc; /**< Time column encoding */
+	FOHColValEnc _valEnc; /**< Value column encoding */
+
+	std::mutex _lock; /**< Everything below */
+	std::condition_variable _work; /**< Wakes the writer */
+	std::condition_variable _idle; /**< Wakes flush() */
+	std::map<uint64_t, _column> _columns; /**< By port << 32 | channel */
+	std::deque<std::vector<char>> _queue; /**< Encoded chunks */
+	size_t _queued; /**< Bytes in _queue */
+	bool _writing; /**< Writer holds a chunk */
+	bool _stop; /**< Ends the writer */
+	uint64_t _offset; /**< File size (writer) */
+	uint64_t _errorsSeen; /**< _st.writeErrors at the last flush() */
+	std::vector<FOHColIndex> _index; /**< Written chunks */
+	FOHColStats _st; /**< Counters */
+	std::thread _thread; /**< Writer */
+};
+
+/**
+ *  @brief Reads channels and time ranges from a column file
+ *
+ *  Uses the chunk directory of a closed file, or scans the chunk headers
+ *  of a file still being written.
+ */
+class FOHColumnReader {
+public:
+	FOHColumnReader();
+	~FOHColumnReader();
+
+	/**
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int open(const char* path);
+	void close();
+
+	const std::vector<FOHColIndex>& chunks() const { return _chunks; }
+	const FOHColHeader* header() const { return (const FOHColHeader*)_map; }
+
+	/**
+	 *  @brief Samples of one channel within a time range
+	 *
+	 *  Only chunks overlapping the range are decoded.
+	 *
+	 *  @return Number of samples appended, -1 for a damaged chunk
+	 */
+	long read(int port, int channel, uint64_t fromNs, uint64_t toNs, std::vector<FOHSample>& out);
+
+private:
+	char* _map; /**< File contents */
+	uint64_t _size; /**< File size */
+	std::vector<FOHColIndex> _chunks; /**< Directory */
+};
+
+#endif
@@ -0,0 +1,278 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file coro.cpp
+ * @brief C++20 coroutine API for ports driven by FOHEventLoop.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "coro.h"
+
+#include <string.h>
+
+//Frame size classes of the coroutine frame pool
+#define FOH_FRAME_GRAIN 64
+#define FOH_FRAME_CLASSES 32
+
+//Free space kept at the end of the receive buffer before reading
+#define FOH_ASYNC_MIN_ROOM 512
+
+struct _frameNode {
+	_frameNode* next;
+};
+
+static thread_local _frameNode* _frameFree[FOH_FRAME_CLASSES];
+
+/**
+ *  @brief Get memory for a coroutine frame
+ *
+ *  Frames up to 2 KiB come from per-thread free lists, so once a dialogue
+ *  has run, the next one with the same shape doesn't touch malloc.
+ */
+void* fohFrameAlloc(size_t n) {
+	size_t c = (n + FOH_FRAME_GRAIN - 1) / FOH_FRAME_GRAIN;
+	if (c == 0 || c > FOH_FRAME_CLASSES)
+		return ::operator new(n);
+
+	_frameNode* f = _frameFree[c - 1];
+	if (f) {
+		_frameFree[c - 1] = f->next;
+		return f;
+	}
+
+	return ::operator new(c * FOH_FRAME_GRAIN);
+}
+
+/**
+ *  @brief Return memory from fohFrameAlloc()
+ */
+void fohFrameFree(void* p, size_t n) {
+	size_t c = (n + FOH_FRAME_GRAIN - 1) / FOH_FRAME_GRAIN;
+	if (c == 0 || c > FOH_FRAME_CLASSES) {
+		::operator delete(p);
+		return;
+	}
+
+	_frameNode* f = (_frameNode*)p;
+	f->next = _frameFree[c - 1];
+	_frameFree[c - 1] = f;
+}
+
+FOHIoAwait::FOHIoAwait(FOHLoopFd* fd, uint32_t events, uint64_t deadlineNs) {
+	_loop = fd->loop;
+	_fd = fd;
+	_events = events;
+	_timer.deadlineNs = deadlineNs;
+	_result = -1;
+}
+
+void FOHIoAwait::await_suspend(std::coroutine_handle<> h) {
+	_h = h;
+	_watch.fn = _onIo;
+	_watch.ctx = this;
+	_timer.fn = _onTimer;
+	_timer.ctx = this;
+	_timer.slot = (size_t)-1;
+
+	_armed = _loop->arm(_fd, &_watch, _events) == 0;
+	if (!_armed) {
+		//Fail through the loop so the caller isn't resumed recursively
+		_result = -1;
+		_timer.deadlineNs = 1;
+	}
+	if (_timer.deadlineNs)
+		_loop->addTimer(&_timer);
+}
+
+void FOHIoAwait::_onIo(void* ctx, uint32_t events) {
+	FOHIoAwait* a = (FOHIoAwait*)ctx;
+
+	if (a->_timer.deadlineNs)
+		a->_loop->cancelTimer(&a->_timer);
+	a->_result = (events & a->_events) ? 1 : -1;
+	a->_h.resume();
+}
+
+void FOHIoAwait::_onTimer(void* ctx) {
+	FOHIoAwait* a = (FOHIoAwait*)ctx;
+
+	//Only this direction stops waiting, a concurrent read or write stays armed
+	if (a->_armed) {
+		a->_loop->disarm(a->_fd, &a->_watch);
+		a->_result = 0;
+	}
+	a->_h.resume();
+}
+
+FOHSleepAwait::FOHSleepAwait(FOHEventLoop* loop, uint64_t deadlineNs) {
+	_loop = loop;
+	_timer.deadlineNs = deadlineNs;
+}
+
+void FOHSleepAwait::await_suspend(std::coroutine_handle<> h) {
+	_h = h;
+	_timer.fn = _onTimer;
+	_timer.ctx = this;
+	_loop->addTimer(&_timer);
+}
+
+void FOHSleepAwait::_onTimer(void* ctx) {
+	((FOHSleepAwait*)ctx)->_h.resume();
+}
+
+/**
+ *  @param loop Loop to run on
+ *  @param port Open port
+ */
+FOHAsyncPort::FOHAsyncPort(FOHEventLoop* loop, FOHSerial* port) {
+	_loop = loop;
+	_port = port;
+	_fd = port->getFd();
+	_rx.resize(4096);
+	_rxHead = 0;
+	_rxLen = 0;
+	_consume = 0;
+
+	loop->watch(_fd, &_reg);
+}
+
+FOHAsyncPort::~FOHAsyncPort() {
+	_loop->unwatch(_fd);
+}
+
+/**
+ *  @brief Drop the bytes returned by the previous read
+ */
+void FOHAsyncPort::_discard() {
+	_rxHead += _consume;
+	_rxLen -= _consume;
+	_consume = 0;
+	if (_rxLen == 0)
+		_rxHead = 0;
+}
+
+/**
+ *  @brief Read up to and including a delimiter
+ *
+ *  @param delim Delimiter string (must stay valid while awaiting)
+ *  @param deadlineNs Give up at this time (0: never)
+ */
+FOHTask<FOHReadResult> FOHAsyncPort::readUntil(const char* delim, uint64_t deadlineNs) {
+	size_t dlen = strlen(delim);
+	size_t scanned = 0;
+	FOHReadResult res;
+	int n;
+
+	_discard();
+
+	for (;;) {
+		//Only look at new bytes (plus a delimiter's worth of overlap)
+		if (dlen && _rxLen >= dlen) {
+			size_t from = scanned >= dlen ? scanned - dlen + 1 : 0;
+			const char* base = &_rx[_rxHead];
+			const char* hit = (const char*)memmem(base + from, _rxLen - from, delim, dlen);
+			if (hit) {
+				_consume = hit - base + dlen;
+				res.status = 1;
+				res.data = base;
+				res.len = _consume;
+				co_return res;
+			}
+		}
+		scanned = _rxLen;
+
+		//Make room: compact first, grow only for long lines
+		if (_rx.size() - _rxHead - _rxLen < FOH_ASYNC_MIN_ROOM) {
+			memmove(&_rx[0], &_rx[_rxHead], _rxLen);
+			_rxHead = 0;
+			if (_rx.size() - _rxLen < FOH_ASYNC_MIN_ROOM)
+				_rx.resize(_rx.size() * 2);
+		}
+
+		n = _port->readChunk(&_rx[_rxHead + _rxLen], _rx.size() - _rxHead - _rxLen, 0);
+		if (n > 0) {
+			_rxLen += n;
+			continue;
+		}
+		if (n == 0)
+			n = co_await FOHIoAwait(&_reg, EPOLLIN, deadlineNs);
+		if (n <= 0) {
+			res.status = n;
+			res.data = _rxLen ? &_rx[_rxHead] : NULL;
+			res.len = _rxLen;
+			co_return res;
+		}
+	}
+}
+
+/**
+ *  @brief Write a buffer completely
+ *
+ *  @param data Bytes to send (must stay valid while awaiting)
+ *  @param len Number of bytes
+ *  @param deadlineNs Give up at this time (0: never)
+ *
+ *  Result: bytes written, less on deadline, -1 on error before any byte.
+ */
+FOHTask<int> FOHAsyncPort::write(const void* data, size_t len, uint64_t deadlineNs) {
+	size_t done = 0;
+	struct iovec iov;
+	int n;
+
+	while (done < len) {
+		iov.iov_base = (char*)data + done;
+		iov.iov_len = len - done;
+
+		n = _port->writeNow(&iov, 1);
+		if (n > 0) {
+			done += n;
+			continue;
+		}
+		if (n == 0)
+			n = co_await FOHIoAwait(&_reg, EPOLLOUT, deadlineNs);
+		if (n <= 0)
+			co_return (n < 0 && done == 0) ? -1 : (int)done;
+	}
+
+	co_return (int)done;
+}
+
+/**
+ *  @brief Write a command and read its reply
+ *
+ *  @param cmd Command bytes (must stay valid while awaiting)
+ *  @param len Command length
+ *  @param delim Reply delimiter
+ *  @param deadlineNs Deadline for the whole transaction (0: never)
+ */
+FOHTask<FOHReadResult> FOHAsyncPort::transact(const void* cmd, size_t len, const char* delim, uint64_t deadlineNs) {
+	FOHReadResult res;
+
+	int w = co_await write(cmd, len, deadlineNs);
+	if (w != (int)len) {
+		res.status = w < 0 ? -1 : 0;
+		res.data = NULL;
+		res.len = 0;
+		co_return res;
+	}
+
+	co_return co_await readUntil(delim, deadlineNs);
+}
@@ -0,0 +1,319 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file coro.h
+ * @brief C++20 coroutine API for ports driven by FOHEventLoop.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_CORO_H
+#define FOH_CORO_H
+
+#include "serial.h"
+#include "eventloop.h"
+
+#include <coroutine>
+#include <exception>
+#include <span>
+#include <utility>
+#include <vector>
+
+/**
+ *  @brief Get memory for a coroutine frame
+ *
+ *  Frames up to 2 KiB come from per-thread free lists, so once a dialogue
+ *  has run, the next one with the same shape doesn't touch malloc.
+ */
+void* fohFrameAlloc(size_t n);
+
+/**
+ *  @brief Return memory from fohFrameAlloc()
+ */
+void fohFrameFree(void* p, size_t n);
+
+/**
+ *  @brief Promise parts shared by every FOHTask
+ */
+struct FOHPromiseBase {
+	std::coroutine_handle<> continuation; /**< Awaiting coroutine */
+	bool detached = false; /**< Frame frees itself when done */
+
+	static void* operator new(size_t n) { return fohFrameAlloc(n); }
+	static void operator delete(void* p, size_t n) { fohFrameFree(p, n); }
+
+	struct FinalAwaiter {
+		bool await_ready() noexcept { return false; }
+
+		template <typename P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+			FOHPromiseBase& p = h.promise();
+			std::coroutine_handle<> next = p.continuation;
+
+			if (p.detached)
+				h.destroy();
+
+			return next ? next : std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	FinalAwaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() noexcept { std::terminate(); }
+};
+
+/**
+ *  @brief Lazily started coroutine returning a T
+ *
+ *  co_await a task to run it and get its result, or start it from plain
+ *  code with detach() (fire and forget) or start() (poll done()/result()).
+ */
+template <typename T>
+class FOHTask {
+public:
+	struct promise_type : FOHPromiseBase {
+		T value{}; /**< co_return value */
+
+		FOHTask get_return_object() noexcept { return FOHTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		void return_value(T v) noexcept { value = std::move(v); }
+	};
+
+	FOHTask(FOHTask&& o) noexcept : _h(o._h) { o._h = nullptr; }
+	FOHTask(const FOHTask&) = delete;
+	FOHTask& operator=(const FOHTask&) = delete;
+	~FOHTask() { if (_h) _h.destroy(); }
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+		_h.promise().continuation = caller;
+		return _h;
+	}
+	T await_resume() { return std::move(_h.promise().value); }
+
+	/**
+	 *  @brief Run until the first suspension, the frame frees itself at the end
+	 */
+	void detach() {
+		std::coroutine_handle<promise_type> h = _h;
+		_h = nullptr;
+		h.promise().detached = true;
+		h.resume();
+	}
+
+	/**
+	 *  @brief Run until the first suspension, keep the frame for result()
+	 */
+	void start() { _h.resume(); }
+
+	bool done() const { return !_h || _h.done(); }
+	T& result() { return _h.promise().value; }
+
+private:
+	explicit FOHTask(std::coroutine_handle<promise_type> h) : _h(h) {}
+
+	std::coroutine_handle<promise_type> _h; /**< Coroutine frame */
+};
+
+/**
+ *  @brief Lazily started coroutine without a result
+ */
+template <>
+class FOHTask<void> {
+public:
+	struct promise_type : FOHPromiseBase {
+		FOHTask get_return_object() noexcept { return FOHTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		void return_void() noexcept {}
+	};
+
+	FOHTask(FOHTask&& o) noexcept : _h(o._h) { o._h = nullptr; }
+	FOHTask(const FOHTask&) = delete;
+	FOHTask& operator=(const FOHTask&) = delete;
+	~FOHTask() { if (_h) _h.destroy(); }
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+		_h.promise().continuation = caller;
+		return _h;
+	}
+	void await_resume() noexcept {}
+
+	void detach() {
+		std::coroutine_handle<promise_type> h = _h;
+		_h = nullptr;
+		h.promise().detached = true;
+		h.resume();
+	}
+	void start() { _h.resume(); }
+	bool done() const { return !_h || _h.done(); }
+
+private:
+	explicit FOHTask(std::coroutine_handle<promise_type> h) : _h(h) {}
+
+	std::coroutine_handle<promise_type> _h; /**< Coroutine frame */
+};
+
+/**
+ *  @brief Awaitable: readiness of a descriptor registered with the loop
+ *
+ *  co_await yields 1 when ready, 0 on deadline, -1 on error/hangup. A
+ *  reader and a writer may wait on the same descriptor at the same time.
+ */
+class FOHIoAwait {
+public:
+	/**
+	 *  @param fd Descriptor registered with FOHEventLoop::watch()
+	 *  @param events EPOLLIN and/or EPOLLOUT
+	 *  @param deadlineNs Give up at this fohMonoNs() time (0: never)
+	 */
+	FOHIoAwait(FOHLoopFd* fd, uint32_t events, uint64_t deadlineNs);
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h);
+	int await_resume() const noexcept { return _result; }
+
+private:
+	static void _onIo(void* ctx, uint32_t events);
+	static void _onTimer(void* ctx);
+
+	FOHEventLoop* _loop; /**< Loop to wait on */
+	FOHLoopFd* _fd; /**< Descriptor */
+	uint32_t _events; /**< Wanted events */
+	FOHLoopWatch _watch; /**< Readiness callback */
+	FOHLoopTimer _timer; /**< Deadline */
+	std::coroutine_handle<> _h; /**< Waiting coroutine */
+	int _result; /**< Outcome */
+	bool _armed; /**< Registered with epoll */
+};
+
+/**
+ *  @brief Awaitable: resume at a point in time
+ */
+class FOHSleepAwait {
+public:
+	/**
+	 *  @param loop Event loop to wait on
+	 *  @param deadlineNs Resume at this fohMonoNs() time
+	 */
+	FOHSleepAwait(FOHEventLoop* loop, uint64_t deadlineNs);
+
+	bool await_ready() const noexcept { return _timer.deadlineNs <= fohMonoNs(); }
+	void await_suspend(std::coroutine_handle<> h);
+	void await_resume() const noexcept {}
+
+private:
+	static void _onTimer(void* ctx);
+
+	FOHEventLoop* _loop; /**< Loop to wait on */
+	FOHLoopTimer _timer; /**< Wakeup */
+	std::coroutine_handle<> _h; /**< Waiting coroutine */
+};
+
+/**
+ *  @brief Result of a read awaitable
+ */
+struct FOHReadResult {
+	int status; /**< 1: delimiter found, 0: deadline, -1: error */
+	const char* data; /**< Received bytes, valid until the next read on the port */
+	size_t len; /**< Length including the delimiter (buffered bytes on deadline) */
+};
+
+/**
+ *  @brief Serial port driven by a FOHEventLoop through coroutines
+ *
+ *  co_await port.readUntil("\r\n", deadline), co_await port.write(span) and
+ *  co_await port.transact(cmd, len, "\r\n", deadline) suspend the calling
+ *  coroutine instead of a thread, so any number of device dialogues share
+ *  the loop thread. Deadlines are absolute fohMonoNs() values, 0 means none.
+ *  At most one read and one write may be outstanding per port.
+ */
+class FOHAsyncPort {
+public:
+	/**
+	 *  @param loop Loop to run on
+	 *  @param port Open port
+	 */
+	FOHAsyncPort(FOHEventLoop* loop, FOHSerial* port);
+	~FOHAsyncPort();
+
+	/**
+	 *  @brief Read up to and including a delimiter
+	 *
+	 *  @param delim Delimiter string (must stay valid while awaiting)
+	 *  @param deadlineNs Give up at this time (0: never)
+	 */
+	FOHTask<FOHReadResult> readUntil(const char* delim, uint64_t deadlineNs);
+
+	/**
+	 *  @brief Write a buffer completely
+	 *
+	 *  @param data Bytes to send (must stay valid while awaiting)
+	 *  @param len Number of bytes
+	 *  @param deadlineNs Give up at this time (0: never)
+	 *
+	 *  Result: bytes written, less on deadline, -1 on error before any byte.
+	 */
+	FOHTask<int> write(const void* data, size_t len, uint64_t deadlineNs = 0);
+
+	FOHTask<int> write(std::span<const uint8_t> data, uint64_t deadlineNs = 0) {
+		return write(data.data(), data.size(), deadlineNs);
+	}
+
+	/**
+	 *  @brief Write a command and read its reply
+	 *
+	 *  @param cmd Command bytes (must stay valid while awaiting)
+	 *  @param len Command length
+	 *  @param delim Reply delimiter
+	 *  @param deadlineNs Deadline for the whole transaction (0: never)
+	 */
+	FOHTask<FOHReadResult> transact(const void* cmd, size_t len, const char* delim, uint64_t deadlineNs);
+
+	/**
+	 *  @brief Wait for readiness of the port
+	 *
+	 *  @param events EPOLLIN and/or EPOLLOUT
+	 *  @param deadlineNs Give up at this time (0: never)
+	 */
+	FOHIoAwait ready(uint32_t events, uint64_t deadlineNs) { return FOHIoAwait(&_reg, events, deadlineNs); }
+
+	/**
+	 *  @brief Sleep on the port's loop
+	 */
+	FOHSleepAwait sleepUntil(uint64_t deadlineNs) { return FOHSleepAwait(_loop, deadlineNs); }
+
+private:
+	/**
+	 *  @brief Drop the bytes returned by the previous read
+	 */
+	void _discard();
+
+	FOHEventLoop* _loop; /**< Loop to run on */
+	FOHSerial* _port; /**< Port */
+	int _fd; /**< Port descriptor */
+	FOHLoopFd _reg; /**< Registration shared by the reader and the writer */
+	std::vector<char> _rx; /**< Receive buffer */
+	size_t _rxHead; /**< First unread byte */
+	size_t _rxLen; /**< Unread bytes */
+	size_t _consume; /**< Bytes handed out by the last read */
+};
+
+#endif
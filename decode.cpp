@@ -0,0 +1,143 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file decode.cpp
+ * @brief Line framing and numeric field parsing of received data.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "decode.h"
+#include "trace.h"
+
+#include <charconv>
+#include <string.h>
+
+//Lines longer than this are cut (runaway data without newlines)
+#define FOH_DECODE_MAX_LINE 65536
+
+/**
+ *  @param port Port number put into the samples
+ */
+FOHLineDecoder::FOHLineDecoder(int port) {
+	_port = port;
+	_lines = 0;
+	_bad = 0;
+}
+
+static inline bool _isSep(char c) {
+	return c == ' ' || c == '\t' || c == ',' || c == ';';
+}
+
+/**
+ *  @brief Decode one complete line (without terminator)
+ *
+ *  @return Number of samples appended
+ */
+size_t FOHLineDecoder::decodeLine(uint64_t tsNs, const char* line, size_t len, std::vector<FOHSample>& out) {
+	const char* p = line;
+	const char* end = line + len;
+	uint32_t ch = 0;
+	size_t n = 0;
+
+	if (len && end[-1] == '\r')
+		end--;
+
+	while (p < end) {
+		while (p < end && _isSep(*p))
+			p++;
+		if (p == end)
+			break;
+
+		const char* f = p;
+		while (p < end && !_isSep(*p))
+			p++;
+
+		//from_chars doesn't take a leading '+'
+		if (*f == '+' && f + 1 < p)
+			f++;
+
+		FOHSample s;
+		std::from_chars_result r = std::from_chars(f, p, s.value);
+		if (r.ec != std::errc() || r.ptr != p) {
+			_bad++;
+			continue;
+		}
+
+		s.hostNs = tsNs;
+		s.port = _port;
+		s.channel = ch++;
+		out.push_back(s);
+		n++;
+	}
+
+	_lines++;
+	FOH_TRACE3(frame_complete, _port, tsNs, n);
+	return n;
+}
+
+/**
+ *  @brief Decode a chunk
+ *
+ *  With byteNs set, each line is stamped with the arrival time of its own
+ *  terminator (tsNs being the time of the chunk's last byte) instead of
+ *  the chunk time.
+ *
+ *  @param tsNs Receive time of the chunk
+ *  @param data Bytes
+ *  @param len Number of bytes
+ *  @param out Samples are appended here
+ *  @param byteNs Transmit time of one byte (0: stamp all lines with tsNs)
+ *
+ *  @return Number of complete lines in the chunk
+ */
+size_t FOHLineDecoder::decode(uint64_t tsNs, const char* data, size_t len, std::vector<FOHSample>& out, uint64_t byteNs) {
+	const char* p = data;
+	const char* end = data + len;
+	size_t lines = 0;
+	uint64_t ts;
+
+	while (p < end) {
+		const char* nl = (const char*)memchr(p, '\n', end - p);
+		if (nl == NULL) {
+			_partial.append(p, end - p);
+			if (_partial.size() > FOH_DECODE_MAX_LINE) {
+				decodeLine(tsNs, _partial.data(), _partial.size(), out);
+				_partial.clear();
+			}
+			break;
+		}
+
+		ts = tsNs - (uint64_t)(end - nl - 1) * byteNs;
+
+		//Only copy when a line spans chunks
+		if (_partial.empty()) {
+			decodeLine(ts, p, nl - p, out);
+		} else {
+			_partial.append(p, nl - p);
+			decodeLine(ts, _partial.data(), _partial.size(), out);
+			_partial.clear();
+		}
+		lines++;
+		p = nl + 1;
+	}
+
+	return lines;
+}
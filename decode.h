@@ -0,0 +1,88 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file decode.h
+ * @brief Line framing and numeric field parsing of received data.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_DECODE_H
+#define FOH_DECODE_H
+
+#include "sink.h"
+
+#include <string>
+#include <vector>
+
+/**
+ *  @brief Turns received text lines into samples
+ *
+ *  Lines end with '\n' (a preceding '\r' is ignored). Every number in a
+ *  line becomes one sample, numbered from channel 0 in order of appearance;
+ *  fields are separated by blanks, tabs, ',' or ';'. Non-numeric fields are
+ *  skipped without using up a channel number. Each line is stamped with the
+ *  time of the chunk that completed it.
+ *
+ *  A decoder keeps the unfinished line of one port, so chunks of a port
+ *  must be fed in order.
+ */
+class FOHLineDecoder {
+public:
+	/**
+	 *  @param port Port number put into the samples
+	 */
+	FOHLineDecoder(int port);
+
+	/**
+	 *  @brief Decode a chunk
+	 *
+	 *  With byteNs set, each line is stamped with the arrival time of its own
+	 *  terminator (tsNs being the time of the chunk's last byte) instead of
+	 *  the chunk time.
+	 *
+	 *  @param tsNs Receive time of the chunk
+	 *  @param data Bytes
+	 *  @param len Number of bytes
+	 *  @param out Samples are appended here
+	 *  @param byteNs Transmit time of one byte (0: stamp all lines with tsNs)
+	 *
+	 *  @return Number of complete lines in the chunk
+	 */
+	size_t decode(uint64_t tsNs, const char* data, size_t len, std::vector<FOHSample>& out, uint64_t byteNs = 0);
+
+	/**
+	 *  @brief Decode one complete line (without terminator)
+	 *
+	 *  @return Number of samples appended
+	 */
+	size_t decodeLine(uint64_t tsNs, const char* line, size_t len, std::vector<FOHSample>& out);
+
+	uint64_t lines() const { return _lines; }
+	uint64_t badFields() const { return _bad; }
+
+private:
+	int _port; /**< Port number for the samples */
+	std::string _partial; /**< Unfinished line */
+	uint64_t _lines; /**< Lines decoded */
+	uint64_t _bad; /**< Fields that weren't numbers */
+};
+
+#endif
@@ -0,0 +1,263 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file decodepool.cpp
+ * @brief Work-stealing thread pool for decoding received data.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "decodepool.h"
+
+//Chunks a strand processes before it goes back to the end of the queue
+#define FOH_POOL_BATCH 32
+
+/**
+ *  @param threads Number of workers (0: one per core)
+ *  @param out Receives the decoded samples
+ */
+FOHDecodePool::FOHDecodePool(int threads, FOHSink* out)
+	: _out(out), _ready(0), _active(0), _stop(false), _chunks(0), _samples(0), _steals(0), _runs(0) {
+	if (threads <= 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads <= 0)
+		threads = 1;
+
+	for (int i = 0; i < threads; i++)
+		_workers.push_back(new _worker);
+	for (int i = 0; i < threads; i++)
+		_workers[i]->thread = std::thread(&FOHDecodePool::_run, this, i);
+}
+
+FOHDecodePool::~FOHDecodePool() {
+	{
+		std::lock_guard<std::mutex> l(_idleLock);
+		_stop.store(true);
+	}
+	_work.notify_all();
+
+	//Join all before freeing any, the others may still steal from a deque
+	for (size_t i = 0; i < _workers.size(); i++)
+		_workers[i]->thread.join();
+	for (size_t i = 0; i < _workers.size(); i++)
+		delete _workers[i];
+	for (size_t i = 0; i < _strands.size(); i++)
+		delete _strands[i];
+}
+
+/**
+ *  @brief Register a port (before submitting to it)
+ *
+ *  @param port Port number put into the samples
+ *
+ *  @return Strand id for submit()
+ */
+int FOHDecodePool::addPort(int port) {
+	std::lock_guard<std::mutex> l(_strandsLock);
+	_strand* s = new _strand(port);
+
+	s->home = _strands.size() % _workers.size();
+	_strands.push_back(s);
+
+	return _strands.size() - 1;
+}
+
+/**
+ *  @brief Put a strand on a worker's deque and wake someone
+ */
+void FOHDecodePool::_schedule(int worker, _strand* s) {
+	//Count before publishing, a worker may pop and finish it right away
+	_active.fetch_add(1);
+	_ready.fetch_add(1);
+	{
+		std::lock_guard<std::mutex> l(_workers[worker]->lock);
+		_workers[worker]->runq.push_back(s);
+	}
+
+	{
+		std::lock_guard<std::mutex> l(_idleLock);
+	}
+	_work.notify_one();
+}
+
+/**
+ *  @brief Queue a received chunk for decoding (copied)
+ *
+ *  @param strand Id from addPort()
+ *  @param tsNs Receive time of the chunk
+ *  @param data Bytes
+ *  @param len Number of bytes
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHDecodePool::submit(int strand, uint64_t tsNs, const void* data, size_t len) {
+	_strand* s;
+	{
+		std::lock_guard<std::mutex> l(_strandsLock);
+		if (strand < 0 || (size_t)strand >= _strands.size())
+			return -1;
+		s = _strands[strand];
+	}
+
+	_chunk c;
+	c.tsNs = tsNs;
+	c.data.assign((const char*)data, (const char*)data + len);
+
+	bool wake;
+	{
+		std::lock_guard<std::mutex> l(s->lock);
+		s->queue.push_back(std::move(c));
+		wake = !s->scheduled;
+		s->scheduled = true;
+	}
+
+	if (wake)
+		_schedule(s->home, s);
+
+	return 0;
+}
+
+/**
+ *  @brief Take the next strand: own deque first (newest), then steal (oldest)
+ */
+FOHDecodePool::_strand* FOHDecodePool::_next(int self) {
+	_worker* w = _workers[self];
+	_strand* s = NULL;
+	size_t n = _workers.size();
+
+	{
+		std::lock_guard<std::mutex> l(w->lock);
+		if (!w->runq.empty()) {
+			s = w->runq.back();
+			w->runq.pop_back();
+		}
+	}
+	if (s) {
+		_ready.fetch_sub(1);
+		return s;
+	}
+
+	for (size_t i = 1; i < n; i++) {
+		_worker* v = _workers[(self + i) % n];
+		std::lock_guard<std::mutex> l(v->lock);
+		if (!v->runq.empty()) {
+			s = v->runq.front();
+			v->runq.pop_front();
+			_ready.fetch_sub(1);
+			_steals.fetch_add(1, std::memory_order_relaxed);
+			return s;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ *  @brief Decode a batch of a strand's chunks, then requeue or release it
+ */
+void FOHDecodePool::_process(int self, _strand* s, std::vector<FOHSample>& samples) {
+	std::deque<_chunk> batch;
+	bool more;
+
+	{
+		std::lock_guard<std::mutex> l(s->lock);
+		for (int i = 0; i < FOH_POOL_BATCH && !s->queue.empty(); i++) {
+			batch.push_back(std::move(s->queue.front()));
+			s->queue.pop_front();
+		}
+	}
+
+	samples.clear();
+	for (size_t i = 0; i < batch.size(); i++)
+		s->decoder.decode(batch[i].tsNs, batch[i].data.data(), batch[i].data.size(), samples);
+
+	if (!samples.empty() && _out)
+		_out->pushSamples(samples.data(), samples.size());
+
+	_chunks.fetch_add(batch.size(), std::memory_order_relaxed);
+	_samples.fetch_add(samples.size(), std::memory_order_relaxed);
+	_runs.fetch_add(1, std::memory_order_relaxed);
+
+	{
+		std::lock_guard<std::mutex> l(s->lock);
+		more = !s->queue.empty();
+		if (!more)
+			s->scheduled = false;
+	}
+
+	//Back of our own deque, so other strands and thieves get a turn
+	if (more) {
+		_active.fetch_add(1);
+		_ready.fetch_add(1);
+		std::lock_guard<std::mutex> l(_workers[self]->lock);
+		_workers[self]->runq.push_front(s);
+	}
+	if (more && _workers.size() > 1) {
+		std::lock_guard<std::mutex> l(_idleLock);
+		_work.notify_one();
+	}
+}
+
+void FOHDecodePool::_run(int self) {
+	std::vector<FOHSample> samples;
+
+	for (;;) {
+		_strand* s = _next(self);
+
+		if (s == NULL) {
+			std::unique_lock<std::mutex> l(_idleLock);
+			if (_stop.load())
+				return;
+			if (_ready.load() > 0)
+				continue;
+
+			_work.wait(l, [this] { return _stop.load() || _ready.load() > 0; });
+			continue;
+		}
+
+		_process(self, s, samples);
+		if (_active.fetch_sub(1) == 1) {
+			std::lock_guard<std::mutex> l(_idleLock);
+			_idle.notify_all();
+		}
+	}
+}
+
+/**
+ *  @brief Wait until every submitted chunk is decoded
+ */
+void FOHDecodePool::waitIdle() {
+	std::unique_lock<std::mutex> l(_idleLock);
+	_idle.wait(l, [this] { return _active.load() == 0; });
+}
+
+/**
+ *  @brief Snapshot of the counters
+ */
+FOHDecodePoolStats FOHDecodePool::stats() const {
+	FOHDecodePoolStats s;
+
+	s.chunks = _chunks.load(std::memory_order_relaxed);
+	s.samples = _samples.load(std::memory_order_relaxed);
+	s.steals = _steals.load(std::memory_order_relaxed);
+	s.runs = _runs.load(std::memory_order_relaxed);
+
+	return s;
+}
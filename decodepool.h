@@ -0,0 +1,147 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file decodepool.h
+ * @brief Work-stealing thread pool for decoding received data.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_DECODEPOOL_H
+#define FOH_DECODEPOOL_H
+
+#include "decode.h"
+#include "sink.h"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+/**
+ *  @brief Decode pool counters (snapshot)
+ */
+struct FOHDecodePoolStats {
+	uint64_t chunks; /**< Chunks decoded */
+	uint64_t samples; /**< Samples produced */
+	uint64_t steals; /**< Port runs taken from another worker */
+	uint64_t runs; /**< Port runs executed */
+};
+
+/**
+ *  @brief Decodes received chunks of many ports on a work-stealing pool
+ *
+ *  I/O threads only submit() the chunks they read. Each port is a strand:
+ *  its chunks queue up in order and at most one worker runs the strand at a
+ *  time, which keeps per-port order without a thread per port. A strand
+ *  with work sits on one worker's deque; idle workers steal strands from
+ *  the others, so a few very busy ports spread over all cores instead of
+ *  saturating a fixed thread.
+ *
+ *  Decoded samples go to the sink's pushSamples() from the worker threads.
+ */
+class FOHDecodePool {
+public:
+	/**
+	 *  @param threads Number of workers (0: one per core)
+	 *  @param out Receives the decoded samples
+	 */
+	FOHDecodePool(int threads, FOHSink* out);
+	~FOHDecodePool();
+
+	/**
+	 *  @brief Register a port (before submitting to it)
+	 *
+	 *  @param port Port number put into the samples
+	 *
+	 *  @return Strand id for submit()
+	 */
+	int addPort(int port);
+
+	/**
+	 *  @brief Queue a received chunk for decoding (copied)
+	 *
+	 *  @param strand Id from addPort()
+	 *  @param tsNs Receive time of the chunk
+	 *  @param data Bytes
+	 *  @param len Number of bytes
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int submit(int strand, uint64_t tsNs, const void* data, size_t len);
+
+	/**
+	 *  @brief Wait until every submitted chunk is decoded
+	 */
+	void waitIdle();
+
+	/**
+	 *  @brief Snapshot of the counters
+	 */
+	FOHDecodePoolStats stats() const;
+
+private:
+	struct _chunk {
+		uint64_t tsNs; /**< Receive time */
+		std::vector<char> data; /**< Bytes */
+	};
+
+	struct _strand {
+		FOHLineDecoder decoder; /**< Line state of the port */
+		std::mutex lock; /**< Protects queue and scheduled */
+		std::deque<_chunk> queue; /**< Chunks waiting, in order */
+		bool scheduled; /**< On a worker deque or running */
+		int home; /**< Worker it is queued to first */
+
+		_strand(int port) : decoder(port), scheduled(false), home(0) {}
+	};
+
+	struct _worker {
+		std::mutex lock; /**< Protects runq */
+		std::deque<_strand*> runq; /**< Strands with work */
+		std::thread thread; /**< Worker thread */
+	};
+
+	void _run(int self);
+	void _schedule(int worker, _strand* s);
+	_strand* _next(int self);
+	void _process(int self, _strand* s, std::vector<FOHSample>& samples);
+
+	FOHSink* _out; /**< Sample destination */
+	std::vector<_worker*> _workers; /**< Workers */
+	std::vector<_strand*> _strands; /**< Ports */
+	std::mutex _strandsLock; /**< Protects _strands growth */
+
+	std::mutex _idleLock; /**< For sleeping workers and waitIdle() */
+	std::condition_variable _work; /**< Strand scheduled */
+	std::condition_variable _idle; /**< All strands drained */
+	std::atomic<int> _ready; /**< Strands sitting on worker deques */
+	std::atomic<int> _active; /**< Strands on deques or running */
+	std::atomic<bool> _stop; /**< Workers should exit */
+
+	std::atomic<uint64_t> _chunks; /**< Chunks decoded */
+	std::atomic<uint64_t> _samples; /**< Samples produced */
+	std::atomic<uint64_t> _steals; /**< Strands stolen */
+	std::atomic<uint64_t> _runs; /**< Strand runs */
+};
+
+#endif
@@ -0,0 +1,370 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file eventloop.cpp
+ * @brief Single threaded epoll event loop with timers.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "eventloop.h"
+#include "serial.h"
+
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <unistd.h>
+
+//Events fetched per epoll_wait()
+#define FOH_LOOP_EVENTS 64
+
+FOHEventLoop::FOHEventLoop() : _stop(false) {
+	_parked.fn = NULL;
+	_parked.ctx = NULL;
+	_epfd = epoll_create1(EPOLL_CLOEXEC);
+	_evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL; //NULL marks the wakeup descriptor
+	epoll_ctl(_epfd, EPOLL_CTL_ADD, _evfd, &ev);
+}
+
+FOHEventLoop::~FOHEventLoop() {
+	close(_evfd);
+	close(_epfd);
+}
+
+/**
+ *  @brief Register a file descriptor (not armed yet)
+ *
+ *  A hangup or error while the descriptor isn't armed is reported to
+ *  w once (if w->fn is set).
+ *
+ *  @param fd File descriptor
+ *  @param w Callback for its events
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHEventLoop::watch(int fd, FOHLoopWatch* w) {
+	struct epoll_event ev;
+	//epoll always reports hangups and errors; one-shot so an unarmed
+	//descriptor that hung up doesn't fire on every wait
+	ev.events = EPOLLONESHOT;
+	ev.data.ptr = w;
+
+	return epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) != 0 ? -1 : 0;
+}
+
+/**
+ *  @brief Wait once for events on a registered descriptor
+ *
+ *  @param fd File descriptor passed to watch()
+ *  @param w Callback for its events
+ *  @param events EPOLLIN and/or EPOLLOUT (0 disarms, w is let go)
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHEventLoop::arm(int fd, FOHLoopWatch* w, uint32_t events) {
+	struct epoll_event ev;
+	ev.events = events | EPOLLONESHOT;
+	//A disarmed descriptor must not keep pointing at a watch that may go
+	//away with its awaiter
+	ev.data.ptr = events ? w : &_parked;
+
+	return epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &ev) != 0 ? -1 : 0;
+}
+
+/**
+ *  @brief Register a descriptor shared by a reader and a writer
+ *
+ *  @param fd File descriptor
+ *  @param f Registration, must stay valid until unwatch()
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHEventLoop::watch(int fd, FOHLoopFd* f) {
+	f->watch.fn = _onFd;
+	f->watch.ctx = f;
+	f->loop = this;
+	f->fd = fd;
+	f->rd = NULL;
+	f->wr = NULL;
+
+	return watch(fd, &f->watch);
+}
+
+/**
+ *  @brief Wait once for one or both directions of a shared descriptor
+ *
+ *  A hangup or error is reported to every waiting direction.
+ *
+ *  @param f Registration passed to watch()
+ *  @param w Callback, stays in use until it ran or disarm() is called
+ *  @param events EPOLLIN and/or EPOLLOUT
+ *
+ *	@return 0 on success, -1 if a direction already has a waiter or on error.
+ */
+int FOHEventLoop::arm(FOHLoopFd* f, FOHLoopWatch* w, uint32_t events) {
+	if ((events & (EPOLLIN | EPOLLOUT)) == 0)
+		return -1;
+	if (((events & EPOLLIN) && f->rd && f->rd != w) || ((events & EPOLLOUT) && f->wr && f->wr != w))
+		return -1;
+
+	if (events & EPOLLIN)
+		f->rd = w;
+	if (events & EPOLLOUT)
+		f->wr = w;
+	if (_rearm(f) == 0)
+		return 0;
+
+	disarm(f, w);
+	return -1;
+}
+
+/**
+ *  @brief Stop waiting with w, other directions stay armed
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHEventLoop::disarm(FOHLoopFd* f, FOHLoopWatch* w) {
+	if (f->rd == w)
+		f->rd = NULL;
+	if (f->wr == w)
+		f->wr = NULL;
+
+	return _rearm(f);
+}
+
+/**
+ *  @brief Arm a shared descriptor for the directions that have a waiter
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHEventLoop::_rearm(FOHLoopFd* f) {
+	struct epoll_event ev;
+	ev.events = (f->rd ? EPOLLIN : 0) | (f->wr ? EPOLLOUT : 0) | EPOLLONESHOT;
+	ev.data.ptr = &f->watch;
+
+	return epoll_ctl(_epfd, EPOLL_CTL_MOD, f->fd, &ev) != 0 ? -1 : 0;
+}
+
+/**
+ *  @brief Hand the events of a shared descriptor to the waiting directions
+ */
+void FOHEventLoop::_onFd(void* ctx, uint32_t events) {
+	FOHLoopFd* f = (FOHLoopFd*)ctx;
+	FOHLoopWatch* rd = NULL;
+	FOHLoopWatch* wr = NULL;
+
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+		rd = f->rd;
+		f->rd = NULL;
+	}
+	if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+		wr = f->wr;
+		f->wr = NULL;
+	}
+
+	//One-shot disarmed both directions, keep waiting for the other one
+	if (f->rd || f->wr)
+		f->loop->_rearm(f);
+
+	if (rd)
+		rd->fn(rd->ctx, events);
+	if (wr && wr != rd)
+		wr->fn(wr->ctx, events);
+}
+
+/**
+ *  @brief Remove a descriptor
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHEventLoop::unwatch(int fd) {
+	return epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL) != 0 ? -1 : 0;
+}
+
+void FOHEventLoop::_siftUp(size_t i) {
+	FOHLoopTimer* t = _heap[i];
+
+	while (i > 0) {
+		size_t p = (i - 1) / 2;
+		if (_heap[p]->deadlineNs <= t->deadlineNs)
+			break;
+		_heap[i] = _heap[p];
+		_heap[i]->slot = i;
+		i = p;
+	}
+	_heap[i] = t;
+	t->slot = i;
+}
+
+void FOHEventLoop::_siftDown(size_t i) {
+	FOHLoopTimer* t = _heap[i];
+	size_t n = _heap.size();
+
+	for (;;) {
+		size_t c = 2 * i + 1;
+		if (c >= n)
+			break;
+		if (c + 1 < n && _heap[c + 1]->deadlineNs < _heap[c]->deadlineNs)
+			c++;
+		if (t->deadlineNs <= _heap[c]->deadlineNs)
+			break;
+		_heap[i] = _heap[c];
+		_heap[i]->slot = i;
+		i = c;
+	}
+	_heap[i] = t;
+	t->slot = i;
+}
+
+/**
+ *  @brief Start a timer (deadlineNs must be set)
+ */
+void FOHEventLoop::addTimer(FOHLoopTimer* t) {
+	_heap.push_back(t);
+	_siftUp(_heap.size() - 1);
+}
+
+/**
+ *  @brief Stop a timer that hasn't fired (no-op otherwise)
+ */
+void FOHEventLoop::cancelTimer(FOHLoopTimer* t) {
+	size_t i = t->slot;
+	if (i >= _heap.size() || _heap[i] != t)
+		return;
+
+	FOHLoopTimer* last = _heap.back();
+	_heap.pop_back();
+	t->slot = (size_t)-1;
+	if (last == t)
+		return;
+
+	_heap[i] = last;
+	last->slot = i;
+	_siftUp(i);
+	_siftDown(last->slot);
+}
+
+void FOHEventLoop::_wake() {
+	uint64_t one = 1;
+	ssize_t r = write(_evfd, &one, sizeof one);
+	(void)r;
+}
+
+/**
+ *  @brief Run a function on the loop thread (thread-safe)
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHEventLoop::post(void (*fn)(void*), void* ctx) {
+	_posted p;
+	p.fn = fn;
+	p.ctx = ctx;
+
+	{
+		std::lock_guard<std::mutex> l(_postLock);
+		_posts.push_back(p);
+	}
+	_wake();
+
+	return 0;
+}
+
+/**
+ *  @brief Wait for and dispatch one batch of events
+ *
+ *  @param timeoutMs Longest wait (-1: until something happens)
+ *
+ *	@return Number of callbacks run when successful, -1 otherwise.
+ */
+int FOHEventLoop::runOnce(int timeoutMs) {
+	struct epoll_event evs[FOH_LOOP_EVENTS];
+	int ran = 0;
+	int n, i;
+
+	//Don't sleep past the earliest timer
+	if (!_heap.empty()) {
+		uint64_t now = fohMonoNs();
+		uint64_t d = _heap[0]->deadlineNs;
+		int ms = d <= now ? 0 : (int)((d - now + 999999) / 1000000);
+		if (timeoutMs < 0 || ms < timeoutMs)
+			timeoutMs = ms;
+	}
+
+	n = epoll_wait(_epfd, evs, FOH_LOOP_EVENTS, timeoutMs);
+	if (n < 0 && errno != EINTR)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		FOHLoopWatch* w = (FOHLoopWatch*)evs[i].data.ptr;
+		if (w == NULL) {
+			uint64_t cnt;
+			ssize_t r = read(_evfd, &cnt, sizeof cnt);
+			(void)r;
+			continue;
+		}
+		if (w->fn == NULL)
+			continue;
+		w->fn(w->ctx, evs[i].events);
+		ran++;
+	}
+
+	//Expired timers, the callback may add new ones
+	uint64_t now = fohMonoNs();
+	while (!_heap.empty() && _heap[0]->deadlineNs <= now) {
+		FOHLoopTimer* t = _heap[0];
+		cancelTimer(t);
+		t->fn(t->ctx);
+		ran++;
+	}
+
+	{
+		std::lock_guard<std::mutex> l(_postLock);
+		_running.swap(_posts);
+	}
+	for (i = 0; i < (int)_running.size(); i++) {
+		_running[i].fn(_running[i].ctx);
+		ran++;
+	}
+	_running.clear();
+
+	return ran;
+}
+
+/**
+ *  @brief Dispatch events until stop() is called
+ */
+void FOHEventLoop::run() {
+	while (!_stop.load(std::memory_order_acquire)) {
+		if (runOnce(-1) < 0)
+			break;
+	}
+	_stop.store(false, std::memory_order_release);
+}
+
+/**
+ *  @brief Make run() return (thread-safe)
+ */
+void FOHEventLoop::stop() {
+	_stop.store(true, std::memory_order_release);
+	_wake();
+}
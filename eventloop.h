@@ -0,0 +1,209 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file eventloop.h
+ * @brief Single threaded epoll event loop with timers.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_EVENTLOOP_H
+#define FOH_EVENTLOOP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/**
+ *  @brief I/O readiness callback, embedded in the object that waits
+ */
+struct FOHLoopWatch {
+	void (*fn)(void* ctx, uint32_t events); /**< Called with the epoll events */
+	void* ctx; /**< Passed to fn */
+};
+
+class FOHEventLoop;
+
+/**
+ *  @brief Descriptor with one reader and one writer waiting independently
+ *
+ *  epoll keeps a single registration per descriptor, so a read and a write
+ *  waiting at the same time share it: the loop arms the union of both
+ *  directions and hands each event to the watch of its direction.
+ */
+struct FOHLoopFd {
+	FOHLoopWatch watch; /**< Registered with epoll, managed by the loop */
+	FOHEventLoop* loop; /**< Loop it is registered with */
+	int fd; /**< File descriptor */
+	FOHLoopWatch* rd; /**< Waiting for EPOLLIN, or NULL */
+	FOHLoopWatch* wr; /**< Waiting for EPOLLOUT, or NULL */
+};
+
+/**
+ *  @brief One-shot timer, embedded in the object that waits
+ */
+struct FOHLoopTimer {
+	void (*fn)(void* ctx); /**< Called when the deadline passed */
+	void* ctx; /**< Passed to fn */
+	uint64_t deadlineNs; /**< Expiry on the fohMonoNs() clock */
+	size_t slot; /**< Heap position, managed by the loop */
+};
+
+/**
+ *  @brief epoll based event loop
+ *
+ *  Watches and timers are owned by the caller (typically a coroutine
+ *  frame), so arming them never allocates. File descriptors are registered
+ *  once with watch() and then armed one-shot for the next wait. Everything
+ *  except post() and stop() must be called from the loop thread.
+ */
+class FOHEventLoop {
+public:
+	FOHEventLoop();
+	~FOHEventLoop();
+
+	/**
+	 *  @brief Register a file descriptor (not armed yet)
+	 *
+	 *  A hangup or error while the descriptor isn't armed is reported to
+	 *  w once (if w->fn is set).
+	 *
+	 *  @param fd File descriptor
+	 *  @param w Callback for its events
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int watch(int fd, FOHLoopWatch* w);
+
+	/**
+	 *  @brief Wait once for events on a registered descriptor
+	 *
+	 *  @param fd File descriptor passed to watch()
+	 *  @param w Callback for its events
+	 *  @param events EPOLLIN and/or EPOLLOUT (0 disarms, w is let go)
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int arm(int fd, FOHLoopWatch* w, uint32_t events);
+
+	/**
+	 *  @brief Register a descriptor shared by a reader and a writer
+	 *
+	 *  @param fd File descriptor
+	 *  @param f Registration, must stay valid until unwatch()
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int watch(int fd, FOHLoopFd* f);
+
+	/**
+	 *  @brief Wait once for one or both directions of a shared descriptor
+	 *
+	 *  A hangup or error is reported to every waiting direction.
+	 *
+	 *  @param f Registration passed to watch()
+	 *  @param w Callback, stays in use until it ran or disarm() is called
+	 *  @param events EPOLLIN and/or EPOLLOUT
+	 *
+	 *	@return 0 on success, -1 if a direction already has a waiter or on error.
+	 */
+	int arm(FOHLoopFd* f, FOHLoopWatch* w, uint32_t events);
+
+	/**
+	 *  @brief Stop waiting with w, other directions stay armed
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int disarm(FOHLoopFd* f, FOHLoopWatch* w);
+
+	/**
+	 *  @brief Remove a descriptor
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int unwatch(int fd);
+
+	/**
+	 *  @brief Start a timer (deadlineNs must be set)
+	 */
+	void addTimer(FOHLoopTimer* t);
+
+	/**
+	 *  @brief Stop a timer that hasn't fired (no-op otherwise)
+	 */
+	void cancelTimer(FOHLoopTimer* t);
+
+	/**
+	 *  @brief Run a function on the loop thread (thread-safe)
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int post(void (*fn)(void*), void* ctx);
+
+	/**
+	 *  @brief Wait for and dispatch one batch of events
+	 *
+	 *  @param timeoutMs Longest wait (-1: until something happens)
+	 *
+	 *	@return Number of callbacks run when successful, -1 otherwise.
+	 */
+	int runOnce(int timeoutMs);
+
+	/**
+	 *  @brief Dispatch events until stop() is called
+	 */
+	void run();
+
+	/**
+	 *  @brief Make run() return (thread-safe)
+	 */
+	void stop();
+
+	/**
+	 *  @brief Number of running timers
+	 */
+	size_t timers() const { return _heap.size(); }
+
+private:
+	void _siftUp(size_t i);
+	void _siftDown(size_t i);
+	void _wake();
+	int _rearm(FOHLoopFd* f);
+	static void _onFd(void* ctx, uint32_t events);
+
+	struct _posted {
+		void (*fn)(void*);
+		void* ctx;
+	};
+
+	int _epfd; /**< epoll instance */
+	int _evfd; /**< eventfd for post() and stop() */
+	std::atomic<bool> _stop; /**< run() should return */
+	FOHLoopWatch _parked; /**< Disarmed descriptors point here, no callback */
+	std::vector<FOHLoopTimer*> _heap; /**< Timers, earliest first */
+	std::vector<_posted> _posts; /**< Pending post() calls */
+	std::vector<_posted> _running; /**< post() calls being run */
+	std::mutex _postLock; /**< Protects _posts */
+};
+
+#endif
@@ -0,0 +1,364 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file filesink.cpp
+ * @brief Asynchronous batched capture file writer.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "filesink.h"
+#include "serial.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ *  @param prefix Path prefix of the files
+ *  @param bufBytes Size of one buffer (rounded up to FOH_FILE_BLOCK)
+ *  @param buffers Number of buffers
+ *  @param direct Try O_DIRECT
+ *  @param flushMs Longest time data stays in a partly filled buffer
+ */
+FOHFileSink::FOHFileSink(const char* prefix, size_t bufBytes, int buffers, bool direct, int flushMs)
+	: _prefix(prefix), _flushMs(flushMs > 0 ? flushMs : 1), _maxBytes(0), _maxNs(0),
+	  _direct(direct), _cur(NULL), _writing(false), _flushReq(false), _stop(false), _fd(-1), _fileBytes(0), _fileOpened(0), _seq(0) {
+	memset(&_st, 0, sizeof(_st));
+	_bufBytes = (bufBytes + FOH_FILE_BLOCK - 1) / FOH_FILE_BLOCK * FOH_FILE_BLOCK;
+	if (_bufBytes == 0)
+		_bufBytes = FOH_FILE_BLOCK;
+	if (buffers < 2)
+		buffers = 2;
+
+	for (int i = 0; i < buffers; i++) {
+		void* p = NULL;
+		//One spare block for the padding of O_DIRECT writes
+		if (posix_memalign(&p, FOH_FILE_BLOCK, _bufBytes + FOH_FILE_BLOCK) != 0)
+			break;
+		_buf* b = new _buf;
+		b->data = (char*)p;
+		b->used = 0;
+		_all.push_back(b);
+		_free.push_back(b);
+	}
+	if (_free.empty() == false) {
+		_cur = _free.back();
+		_free.pop_back();
+	}
+
+	_thread = std::thread(&FOHFileSink::_run, this);
+}
+
+FOHFileSink::~FOHFileSink() {
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		_stop = true;
+	}
+	_work.notify_one();
+	_thread.join();
+
+	if (_fd >= 0)
+		close(_fd);
+	for (size_t i = 0; i < _all.size(); i++) {
+		free(_all[i]->data);
+		delete _all[i];
+	}
+}
+
+/**
+ *  @brief Start a new file after maxBytes or maxNs (0: no limit)
+ *
+ *  Takes effect with the next file.
+ */
+void FOHFileSink::setRotation(uint64_t maxBytes, uint64_t maxNs) {
+	std::lock_guard<std::mutex> l(_lock);
+	_maxBytes = maxBytes;
+	_maxNs = maxNs;
+}
+
+int FOHFileSink::push(int port, int dir, uint64_t tsNs, const void* data, size_t len) {
+	return _put(tsNs, port, dir, FOH_CAP_DATA, data, len);
+}
+
+/**
+ *  @brief Store samples, split into records that fit a buffer
+ */
+int FOHFileSink::pushSamples(const FOHSample* s, size_t n) {
+	size_t per = (_bufBytes - sizeof(FOHCapRecord)) / sizeof(FOHSample);
+	int ret = 0;
+	for (size_t i = 0; i < n; i += per) {
+		size_t k = n - i < per ? n - i : per;
+		if (_put(s[i].hostNs, s[i].port, FOH_DIR_RX, FOH_CAP_SAMPLES, s + i, k * sizeof(FOHSample)) < 0)
+			ret = -1;
+	}
+	return ret;
+}
+
+/**
+ *  @brief Write out and sync everything buffered so far
+ *
+ *	@return 0 when everything is out, 1 on timeout, -1 on error.
+ */
+int FOHFileSink::flush(int timeoutMs) {
+	std::unique_lock<std::mutex> l(_lock);
+	uint64_t errors = _st.writeErrors;
+	_flushReq = true;
+	_work.notify_one();
+
+	bool done = _idle.wait_for(l, std::chrono::milliseconds(timeoutMs), [this] {
+		return _flushReq == false;
+	});
+	if (done == false)
+		return 1;
+	return _st.writeErrors != errors ? -1 : 0;
+}
+
+FOHFileSinkStats FOHFileSink::stats() {
+	std::lock_guard<std::mutex> l(_lock);
+	FOHFileSinkStats s = _st;
+	s.direct = _direct;
+	return s;
+}
+
+/**
+ *  @brief Path of the file being written
+ */
+std::string FOHFileSink::currentFile() {
+	std::lock_guard<std::mutex> l(_lock);
+	return _path;
+}
+
+/**
+ *  @brief Room for a record in the current buffer (lock held)
+ *
+ *  @return Destination, NULL if no buffer is free
+ */
+char* FOHFileSink::_reserve(size_t size) {
+	if (size > _bufBytes)
+		return NULL;
+
+	if (_cur != NULL && _cur->used + size > _bufBytes) {
+		_full.push_back(_cur);
+		_st.backlogBytes += _cur->used;
+		if (_st.backlogBytes > _st.maxBacklogBytes)
+			_st.maxBacklogBytes = _st.backlogBytes;
+		_work.notify_one();
+
+		_cur = NULL;
+		if (_free.empty() == false) {
+			_cur = _free.back();
+			_free.pop_back();
+		}
+	}
+	if (_cur == NULL)
+		return NULL;
+
+	char* p = _cur->data + _cur->used;
+	_cur->used += size;
+	return p;
+}
+
+int FOHFileSink::_put(uint64_t tsNs, uint32_t port, uint16_t dir, uint16_t type, const void* data, uint32_t len) {
+	size_t size = fohCapRecordSize(len);
+
+	std::lock_guard<std::mutex> l(_lock);
+	char* dst = _reserve(size);
+	if (dst == NULL) {
+		_st.droppedBytes += size;
+		return -1;
+	}
+
+	fohCapPut(dst, tsNs, port, dir, type, data, len);
+	_st.bytesIn += size;
+	return 0;
+}
+
+/**
+ *  @brief Start the next file (writer thread)
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHFileSink::_open() {
+	if (_fd >= 0)
+		close(_fd);
+
+	std::string path = _prefix + "-" + std::to_string(_seq++) + ".fohcap";
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	_fd = -1;
+	if (_direct) {
+		_fd = open(path.c_str(), flags | O_DIRECT, 0644);
+		if (_fd < 0 && errno == EINVAL) {
+			std::lock_guard<std::mutex> l(_lock);
+			_direct = false;
+		}
+	}
+	if (_fd < 0 && _direct == false)
+		_fd = open(path.c_str(), flags, 0644);
+	if (_fd < 0)
+		return -1;
+
+	uint64_t maxBytes;
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		maxBytes = _maxBytes;
+		_path = path;
+		_st.files++;
+	}
+	//Keep the size at the data, so readers never see the preallocated zeros
+	if (maxBytes > 0)
+		fallocate(_fd, FALLOC_FL_KEEP_SIZE, 0, maxBytes);
+
+	//Header, padded to a block for O_DIRECT
+	size_t len = _direct ? FOH_FILE_BLOCK : sizeof(FOHCapHeader);
+	void* blk = NULL;
+	if (posix_memalign(&blk, FOH_FILE_BLOCK, FOH_FILE_BLOCK) != 0)
+		return -1;
+	fohCapHeader((FOHCapHeader*)blk);
+	if (_direct)
+		fohCapPad((char*)blk + sizeof(FOHCapHeader), FOH_FILE_BLOCK - sizeof(FOHCapHeader));
+
+	ssize_t n = pwrite(_fd, blk, len, 0);
+	free(blk);
+	if (n != (ssize_t)len) {
+		//Don't leave a file without header behind
+		close(_fd);
+		_fd = -1;
+		unlink(path.c_str());
+		return -1;
+	}
+
+	_fileBytes = len;
+	_fileOpened = fohMonoNs();
+	return 0;
+}
+
+/**
+ *  @brief Write one buffer, rotating before it if due (writer thread)
+ *
+ *  After a failed or short write the next buffer goes to a new file.
+ */
+void FOHFileSink::_write(_buf* b) {
+	size_t len = b->used;
+	if (_direct) {
+		size_t padded = (len + FOH_FILE_BLOCK - 1) / FOH_FILE_BLOCK * FOH_FILE_BLOCK;
+		if (padded > len && padded - len < sizeof(FOHCapRecord))
+			padded += FOH_FILE_BLOCK;
+		if (padded > len)
+			fohCapPad(b->data + len, padded - len);
+		len = padded;
+	}
+
+	uint64_t maxBytes, maxNs;
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		maxBytes = _maxBytes;
+		maxNs = _maxNs;
+	}
+
+	uint64_t now = fohMonoNs();
+	bool rotate = _fd < 0;
+	if (maxBytes > 0 && _fileBytes + len > maxBytes && _fileBytes > FOH_FILE_BLOCK)
+		rotate = true;
+	if (maxNs > 0 && now - _fileOpened >= maxNs)
+		rotate = true;
+
+	bool ok = true;
+	if (rotate && _open() < 0)
+		ok = false;
+
+	//O_DIRECT may have been dropped by _open(); the padding is harmless then
+	size_t done = 0;
+	while (ok && done < len) {
+		ssize_t n = pwrite(_fd, b->data + done, len - done, _fileBytes + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			ok = false;
+		else
+			done += n;
+	}
+	_fileBytes += done;
+
+	//A torn buffer ends the file, also O_DIRECT needs aligned offsets
+	if (ok == false && _fd >= 0) {
+		close(_fd);
+		_fd = -1;
+	}
+
+	uint64_t took = fohMonoNs() - now;
+	std::lock_guard<std::mutex> l(_lock);
+	_st.bytesWritten += done;
+	if (ok == false)
+		_st.writeErrors++;
+	if (took > _st.maxWriteNs)
+		_st.maxWriteNs = took;
+}
+
+void FOHFileSink::_run() {
+	std::unique_lock<std::mutex> l(_lock);
+	for (;;) {
+		bool timeout = false;
+		if (_full.empty() && _stop == false && _flushReq == false)
+			timeout = _work.wait_for(l, std::chrono::milliseconds(_flushMs)) == std::cv_status::timeout;
+
+		//Partly filled buffer: on timeout, flush or stop
+		if (_full.empty() && (timeout || _flushReq || _stop) && _cur != NULL && _cur->used > 0) {
+			_full.push_back(_cur);
+			_st.backlogBytes += _cur->used;
+			_cur = NULL;
+			if (_free.empty() == false) {
+				_cur = _free.back();
+				_free.pop_back();
+			}
+		}
+
+		if (_full.empty()) {
+			if (_flushReq) {
+				l.unlock();
+				if (_fd >= 0)
+					fdatasync(_fd);
+				l.lock();
+				_flushReq = false;
+				_idle.notify_all();
+			}
+			if (_stop)
+				break;
+			continue;
+		}
+
+		_buf* b = _full.front();
+		_full.pop_front();
+		_writing = true;
+		l.unlock();
+
+		_write(b);
+
+		l.lock();
+		_st.backlogBytes -= b->used;
+		b->used = 0;
+		_writing = false;
+		if (_cur == NULL)
+			_cur = b;
+		else
+			_free.push_back(b);
+	}
+}
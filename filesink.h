@@ -0,0 +1,148 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file filesink.h
+ * @brief Asynchronous batched capture file writer.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_FILESINK_H
+#define FOH_FILESINK_H
+
+#include "sink.h"
+#include "capture.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Write alignment for O_DIRECT
+#define FOH_FILE_BLOCK 4096
+
+/**
+ *  @brief File sink counters (snapshot)
+ */
+struct FOHFileSinkStats {
+	uint64_t bytesIn; /**< Record bytes accepted */
+	uint64_t bytesWritten; /**< Bytes written to files (with padding) */
+	uint64_t droppedBytes; /**< Record bytes dropped, no buffer was free */
+	uint64_t backlogBytes; /**< Bytes waiting for the writer now */
+	uint64_t maxBacklogBytes; /**< Largest backlog seen */
+	uint64_t maxWriteNs; /**< Slowest single write */
+	uint64_t files; /**< Files opened */
+	uint64_t writeErrors; /**< Failed writes or opens */
+	bool direct; /**< Files are written with O_DIRECT */
+};
+
+/**
+ *  @brief Sink writing raw data and samples to capture files
+ *
+ *  Records are appended to the current buffer under a short lock; full
+ *  buffers go to a writer thread. The receive path never waits for the
+ *  disk: when all buffers are queued, records are dropped and counted.
+ *  The writer also takes partly filled buffers after flushMs, so data
+ *  reaches the file with bounded delay.
+ *
+ *  Files are named <prefix>-<n>.fohcap and preallocated up to the size
+ *  limit. Rotation by size or age happens in the writer between buffers;
+ *  a failed write also ends the file, so no file holds a torn record.
+ *  With O_DIRECT, writes are padded to FOH_FILE_BLOCK with filler
+ *  records; if the file system refuses O_DIRECT, buffered I/O is used.
+ */
+class FOHFileSink : public FOHSink {
+public:
+	/**
+	 *  @param prefix Path prefix of the files
+	 *  @param bufBytes Size of one buffer (rounded up to FOH_FILE_BLOCK)
+	 *  @param buffers Number of buffers
+	 *  @param direct Try O_DIRECT
+	 *  @param flushMs Longest time data stays in a partly filled buffer
+	 */
+	FOHFileSink(const char* prefix, size_t bufBytes = 1 << 20, int buffers = 8, bool direct = false, int flushMs = 100);
+	~FOHFileSink();
+
+	/**
+	 *  @brief Start a new file after maxBytes or maxNs (0: no limit)
+	 *
+	 *  Takes effect with the next file.
+	 */
+	void setRotation(uint64_t maxBytes, uint64_t maxNs);
+
+	int push(int port, int dir, uint64_t tsNs, const void* data, size_t len) override;
+	int pushSamples(const FOHSample* s, size_t n) override;
+
+	/**
+	 *  @brief Write out and sync everything buffered so far
+	 *
+	 *	@return 0 when everything is out, 1 on timeout, -1 on error.
+	 */
+	int flush(int timeoutMs) override;
+
+	FOHFileSinkStats stats();
+
+	/**
+	 *  @brief Path of the file being written
+	 */
+	std::string currentFile();
+
+private:
+	struct _buf {
+		char* data; /**< FOH_FILE_BLOCK aligned */
+		size_t used; /**< Bytes filled */
+	};
+
+	char* _reserve(size_t size);
+	int _put(uint64_t tsNs, uint32_t port, uint16_t dir, uint16_t type, const void* data, uint32_t len);
+	int _open();
+	void _write(_buf* b);
+	void _run();
+
+	std::string _prefix; /**< File prefix */
+	size_t _bufBytes; /**< Buffer size */
+	int _flushMs; /**< Partial buffer timeout */
+	uint64_t _maxBytes; /**< Rotation size */
+	uint64_t _maxNs; /**< Rotation age */
+
+	std::vector<_buf*> _all; /**< All buffers */
+	std::mutex _lock; /**< Buffers and counters below */
+	bool _direct; /**< O_DIRECT requested and working (cleared by the writer) */
+	std::condition_variable _work; /**< Wakes the writer */
+	std::condition_variable _idle; /**< Wakes flush() */
+	_buf* _cur; /**< Buffer being filled, NULL: none free */
+	std::deque<_buf*> _full; /**< Waiting for the writer */
+	std::vector<_buf*> _free; /**< Free buffers */
+	bool _writing; /**< Writer holds a buffer */
+	bool _flushReq; /**< flush() waits */
+	bool _stop; /**< Ends the writer */
+	FOHFileSinkStats _st; /**< Counters */
+
+	int _fd; /**< Current file (writer only) */
+	std::string _path; /**< Its path */
+	uint64_t _fileBytes; /**< Its size */
+	uint64_t _fileOpened; /**< Its creation time */
+	unsigned _seq; /**< Next file number */
+	std::thread _thread; /**< Writer */
+};
+
+#endif
@@ -0,0 +1,235 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file frame.cpp
+ * @brief Prebuilt command frames with CRC-16 and in-place field patching.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "frame.h"
+
+#include <string.h>
+
+/**
+ *  @brief 256 entry lookup table for fohCrc16(), built at compile time
+ */
+struct _crcTable {
+	uint16_t t[256];
+	constexpr _crcTable() : t() {
+		for (int i = 0; i < 256; i++)
+			t[i] = fohCrc16Update(0, (uint8_t)i);
+	}
+};
+static constexpr _crcTable _crc16tab;
+
+/**
+ *  @brief CRC-16/CCITT-FALSE over a buffer (table driven, run time)
+ *
+ *  @param data Bytes to checksum
+ *  @param len Number of bytes
+ *  @param crc Initial value
+ *
+ *  @return CRC of the bytes
+ */
+uint16_t fohCrc16(const void* data, size_t len, uint16_t crc) {
+	const uint8_t* p = (const uint8_t*)data;
+
+	for (size_t i = 0; i < len; i++)
+		crc = (uint16_t)(crc << 8) ^ _crc16tab.t[(crc >> 8) ^ p[i]];
+
+	return crc;
+}
+
+/**
+ *  @brief Build a frame from its prototype
+ *
+ *  @param proto Frame bytes without CRC
+ *  @param len Prototype length
+ *  @param crcFrom First byte covered by the CRC
+ *  @param crcAt Where the 2 CRC bytes get inserted (len to append)
+ */
+FOHFrameTemplate::FOHFrameTemplate(const void* proto, size_t len, size_t crcFrom, size_t crcAt) {
+	const uint8_t* p = (const uint8_t*)proto;
+
+	//Clamp nonsense ranges instead of failing, an empty range gives CRC 0xFFFF
+	if (crcAt > len) crcAt = len;
+	if (crcFrom > crcAt) crcFrom = crcAt;
+	_crcFrom = crcFrom;
+	_crcAt = crcAt;
+
+	_buf.reserve(len + 2);
+	_buf.insert(_buf.end(), p, p + crcAt);
+	_buf.push_back(0);
+	_buf.push_back(0);
+	_buf.insert(_buf.end(), p + crcAt, p + len);
+
+	_crc = fohCrc16(_buf.data() + crcFrom, crcAt - crcFrom);
+	_buf[crcAt] = (uint8_t)(_crc >> 8);
+	_buf[crcAt + 1] = (uint8_t)_crc;
+}
+
+/**
+ *  @brief Declare a patchable field
+ *
+ *  @param offset Offset of the field within the prototype
+ *  @param len Field length in bytes
+ *
+ *	@return Field index on success, -1 otherwise.
+ */
+int FOHFrameTemplate::addField(size_t offset, size_t len) {
+	//Fields must lie within the checksummed part
+	if (len == 0 || offset < _crcFrom || offset + len > _crcAt)
+		return -1;
+
+	_field f;
+	f.offset = offset;
+	f.len = len;
+	f.contrib = _contrib.size();
+
+	/*
+	 * The CRC is affine in the covered bytes, so flipping one bit changes
+	 * it by a constant: the zero-initialised CRC of that bit followed by
+	 * the zero bytes up to the end of the covered range.
+	 */
+	for (size_t i = 0; i < len; i++) {
+		size_t tail = _crcAt - (offset + i) - 1;
+		for (int b = 0; b < 8; b++) {
+			uint16_t c = fohCrc16Update(0, (uint8_t)(1 << b));
+			for (size_t z = 0; z < tail; z++)
+				c = fohCrc16Update(c, 0);
+			_contrib.push_back(c);
+		}
+	}
+
+	_fields.push_back(f);
+	return _fields.size() - 1;
+}
+
+/**
+ *  @brief Overwrite a field and update the CRC incrementally
+ *
+ *  @param field Index returned by addField()
+ *  @param value New field bytes (exactly the field length)
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHFrameTemplate::setField(int field, const void* value) {
+	if (field < 0 || (size_t)field >= _fields.size())
+		return -1;
+
+	const _field& f = _fields[field];
+	const uint8_t* v = (const uint8_t*)value;
+	const uint16_t* contrib = &_contrib[f.contrib];
+	uint8_t* dst = &_buf[f.offset];
+
+	for (size_t i = 0; i < f.len; i++) {
+		uint8_t d = dst[i] ^ v[i];
+		while (d) {
+			_crc ^= contrib[i * 8 + __builtin_ctz(d)];
+			d &= d - 1;
+		}
+		dst[i] = v[i];
+	}
+
+	_buf[_crcAt] = (uint8_t)(_crc >> 8);
+	_buf[_crcAt + 1] = (uint8_t)_crc;
+
+	return 0;
+}
+
+/**
+ *  @brief Store an unsigned integer big-endian into a field
+ *
+ *  @param field Index returned by addField() (up to 8 bytes)
+ *  @param value Value to store, truncated to the field length
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHFrameTemplate::setFieldBE(int field, uint64_t value) {
+	if (field < 0 || (size_t)field >= _fields.size())
+		return -1;
+
+	size_t len = _fields[field].len;
+	if (len > 8)
+		return -1;
+
+	uint8_t tmp[8];
+	for (size_t i = 0; i < len; i++)
+		tmp[i] = (uint8_t)(value >> (8 * (len - 1 - i)));
+
+	return setField(field, tmp);
+}
+
+/**
+ *  @brief Segment for FOHSerial::writeToSerialPortv()
+ */
+struct iovec FOHFrameTemplate::iov() const {
+	struct iovec v;
+	v.iov_base = (void*)_buf.data();
+	v.iov_len = _buf.size();
+	return v;
+}
+
+/**
+ *  @brief Prebuild a frame
+ *
+ *  @param name Command name
+ *  @param proto Frame bytes without CRC
+ *  @param len Prototype length
+ *  @param crcFrom First byte covered by the CRC
+ *  @param crcAt Where the CRC gets inserted
+ *
+ *	@return Index of the frame on success, -1 if the name is taken.
+ */
+int FOHFrameCache::add(const std::string& name, const void* proto, size_t len, size_t crcFrom, size_t crcAt) {
+	if (_names.count(name))
+		return -1;
+
+	_frames.push_back(FOHFrameTemplate(proto, len, crcFrom, crcAt));
+	_names[name] = _frames.size() - 1;
+
+	return _frames.size() - 1;
+}
+
+/**
+ *  @brief Index of a named frame
+ *
+ *	@return Index on success, -1 otherwise.
+ */
+int FOHFrameCache::find(const std::string& name) const {
+	std::unordered_map<std::string, int>::const_iterator it = _names.find(name);
+	if (it == _names.end())
+		return -1;
+
+	return it->second;
+}
+
+/**
+ *  @brief Frame by index
+ *
+ *	@return Frame on success, NULL otherwise.
+ */
+FOHFrameTemplate* FOHFrameCache::get(int idx) {
+	if (idx < 0 || (size_t)idx >= _frames.size())
+		return NULL;
+
+	return &_frames[idx];
+}
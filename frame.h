@@ -0,0 +1,228 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file frame.h
+ * @brief Prebuilt command frames with CRC-16 and in-place field patching.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_FRAME_H
+#define FOH_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/**
+ *  @brief Feed one byte into a CRC-16/CCITT-FALSE (poly 0x1021)
+ *
+ *  Bitwise so it can be evaluated at compile time.
+ *
+ *  @param crc Running CRC
+ *  @param b Next byte
+ *
+ *  @return Updated CRC
+ */
+constexpr uint16_t fohCrc16Update(uint16_t crc, uint8_t b) {
+	crc ^= (uint16_t)(b << 8);
+	for (int i = 0; i < 8; i++)
+		crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+	return crc;
+}
+
+/**
+ *  @brief CRC-16/CCITT-FALSE over a constant string (compile time)
+ *
+ *  @param str Bytes to checksum
+ *  @param len Number of bytes
+ *  @param crc Initial value
+ *
+ *  @return CRC of the bytes
+ */
+constexpr uint16_t fohCrc16Const(const char* str, size_t len, uint16_t crc = 0xFFFF) {
+	for (size_t i = 0; i < len; i++)
+		crc = fohCrc16Update(crc, (uint8_t)str[i]);
+	return crc;
+}
+
+/**
+ *  @brief CRC-16/CCITT-FALSE over a buffer (table driven, run time)
+ *
+ *  @param data Bytes to checksum
+ *  @param len Number of bytes
+ *  @param crc Initial value
+ *
+ *  @return CRC of the bytes
+ */
+uint16_t fohCrc16(const void* data, size_t len, uint16_t crc = 0xFFFF);
+
+/**
+ *  @brief Fully static command frame, checksummed at compile time
+ *
+ *  Holds the command bytes followed by the big-endian CRC-16 of them.
+ *  Example: static constexpr FOHStaticFrame<5> stop("STOP");
+ */
+template <size_t N>
+struct FOHStaticFrame {
+	uint8_t bytes[N + 1]; /**< Command (without NUL) + 2 CRC bytes */
+
+	constexpr FOHStaticFrame(const char (&cmd)[N]) : bytes() {
+		for (size_t i = 0; i < N - 1; i++)
+			bytes[i] = (uint8_t)cmd[i];
+		uint16_t crc = fohCrc16Const(cmd, N - 1);
+		bytes[N - 1] = (uint8_t)(crc >> 8);
+		bytes[N] = (uint8_t)crc;
+	}
+
+	constexpr size_t size() const { return N + 1; }
+
+	/**
+	 *  @brief Segment for FOHSerial::writeToSerialPortv()
+	 */
+	struct iovec iov() const {
+		struct iovec v;
+		v.iov_base = (void*)bytes;
+		v.iov_len = N + 1;
+		return v;
+	}
+};
+
+/**
+ *  @brief Prebuilt frame with patchable fields
+ *
+ *  The frame is laid out once from a prototype. A CRC-16 over
+ *  [crcFrom, crcAt) is stored big-endian at crcAt, bytes after it
+ *  (e.g. a line terminator) are left uncovered. Fields inside the
+ *  covered range can be overwritten later; the CRC is then corrected
+ *  from the changed bits only, without rescanning the frame.
+ */
+class FOHFrameTemplate {
+public:
+	/**
+	 *  @brief Build a frame from its prototype
+	 *
+	 *  @param proto Frame bytes without CRC
+	 *  @param len Prototype length
+	 *  @param crcFrom First byte covered by the CRC
+	 *  @param crcAt Where the 2 CRC bytes get inserted (len to append)
+	 */
+	FOHFrameTemplate(const void* proto, size_t len, size_t crcFrom, size_t crcAt);
+
+	/**
+	 *  @brief Declare a patchable field
+	 *
+	 *  @param offset Offset of the field within the prototype
+	 *  @param len Field length in bytes
+	 *
+	 *	@return Field index on success, -1 otherwise.
+	 */
+	int addField(size_t offset, size_t len);
+
+	/**
+	 *  @brief Overwrite a field and update the CRC incrementally
+	 *
+	 *  @param field Index returned by addField()
+	 *  @param value New field bytes (exactly the field length)
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int setField(int field, const void* value);
+
+	/**
+	 *  @brief Store an unsigned integer big-endian into a field
+	 *
+	 *  @param field Index returned by addField() (up to 8 bytes)
+	 *  @param value Value to store, truncated to the field length
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int setFieldBE(int field, uint64_t value);
+
+	const uint8_t* data() const { return _buf.data(); }
+	size_t size() const { return _buf.size(); }
+	uint16_t crc() const { return _crc; }
+
+	/**
+	 *  @brief Segment for FOHSerial::writeToSerialPortv()
+	 */
+	struct iovec iov() const;
+
+private:
+	struct _field {
+		size_t offset; /**< Offset in the final frame */
+		size_t len; /**< Length in bytes */
+		size_t contrib; /**< First entry in _contrib (8 per byte) */
+	};
+
+	std::vector<uint8_t> _buf; /**< Ready-to-send frame */
+	std::vector<_field> _fields; /**< Patchable fields */
+	std::vector<uint16_t> _contrib; /**< CRC change caused by each field bit */
+	size_t _crcFrom; /**< Start of CRC coverage */
+	size_t _crcAt; /**< Offset of the CRC bytes */
+	uint16_t _crc; /**< Current CRC */
+};
+
+/**
+ *  @brief Set of prebuilt frames looked up by name or index
+ *
+ *  Build every command once at startup, then fetch it by index in the
+ *  send loop (the name lookup is only meant for setup code).
+ */
+class FOHFrameCache {
+public:
+	/**
+	 *  @brief Prebuild a frame
+	 *
+	 *  @param name Command name
+	 *  @param proto Frame bytes without CRC
+	 *  @param len Prototype length
+	 *  @param crcFrom First byte covered by the CRC
+	 *  @param crcAt Where the CRC gets inserted
+	 *
+	 *	@return Index of the frame on success, -1 if the name is taken.
+	 */
+	int add(const std::string& name, const void* proto, size_t len, size_t crcFrom, size_t crcAt);
+
+	/**
+	 *  @brief Index of a named frame
+	 *
+	 *	@return Index on success, -1 otherwise.
+	 */
+	int find(const std::string& name) const;
+
+	/**
+	 *  @brief Frame by index
+	 *
+	 *	@return Frame on success, NULL otherwise.
+	 */
+	FOHFrameTemplate* get(int idx);
+
+	size_t count() const { return _frames.size(); }
+
+private:
+	std::vector<FOHFrameTemplate> _frames; /**< Prebuilt frames */
+	std::unordered_map<std::string, int> _names; /**< Name -> index */
+};
+
+#endif
@@ -0,0 +1,186 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file gorilla.cpp
+ * @brief Delta-of-delta timestamp and XOR float compression (Gorilla).
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "gorilla.h"
+
+#include <string.h>
+
+/*
+ * Both encoders first compute the differences in a plain array pass the
+ * compiler vectorises, then pack bits serially.
+ */
+
+static inline uint64_t _zigzag(int64_t v) {
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t _unzigzag(uint64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/**
+ *  @brief Delta-of-delta encode timestamps
+ *
+ *  Regular sampling makes the second difference small or zero: 0 costs
+ *  one bit, jitter of a few us in ns timestamps about 3 bytes.
+ *
+ *  @param ts Timestamps
+ *  @param n Number of timestamps
+ *  @param out Encoded bytes are appended here
+ */
+void fohDodEncode(const uint64_t* ts, size_t n, std::vector<char>& out) {
+	if (n == 0)
+		return;
+
+	std::vector<uint64_t> z(n);
+	z[0] = 0;
+	if (n > 1)
+		z[1] = _zigzag((int64_t)(ts[1] - ts[0]));
+	for (size_t i = 2; i < n; i++)
+		z[i] = _zigzag((int64_t)(ts[i] - 2 * ts[i - 1] + ts[i - 2]));
+
+	FOHBitWriter w(out);
+	w.put(ts[0], 64);
+	for (size_t i = 1; i < n; i++) {
+		uint64_t v = z[i];
+		if (v == 0) {
+			w.put(0, 1);
+		} else if (v < (1ULL << 7)) {
+			w.put(0x2, 2);
+			w.put(v, 7);
+		} else if (v < (1ULL << 12)) {
+			w.put(0x6, 3);
+			w.put(v, 12);
+		} else if (v < (1ULL << 20)) {
+			w.put(0xE, 4);
+			w.put(v, 20);
+		} else if (v < (1ULL << 32)) {
+			w.put(0x1E, 5);
+			w.put(v, 32);
+		} else {
+			w.put(0x1F, 5);
+			w.put(v, 64);
+		}
+	}
+	w.finish();
+}
+
+/**
+ *	@return true on success, false if the data is damaged.
+ */
+bool fohDodDecode(const void* data, size_t len, uint64_t* ts, size_t n) {
+	if (n == 0)
+		return true;
+
+	static const int widths[] = { 7, 12, 20, 32, 64 };
+	FOHBitReader r(data, len);
+	ts[0] = r.get(64);
+	uint64_t delta = 0; //Unsigned, so it wraps like the encoder's differences
+	for (size_t i = 1; i < n; i++) {
+		int ones = 0;
+		while (ones < 5 && r.bit())
+			ones++;
+		int64_t dod = ones == 0 ? 0 : _unzigzag(r.get(widths[ones - 1]));
+		delta += (uint64_t)dod;
+		ts[i] = ts[i - 1] + delta;
+	}
+	return r.bad() == false;
+}
+
+/**
+ *  @brief XOR encode values (Gorilla)
+ *
+ *  Each value is XORed with its predecessor. Repeated values cost one bit;
+ *  slowly changing ones only their differing middle bits, reusing the
+ *  previous bit window where possible.
+ *
+ *  @param v Values
+ *  @param n Number of values
+ *  @param out Encoded bytes are appended here
+ */
+void fohGorillaEncode(const double* v, size_t n, std::vector<char>& out) {
+	if (n == 0)
+		return;
+
+	std::vector<uint64_t> b(n), x(n);
+	memcpy(b.data(), v, n * sizeof(double));
+	x[0] = b[0];
+	for (size_t i = 1; i < n; i++)
+		x[i] = b[i] ^ b[i - 1];
+
+	FOHBitWriter w(out);
+	w.put(x[0], 64);
+	int lead = -1, trail = 0;
+	for (size_t i = 1; i < n; i++) {
+		uint64_t d = x[i];
+		if (d == 0) {
+			w.put(0, 1);
+			continue;
+		}
+
+		int lz = __builtin_clzll(d), tz = __builtin_ctzll(d);
+		if (lead >= 0 && lz >= lead && tz >= trail) {
+			w.put(0x2, 2);
+			w.put(d >> trail, 64 - lead - trail);
+		} else {
+			int bits = 64 - lz - tz;
+			w.put(0x3, 2);
+			w.put(lz, 6);
+			w.put(bits - 1, 6);
+			w.put(d >> tz, bits);
+			lead = lz;
+			trail = tz;
+		}
+	}
+	w.finish();
+}
+
+/**
+ *	@return true on success, false if the data is damaged.
+ */
+bool fohGorillaDecode(const void* data, size_t len, double* v, size_t n) {
+	if (n == 0)
+		return true;
+
+	FOHBitReader r(data, len);
+	uint64_t prev = r.get(64);
+	memcpy(&v[0], &prev, 8);
+	int lead = 0, trail = 0;
+	for (size_t i = 1; i < n; i++) {
+		if (r.bit()) {
+			if (r.bit()) {
+				lead = r.get(6);
+				int bits = r.get(6) + 1;
+				trail = 64 - lead - bits;
+				if (trail < 0)
+					return false;
+			}
+			prev ^= r.get(64 - lead - trail) << trail;
+		}
+		memcpy(&v[i], &prev, 8);
+	}
+	return r.bad() == false;
+}
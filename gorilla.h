@@ -0,0 +1,159 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file gorilla.h
+ * @brief Delta-of-delta timestamp and XOR float compression (Gorilla).
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_GORILLA_H
+#define FOH_GORILLA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ *  @brief MSB-first bit packer appending to a byte vector
+ */
+class FOHBitWriter {
+public:
+	FOHBitWriter(std::vector<char>& out) : _out(out), _acc(0), _n(0) {}
+
+	/**
+	 *  @brief Append the low bits of v (1 to 64)
+	 */
+	void put(uint64_t v, int bits) {
+		if (bits < 64)
+			v &= (1ULL << bits) - 1;
+		int room = 64 - _n;
+		if (bits < room) {
+			_acc |= v << (room - bits);
+			_n += bits;
+			return;
+		}
+		int rest = bits - room;
+		_acc |= rest < 64 ? v >> rest : 0;
+		_emit(_acc);
+		_acc = rest > 0 ? v << (64 - rest) : 0;
+		_n = rest;
+	}
+
+	/**
+	 *  @brief Write out the last partial byte
+	 */
+	void finish() {
+		for (int i = 0; i < (_n + 7) / 8; i++)
+			_out.push_back((char)(_acc >> (56 - 8 * i)));
+		_acc = 0;
+		_n = 0;
+	}
+
+private:
+	void _emit(uint64_t w) {
+		char b[8];
+		for (int i = 0; i < 8; i++)
+			b[i] = (char)(w >> (56 - 8 * i));
+		_out.insert(_out.end(), b, b + 8);
+	}
+
+	std::vector<char>& _out; /**< Destination */
+	uint64_t _acc; /**< Pending bits, MSB first */
+	int _n; /**< Number of pending bits */
+};
+
+/**
+ *  @brief Reader for FOHBitWriter output
+ */
+class FOHBitReader {
+public:
+	FOHBitReader(const void* data, size_t len)
+		: _p((const uint8_t*)data), _end((const uint8_t*)data + len), _cur(0), _avail(0), _bad(false) {}
+
+	/**
+	 *  @brief Next bits (1 to 64); reading past the end sets bad()
+	 */
+	uint64_t get(int bits) {
+		uint64_t v = 0;
+		while (bits > 0) {
+			if (_avail == 0) {
+				if (_p == _end) {
+					_bad = true;
+					return 0;
+				}
+				_cur = *_p++;
+				_avail = 8;
+			}
+			int take = bits < _avail ? bits : _avail;
+			v = (v << take) | ((_cur >> (_avail - take)) & ((1u << take) - 1));
+			_avail -= take;
+			bits -= take;
+		}
+		return v;
+	}
+
+	bool bit() { return get(1) != 0; }
+	bool bad() const { return _bad; }
+
+private:
+	const uint8_t* _p; /**< Next byte */
+	const uint8_t* _end; /**< End of data */
+	uint32_t _cur; /**< Current byte */
+	int _avail; /**< Unread bits of it */
+	bool _bad; /**< Ran out of data */
+};
+
+/**
+ *  @brief Delta-of-delta encode timestamps
+ *
+ *  Regular sampling makes the second difference small or zero: 0 costs
+ *  one bit, jitter of a few us in ns timestamps about 3 bytes.
+ *
+ *  @param ts Timestamps
+ *  @param n Number of timestamps
+ *  @param out Encoded bytes are appended here
+ */
+void fohDodEncode(const uint64_t* ts, size_t n, std::vector<char>& out);
+
+/**
+ *	@return true on success, false if the data is damaged.
+ */
+bool fohDodDecode(const void* data, size_t len, uint64_t* ts, size_t n);
+
+/**
+ *  @brief XOR encode values (Gorilla)
+ *
+ *  Each value is XORed with its predecessor. Repeated values cost one bit;
+ *  slowly changing ones only their differing middle bits, reusing the
+ *  previous bit window where possible.
+ *
+ *  @param v Values
+ *  @param n Number of values
+ *  @param out Encoded bytes are appended here
+ */
+void fohGorillaEncode(const double* v, size_t n, std::vector<char>& out);
+
+/**
+ *	@return true on success, false if the data is damaged.
+ */
+bool fohGorillaDecode(const void* data, size_t len, double* v, size_t n);
+
+#endif
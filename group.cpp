@@ -0,0 +1,197 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file group.cpp
+ * @brief Groups of ports that are managed together.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "group.h"
+
+#include <errno.h>
+#include <string.h>
+
+//Poll interval while draining
+#define FOH_GROUP_POLL_NS 1000000ULL
+
+FOHPortGroup::FOHPortGroup() {
+}
+
+/**
+ *  @brief Add a port
+ *
+ *  @param port Open port
+ *  @param txq Its transmit queue (optional)
+ *
+ *  @return Index of the port within the group
+ */
+int FOHPortGroup::addPort(FOHSerial* port, FOHTxQueue* txq) {
+	_member m;
+	m.port = port;
+	m.txq = txq;
+	_ports.push_back(m);
+
+	return _ports.size() - 1;
+}
+
+/**
+ *  @brief Add a sink to flush on shutdown
+ */
+void FOHPortGroup::addSink(FOHSink* sink) {
+	_sinks.push_back(sink);
+}
+
+/**
+ *  @brief Stop the group within a bounded time
+ *
+ *  Transmit queues stop accepting frames, blocked readers are cancelled,
+ *  queued frames and the kernel output queues drain in parallel across
+ *  ports (tcdrain() at the end), then the sinks are flushed with the time
+ *  that is left. Whatever hasn't gone out by the deadline is discarded.
+ *
+ *  The threads that run service() on the transmit queues must have stopped
+ *  before: a port whose queue is still serviced elsewhere is left alone
+ *  (its frames aren't sent or discarded, the port isn't closed) and -1 is
+ *  returned.
+ *
+ *  @param timeoutMs Time limit for the whole shutdown
+ *  @param stats Per port results (optional)
+ *  @param closePorts Close the ports afterwards
+ *
+ *	@return 0 when everything drained and flushed, 1 on timeout, -1 on error.
+ */
+int FOHPortGroup::shutdown(int timeoutMs, std::vector<FOHShutdownStats>* stats, bool closePorts) {
+	enum { QUEUE, KERNEL, DONE };
+	uint64_t start = fohMonoNs();
+	uint64_t deadline = start + (uint64_t)(timeoutMs > 0 ? timeoutMs : 0) * 1000000ULL;
+	std::vector<FOHShutdownStats> st(_ports.size());
+	std::vector<int> state(_ports.size());
+	std::vector<bool> busy(_ports.size()); //Queue serviced by another thread
+	size_t left = _ports.size();
+	int ret = 0;
+	size_t i;
+
+	_cancel.cancel();
+
+	for (i = 0; i < _ports.size(); i++) {
+		memset(&st[i], 0, sizeof st[i]);
+		st[i].port = i;
+		st[i].outqLeft = -1;
+		state[i] = KERNEL;
+		if (_ports[i].txq) {
+			_ports[i].txq->close();
+			state[i] = QUEUE;
+		}
+	}
+
+	//Drain all ports side by side so a slow one doesn't eat the others' time
+	while (left > 0) {
+		for (i = 0; i < _ports.size(); i++) {
+			_member& m = _ports[i];
+
+			if (state[i] == QUEUE) {
+				//EBUSY: the application still services the queue
+				int w = m.txq->service(0);
+				if (w > 0)
+					st[i].sentBytes += w;
+				if (w < 0) {
+					busy[i] = errno == EBUSY;
+					state[i] = DONE;
+					left--;
+					ret = -1;
+				} else if (m.txq->unsentBytes() == 0) {
+					state[i] = KERNEL;
+				}
+			}
+
+			if (state[i] == KERNEL) {
+				int d = m.port->drainOutput(0);
+				if (d != 1) {
+					state[i] = DONE;
+					left--;
+					st[i].drained = d == 0;
+					st[i].outqLeft = d == 0 ? 0 : -1;
+					st[i].elapsedNs = fohMonoNs() - start;
+					if (d < 0)
+						ret = -1;
+				}
+			}
+		}
+
+		uint64_t now = fohMonoNs();
+		if (left == 0 || now >= deadline)
+			break;
+
+		uint64_t wait = deadline - now < FOH_GROUP_POLL_NS ? deadline - now : FOH_GROUP_POLL_NS;
+		struct timespec ts;
+		ts.tv_sec = 0;
+		ts.tv_nsec = wait;
+		nanosleep(&ts, NULL);
+	}
+
+	//Out of time: give up on the rest so close() doesn't hang
+	for (i = 0; i < _ports.size(); i++) {
+		if (state[i] == DONE)
+			continue;
+
+		if (_ports[i].txq) {
+			errno = 0;
+			st[i].discardedBytes = _ports[i].txq->discard();
+			if (errno == EBUSY) {
+				busy[i] = true;
+				ret = -1;
+				continue;
+			}
+		}
+		st[i].outqLeft = _ports[i].port->outputQueueBytes();
+		if (st[i].outqLeft > 0)
+			st[i].discardedBytes += st[i].outqLeft;
+		_ports[i].port->discardOutput();
+		st[i].elapsedNs = fohMonoNs() - start;
+		if (ret == 0)
+			ret = 1;
+	}
+
+	//Sinks get the remaining time, but at least a chance to try
+	for (i = 0; i < _sinks.size(); i++) {
+		uint64_t now = fohMonoNs();
+		int ms = now < deadline ? (int)((deadline - now) / 1000000ULL) : 0;
+		int r = _sinks[i]->flush(ms);
+		if (r < 0)
+			ret = -1;
+		else if (r > 0 && ret == 0)
+			ret = 1;
+	}
+
+	for (i = 0; i < _ports.size(); i++) {
+		if (_ports[i].txq) {
+			for (int p = 0; p < FOH_TX_PRIOS; p++)
+				st[i].tx[p] = _ports[i].txq->stats(p);
+		}
+		if (closePorts && busy[i] == false)
+			_ports[i].port->closeSerialPort();
+	}
+
+	if (stats)
+		stats->swap(st);
+
+	return ret;
+}
@@ -0,0 +1,116 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file group.h
+ * @brief Groups of ports that are managed together.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_GROUP_H
+#define FOH_GROUP_H
+
+#include "serial.h"
+#include "txqueue.h"
+#include "cancel.h"
+#include "sink.h"
+
+#include <vector>
+
+/**
+ *  @brief Outcome of shutting down one port
+ */
+struct FOHShutdownStats {
+	int port; /**< Index within the group */
+	uint64_t sentBytes; /**< Queued bytes sent during shutdown */
+	uint64_t discardedBytes; /**< Queued bytes given up on */
+	int outqLeft; /**< Bytes still in the kernel queue when giving up (-1: unknown) */
+	bool drained; /**< Everything went out */
+	uint64_t elapsedNs; /**< Time until the port was done */
+	FOHTxStats tx[FOH_TX_PRIOS]; /**< Final transmit statistics */
+};
+
+/**
+ *  @brief Set of ports with their transmit queues and sinks
+ *
+ *  Readers of the ports should pass cancelToken() to their blocking calls,
+ *  so shutdown() can wake them.
+ */
+class FOHPortGroup {
+public:
+	FOHPortGroup();
+
+	/**
+	 *  @brief Add a port
+	 *
+	 *  @param port Open port
+	 *  @param txq Its transmit queue (optional)
+	 *
+	 *  @return Index of the port within the group
+	 */
+	int addPort(FOHSerial* port, FOHTxQueue* txq = NULL);
+
+	/**
+	 *  @brief Add a sink to flush on shutdown
+	 */
+	void addSink(FOHSink* sink);
+
+	/**
+	 *  @brief Token cancelled by shutdown()
+	 */
+	FOHCancelToken* cancelToken() { return &_cancel; }
+
+	size_t ports() const { return _ports.size(); }
+	FOHSerial* port(int idx) { return _ports[idx].port; }
+	FOHTxQueue* txQueue(int idx) { return _ports[idx].txq; }
+
+	/**
+	 *  @brief Stop the group within a bounded time
+	 *
+	 *  Transmit queues stop accepting frames, blocked readers are cancelled,
+	 *  queued frames and the kernel output queues drain in parallel across
+	 *  ports (tcdrain() at the end), then the sinks are flushed with the time
+	 *  that is left. Whatever hasn't gone out by the deadline is discarded.
+	 *
+	 *  The threads that run service() on the transmit queues must have stopped
+	 *  before: a port whose queue is still serviced elsewhere is left alone
+	 *  (its frames aren't sent or discarded, the port isn't closed) and -1 is
+	 *  returned.
+	 *
+	 *  @param timeoutMs Time limit for the whole shutdown
+	 *  @param stats Per port results (optional)
+	 *  @param closePorts Close the ports afterwards
+	 *
+	 *	@return 0 when everything drained and flushed, 1 on timeout, -1 on error.
+	 */
+	int shutdown(int timeoutMs, std::vector<FOHShutdownStats>* stats = NULL, bool closePorts = true);
+
+private:
+	struct _member {
+		FOHSerial* port; /**< Port */
+		FOHTxQueue* txq; /**< Its transmit queue, or NULL */
+	};
+
+	std::vector<_member> _ports; /**< Members */
+	std::vector<FOHSink*> _sinks; /**< Sinks to flush */
+	FOHCancelToken _cancel; /**< Wakes blocked readers */
+};
+
+#endif
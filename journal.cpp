@@ -0,0 +1,324 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file journal.cpp
+ * @brief Crash-safe memory mapped capture journal.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "journal.h"
+#include "serial.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+//Room kept free in every file for its closing commit marker
+#define FOH_JOURNAL_RESERVE fohCapRecordSize(sizeof(FOHJournalCommit))
+
+/**
+ *  @param prefix Path prefix of the files
+ *  @param fileBytes Size of one journal file
+ *  @param commitMs Commit interval
+ */
+FOHJournal::FOHJournal(const char* prefix, size_t fileBytes, int commitMs)
+	: _prefix(prefix), _commitMs(commitMs > 0 ? commitMs : 1), _nextSeq(0), _dirty(false), _syncReq(0), _syncDone(0), _syncResult(0), _stop(false) {
+	memset(&_st, 0, sizeof(_st));
+	_fileBytes = fileBytes & ~(size_t)(FOH_CAP_ALIGN - 1);
+	if (_fileBytes < sizeof(FOHCapHeader) + 2 * FOH_JOURNAL_RESERVE)
+		_fileBytes = 1 << 20;
+
+	_next.fd = -1;
+	_isValid = _prepare(&_cur, _nextSeq++) == 0;
+	if (_isValid)
+		_st.files++;
+	_thread = std::thread(&FOHJournal::_run, this);
+}
+
+FOHJournal::~FOHJournal() {
+	{
+		std::lock_guard<std::mutex> l(_lock);
+		_stop = true;
+	}
+	_wake.notify_one();
+	_synced.notify_all();
+	_thread.join();
+
+	_commitLocked();
+	_finish(&_cur);
+	for (size_t i = 0; i < _retired.size(); i++)
+		_finish(&_retired[i]);
+	if (_next.fd >= 0) {
+		munmap(_next.base, _fileBytes);
+		close(_next.fd);
+		unlink(_next.path.c_str());
+	}
+}
+
+int FOHJournal::push(int port, int dir, uint64_t tsNs, const void* data, size_t len) {
+	return _append(tsNs, port, dir, FOH_CAP_DATA, data, len);
+}
+
+int FOHJournal::pushSamples(const FOHSample* s, size_t n) {
+	size_t per = (_fileBytes - sizeof(FOHCapHeader) - FOH_JOURNAL_RESERVE - sizeof(FOHCapRecord)) / sizeof(FOHSample);
+	if (per > 4096)
+		per = 4096;
+
+	int ret = 0;
+	for (size_t i = 0; i < n; i += per) {
+		size_t k = n - i < per ? n - i : per;
+		if (_append(s[i].hostNs, s[i].port, FOH_DIR_RX, FOH_CAP_SAMPLES, s + i, k * sizeof(FOHSample)) < 0)
+			ret = -1;
+	}
+	return ret;
+}
+
+/**
+ *  @brief Commit and wait until the data is on disk
+ *
+ *  The journal thread does the sync, so push() isn't held up by it. On
+ *  timeout the sync still completes in the background.
+ *
+ *  @param timeoutMs Longest wait
+ *
+ *	@return 0 when everything is out, 1 on timeout, -1 on error.
+ */
+int FOHJournal::flush(int timeoutMs) {
+	std::unique_lock<std::mutex> l(_lock);
+	if (_cur.fd < 0)
+		return -1;
+	_commitLocked();
+
+	uint64_t ticket = ++_syncReq;
+	_wake.notify_one();
+	bool done = _synced.wait_for(l, std::chrono::milliseconds(timeoutMs > 0 ? timeoutMs : 0),
+			[this, ticket] { return _syncDone >= ticket || _stop; });
+	if (done == false || _syncDone < ticket)
+		return 1;
+
+	return _syncResult;
+}
+
+/**
+ *  @brief Write a commit marker now
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHJournal::commit() {
+	std::lock_guard<std::mutex> l(_lock);
+	return _commitLocked();
+}
+
+FOHJournalStats FOHJournal::stats() {
+	std::lock_guard<std::mutex> l(_lock);
+	return _st;
+}
+
+/**
+ *  @brief Create, allocate and map a journal file
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHJournal::_prepare(_file* f, unsigned seq) {
+	f->fd = -1;
+	f->path = _prefix + "-" + std::to_string(seq) + ".fohcap";
+
+	int fd = open(f->path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+
+	//Allocated blocks: stores into the mapping can't hit a full disk
+	void* m = MAP_FAILED;
+	if (posix_fallocate(fd, 0, _fileBytes) == 0)
+		m = mmap(NULL, _fileBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	if (m == MAP_FAILED) {
+		close(fd);
+		unlink(f->path.c_str());
+		return -1;
+	}
+
+	f->fd = fd;
+	f->base = (char*)m;
+	fohCapHeader((FOHCapHeader*)f->base);
+	f->used = sizeof(FOHCapHeader);
+	f->synced = 0;
+	f->seq = 0;
+	f->records = 0;
+	return 0;
+}
+
+/**
+ *  @brief Unmap a file, cut it to its data and sync it
+ */
+void FOHJournal::_finish(_file* f) {
+	if (f->fd < 0)
+		return;
+
+	munmap(f->base, _fileBytes);
+	int r = ftruncate(f->fd, f->used);
+	(void)r;
+	fdatasync(f->fd);
+	close(f->fd);
+	f->fd = -1;
+}
+
+int FOHJournal::_append(uint64_t tsNs, uint32_t port, uint16_t dir, uint16_t type, const void* data, uint32_t len) {
+	size_t size = fohCapRecordSize(len);
+
+	std::lock_guard<std::mutex> l(_lock);
+	if (_cur.fd < 0 || sizeof(FOHCapHeader) + size + FOH_JOURNAL_RESERVE > _fileBytes) {
+		_st.droppedBytes += size;
+		return -1;
+	}
+
+	if (_cur.used + size + FOH_JOURNAL_RESERVE > _fileBytes) {
+		//Close the file on a commit and continue in the prepared one
+		_commitLocked();
+		if (_next.fd < 0 && _prepare(&_next, _nextSeq++) < 0) {
+			_st.droppedBytes += size;
+			return -1;
+		}
+		_retired.push_back(_cur);
+		_cur = _next;
+		_next.fd = -1;
+		_st.files++;
+		_wake.notify_one();
+	}
+
+	_dirty = true;
+	fohCapPut(_cur.base + _cur.used, tsNs, port, dir, type, data, len);
+	_cur.used += size;
+	_cur.records++;
+	_st.records++;
+	_st.bytes += size;
+	return 0;
+}
+
+/**
+ *  @brief Append a commit marker if records came in since the last one
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHJournal::_commitLocked() {
+	if (_cur.fd < 0)
+		return -1;
+	if (_dirty == false)
+		return 0;
+
+	FOHJournalCommit c;
+	memcpy(c.tag, FOH_JOURNAL_TAG, 8);
+	c.seq = ++_cur.seq;
+	c.records = _cur.records;
+
+	//The reserve guarantees the room
+	_cur.used += fohCapPut(_cur.base + _cur.used, fohMonoNs(), 0, 0, FOH_CAP_MARK, &c, sizeof(c));
+	_dirty = false;
+	_st.commits++;
+	_st.bytes += FOH_JOURNAL_RESERVE;
+	return 0;
+}
+
+void FOHJournal::_run() {
+	std::unique_lock<std::mutex> l(_lock);
+	while (_stop == false) {
+		//flush() asks under the lock, so a request isn't missed while busy
+		if (_syncReq == _syncDone)
+			_wake.wait_for(l, std::chrono::milliseconds(_commitMs));
+		if (_stop)
+			break;
+
+		_commitLocked();
+
+		//Start writeback of what is committed, without waiting for it
+		int fd = _cur.fd;
+		uint64_t from = _cur.synced, to = _cur.used;
+		_cur.synced = to;
+		std::vector<_file> retired;
+		retired.swap(_retired);
+		bool needNext = _next.fd < 0;
+		unsigned seq = needNext ? _nextSeq++ : 0;
+		uint64_t syncTo = _syncReq;
+		bool wantSync = syncTo != _syncDone;
+		char* base = _cur.base;
+		l.unlock();
+
+		//Only this thread unmaps files, so the mapping stays valid unlocked
+		if (fd >= 0 && to > from)
+			sync_file_range(fd, from, to - from, SYNC_FILE_RANGE_WRITE);
+		for (size_t i = 0; i < retired.size(); i++)
+			_finish(&retired[i]);
+		if (wantSync) {
+			int synced = fd >= 0 && msync(base, to, MS_SYNC) != 0 ? -1 : 0;
+			l.lock();
+			_syncDone = syncTo;
+			_syncResult = synced;
+			_synced.notify_all();
+			l.unlock();
+		}
+
+		_file f;
+		f.fd = -1;
+		if (needNext)
+			_prepare(&f, seq);
+
+		l.lock();
+		if (f.fd >= 0 && _next.fd < 0) {
+			_next = f;
+		} else if (f.fd >= 0) {
+			//The receive path made one meanwhile
+			munmap(f.base, _fileBytes);
+			close(f.fd);
+			unlink(f.path.c_str());
+		}
+	}
+}
+
+/**
+ *  @brief Find the complete records and commits of a journal
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int fohJournalScan(const char* path, FOHJournalScan* out) {
+	memset(out, 0, sizeof(*out));
+
+	FOHCapReader r;
+	if (r.open(path) < 0)
+		return -1;
+
+	out->fileBytes = r.size();
+	out->validBytes = r.offset();
+	out->committedBytes = r.offset();
+
+	const FOHCapRecord* rec;
+	const char* data;
+	while (r.next(&rec, &data) == 1) {
+		out->records++;
+		out->validBytes = r.offset();
+		out->lastTsNs = rec->tsNs;
+		if (rec->type == FOH_CAP_MARK && rec->len >= sizeof(FOHJournalCommit)
+				&& memcmp(data, FOH_JOURNAL_TAG, 8) == 0) {
+			out->commits++;
+			out->committedBytes = r.offset();
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,170 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file journal.h
+ * @brief Crash-safe memory mapped capture journal.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_JOURNAL_H
+#define FOH_JOURNAL_H
+
+#include "sink.h"
+#include "capture.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define FOH_JOURNAL_TAG "commit\0\0"
+
+/**
+ *  @brief Data of a commit marker (FOH_CAP_MARK record)
+ */
+struct FOHJournalCommit {
+	char tag[8]; /**< FOH_JOURNAL_TAG */
+	uint64_t seq; /**< Commit number within the file */
+	uint64_t records; /**< Records before this marker */
+};
+
+/**
+ *  @brief Journal counters (snapshot)
+ */
+struct FOHJournalStats {
+	uint64_t records; /**< Records written */
+	uint64_t bytes; /**< Bytes written */
+	uint64_t commits; /**< Commit markers written */
+	uint64_t files; /**< Journal files started */
+	uint64_t droppedBytes; /**< Records that could not be stored */
+};
+
+/**
+ *  @brief Result of scanning a journal
+ */
+struct FOHJournalScan {
+	uint64_t records; /**< Complete records */
+	uint64_t validBytes; /**< End of the last complete record */
+	uint64_t committedBytes; /**< End of the last commit marker */
+	uint64_t commits; /**< Commit markers found */
+	uint64_t lastTsNs; /**< Time of the last complete record */
+	uint64_t fileBytes; /**< File size */
+};
+
+/**
+ *  @brief Sink storing records in memory mapped capture files
+ *
+ *  Records are copied straight into a shared file mapping, so once push()
+ *  returns they are in the page cache and survive a crash of the process.
+ *  A thread writes commit markers every commitMs and starts writeback of
+ *  the committed range without waiting for it; flush() has the thread
+ *  sync it and waits up to its timeout.
+ *  After a crash, fohJournalScan() finds the last complete record (records
+ *  carry a CRC) and the last commit; tools/fohrecover cuts the file there.
+ *
+ *  Files are <prefix>-<n>.fohcap, fully allocated up front so the mapping
+ *  cannot fault on a full disk. When one is full, the receive path
+ *  switches to the next file, which the thread has prepared already.
+ *  Closed files are truncated to their data and are plain capture files.
+ */
+class FOHJournal : public FOHSink {
+public:
+	/**
+	 *  @param prefix Path prefix of the files
+	 *  @param fileBytes Size of one journal file
+	 *  @param commitMs Commit interval
+	 */
+	FOHJournal(const char* prefix, size_t fileBytes = 64 << 20, int commitMs = 100);
+	~FOHJournal();
+
+	int push(int port, int dir, uint64_t tsNs, const void* data, size_t len) override;
+	int pushSamples(const FOHSample* s, size_t n) override;
+
+	/**
+	 *  @brief Commit and wait until the data is on disk
+	 *
+	 *  The journal thread does the sync, so push() isn't held up by it. On
+	 *  timeout the sync still completes in the background.
+	 *
+	 *  @param timeoutMs Longest wait
+	 *
+	 *	@return 0 when everything is out, 1 on timeout, -1 on error.
+	 */
+	int flush(int timeoutMs) override;
+
+	/**
+	 *  @brief Write a commit marker now
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int commit();
+
+	FOHJournalStats stats();
+
+	bool isValid() const { return _isValid; }
+
+private:
+	struct _file {
+		int fd; /**< File, -1: none */
+		char* base; /**< Mapping */
+		size_t used; /**< Bytes written */
+		uint64_t synced; /**< Writeback started up to here */
+		uint64_t seq; /**< Commits in this file */
+		uint64_t records; /**< Records in this file */
+		std::string path; /**< File name */
+	};
+
+	int _prepare(_file* f, unsigned seq);
+	void _finish(_file* f);
+	int _append(uint64_t tsNs, uint32_t port, uint16_t dir, uint16_t type, const void* data, uint32_t len);
+	int _commitLocked();
+	void _run();
+
+	std::string _prefix; /**< File prefix */
+	size_t _fileBytes; /**< File size */
+	int _commitMs; /**< Commit interval */
+	unsigned _nextSeq; /**< Number of the next file */
+	bool _isValid; /**< First file could be created */
+
+	std::mutex _lock; /**< Everything below */
+	std::condition_variable _wake; /**< Wakes the thread */
+	std::condition_variable _synced; /**< Wakes flush() */
+	_file _cur; /**< File being written */
+	_file _next; /**< Prepared file, fd -1 if not ready */
+	std::vector<_file> _retired; /**< Full files for the thread to close */
+	bool _dirty; /**< Records since the last commit */
+	uint64_t _syncReq; /**< Syncs asked for by flush() */
+	uint64_t _syncDone; /**< Syncs asked for up to here are done */
+	int _syncResult; /**< Outcome of the last sync, 0 or -1 */
+	bool _stop; /**< Ends the thread */
+	FOHJournalStats _st; /**< Counters */
+	std::thread _thread; /**< Commits and prepares files */
+};
+
+/**
+ *  @brief Find the complete records and commits of a journal
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int fohJournalScan(const char* path, FOHJournalScan* out);
+
+#endif
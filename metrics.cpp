@@ -0,0 +1,477 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file metrics.cpp
+ * @brief Lock-free counters and histograms with Prometheus text export.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <linux/serial.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ *  @param unit Scale from observed values to exported values
+ *  @param minLog2 Smallest exported bucket
+ *  @param maxLog2 Largest exported bucket
+ */
+FOHHistogram::FOHHistogram(double unit, int minLog2, int maxLog2) : _sum(0), _count(0), _unit(unit) {
+	for (int i = 0; i < FOH_HIST_BUCKETS; i++)
+		_b[i].store(0);
+	_min = minLog2 < 0 ? 0 : minLog2;
+	_max = maxLog2 >= FOH_HIST_BUCKETS ? FOH_HIST_BUCKETS - 1 : maxLog2;
+	if (_max < _min)
+		_max = _min;
+}
+
+/**
+ *  @brief Estimated quantile (upper bucket bound), in exported units
+ *
+ *  @param q Quantile (0..1)
+ */
+double FOHHistogram::quantile(double q) const {
+	uint64_t total = 0;
+	uint64_t b[FOH_HIST_BUCKETS];
+	for (int i = 0; i < FOH_HIST_BUCKETS; i++) {
+		b[i] = bucket(i);
+		total += b[i];
+	}
+	if (total == 0)
+		return 0;
+
+	double target = q * total;
+	uint64_t cum = 0;
+	for (int i = 0; i < FOH_HIST_BUCKETS; i++) {
+		cum += b[i];
+		if (cum >= target && cum > 0)
+			return (double)(1ULL << (i < 63 ? i : 63)) * _unit;
+	}
+	return (double)(1ULL << 63) * _unit;
+}
+
+static void _fmt(std::string& s, const char* name, const std::string& labels, double value) {
+	char v[64];
+	if (value == (double)(int64_t)value && value < 9e15 && value > -9e15)
+		snprintf(v, sizeof(v), "%lld", (long long)value);
+	else
+		snprintf(v, sizeof(v), "%.9g", value);
+
+	s += name;
+	if (labels.empty() == false) {
+		s += '{';
+		s += labels;
+		s += '}';
+	}
+	s += ' ';
+	s += v;
+	s += '\n';
+}
+
+FOHMetricsOut::_family& FOHMetricsOut::_get(const char* name, const char* type, const char* help) {
+	auto it = _families.find(name);
+	if (it != _families.end())
+		return it->second;
+
+	_order.push_back(name);
+	_family& f = _families[name];
+	f.type = type;
+	f.help = help;
+	return f;
+}
+
+/**
+ *  @brief Add a sample
+ *
+ *  @param name Metric name (family)
+ *  @param type "counter", "gauge" or "histogram"
+ *  @param help Description, used for the first sample of a family
+ *  @param labels Labels without braces, e.g. port="1"
+ *  @param value Value
+ */
+void FOHMetricsOut::sample(const char* name, const char* type, const char* help, const std::string& labels, double value) {
+	_fmt(_get(name, type, help).lines, name, labels, value);
+}
+
+/**
+ *  @brief Add all series of a histogram
+ */
+void FOHMetricsOut::histogram(const char* name, const char* help, const std::string& labels, const FOHHistogram& h) {
+	_family& f = _get(name, "histogram", help);
+	std::string bucket = std::string(name) + "_bucket";
+	std::string sep = labels.empty() ? "" : ",";
+
+	uint64_t cum = 0;
+	for (int i = 0; i < h.minLog2(); i++)
+		cum += h.bucket(i);
+	for (int i = h.minLog2(); i <= h.maxLog2(); i++) {
+		cum += h.bucket(i);
+		char le[48];
+		snprintf(le, sizeof(le), "le=\"%.9g\"", (double)(1ULL << i) * h.unit());
+		_fmt(f.lines, bucket.c_str(), labels + sep + le, cum);
+	}
+	_fmt(f.lines, bucket.c_str(), labels + sep + "le=\"+Inf\"", h.count());
+	_fmt(f.lines, (std::string(name) + "_sum").c_str(), labels, h.sum() * h.unit());
+	_fmt(f.lines, (std::string(name) + "_count").c_str(), labels, h.count());
+}
+
+/**
+ *  @brief Prometheus text exposition of everything added
+ */
+std::string FOHMetricsOut::text() const {
+	std::string s;
+	for (size_t i = 0; i < _order.size(); i++) {
+		const _family& f = _families.at(_order[i]);
+		s += "# HELP " + _order[i] + " " + f.help + "\n";
+		s += "# TYPE " + _order[i] + " " + f.type + "\n";
+		s += f.lines;
+	}
+	return s;
+}
+
+FOHMetrics::FOHMetrics() {
+}
+
+FOHMetrics::~FOHMetrics() {
+	//Detach first, a transmit queue may be observing right now
+	for (size_t i = 0; i < _ports.size(); i++)
+		if (_ports[i].txq != NULL)
+			_ports[i].txq->setLatencyHistogram(NULL);
+	for (size_t i = 0; i < _metrics.size(); i++) {
+		if (_metrics[i].kind == _COUNTER)
+			delete (FOHCounter*)_metrics[i].m;
+		else if (_metrics[i].kind == _GAUGE)
+			delete (FOHGauge*)_metrics[i].m;
+		else
+			delete (FOHHistogram*)_metrics[i].m;
+	}
+}
+
+/**
+ *  @brief Create a metric (owned by the registry)
+ *
+ *  @param name Metric name
+ *  @param help Description
+ *  @param labels Labels without braces, e.g. port="1"
+ */
+FOHCounter* FOHMetrics::counter(const char* name, const char* help, const char* labels) {
+	FOHCounter* c = new FOHCounter;
+	std::lock_guard<std::mutex> l(_lock);
+	_metrics.push_back(_metric{ _COUNTER, name, help, labels, c });
+	return c;
+}
+
+FOHGauge* FOHMetrics::gauge(const char* name, const char* help, const char* labels) {
+	FOHGauge* g = new FOHGauge;
+	std::lock_guard<std::mutex> l(_lock);
+	_metrics.push_back(_metric{ _GAUGE, name, help, labels, g });
+	return g;
+}
+
+FOHHistogram* FOHMetrics::histogram(const char* name, const char* help, const char* labels,
+		double unit, int minLog2, int maxLog2) {
+	FOHHistogram* h = new FOHHistogram(unit, minLog2, maxLog2);
+	std::lock_guard<std::mutex> l(_lock);
+	_metrics.push_back(_metric{ _HISTOGRAM, name, help, labels, h });
+	return h;
+}
+
+/**
+ *  @brief Call fn at every scrape to add samples
+ */
+void FOHMetrics::addCollector(void (*fn)(void* ctx, FOHMetricsOut& out), void* ctx) {
+	std::lock_guard<std::mutex> l(_lock);
+	_collectors.push_back(_collector{ fn, ctx });
+}
+
+/**
+ *  @brief Export the health of a port
+ *
+ *  Bytes, errors and timeouts counted by FOHSerial, UART counters
+ *  (TIOCGICOUNT, if the driver has them), line occupancy
+ *  per direction since the previous scrape, kernel output queue and,
+ *  with a transmit queue, its frame, byte, latency and depth figures.
+ *  A latency histogram is attached to the transmit queue.
+ *
+ *  @param port Open port
+ *  @param id Value of the port label
+ *  @param txq Transmit queue of the port (may be NULL)
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHMetrics::addPort(FOHSerial* port, int id, FOHTxQueue* txq) {
+	if (port == NULL)
+		return -1;
+
+	_port p;
+	p.port = port;
+	p.txq = txq;
+	p.label = "port=\"" + std::to_string(id) + "\"";
+	p.latency = NULL;
+	p.haveLast = false;
+	p.lastNs = p.lastRx = p.lastTx = 0;
+	if (txq != NULL) {
+		p.latency = new FOHHistogram();
+		txq->setLatencyHistogram(p.latency);
+	}
+
+	std::lock_guard<std::mutex> l(_lock);
+	_ports.push_back(p);
+	_collectors.push_back(_collector{ _collectPort, &_ports.back() });
+	if (p.latency != NULL)
+		_metrics.push_back(_metric{ _HISTOGRAM, "", "", "", p.latency });
+	return 0;
+}
+
+/**
+ *  @brief Prometheus text exposition of all metrics
+ */
+std::string FOHMetrics::scrape() {
+	std::lock_guard<std::mutex> l(_lock);
+	FOHMetricsOut out;
+
+	for (size_t i = 0; i < _metrics.size(); i++) {
+		const _metric& m = _metrics[i];
+		if (m.name.empty())
+			continue;
+		if (m.kind == _COUNTER)
+			out.sample(m.name.c_str(), "counter", m.help.c_str(), m.labels, ((FOHCounter*)m.m)->value());
+		else if (m.kind == _GAUGE)
+			out.sample(m.name.c_str(), "gauge", m.help.c_str(), m.labels, ((FOHGauge*)m.m)->value());
+		else
+			out.histogram(m.name.c_str(), m.help.c_str(), m.labels, *(FOHHistogram*)m.m);
+	}
+	for (size_t i = 0; i < _collectors.size(); i++)
+		_collectors[i].fn(_collectors[i].ctx, out);
+
+	return out.text();
+}
+
+void FOHMetrics::_collectPort(void* ctx, FOHMetricsOut& out) {
+	static const char* prio[FOH_TX_PRIOS] = { "urgent", "normal", "bulk" };
+	_port* p = (_port*)ctx;
+	const std::string& lb = p->label;
+	uint64_t now = fohMonoNs();
+
+	struct serial_icounter_struct ic;
+	if (p->port->getICounts(&ic) == 0) {
+		out.sample("foh_uart_rx_chars_total", "counter", "Characters received by the UART", lb, (uint32_t)ic.rx);
+		out.sample("foh_uart_tx_chars_total", "counter", "Characters sent by the UART", lb, (uint32_t)ic.tx);
+		out.sample("foh_uart_frame_errors_total", "counter", "UART framing errors", lb, (uint32_t)ic.frame);
+		out.sample("foh_uart_overruns_total", "counter", "UART receive overruns", lb, (uint32_t)ic.overrun);
+		out.sample("foh_uart_parity_errors_total", "counter", "UART parity errors", lb, (uint32_t)ic.parity);
+		out.sample("foh_uart_breaks_total", "counter", "Breaks received", lb, (uint32_t)ic.brk);
+		out.sample("foh_uart_buffer_overruns_total", "counter", "Tty buffer overruns", lb, (uint32_t)ic.buf_overrun);
+
+		//Share of the time each direction of the line carried characters
+		uint64_t ct = p->port->charTimeNs();
+		if (p->haveLast && now > p->lastNs && ct > 0) {
+			double dt = now - p->lastNs;
+			double rx = (uint32_t)((uint32_t)ic.rx - (uint32_t)p->lastRx) * (double)ct / dt;
+			double tx = (uint32_t)((uint32_t)ic.tx - (uint32_t)p->lastTx) * (double)ct / dt;
+			out.sample("foh_line_occupancy_ratio", "gauge", "Line occupancy since the previous scrape", lb + ",dir=\"rx\"",
+					rx > 1 ? 1 : rx);
+			out.sample("foh_line_occupancy_ratio", "gauge", "Line occupancy since the previous scrape", lb + ",dir=\"tx\"",
+					tx > 1 ? 1 : tx);
+		}
+		p->haveLast = true;
+		p->lastNs = now;
+		p->lastRx = (uint32_t)ic.rx;
+		p->lastTx = (uint32_t)ic.tx;
+	}
+
+	FOHSerialStats ss = p->port->stats();
+	out.sample("foh_rx_bytes_total", "counter", "Bytes read from the port", lb, ss.rxBytes);
+	out.sample("foh_tx_written_bytes_total", "counter", "Bytes written to the port", lb, ss.txBytes);
+	out.sample("foh_read_errors_total", "counter", "Failed reads", lb, ss.readErrors);
+	out.sample("foh_write_errors_total", "counter", "Failed writes", lb, ss.writeErrors);
+	out.sample("foh_timeouts_total", "counter", "Waits for the port that timed out", lb, ss.timeouts);
+
+	int outq = p->port->outputQueueBytes();
+	if (outq >= 0)
+		out.sample("foh_kernel_outq_bytes", "gauge", "Bytes in the kernel output queue", lb, outq);
+
+	if (p->txq == NULL)
+		return;
+
+	for (int i = 0; i < FOH_TX_PRIOS; i++) {
+		FOHTxStats s = p->txq->stats(i);
+		std::string l = lb + ",prio=\"" + prio[i] + "\"";
+		out.sample("foh_tx_frames_total", "counter", "Frames handed to the kernel", l, s.frames);
+		out.sample("foh_tx_bytes_total", "counter", "Bytes handed to the kernel", l, s.bytes);
+		out.sample("foh_tx_latency_max_seconds", "gauge", "Worst frame latency", l, s.maxLatencyNs * 1e-9);
+		out.sample("foh_tx_over_bound_total", "counter", "Urgent frames slower than the latency bound", l, s.overBound);
+		out.sample("foh_tx_queued_frames", "gauge", "Frames waiting in the transmit queue", l, p->txq->pending(i));
+	}
+	out.sample("foh_tx_unsent_bytes", "gauge", "Bytes queued and not yet handed to the kernel", lb, p->txq->unsentBytes());
+	out.histogram("foh_tx_latency_seconds", "Frame latency from enqueue to the last byte on the line", lb, *p->latency);
+}
+
+FOHMetricsServer::FOHMetricsServer(FOHMetrics* metrics) : _metrics(metrics) {
+}
+
+FOHMetricsServer::~FOHMetricsServer() {
+	stop();
+	for (size_t i = 0; i < _fds.size(); i++)
+		close(_fds[i]);
+	if (_unixPath.empty() == false)
+		unlink(_unixPath.c_str());
+}
+
+/**
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHMetricsServer::listenUnix(const char* path) {
+	struct sockaddr_un a;
+	if (strlen(path) >= sizeof(a.sun_path))
+		return -1;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&a, 0, sizeof(a));
+	a.sun_family = AF_UNIX;
+	strcpy(a.sun_path, path);
+	unlink(path);
+	if (bind(fd, (struct sockaddr*)&a, sizeof(a)) < 0 || listen(fd, 8) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	_fds.push_back(fd);
+	_unixPath = path;
+	return 0;
+}
+
+/**
+ *  @param port TCP port on 127.0.0.1
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHMetricsServer::listenTcp(int port) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	struct sockaddr_in a;
+	memset(&a, 0, sizeof(a));
+	a.sin_family = AF_INET;
+	a.sin_port = htons(port);
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr*)&a, sizeof(a)) < 0 || listen(fd, 8) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	_fds.push_back(fd);
+	return 0;
+}
+
+/**
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHMetricsServer::start() {
+	if (_fds.empty() || _thread.joinable() || _cancel.getFd() < 0)
+		return -1;
+
+	_cancel.reset();
+	_thread = std::thread(&FOHMetricsServer::_run, this);
+	return 0;
+}
+
+void FOHMetricsServer::stop() {
+	if (_thread.joinable() == false)
+		return;
+	_cancel.cancel();
+	_thread.join();
+}
+
+/**
+ *  @brief Answer one connection with the metrics
+ */
+void FOHMetricsServer::_serve(int fd) {
+	struct timeval tv = { 1, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	//Read the request head; its content doesn't matter
+	char req[4096];
+	size_t got = 0;
+	while (got < sizeof(req) - 1) {
+		ssize_t n = recv(fd, req + got, sizeof(req) - 1 - got, 0);
+		if (n <= 0)
+			break;
+		got += n;
+		req[got] = '\0';
+		if (strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL)
+			break;
+	}
+
+	std::string body = _metrics->scrape();
+	std::string head = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+			+ std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+	std::string all = head + body;
+
+	size_t done = 0;
+	while (done < all.size()) {
+		ssize_t n = send(fd, all.data() + done, all.size() - done, MSG_NOSIGNAL);
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	close(fd);
+}
+
+void FOHMetricsServer::_run() {
+	std::vector<struct pollfd> pfd(_fds.size() + 1);
+	for (size_t i = 0; i < _fds.size(); i++) {
+		pfd[i].fd = _fds[i];
+		pfd[i].events = POLLIN;
+	}
+	pfd[_fds.size()].fd = _cancel.getFd();
+	pfd[_fds.size()].events = POLLIN;
+
+	while (_cancel.cancelled() == false) {
+		if (poll(pfd.data(), pfd.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		for (size_t i = 0; i < _fds.size(); i++) {
+			if ((pfd[i].revents & POLLIN) == 0)
+				continue;
+			int c = accept4(_fds[i], NULL, NULL, SOCK_CLOEXEC);
+			if (c >= 0)
+				_serve(c);
+		}
+	}
+}
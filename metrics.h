@@ -0,0 +1,286 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file metrics.h
+ * @brief Lock-free counters and histograms with Prometheus text export.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_METRICS_H
+#define FOH_METRICS_H
+
+#include "serial.h"
+#include "txqueue.h"
+#include "cancel.h"
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Buckets of FOHHistogram (powers of two)
+#define FOH_HIST_BUCKETS 64
+
+/**
+ *  @brief Monotonic counter, updated without locks
+ */
+class FOHCounter {
+public:
+	FOHCounter() : _v(0) {}
+	void add(uint64_t n = 1) { _v.fetch_add(n, std::memory_order_relaxed); }
+	uint64_t value() const { return _v.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t> _v; /**< Count */
+};
+
+/**
+ *  @brief Value that goes up and down, updated without locks
+ */
+class FOHGauge {
+public:
+	FOHGauge() : _v(0) {}
+	void set(int64_t v) { _v.store(v, std::memory_order_relaxed); }
+	void add(int64_t n) { _v.fetch_add(n, std::memory_order_relaxed); }
+	int64_t value() const { return _v.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<int64_t> _v; /**< Value */
+};
+
+/**
+ *  @brief Histogram with power of two buckets, updated without locks
+ *
+ *  Bucket i counts values in (2^(i-1), 2^i]; observe() is a bit scan and
+ *  three relaxed atomic adds. Exported are the buckets minLog2..maxLog2,
+ *  with values scaled by unit (e.g. 1e-9 to export ns as seconds).
+ */
+class FOHHistogram {
+public:
+	/**
+	 *  @param unit Scale from observed values to exported values
+	 *  @param minLog2 Smallest exported bucket
+	 *  @param maxLog2 Largest exported bucket
+	 */
+	FOHHistogram(double unit = 1e-9, int minLog2 = 10, int maxLog2 = 34);
+
+	void observe(uint64_t v) {
+		int i = v <= 1 ? 0 : 64 - __builtin_clzll(v - 1);
+		_b[i < FOH_HIST_BUCKETS ? i : FOH_HIST_BUCKETS - 1].fetch_add(1, std::memory_order_relaxed);
+		_sum.fetch_add(v, std::memory_order_relaxed);
+		_count.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/**
+	 *  @brief Estimated quantile (upper bucket bound), in exported units
+	 *
+	 *  @param q Quantile (0..1)
+	 */
+	double quantile(double q) const;
+
+	uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+	uint64_t sum() const { return _sum.load(std::memory_order_relaxed); }
+	uint64_t bucket(int i) const { return _b[i].load(std::memory_order_relaxed); }
+
+	double unit() const { return _unit; }
+	int minLog2() const { return _min; }
+	int maxLog2() const { return _max; }
+
+private:
+	std::atomic<uint64_t> _b[FOH_HIST_BUCKETS]; /**< Bucket counts */
+	std::atomic<uint64_t> _sum; /**< Sum of values */
+	std::atomic<uint64_t> _count; /**< Number of values */
+	double _unit; /**< Export scale */
+	int _min; /**< First exported bucket */
+	int _max; /**< Last exported bucket */
+};
+
+/**
+ *  @brief Collects samples during a scrape, grouped by metric family
+ */
+class FOHMetricsOut {
+public:
+	/**
+	 *  @brief Add a sample
+	 *
+	 *  @param name Metric name (family)
+	 *  @param type "counter", "gauge" or "histogram"
+	 *  @param help Description, used for the first sample of a family
+	 *  @param labels Labels without braces, e.g. port="1"
+	 *  @param value Value
+	 */
+	void sample(const char* name, const char* type, const char* help, const std::string& labels, double value);
+
+	/**
+	 *  @brief Add all series of a histogram
+	 */
+	void histogram(const char* name, const char* help, const std::string& labels, const FOHHistogram& h);
+
+	/**
+	 *  @brief Prometheus text exposition of everything added
+	 */
+	std::string text() const;
+
+private:
+	struct _family {
+		std::string type; /**< Metric type */
+		std::string help; /**< Description */
+		std::string lines; /**< Samples */
+	};
+
+	_family& _get(const char* name, const char* type, const char* help);
+
+	std::vector<std::string> _order; /**< Families in order of appearance */
+	std::map<std::string, _family> _families; /**< By name */
+};
+
+/**
+ *  @brief Registry of metrics and collectors
+ *
+ *  Metrics are created once and then updated lock-free from any thread.
+ *  Collectors turn existing statistics (port counters, queue stats) into
+ *  samples at scrape time. scrape() is cheap enough to run every second
+ *  with many ports: a few atomic loads and ioctls per port.
+ */
+class FOHMetrics {
+public:
+	FOHMetrics();
+	~FOHMetrics();
+
+	/**
+	 *  @brief Create a metric (owned by the registry)
+	 *
+	 *  @param name Metric name
+	 *  @param help Description
+	 *  @param labels Labels without braces, e.g. port="1"
+	 */
+	FOHCounter* counter(const char* name, const char* help, const char* labels = "");
+	FOHGauge* gauge(const char* name, const char* help, const char* labels = "");
+	FOHHistogram* histogram(const char* name, const char* help, const char* labels = "",
+			double unit = 1e-9, int minLog2 = 10, int maxLog2 = 34);
+
+	/**
+	 *  @brief Call fn at every scrape to add samples
+	 */
+	void addCollector(void (*fn)(void* ctx, FOHMetricsOut& out), void* ctx);
+
+	/**
+	 *  @brief Export the health of a port
+	 *
+	 *  Bytes, errors and timeouts counted by FOHSerial, UART counters
+	 *  (TIOCGICOUNT, if the driver has them), line occupancy
+	 *  per direction since the previous scrape, kernel output queue and,
+	 *  with a transmit queue, its frame, byte, latency and depth figures.
+	 *  A latency histogram is attached to the transmit queue.
+	 *
+	 *  @param port Open port
+	 *  @param id Value of the port label
+	 *  @param txq Transmit queue of the port (may be NULL)
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int addPort(FOHSerial* port, int id, FOHTxQueue* txq = NULL);
+
+	/**
+	 *  @brief Prometheus text exposition of all metrics
+	 */
+	std::string scrape();
+
+private:
+	enum _kind { _COUNTER, _GAUGE, _HISTOGRAM };
+
+	struct _metric {
+		_kind kind; /**< Type */
+		std::string name; /**< Name */
+		std::string help; /**< Description */
+		std::string labels; /**< Labels */
+		void* m; /**< FOHCounter, FOHGauge or FOHHistogram */
+	};
+
+	struct _collector {
+		void (*fn)(void*, FOHMetricsOut&); /**< Callback */
+		void* ctx; /**< Its context */
+	};
+
+	struct _port {
+		FOHSerial* port; /**< Port */
+		FOHTxQueue* txq; /**< Transmit queue or NULL */
+		std::string label; /**< port="id" */
+		FOHHistogram* latency; /**< Transmit latency */
+		bool haveLast; /**< Previous counters are valid */
+		uint64_t lastNs; /**< Time of the previous scrape */
+		uint64_t lastRx; /**< Received characters then */
+		uint64_t lastTx; /**< Sent characters then */
+	};
+
+	static void _collectPort(void* ctx, FOHMetricsOut& out);
+
+	std::mutex _lock; /**< Registration and scrapes */
+	std::deque<_metric> _metrics; /**< Owned metrics */
+	std::vector<_collector> _collectors; /**< Collectors */
+	std::deque<_port> _ports; /**< Port collectors */
+};
+
+/**
+ *  @brief Serves FOHMetrics::scrape() over HTTP
+ *
+ *  Listens on a Unix socket (curl --unix-socket) and/or a TCP port on the
+ *  loopback interface. Every request, whatever its path, gets the
+ *  metrics; one request is served at a time by a single thread.
+ */
+class FOHMetricsServer {
+public:
+	FOHMetricsServer(FOHMetrics* metrics);
+	~FOHMetricsServer();
+
+	/**
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int listenUnix(const char* path);
+
+	/**
+	 *  @param port TCP port on 127.0.0.1
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int listenTcp(int port);
+
+	/**
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int start();
+	void stop();
+
+private:
+	void _serve(int fd);
+	void _run();
+
+	FOHMetrics* _metrics; /**< Source */
+	std::vector<int> _fds; /**< Listening sockets */
+	std::string _unixPath; /**< Unix socket to remove */
+	FOHCancelToken _cancel; /**< Stops the thread */
+	std::thread _thread; /**< Server */
+};
+
+#endif
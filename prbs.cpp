@@ -0,0 +1,201 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file prbs.cpp
+ * @brief PRBS test pattern generator and bit error checker.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "prbs.h"
+
+#include <string.h>
+
+/**
+ *  @param order 7, 15, 23 or 31
+ *  @param seed Initial state (0 is replaced by all ones)
+ */
+FOHPrbs::FOHPrbs(int order, uint32_t seed) {
+	switch (order) {
+	case 7: _m = 6; break;
+	case 15: _m = 14; break;
+	case 23: _m = 18; break;
+	case 31: _m = 28; break;
+	default: _m = 0; break;
+	}
+	_n = _m ? order : 0;
+	_mask = _n ? (uint32_t)((1ULL << _n) - 1) : 0;
+	_state = seed & _mask;
+	if (_state == 0)
+		_state = _mask;
+}
+
+/**
+ *  @brief Fill a buffer with the next bytes
+ */
+void FOHPrbs::fill(void* buf, size_t len) {
+	uint8_t* p = (uint8_t*)buf;
+	for (size_t i = 0; i < len; i++)
+		p[i] = next();
+}
+
+/**
+ *  @brief Shift received bytes into the state
+ */
+void FOHPrbs::absorb(const uint8_t* data, size_t len) {
+	for (size_t i = 0; i < len; i++)
+		for (int k = 0; k < 8; k++)
+			_state = ((_state << 1) | ((data[i] >> k) & 1)) & _mask;
+}
+
+/**
+ *  @param order 7, 15, 23 or 31
+ */
+FOHPrbsChecker::FOHPrbsChecker(int order) : _gen(order), _ghost(order) {
+	reset();
+}
+
+void FOHPrbsChecker::reset() {
+	memset(&_s, 0, sizeof(_s));
+	_ghostValid = false;
+	_histPos = _histLen = 0;
+	_syncLen = 0;
+	_bad = 0;
+	_winPos = 0;
+	memset(_winBits, 0, sizeof(_winBits));
+}
+
+/**
+ *  @brief Check received bytes
+ */
+void FOHPrbsChecker::feed(const void* data, size_t len) {
+	const uint8_t* p = (const uint8_t*)data;
+	if (_gen.isValid() == false)
+		return;
+
+	for (size_t i = 0; i < len; i++) {
+		_s.bytes++;
+		if (_s.locked == false) {
+			_hunt(p[i]);
+			continue;
+		}
+
+		uint8_t diff = p[i] ^ _gen.next();
+		_hist[_histPos] = _gen.state();
+		_histPos = (_histPos + 1) % FOH_PRBS_SLIP;
+		if (_histLen < FOH_PRBS_SLIP)
+			_histLen++;
+
+		int bits = __builtin_popcount(diff);
+		_s.checked++;
+		_s.bitErrors += bits;
+		_s.byteErrors += bits != 0;
+		_winPos = (_winPos + 1) % FOH_PRBS_WINDOW;
+		_winBits[_winPos] = bits;
+		_bad = (_bad << 1) | (bits != 0);
+
+		if (bits && __builtin_popcount(_bad) >= FOH_PRBS_LOSS)
+			_lose();
+	}
+}
+
+//Too many errors: a slip, not noise
+void FOHPrbsChecker::_lose() {
+	//The bytes from the first bad one in the window on are the slip
+	int first = 31 - __builtin_clz(_bad);
+	for (int k = 0; k <= first; k++) {
+		uint8_t bits = _winBits[(_winPos + FOH_PRBS_WINDOW - k) % FOH_PRBS_WINDOW];
+		_s.bitErrors -= bits;
+		_s.byteErrors -= bits != 0;
+		_s.checked--;
+		_s.unchecked++;
+	}
+
+	_ghost = _gen;
+	_ghostValid = true;
+	_s.locked = false;
+	_syncLen = 0;
+	_bad = 0;
+	memset(_winBits, 0, sizeof(_winBits));
+}
+
+void FOHPrbsChecker::_hunt(uint8_t b) {
+	_s.unchecked++;
+
+	//Keep following where the stream should be
+	if (_ghostValid) {
+		_ghost.next();
+		_hist[_histPos] = _ghost.state();
+		_histPos = (_histPos + 1) % FOH_PRBS_SLIP;
+		if (_histLen < FOH_PRBS_SLIP)
+			_histLen++;
+	}
+
+	_sync[_syncLen++] = b;
+	size_t need = (_gen.order() + 7) / 8;
+	if (_syncLen < need + FOH_PRBS_VERIFY)
+		return;
+
+	//Seed from the first bytes, the rest must follow
+	FOHPrbs cand(_gen.order());
+	cand.absorb(_sync, need);
+	size_t k;
+	for (k = need; k < _syncLen; k++)
+		if (cand.next() != _sync[k])
+			break;
+
+	if (k < _syncLen) {
+		memmove(_sync, _sync + 1, --_syncLen);
+		return;
+	}
+
+	_gen = cand;
+	_s.locked = true;
+	_syncLen = 0;
+	if (_ghostValid) {
+		_s.resyncs++;
+		_classify();
+	}
+	_ghostValid = false;
+}
+
+//Where the lock was found against where the stream should be
+void FOHPrbsChecker::_classify() {
+	uint32_t now = _gen.state();
+	if (now == _ghost.state())
+		return;
+
+	//Closest first, PRBS-7 repeats every 127 bytes. Ahead of the expected
+	//position bytes were dropped, behind it repeated or inserted.
+	FOHPrbs ahead = _ghost;
+	for (size_t d = 1; d < FOH_PRBS_SLIP; d++) {
+		ahead.next();
+		if (ahead.state() == now) {
+			_s.dropped += d;
+			return;
+		}
+		if (d < _histLen && _hist[(_histPos + FOH_PRBS_SLIP - 1 - d) % FOH_PRBS_SLIP] == now) {
+			_s.duplicated += d;
+			return;
+		}
+	}
+
+	_s.unknownSlips++;
+}
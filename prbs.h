@@ -0,0 +1,161 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file prbs.h
+ * @brief PRBS test pattern generator and bit error checker.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_PRBS_H
+#define FOH_PRBS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FOH_PRBS_WINDOW 32 /**< Bytes watched for loss of lock */
+#define FOH_PRBS_LOSS 8 /**< Bad bytes in the window that mean lock is lost */
+#define FOH_PRBS_VERIFY 8 /**< Bytes that must match before locking */
+#define FOH_PRBS_SLIP 256 /**< Largest slip classified as dropped or duplicated bytes */
+
+/**
+ *  @brief Pseudo random bit sequence (ITU-T O.150 polynomials)
+ *
+ *  PRBS-7 (x^7 + x^6 + 1), PRBS-15 (x^15 + x^14 + 1), PRBS-23
+ *  (x^23 + x^18 + 1) and PRBS-31 (x^31 + x^28 + 1), not inverted. Bits are
+ *  packed LSB first, the order a UART sends them, so the bit stream on the
+ *  line is the sequence itself. The state is the last order bits.
+ */
+class FOHPrbs {
+public:
+	/**
+	 *  @param order 7, 15, 23 or 31
+	 *  @param seed Initial state (0 is replaced by all ones)
+	 */
+	FOHPrbs(int order, uint32_t seed = 0xFFFFFFFFU);
+
+	/**
+	 *  @brief Whether the order is supported
+	 */
+	bool isValid() const { return _n != 0; }
+
+	/**
+	 *  @brief Next 8 bits of the sequence
+	 */
+	uint8_t next() {
+		uint8_t out = 0;
+		for (int i = 0; i < 8; i++) {
+			uint32_t bit = ((_state >> (_n - 1)) ^ (_state >> (_m - 1))) & 1;
+			_state = ((_state << 1) | bit) & _mask;
+			out |= bit << i;
+		}
+		return out;
+	}
+
+	/**
+	 *  @brief Fill a buffer with the next bytes
+	 */
+	void fill(void* buf, size_t len);
+
+	/**
+	 *  @brief Shift received bytes into the state
+	 *
+	 *  After order bits, the generator continues the received sequence.
+	 */
+	void absorb(const uint8_t* data, size_t len);
+
+	int order() const { return _n; }
+	uint32_t state() const { return _state; }
+	void setState(uint32_t state) { _state = state & _mask; }
+
+private:
+	int _n; /**< Order (0: invalid) */
+	int _m; /**< Second tap */
+	uint32_t _mask; /**< Low _n bits */
+	uint32_t _state; /**< Last _n bits */
+};
+
+/**
+ *  @brief Counters of a FOHPrbsChecker
+ */
+struct FOHPrbsStats {
+	uint64_t bytes; /**< Bytes received */
+	uint64_t checked; /**< Bytes compared while locked */
+	uint64_t bitErrors; /**< Wrong bits in checked bytes */
+	uint64_t byteErrors; /**< Checked bytes with wrong bits */
+	uint64_t resyncs; /**< Times the lock was lost and found again */
+	uint64_t dropped; /**< Bytes missing at slips */
+	uint64_t duplicated; /**< Bytes repeated or inserted at slips */
+	uint64_t unknownSlips; /**< Resyncs that couldn't be classified */
+	uint64_t unchecked; /**< Bytes received without lock */
+	bool locked; /**< Currently locked */
+};
+
+/**
+ *  @brief Checks a received PRBS stream
+ *
+ *  The checker seeds itself from the received bits, verifies the next
+ *  FOH_PRBS_VERIFY bytes and then compares every byte with its own
+ *  generator, so a bit error counts once. When FOH_PRBS_LOSS of the last
+ *  FOH_PRBS_WINDOW bytes are wrong, the bytes since the first wrong one
+ *  are taken as a slip rather than bit errors and the checker searches
+ *  for the sequence again. Meanwhile it keeps track of where the stream
+ *  should be. Once locked again, the new position against the expected
+ *  one tells how many bytes were dropped or duplicated.
+ */
+class FOHPrbsChecker {
+public:
+	/**
+	 *  @param order 7, 15, 23 or 31
+	 */
+	FOHPrbsChecker(int order);
+
+	/**
+	 *  @brief Check received bytes
+	 */
+	void feed(const void* data, size_t len);
+
+	const FOHPrbsStats& stats() const { return _s; }
+
+	/**
+	 *  @brief Clear the counters and search for the sequence
+	 */
+	void reset();
+
+private:
+	void _lose();
+	void _hunt(uint8_t b);
+	void _classify();
+
+	FOHPrbs _gen; /**< Expected sequence while locked */
+	FOHPrbs _ghost; /**< Expected sequence while searching after a loss */
+	bool _ghostValid; /**< Lock was lost (not never found) */
+	uint32_t _hist[FOH_PRBS_SLIP]; /**< States of the expected sequence after the last bytes */
+	size_t _histPos; /**< Next entry of _hist */
+	size_t _histLen; /**< Valid entries of _hist */
+	uint8_t _sync[(31 + 7) / 8 + FOH_PRBS_VERIFY]; /**< Bytes collected to lock */
+	size_t _syncLen; /**< Valid bytes in _sync */
+	uint32_t _bad; /**< Bad byte flags of the window, bit 0 newest */
+	uint8_t _winBits[FOH_PRBS_WINDOW]; /**< Bit errors of the window's bytes */
+	size_t _winPos; /**< Newest entry of _winBits */
+	FOHPrbsStats _s; /**< Counters */
+};
+
+#endif
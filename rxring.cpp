@@ -0,0 +1,231 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file rxring.cpp
+ * @brief Budgeted receive ring between the port reader and its consumer.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "rxring.h"
+
+#include <string.h>
+
+/**
+ *  @brief Create a ring
+ *
+ *  @param port Port to read from
+ *  @param budget Budget to charge buffered bytes to (NULL: unbounded)
+ *  @param policy What to do when the budget is exhausted (see FOHBudgetPolicy)
+ */
+FOHRxRing::FOHRxRing(FOHSerial* port, FOHMemBudget* budget, int policy) {
+	_port = port;
+	_budget = budget;
+	_policy = policy;
+	_flow = NULL;
+	_paused = false;
+	_head = 0;
+	_len = 0;
+	_buf.resize(FOH_RXRING_CHUNK);
+}
+
+FOHRxRing::~FOHRxRing() {
+	if (_budget)
+		_budget->release(_len);
+	if (_paused)
+		_port->throttleInput(false);
+}
+
+/**
+ *  @brief Append bytes, growing the buffer if needed (lock held)
+ */
+void FOHRxRing::_push(const uint8_t* data, size_t len) {
+	if (_len + len > _buf.size()) {
+		size_t cap = _buf.size();
+		while (cap < _len + len)
+			cap *= 2;
+
+		//Linearise into the bigger buffer
+		std::vector<uint8_t> nbuf(cap);
+		size_t first = _buf.size() - _head;
+		if (first > _len)
+			first = _len;
+		memcpy(&nbuf[0], &_buf[_head], first);
+		memcpy(&nbuf[first], &_buf[0], _len - first);
+		_buf.swap(nbuf);
+		_head = 0;
+	}
+
+	size_t tail = (_head + _len) % _buf.size();
+	size_t first = _buf.size() - tail;
+	if (first > len)
+		first = len;
+	memcpy(&_buf[tail], data, first);
+	memcpy(&_buf[0], data + first, len - first);
+	_len += len;
+}
+
+/**
+ *  @brief Discard the oldest bytes (lock held)
+ */
+void FOHRxRing::_drop(size_t n) {
+	_head = (_head + n) % _buf.size();
+	_len -= n;
+}
+
+/**
+ *  @brief Read once from the port into the ring
+ *
+ *  @param timeoutMs Longest wait for data (and for budget room with FOH_BUDGET_BLOCK)
+ *  @param cancel Token that aborts the wait for data (optional)
+ *
+ *	@return Bytes stored (0 on timeout) when successful, -1 otherwise.
+ */
+int FOHRxRing::fill(int timeoutMs, FOHCancelToken* cancel) {
+	uint8_t tmp[FOH_RXRING_CHUNK];
+	size_t want = sizeof tmp;
+	size_t accepted;
+	size_t reserved = 0;
+	int n;
+
+	//Blocking producers leave data in the kernel until there is room
+	if (_budget && _policy == FOH_BUDGET_BLOCK) {
+		reserved = _budget->reserve(want, timeoutMs);
+		if (reserved == 0)
+			return 0;
+		want = reserved;
+	}
+
+	n = _port->readChunk(tmp, want, timeoutMs, cancel);
+	if (n > 0 && _flow)
+		n = _flow->filter(tmp, n);
+	if (n <= 0) {
+		if (reserved)
+			_budget->release(reserved);
+		return n;
+	}
+
+	std::lock_guard<std::mutex> l(_lock);
+	accepted = n;
+
+	if (_budget) {
+		if (_policy == FOH_BUDGET_BLOCK) {
+			_budget->release(reserved - n);
+		} else {
+			accepted = _budget->reserve(n, 0);
+			if (accepted < (size_t)n) {
+				size_t over = n - accepted;
+				size_t d = 0;
+
+				//Oldest buffered bytes make room, their charge carries over
+				if (_policy == FOH_BUDGET_DROP_OLDEST) {
+					d = over < _len ? over : _len;
+					_drop(d);
+					accepted += d;
+				}
+				//Lost either way: evicted old bytes and new ones that didn't fit
+				_budget->noteDropped(d + n - accepted);
+			}
+		}
+	}
+
+	//Drop-oldest keeps the newest input, the other policies the earliest
+	if (_policy == FOH_BUDGET_DROP_OLDEST)
+		_push(tmp + (n - accepted), accepted);
+	else
+		_push(tmp, accepted);
+
+	if (_budget && _policy == FOH_BUDGET_PAUSE_DEVICE && !_paused && _budget->room() < _budget->limit() / 4) {
+		if (_port->throttleInput(true) == 0) {
+			_paused = true;
+			_budget->notePause();
+		}
+	}
+
+	if (accepted)
+		_cond.notify_all();
+
+	return accepted;
+}
+
+/**
+ *  @brief Take bytes out of the ring
+ *
+ *  @param dst Destination buffer
+ *  @param max Buffer size
+ *
+ *  @return Bytes copied
+ */
+size_t FOHRxRing::read(void* dst, size_t max) {
+	std::lock_guard<std::mutex> l(_lock);
+	size_t n = max < _len ? max : _len;
+	size_t first = _buf.size() - _head;
+
+	if (first > n)
+		first = n;
+	memcpy(dst, &_buf[_head], first);
+	memcpy((uint8_t*)dst + first, &_buf[0], n - first);
+	_drop(n);
+
+	if (_budget) {
+		_budget->release(n);
+
+		if (_paused && _budget->room() >= _budget->limit() / 2) {
+			if (_port->throttleInput(false) == 0)
+				_paused = false;
+		}
+	}
+
+	return n;
+}
+
+/**
+ *  @brief Wait until the ring holds data
+ *
+ *  @param timeoutMs Longest wait (-1: forever)
+ *
+ *  @return true if data is available
+ */
+bool FOHRxRing::wait(int timeoutMs) {
+	std::unique_lock<std::mutex> l(_lock);
+
+	if (timeoutMs < 0) {
+		_cond.wait(l, [this] { return _len > 0; });
+		return true;
+	}
+
+	return _cond.wait_for(l, std::chrono::milliseconds(timeoutMs), [this] { return _len > 0; });
+}
+
+/**
+ *  @brief Bytes currently buffered
+ */
+size_t FOHRxRing::size() {
+	std::lock_guard<std::mutex> l(_lock);
+	return _len;
+}
+
+/**
+ *  @brief Whether the device is currently paused by this ring
+ */
+bool FOHRxRing::paused() {
+	std::lock_guard<std::mutex> l(_lock);
+	return _paused;
+}
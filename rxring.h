@@ -0,0 +1,133 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file rxring.h
+ * @brief Budgeted receive ring between the port reader and its consumer.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_RXRING_H
+#define FOH_RXRING_H
+
+#include "serial.h"
+#include "budget.h"
+#include "softflow.h"
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+//Bytes read from the port per fill()
+#define FOH_RXRING_CHUNK 4096
+
+/**
+ *  @brief Receive ring of a port
+ *
+ *  One thread calls fill() to move data from the port into the ring,
+ *  consumers take it out with read(). Buffered bytes are charged to a
+ *  FOHMemBudget; when it runs out the configured FOHBudgetPolicy decides
+ *  what happens. With FOH_BUDGET_PAUSE_DEVICE the device is throttled once
+ *  less than a quarter of the budget is left and resumed at one half.
+ */
+class FOHRxRing {
+public:
+	/**
+	 *  @brief Create a ring
+	 *
+	 *  @param port Port to read from
+	 *  @param budget Budget to charge buffered bytes to (NULL: unbounded)
+	 *  @param policy What to do when the budget is exhausted (see FOHBudgetPolicy)
+	 */
+	FOHRxRing(FOHSerial* port, FOHMemBudget* budget, int policy);
+	~FOHRxRing();
+
+	/**
+	 *  @brief Strip XON/XOFF from received data before it is buffered
+	 *
+	 *  @param flow User space flow control of the port (NULL: off)
+	 */
+	void setSoftFlow(FOHSoftFlow* flow) { _flow = flow; }
+
+	/**
+	 *  @brief Read once from the port into the ring
+	 *
+	 *  @param timeoutMs Longest wait for data (and for budget room with FOH_BUDGET_BLOCK)
+	 *  @param cancel Token that aborts the wait for data (optional)
+	 *
+	 *	@return Bytes stored (0 on timeout) when successful, -1 otherwise.
+	 */
+	int fill(int timeoutMs, FOHCancelToken* cancel = NULL);
+
+	/**
+	 *  @brief Take bytes out of the ring
+	 *
+	 *  @param dst Destination buffer
+	 *  @param max Buffer size
+	 *
+	 *  @return Bytes copied
+	 */
+	size_t read(void* dst, size_t max);
+
+	/**
+	 *  @brief Wait until the ring holds data
+	 *
+	 *  @param timeoutMs Longest wait (-1: forever)
+	 *
+	 *  @return true if data is available
+	 */
+	bool wait(int timeoutMs);
+
+	/**
+	 *  @brief Bytes currently buffered
+	 */
+	size_t size();
+
+	/**
+	 *  @brief Whether the device is currently paused by this ring
+	 */
+	bool paused();
+
+private:
+	/**
+	 *  @brief Append bytes, growing the buffer if needed (lock held)
+	 */
+	void _push(const uint8_t* data, size_t len);
+
+	/**
+	 *  @brief Discard the oldest bytes (lock held)
+	 */
+	void _drop(size_t n);
+
+	FOHSerial* _port; /**< Port to read from */
+	FOHMemBudget* _budget; /**< Budget for buffered bytes */
+	int _policy; /**< Overflow policy */
+	FOHSoftFlow* _flow; /**< User space XON/XOFF, or NULL */
+	bool _paused; /**< Device throttled by us */
+
+	std::vector<uint8_t> _buf; /**< Ring storage */
+	size_t _head; /**< Offset of the oldest byte */
+	size_t _len; /**< Bytes buffered */
+
+	std::mutex _lock; /**< Protects the ring */
+	std::condition_variable _cond; /**< Signalled on new data */
+};
+
+#endif
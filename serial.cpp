@@ -27,10 +27,20 @@
  */
 
 #include "serial.h"
+#include "cancel.h"
+#include "trace.h"
 
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
 #include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+
+//Maximum number of segments handed to a single writev() call
+#define FOH_IOV_BATCH 64
 
 
 /**
@@ -62,6 +72,53 @@ speed_t FOHSerial::__convBaud(int num) {
 	return B50;
 }
 
+/**
+ *  @brief Numeric baud rate of a speed_t constant
+ *
+ *  @param speed Baud in speed_t format
+ *
+ *  @return Baud as int, 0 if unknown
+ */
+static int _baudValue(speed_t speed) {
+	switch (speed) {
+		case B460800: return 460800;
+		case B230400: return 230400;
+		case B115200: return 115200;
+		case B57600: return 57600;
+		case B38400: return 38400;
+		case B19200: return 19200;
+		case B9600: return 9600;
+		case B4800: return 4800;
+		case B2400: return 2400;
+		case B1800: return 1800;
+		case B1200: return 1200;
+		case B600: return 600;
+		case B300: return 300;
+		case B200: return 200;
+		case B150: return 150;
+		case B134: return 134;
+		case B110: return 110;
+		case B75: return 75;
+		case B50: return 50;
+		default: return 0;
+	}
+}
+
+/**
+ *  @brief Total length of a segment array
+ *
+ *  @param iov Array of segments
+ *  @param iovcnt Number of segments
+ *
+ *  @return Sum of the iov_len values
+ */
+static size_t _iovBytes(const struct iovec* iov, int iovcnt) {
+	size_t n = 0;
+	for (int i = 0; i < iovcnt; i++)
+		n += iov[i].iov_len;
+	return n;
+}
+
 /**
  *  @brief Set attributes of a serial interface.
  * 
@@ -95,6 +152,7 @@ struct termios FOHSerial::if_attrib_set(speed_t speed, int clen, bool parityOn,
 	tty.c_cflag |= speed;
 
 	//Set byte length
+	tty.c_cflag &= ~CSIZE;
 	if (clen == 5)
 		tty.c_cflag |= CS5;
 	else if (clen == 6)
@@ -107,7 +165,7 @@ struct termios FOHSerial::if_attrib_set(speed_t speed, int clen, bool parityOn,
 	tty.c_cflag |= CLOCAL;
 	tty.c_cflag |= CREAD;
 	
-	tty.c_iflag |= ~IGNBRK;
+	tty.c_iflag &= ~IGNBRK;
 	tty.c_iflag &= ~BRKINT;
 
 	tty.c_iflag &= ~ICRNL;
@@ -123,14 +181,16 @@ struct termios FOHSerial::if_attrib_set(speed_t speed, int clen, bool parityOn,
 		tty.c_iflag &= ~(IXON | IXOFF | IXANY);
 		tty.c_cflag &= ~CRTSCTS;
 	} else if (fctrl == 1) {
-		tty.c_iflag |= ~(IXON | IXOFF | IXANY);
+		tty.c_iflag |= IXON | IXOFF;
+		tty.c_iflag &= ~IXANY;
 		tty.c_cflag &= ~CRTSCTS;
 	} else if (fctrl == 2) {
 		tty.c_iflag &= ~(IXON | IXOFF | IXANY);
-		tty.c_cflag |= ~CRTSCTS;
+		tty.c_cflag |= CRTSCTS;
 	} else if (fctrl == 3) {
-		tty.c_iflag |= ~(IXON | IXOFF | IXANY);
-		tty.c_cflag |= ~CRTSCTS;
+		tty.c_iflag |= IXON | IXOFF;
+		tty.c_iflag &= ~IXANY;
+		tty.c_cflag |= CRTSCTS;
 	} else {
 		//Invalid flow control option
 		return ftty;
@@ -139,22 +199,23 @@ struct termios FOHSerial::if_attrib_set(speed_t speed, int clen, bool parityOn,
 	//Set parity options
 	if (parityOn) {
 		if (parityType == 1) {
-			tty.c_cflag |= ~(PARENB);
+			tty.c_cflag |= PARENB;
+			tty.c_cflag &= ~PARODD;
 			tty.c_iflag &= ~IGNPAR;
-			tty.c_iflag |= ~PARMRK;
-			tty.c_iflag |= ~INPCK;
+			tty.c_iflag &= ~PARMRK;
+			tty.c_iflag &= ~INPCK;
 		} else if (parityType == 2) {
-			tty.c_cflag |= ~(PARENB | PARODD);
+			tty.c_cflag |= PARENB | PARODD;
 			tty.c_iflag &= ~IGNPAR;
-			tty.c_iflag |= ~PARMRK;
-			tty.c_iflag |= ~INPCK;
+			tty.c_iflag &= ~PARMRK;
+			tty.c_iflag &= ~INPCK;
 		} else {
 			//Invalid parity option
 			return ftty;
 		}
 	} else {
 		tty.c_cflag &= ~(PARENB | PARODD);
-		tty.c_iflag |= ~IGNPAR;
+		tty.c_iflag &= ~IGNPAR;
 		tty.c_iflag &= ~PARMRK;
 		tty.c_iflag &= ~INPCK;
 	}
@@ -163,11 +224,16 @@ struct termios FOHSerial::if_attrib_set(speed_t speed, int clen, bool parityOn,
 	if (!stopbx)
 		tty.c_cflag &= ~CSTOPB;
 	else
-		tty.c_cflag |= ~CSTOPB;
+		tty.c_cflag |= CSTOPB;
 
 	//Apply new termios attributes
 	if (tcsetattr(_serfd, TCSANOW, &tty) != 0) return ftty;
 
+	//Remember the line timing for queue sizing
+	_baud = _baudValue(speed);
+	_charBits = 1 + clen + (parityOn ? 1 : 0) + (stopbx ? 2 : 1);
+	_fctrl = fctrl;
+
 	return tty;
 }
 
@@ -176,26 +242,89 @@ struct termios FOHSerial::if_attrib_set(speed_t speed, int clen, bool parityOn,
  * 
  *  @param buf Text buffer
  *  @param size Bytes to be sent
+ *  @param cancel Token that aborts the wait for the port
  * 
  *	@return Number of bytes written when successful, -1 otherwise.
  */
-int FOHSerial::_serialPut(char** buf, size_t size) {
+int FOHSerial::_serialPut(char** buf, size_t size, FOHCancelToken* cancel) {
 	if (this->_isValid == false)
 		return -1;
 
-	size_t i;
+	struct iovec iov;
+	iov.iov_base = *buf;
+	iov.iov_len = size;
+
+	return _serialPutv(&iov, 1, cancel);
+}
+
+/**
+ *  @brief Send a list of segments on serial port
+ *
+ *  @param iov Array of segments
+ *  @param iovcnt Number of segments
+ *  @param cancel Token that aborts the wait for the port
+ *
+ *	@return Number of bytes written when successful, -1 otherwise.
+ */
+int FOHSerial::_serialPutv(const struct iovec* iov, int iovcnt, FOHCancelToken* cancel) {
+	if (this->_isValid == false)
+		return -1;
+	if (iov == NULL || iovcnt < 0)
+		return -1;
+
+	struct iovec win[FOH_IOV_BATCH];
+	size_t skip = 0; //Bytes of iov[0] already sent
+	size_t total = 0;
+	int cnt, i;
 	ssize_t written;
 
-	for (i = 0; i < size; i++) {
-		written = write(_serfd, buf[i], 1);
-		if (written < 0) break;
+	//Skip empty segments so a trailing zero-length piece doesn't cost a syscall
+	while (iovcnt > 0 && iov->iov_len == 0) {
+		iov++;
+		iovcnt--;
 	}
 
-	std::cout << i << std::endl;
-	//Indicate we stopped earlier. Something with write() went wrong!
-	if (i > size) exit(40);//i = -1;
-	
-	return i;
+	while (iovcnt > 0) {
+		//Build the next window, the first segment may be partially sent
+		cnt = iovcnt < FOH_IOV_BATCH ? iovcnt : FOH_IOV_BATCH;
+		for (i = 0; i < cnt; i++)
+			win[i] = iov[i];
+		win[0].iov_base = (char*)win[0].iov_base + skip;
+		win[0].iov_len -= skip;
+
+		FOH_TRACE2(write_submit, _serfd, _iovBytes(win, cnt));
+		written = writev(_serfd, win, cnt);
+		FOH_TRACE2(write_done, _serfd, written);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN && _waitReady(POLLOUT, -1, cancel) == 1)
+				continue;
+			if (errno != EAGAIN && errno != ECANCELED)
+				_writeErrors.fetch_add(1, std::memory_order_relaxed);
+			break;
+		}
+		total += written;
+		_txBytes.fetch_add(written, std::memory_order_relaxed);
+
+		//Advance over everything the kernel accepted
+		while (iovcnt > 0 && (size_t)written >= iov->iov_len - skip) {
+			written -= iov->iov_len - skip;
+			skip = 0;
+			iov++;
+			iovcnt--;
+		}
+		skip += written;
+	}
+
+	//Nothing went out at all
+	if (iovcnt > 0 && total == 0) {
+		if (cancel && cancel->cancelled())
+			errno = ECANCELED;
+		return -1;
+	}
+
+	return total;
 }
 
 /**
@@ -207,8 +336,8 @@ int FOHSerial::_serialPut(char** buf, size_t size) {
  *	@return 0 on success, -1 otherwise.
  */
 int FOHSerial::setupSerialPort(const char* portname, int speed) {
-	//Open _serfd
-	_serfd = open(portname, O_RDWR | O_NOCTTY | O_SYNC);
+	//Open _serfd, blocking calls wait in poll() so they can be cancelled
+	_serfd = open(portname, O_RDWR | O_NOCTTY | O_SYNC | O_NONBLOCK);
 
 	//Is _serfd valid?
 	if (_serfd < 0) return -1;
@@ -227,6 +356,7 @@ int FOHSerial::setupSerialPort(const char* portname, int speed) {
 	usleep(10000);
 	tcflush(_serfd, TCIOFLUSH);
 
+	FOH_TRACE2(port_open, _serfd, speed);
 	return 0;
 }
 
@@ -235,20 +365,90 @@ int FOHSerial::setupSerialPort(const char* portname, int speed) {
  * 
  *  @param buf Text buffer
  *  @param size Bytes to be sent
+ *  @param cancel Token that aborts the wait for the port (optional)
  * 
  *	@return Number of bytes written when successful, -1 otherwise.
  */
-int FOHSerial::writeToSerialPort(char** buf, size_t size) {
+int FOHSerial::writeToSerialPort(char** buf, size_t size, FOHCancelToken* cancel) {
 	if (this->_isValid == false)
 		return -1;
 
-	int ret = _serialPut(buf, size);
+	int ret = _serialPut(buf, size, cancel);
 
 	//Flush buffer
 	usleep(10000);
 	tcflush(_serfd, TCIOFLUSH);
 
-	return size;
+	return ret;
+}
+
+/**
+ *  @brief Wait until the port is ready or the token is cancelled
+ *
+ *  @param events POLLIN or POLLOUT
+ *  @param timeoutMs Longest wait (-1: forever)
+ *  @param cancel Token to watch as well (may be NULL)
+ *
+ *	@return 1 when ready, 0 on timeout, -1 on error, -2 when cancelled.
+ */
+int FOHSerial::_waitReady(short events, int timeoutMs, FOHCancelToken* cancel) {
+	struct pollfd pfd[2];
+	int n = 1;
+	int r;
+
+	pfd[0].fd = _serfd;
+	pfd[0].events = events;
+	pfd[0].revents = 0;
+	if (cancel) {
+		pfd[1].fd = cancel->getFd();
+		pfd[1].events = POLLIN;
+		pfd[1].revents = 0;
+		n = 2;
+	}
+
+	do {
+		r = poll(pfd, n, timeoutMs);
+	} while (r < 0 && errno == EINTR);
+
+	if (r < 0)
+		return -1;
+	if (cancel && (pfd[1].revents & POLLIN)) {
+		errno = ECANCELED;
+		return -2;
+	}
+	if (r == 0) {
+		_timeouts.fetch_add(1, std::memory_order_relaxed);
+		FOH_TRACE2(timeout, _serfd, timeoutMs);
+		return 0;
+	}
+	if (pfd[0].revents & (POLLERR | POLLNVAL))
+		return -1;
+	//Hung up: only data still buffered can be read, nothing written
+	if ((pfd[0].revents & POLLHUP) && (pfd[0].revents & events & POLLIN) == 0)
+		return -1;
+
+	return 1;
+}
+
+/**
+ *  @brief Gather-write a list of buffers with writev()
+ *
+ *  Frames built from separate pieces (header, payload, CRC) can be sent
+ *  without first copying them into one buffer. Partial writes are resumed
+ *  at the exact byte where the kernel stopped, across segment boundaries.
+ *
+ *  @param iov Array of segments
+ *  @param iovcnt Number of segments (any count, submitted in batches)
+ *  @param cancel Token that aborts the wait for the port (optional)
+ *
+ *	@return Number of bytes written when successful, -1 otherwise.
+ *	        If an error occurs after some bytes went out, the partial count is returned.
+ */
+int FOHSerial::writeToSerialPortv(const struct iovec* iov, int iovcnt, FOHCancelToken* cancel) {
+	if (this->_isValid == false)
+		return -1;
+
+	return _serialPutv(iov, iovcnt, cancel);
 }
 
 /**
@@ -256,10 +456,13 @@ int FOHSerial::writeToSerialPort(char** buf, size_t size) {
  * 
  *  @param buf Text buffer
  *  @param size Buffer size
+ *  @param cancel Token that aborts the wait for data (optional)
+ * 
+ *  A cancel or a hangup of the other end returns the bytes read so far.
  * 
  *	@return Number of bytes read when successful, -1 otherwise.
  */
-int FOHSerial::readFromSerialPort(char** buf, size_t size) {
+int FOHSerial::readFromSerialPort(char** buf, size_t size, FOHCancelToken* cancel) {
 	if (this->_isValid == false)
 		return -1;
 
@@ -279,11 +482,33 @@ int FOHSerial::readFromSerialPort(char** buf, size_t size) {
 
 	char _cbuf = NULL;
 	size_t _read = 0;
+	bool ready = false; //poll() reported data before this read()
 	while (_cbuf != '\n' && _read < size) {
 		n = read(_serfd, &_cbuf, 1);
-		if (n == -1) return -1;
+
+		//Readable but nothing there: the other end hung up
+		if (n == 0 && ready)
+			return _read > 0 ? _read : -1;
+
+		if (n == 0 || (n == -1 && (errno == EAGAIN || errno == EINTR))) {
+			int w = _waitReady(POLLIN, -1, cancel);
+			ready = w == 1;
+			if (w == 1)
+				continue;
+
+			//Cancelled or hung up: report what we already have
+			if (_read > 0)
+				return _read;
+			return -1;
+		}
+		ready = false;
+		if (n == -1) {
+			_readErrors.fetch_add(1, std::memory_order_relaxed);
+			return -1;
+		}
 
 		_read++;
+		_rxBytes.fetch_add(1, std::memory_order_relaxed);
 
 		//Write only to our output if we don't have to deal with delimiters
 		if (_cbuf != '\n' || _cbuf != '\r')
@@ -292,9 +517,325 @@ int FOHSerial::readFromSerialPort(char** buf, size_t size) {
 
 	_read--;
 
+	FOH_TRACE2(chunk_rx, _serfd, _read);
 	return _read;
 }
 
+/**
+ *  @brief Read whatever is available, without delimiter handling
+ *
+ *  Waits up to timeoutMs for data, then returns as much as one read() gives.
+ *
+ *  @param buf Destination buffer
+ *  @param size Buffer size
+ *  @param timeoutMs Longest wait (0: don't wait, -1: forever)
+ *  @param cancel Token that aborts the wait (optional)
+ *
+ *	@return Number of bytes read (0 on timeout) when successful, -1 otherwise
+ *	        (also once the other end hung up).
+ */
+int FOHSerial::readChunk(void* buf, size_t size, int timeoutMs, FOHCancelToken* cancel) {
+	if (this->_isValid == false)
+		return -1;
+
+	int r = _waitReady(POLLIN, timeoutMs, cancel);
+	if (r < 0)
+		return -1;
+	if (r == 0)
+		return 0;
+
+	ssize_t n = read(_serfd, buf, size);
+	if (n < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return 0;
+		_readErrors.fetch_add(1, std::memory_order_relaxed);
+		return -1;
+	}
+	//Readable but nothing there: the other end hung up
+	if (n == 0 && size > 0)
+		return -1;
+
+	_rxBytes.fetch_add(n, std::memory_order_relaxed);
+	FOH_TRACE2(chunk_rx, _serfd, n);
+	return n;
+}
+
+/**
+ *  @brief Single non-blocking gather-write attempt
+ *
+ *  For event driven callers: writes what fits right now and returns.
+ *
+ *  @param iov Array of segments
+ *  @param iovcnt Number of segments (at most IOV_MAX)
+ *
+ *	@return Number of bytes written (0 if the port is full) when successful, -1 otherwise.
+ */
+int FOHSerial::writeNow(const struct iovec* iov, int iovcnt) {
+	if (this->_isValid == false)
+		return -1;
+
+	FOH_TRACE2(write_submit, _serfd, _iovBytes(iov, iovcnt));
+	ssize_t n = writev(_serfd, iov, iovcnt);
+	FOH_TRACE2(write_done, _serfd, n);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		_writeErrors.fetch_add(1, std::memory_order_relaxed);
+		return -1;
+	}
+
+	_txBytes.fetch_add(n, std::memory_order_relaxed);
+	return n;
+}
+
+/**
+ *  @brief Make sure O_NONBLOCK is set on the port
+ *
+ *  Deprecated: the port is always opened non-blocking, the blocking calls
+ *  wait in poll() so they can be cancelled. Blocking I/O can't be switched
+ *  back on, a blocked read() would ignore the cancel token.
+ *
+ *  @param on Must be true
+ *
+ *	@return 0 on success, -1 otherwise (errno EINVAL for false).
+ */
+int FOHSerial::setNonBlocking(bool on) {
+	if (this->_isValid == false)
+		return -1;
+
+	if (on == false) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	int fl = fcntl(_serfd, F_GETFL);
+	if (fl < 0)
+		return -1;
+	if (fl & O_NONBLOCK)
+		return 0;
+
+	return fcntl(_serfd, F_SETFL, fl | O_NONBLOCK) != 0 ? -1 : 0;
+}
+
+/**
+ *  @brief File descriptor of the port, for event loops
+ *
+ *	@return fd on success, -1 otherwise.
+ */
+int FOHSerial::getFd() {
+	if (this->_isValid == false)
+		return -1;
+
+	return _serfd;
+}
+
+/**
+ *  @brief Ask the device to stop or resume sending
+ *
+ *  Sends XOFF/XON when software flow control is configured, otherwise
+ *  drops/raises RTS.
+ *
+ *  @param stop true to pause, false to resume
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHSerial::throttleInput(bool stop) {
+	if (this->_isValid == false)
+		return -1;
+
+	if (_fctrl == 1 || _fctrl == 3)
+		return tcflow(_serfd, stop ? TCIOFF : TCION);
+
+	int bits = TIOCM_RTS;
+	return ioctl(_serfd, stop ? TIOCMBIC : TIOCMBIS, &bits);
+}
+
+/**
+ *  @brief Switch kernel XON/XOFF handling on or off
+ *
+ *  Turn it off when flow control bytes are handled in user space
+ *  (see FOHSoftFlow), so they reach the receive path.
+ *
+ *  @param on true to let the kernel handle XON/XOFF
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHSerial::setKernelXonXoff(bool on) {
+	if (this->_isValid == false)
+		return -1;
+
+	struct termios tty;
+	if (tcgetattr(_serfd, &tty) != 0)
+		return -1;
+
+	if (on)
+		tty.c_iflag |= IXON | IXOFF;
+	else
+		tty.c_iflag &= ~(IXON | IXOFF | IXANY);
+
+	return tcsetattr(_serfd, TCSANOW, &tty) != 0 ? -1 : 0;
+}
+
+/**
+ *  @brief Make the port binary transparent
+ *
+ *  No canonical input, echo, signal characters, XON/XOFF or CR/NL
+ *  translation, so every byte passes unchanged (binary protocols,
+ *  test patterns). Speed, character size, parity and stop bits stay.
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHSerial::setRawMode() {
+	if (this->_isValid == false)
+		return -1;
+
+	struct termios tty;
+	if (tcgetattr(_serfd, &tty) != 0)
+		return -1;
+
+	tty.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY);
+	tty.c_oflag &= ~OPOST;
+	tty.c_lflag &= ~(ECHO | ECHOE | ECHONL | ICANON | ISIG | IEXTEN);
+	tty.c_cc[VMIN] = 1;
+	tty.c_cc[VTIME] = 0;
+
+	return tcsetattr(_serfd, TCSANOW, &tty) != 0 ? -1 : 0;
+}
+
+/**
+ *  @brief Wait until everything written has left the port
+ *
+ *  Polls the kernel output queue instead of blocking in tcdrain() right
+ *  away, so the wait is bounded; tcdrain() finishes the last bytes once
+ *  the queue is empty.
+ *
+ *  @param timeoutMs Longest wait
+ *
+ *	@return 0 when drained, 1 on timeout, -1 otherwise.
+ */
+int FOHSerial::drainOutput(int timeoutMs) {
+	if (this->_isValid == false)
+		return -1;
+
+	uint64_t deadline = fohMonoNs() + (uint64_t)timeoutMs * 1000000ULL;
+	uint64_t ct = charTimeNs();
+	int n;
+
+	for (;;) {
+		n = outputQueueBytes();
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+
+		uint64_t now = fohMonoNs();
+		if (now >= deadline)
+			return 1;
+
+		//Sleep about as long as the queue needs, at least 100us
+		uint64_t wait = ct ? n * ct : 1000000;
+		if (wait < 100000)
+			wait = 100000;
+		if (wait > deadline - now)
+			wait = deadline - now;
+
+		struct timespec ts;
+		ts.tv_sec = wait / 1000000000ULL;
+		ts.tv_nsec = wait % 1000000000ULL;
+		nanosleep(&ts, NULL);
+	}
+
+	//Only the UART FIFO is left
+	return tcdrain(_serfd) != 0 ? -1 : 0;
+}
+
+/**
+ *  @brief Throw away output that hasn't been transmitted yet
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHSerial::discardOutput() {
+	if (this->_isValid == false)
+		return -1;
+
+	return tcflush(_serfd, TCOFLUSH) != 0 ? -1 : 0;
+}
+
+/**
+ *  @brief Close the port, the instance becomes invalid
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHSerial::closeSerialPort() {
+	if (this->_isValid == false)
+		return -1;
+
+	_isValid = false;
+
+	FOH_TRACE1(port_close, _serfd);
+	return close(_serfd) != 0 ? -1 : 0;
+}
+
+/**
+ *  @brief Bytes still waiting in the kernel output queue (TIOCOUTQ)
+ *
+ *	@return Queued bytes when successful, -1 otherwise.
+ */
+int FOHSerial::outputQueueBytes() {
+	if (this->_isValid == false)
+		return -1;
+
+	int n = 0;
+	if (ioctl(_serfd, TIOCOUTQ, &n) != 0)
+		return -1;
+
+	return n;
+}
+
+/**
+ *  @brief UART interrupt counters of the driver (TIOCGICOUNT)
+ *
+ *  Characters received and sent plus frame, overrun, parity and break
+ *  errors since the driver loaded. Not every driver has them.
+ *
+ *  @param ic Receives the counters (<linux/serial.h>)
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHSerial::getICounts(struct serial_icounter_struct* ic) {
+	if (this->_isValid == false)
+		return -1;
+
+	return ioctl(_serfd, TIOCGICOUNT, ic) != 0 ? -1 : 0;
+}
+
+/**
+ *  @brief I/O counters since the port was opened (thread-safe)
+ */
+FOHSerialStats FOHSerial::stats() const {
+	FOHSerialStats s;
+	s.rxBytes = _rxBytes.load(std::memory_order_relaxed);
+	s.txBytes = _txBytes.load(std::memory_order_relaxed);
+	s.readErrors = _readErrors.load(std::memory_order_relaxed);
+	s.writeErrors = _writeErrors.load(std::memory_order_relaxed);
+	s.timeouts = _timeouts.load(std::memory_order_relaxed);
+	return s;
+}
+
+/**
+ *  @brief Time one character occupies the line at the current settings
+ *
+ *  Counts start, data, parity and stop bits.
+ *
+ *	@return Character time in nanoseconds, 0 if the port isn't configured.
+ */
+unsigned FOHSerial::charTimeNs() {
+	if (this->_isValid == false || _baud <= 0)
+		return 0;
+
+	return (unsigned)(1000000000ULL * _charBits / _baud);
+}
+
 /**
  * @brief Main constructor
  *
@@ -304,7 +845,12 @@ int FOHSerial::readFromSerialPort(char** buf, size_t size) {
  *
  * @return Sets valid boolean
  */
-FOHSerial::FOHSerial(const char* port, int speed, uint8_t param) {
+FOHSerial::FOHSerial(const char* port, int speed, uint8_t param)
+	: _rxBytes(0), _txBytes(0), _readErrors(0), _writeErrors(0), _timeouts(0) {
+	 _baud = 0;
+	 _charBits = 10;
+	 _fctrl = 0;
+
 	 int returns = 0;
 	 struct termios returnsb = {0};
 
@@ -367,7 +913,7 @@ FOHSerial::FOHSerial(const char* port, int speed, uint8_t param) {
 	  * 	    0: 1 stop bit
 	  * 	    1: 2 stop bits
 	  */
-	 if (stopbx & 64)
+	 if (param & 64)
 		 stopbx = true;
 	 else
 		 stopbx = false;
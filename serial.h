@@ -25,11 +25,40 @@
  * 
  */
 
+#ifndef FOH_SERIAL_H
+#define FOH_SERIAL_H
 
 #include <sys/types.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <time.h>
 #include <iostream>
+#include <atomic>
+
+class FOHCancelToken;
+struct serial_icounter_struct;
+
+/**
+ *  @brief Monotonic clock in nanoseconds (common time base of the library)
+ */
+static inline uint64_t fohMonoNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ *  @brief I/O counters of a port, kept by the library
+ */
+struct FOHSerialStats {
+	uint64_t rxBytes; /**< Bytes read */
+	uint64_t txBytes; /**< Bytes written */
+	uint64_t readErrors; /**< Failed reads */
+	uint64_t writeErrors; /**< Failed writes */
+	uint64_t timeouts; /**< Waits for the port that timed out */
+};
 
 /**
  *  @brief Class for defining a serial port in software
@@ -79,20 +108,182 @@ public:
 	 * 
 	 *  @param buf Text buffer
 	 *  @param size Bytes to be sent
+	 *  @param cancel Token that aborts the wait for the port (optional)
 	 * 
 	 *	@return Number of bytes written when successful, -1 otherwise.
 	 */
-	int writeToSerialPort(char** buf, size_t size);
+	int writeToSerialPort(char** buf, size_t size, FOHCancelToken* cancel = NULL);
+
+	/**
+	 *  @brief Gather-write a list of buffers with writev()
+	 *
+	 *  Frames built from separate pieces (header, payload, CRC) can be sent
+	 *  without first copying them into one buffer. Partial writes are resumed
+	 *  at the exact byte where the kernel stopped, across segment boundaries.
+	 *
+	 *  @param iov Array of segments
+	 *  @param iovcnt Number of segments (any count, submitted in batches)
+	 *  @param cancel Token that aborts the wait for the port (optional)
+	 *
+	 *	@return Number of bytes written when successful, -1 otherwise.
+	 *	        If an error occurs after some bytes went out, the partial count is returned.
+	 */
+	int writeToSerialPortv(const struct iovec* iov, int iovcnt, FOHCancelToken* cancel = NULL);
 
 	/**
 	 *  @brief Read from a serial port
 	 * 
 	 *  @param buf Text buffer
 	 *  @param size Buffer size
+	 *  @param cancel Token that aborts the wait for data (optional)
+	 * 
+	 *  A cancel or a hangup of the other end returns the bytes read so far.
 	 * 
 	 *	@return Number of bytes read when successful, -1 otherwise.
 	 */
-	int readFromSerialPort(char** buf, size_t size);
+	int readFromSerialPort(char** buf, size_t size, FOHCancelToken* cancel = NULL);
+
+	/**
+	 *  @brief Read whatever is available, without delimiter handling
+	 *
+	 *  Waits up to timeoutMs for data, then returns as much as one read() gives.
+	 *
+	 *  @param buf Destination buffer
+	 *  @param size Buffer size
+	 *  @param timeoutMs Longest wait (0: don't wait, -1: forever)
+	 *  @param cancel Token that aborts the wait (optional)
+	 *
+	 *	@return Number of bytes read (0 on timeout) when successful, -1 otherwise
+	 *	        (also once the other end hung up).
+	 */
+	int readChunk(void* buf, size_t size, int timeoutMs, FOHCancelToken* cancel = NULL);
+
+	/**
+	 *  @brief Single non-blocking gather-write attempt
+	 *
+	 *  For event driven callers: writes what fits right now and returns.
+	 *
+	 *  @param iov Array of segments
+	 *  @param iovcnt Number of segments (at most IOV_MAX)
+	 *
+	 *	@return Number of bytes written (0 if the port is full) when successful, -1 otherwise.
+	 */
+	int writeNow(const struct iovec* iov, int iovcnt);
+
+	/**
+	 *  @brief Make sure O_NONBLOCK is set on the port
+	 *
+	 *  Deprecated: the port is always opened non-blocking, the blocking calls
+	 *  wait in poll() so they can be cancelled. Blocking I/O can't be switched
+	 *  back on, a blocked read() would ignore the cancel token.
+	 *
+	 *  @param on Must be true
+	 *
+	 *	@return 0 on success, -1 otherwise (errno EINVAL for false).
+	 */
+	int setNonBlocking(bool on);
+
+	/**
+	 *  @brief File descriptor of the port, for event loops
+	 *
+	 *	@return fd on success, -1 otherwise.
+	 */
+	int getFd();
+
+	/**
+	 *  @brief Ask the device to stop or resume sending
+	 *
+	 *  Sends XOFF/XON when software flow control is configured, otherwise
+	 *  drops/raises RTS.
+	 *
+	 *  @param stop true to pause, false to resume
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int throttleInput(bool stop);
+
+	/**
+	 *  @brief Switch kernel XON/XOFF handling on or off
+	 *
+	 *  Turn it off when flow control bytes are handled in user space
+	 *  (see FOHSoftFlow), so they reach the receive path.
+	 *
+	 *  @param on true to let the kernel handle XON/XOFF
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int setKernelXonXoff(bool on);
+
+	/**
+	 *  @brief Make the port binary transparent
+	 *
+	 *  No canonical input, echo, signal characters, XON/XOFF or CR/NL
+	 *  translation, so every byte passes unchanged (binary protocols,
+	 *  test patterns). Speed, character size, parity and stop bits stay.
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int setRawMode();
+
+	/**
+	 *  @brief Wait until everything written has left the port
+	 *
+	 *  Polls the kernel output queue instead of blocking in tcdrain() right
+	 *  away, so the wait is bounded; tcdrain() finishes the last bytes once
+	 *  the queue is empty.
+	 *
+	 *  @param timeoutMs Longest wait
+	 *
+	 *	@return 0 when drained, 1 on timeout, -1 otherwise.
+	 */
+	int drainOutput(int timeoutMs);
+
+	/**
+	 *  @brief Throw away output that hasn't been transmitted yet
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int discardOutput();
+
+	/**
+	 *  @brief Close the port, the instance becomes invalid
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int closeSerialPort();
+
+	/**
+	 *  @brief Bytes still waiting in the kernel output queue (TIOCOUTQ)
+	 *
+	 *	@return Queued bytes when successful, -1 otherwise.
+	 */
+	int outputQueueBytes();
+
+	/**
+	 *  @brief UART interrupt counters of the driver (TIOCGICOUNT)
+	 *
+	 *  Characters received and sent plus frame, overrun, parity and break
+	 *  errors since the driver loaded. Not every driver has them.
+	 *
+	 *  @param ic Receives the counters (<linux/serial.h>)
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int getICounts(struct serial_icounter_struct* ic);
+
+	/**
+	 *  @brief Time one character occupies the line at the current settings
+	 *
+	 *  Counts start, data, parity and stop bits.
+	 *
+	 *	@return Character time in nanoseconds, 0 if the port isn't configured.
+	 */
+	unsigned charTimeNs();
+
+	/**
+	 *  @brief I/O counters since the port was opened (thread-safe)
+	 */
+	FOHSerialStats stats() const;
 
 private:
 	/**
@@ -109,11 +300,44 @@ private:
 	 * 
 	 *  @param buf Text buffer
 	 *  @param size Bytes to be sent
+	 *  @param cancel Token that aborts the wait for the port
 	 * 
 	 *	@return Number of bytes written when successful, -1 otherwise.
 	 */
-	int _serialPut(char** buf, size_t size);
+	int _serialPut(char** buf, size_t size, FOHCancelToken* cancel);
+
+	/**
+	 *  @brief Send a list of segments on serial port
+	 *
+	 *  @param iov Array of segments
+	 *  @param iovcnt Number of segments
+	 *  @param cancel Token that aborts the wait for the port
+	 *
+	 *	@return Number of bytes written when successful, -1 otherwise.
+	 */
+	int _serialPutv(const struct iovec* iov, int iovcnt, FOHCancelToken* cancel);
+
+	/**
+	 *  @brief Wait until the port is ready or the token is cancelled
+	 *
+	 *  @param events POLLIN or POLLOUT
+	 *  @param timeoutMs Longest wait (-1: forever)
+	 *  @param cancel Token to watch as well (may be NULL)
+	 *
+	 *	@return 1 when ready, 0 on timeout, -1 on error, -2 when cancelled.
+	 */
+	int _waitReady(short events, int timeoutMs, FOHCancelToken* cancel);
 
 	int _serfd; /**< Serial fd */
 	bool _isValid; /**< is valid instance */
+	int _baud; /**< Baud rate in use */
+	int _charBits; /**< Bits per character on the line */
+	int _fctrl; /**< Flow control type (see if_attrib_set()) */
+	std::atomic<uint64_t> _rxBytes; /**< See FOHSerialStats */
+	std::atomic<uint64_t> _txBytes; /**< See FOHSerialStats */
+	std::atomic<uint64_t> _readErrors; /**< See FOHSerialStats */
+	std::atomic<uint64_t> _writeErrors; /**< See FOHSerialStats */
+	std::atomic<uint64_t> _timeouts; /**< See FOHSerialStats */
 };
+
+#endif
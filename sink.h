@@ -0,0 +1,103 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file sink.h
+ * @brief Interface of data sinks (recorders, captures, exporters).
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_SINK_H
+#define FOH_SINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ *  @brief Direction of recorded data
+ */
+enum FOHDirection {
+	FOH_DIR_RX = 0, /**< Received from the device */
+	FOH_DIR_TX = 1 /**< Sent to the device */
+};
+
+/**
+ *  @brief One decoded measurement value
+ */
+struct FOHSample {
+	uint64_t hostNs; /**< Host receive time (fohMonoNs() clock) */
+	uint32_t port; /**< Port number within the application */
+	uint32_t channel; /**< Channel (field index within the line) */
+	double value; /**< Measured value */
+};
+
+/**
+ *  @brief Destination for data leaving the receive/transmit path
+ *
+ *  Raw data sinks implement push(), measurement sinks pushSamples().
+ *  Sinks must not block the caller of push() for long; buffering and disk
+ *  I/O belong to the sink. flush() is where they may wait, bounded by the
+ *  given time, e.g. during FOHPortGroup::shutdown().
+ */
+class FOHSink {
+public:
+	virtual ~FOHSink() {}
+
+	/**
+	 *  @brief Hand over a chunk of raw port data
+	 *
+	 *  @param port Port number within the application
+	 *  @param dir Direction (see FOHDirection)
+	 *  @param tsNs Timestamp of the chunk (fohMonoNs() clock)
+	 *  @param data Bytes
+	 *  @param len Number of bytes
+	 *
+	 *	@return 0 on success, -1 if the chunk was dropped.
+	 */
+	virtual int push(int /*port*/, int /*dir*/, uint64_t /*tsNs*/, const void* /*data*/, size_t /*len*/) {
+		return 0;
+	}
+
+	/**
+	 *  @brief Hand over decoded samples
+	 *
+	 *  May be called from several decode threads at once (never for the
+	 *  same port concurrently).
+	 *
+	 *  @param s Samples, in receive order per port
+	 *  @param n Number of samples
+	 *
+	 *	@return 0 on success, -1 if the samples were dropped.
+	 */
+	virtual int pushSamples(const FOHSample* /*s*/, size_t /*n*/) {
+		return 0;
+	}
+
+	/**
+	 *  @brief Write out everything buffered so far
+	 *
+	 *  @param timeoutMs Longest wait
+	 *
+	 *	@return 0 when everything is out, 1 on timeout, -1 on error.
+	 */
+	virtual int flush(int timeoutMs) = 0;
+};
+
+#endif
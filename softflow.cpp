@@ -0,0 +1,151 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file softflow.cpp
+ * @brief User space XON/XOFF flow control with throttling statistics.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "softflow.h"
+
+#include <string.h>
+
+/**
+ *  @brief Take over XON/XOFF handling of a port
+ *
+ *  @param port Port whose kernel XON/XOFF handling gets disabled
+ */
+FOHSoftFlow::FOHSoftFlow(FOHSerial* port) : _stopped(false) {
+	_stopNs = 0;
+	_xoffs = 0;
+	_xons = 0;
+	_throttledNs = 0;
+	_maxThrottleNs = 0;
+
+	port->setKernelXonXoff(false);
+}
+
+/**
+ *  @brief Apply one flow control byte
+ */
+void FOHSoftFlow::_apply(uint8_t c) {
+	std::lock_guard<std::mutex> l(_lock);
+
+	if (c == FOH_XOFF) {
+		_xoffs++;
+		if (!_stopped.load(std::memory_order_relaxed)) {
+			_stopNs = fohMonoNs();
+			_stopped.store(true, std::memory_order_release);
+		}
+	} else {
+		_xons++;
+		if (_stopped.load(std::memory_order_relaxed)) {
+			uint64_t d = fohMonoNs() - _stopNs;
+			_throttledNs += d;
+			if (d > _maxThrottleNs)
+				_maxThrottleNs = d;
+			_stopped.store(false, std::memory_order_release);
+			_cond.notify_all();
+		}
+	}
+}
+
+/**
+ *  @brief Remove flow control bytes from received data (in place)
+ *
+ *  @param data Received bytes
+ *  @param len Number of bytes
+ *
+ *  @return Remaining number of bytes
+ */
+size_t FOHSoftFlow::filter(uint8_t* data, size_t len) {
+	uint8_t* on = (uint8_t*)memchr(data, FOH_XON, len);
+	uint8_t* off = (uint8_t*)memchr(data, FOH_XOFF, len);
+	uint8_t* p;
+	size_t out;
+
+	//Common case, nothing to strip
+	if (on == NULL && off == NULL)
+		return len;
+
+	p = (on == NULL || (off != NULL && off < on)) ? off : on;
+	out = p - data;
+
+	for (size_t i = out; i < len; i++) {
+		if (data[i] == FOH_XON || data[i] == FOH_XOFF)
+			_apply(data[i]);
+		else
+			data[out++] = data[i];
+	}
+
+	return out;
+}
+
+/**
+ *  @brief Wait until the peer allows sending
+ *
+ *  @param timeoutMs Longest wait (-1: forever)
+ *
+ *  @return true if sending is allowed
+ */
+bool FOHSoftFlow::waitResume(int timeoutMs) {
+	if (!stopped())
+		return true;
+
+	std::unique_lock<std::mutex> l(_lock);
+	if (timeoutMs < 0) {
+		_cond.wait(l, [this] { return !_stopped.load(std::memory_order_relaxed); });
+		return true;
+	}
+
+	return _cond.wait_for(l, std::chrono::milliseconds(timeoutMs), [this] { return !_stopped.load(std::memory_order_relaxed); });
+}
+
+/**
+ *  @brief Forget a pending stop (e.g. after the device was reset)
+ */
+void FOHSoftFlow::reset() {
+	std::lock_guard<std::mutex> l(_lock);
+
+	if (_stopped.load(std::memory_order_relaxed)) {
+		_throttledNs += fohMonoNs() - _stopNs;
+		_stopped.store(false, std::memory_order_release);
+		_cond.notify_all();
+	}
+}
+
+/**
+ *  @brief Snapshot of the statistics
+ */
+FOHSoftFlowStats FOHSoftFlow::stats() {
+	std::lock_guard<std::mutex> l(_lock);
+	FOHSoftFlowStats s;
+
+	s.xoffs = _xoffs;
+	s.xons = _xons;
+	s.throttledNs = _throttledNs;
+	s.maxThrottleNs = _maxThrottleNs;
+	s.stopped = _stopped.load(std::memory_order_relaxed);
+	if (s.stopped)
+		s.throttledNs += fohMonoNs() - _stopNs;
+
+	return s;
+}
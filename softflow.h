@@ -0,0 +1,122 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file softflow.h
+ * @brief User space XON/XOFF flow control with throttling statistics.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_SOFTFLOW_H
+#define FOH_SOFTFLOW_H
+
+#include "serial.h"
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#define FOH_XON 0x11 /**< DC1, resume */
+#define FOH_XOFF 0x13 /**< DC3, stop */
+
+/**
+ *  @brief Throttling statistics (snapshot)
+ */
+struct FOHSoftFlowStats {
+	uint64_t xoffs; /**< XOFF bytes received */
+	uint64_t xons; /**< XON bytes received */
+	uint64_t throttledNs; /**< Total time spent stopped (including now) */
+	uint64_t maxThrottleNs; /**< Longest single stop */
+	bool stopped; /**< Currently stopped */
+};
+
+/**
+ *  @brief XON/XOFF handled in user space instead of the kernel
+ *
+ *  Kernel handling is switched off so the flow control bytes reach us:
+ *  filter() strips them from received data (two memchr() passes when there
+ *  are none) and tracks the stop state, FOHTxQueue waits at the next frame
+ *  boundary while stopped. Stopping the device in the other direction keeps
+ *  working through FOHSerial::throttleInput() on a port configured for
+ *  software flow control.
+ *
+ *  Frames transmitted as binary data must not contain XON/XOFF bytes.
+ */
+class FOHSoftFlow {
+public:
+	/**
+	 *  @brief Take over XON/XOFF handling of a port
+	 *
+	 *  @param port Port whose kernel XON/XOFF handling gets disabled
+	 */
+	FOHSoftFlow(FOHSerial* port);
+
+	/**
+	 *  @brief Remove flow control bytes from received data (in place)
+	 *
+	 *  @param data Received bytes
+	 *  @param len Number of bytes
+	 *
+	 *  @return Remaining number of bytes
+	 */
+	size_t filter(uint8_t* data, size_t len);
+
+	/**
+	 *  @brief Whether the peer asked us to stop sending
+	 */
+	bool stopped() const { return _stopped.load(std::memory_order_acquire); }
+
+	/**
+	 *  @brief Wait until the peer allows sending
+	 *
+	 *  @param timeoutMs Longest wait (-1: forever)
+	 *
+	 *  @return true if sending is allowed
+	 */
+	bool waitResume(int timeoutMs);
+
+	/**
+	 *  @brief Forget a pending stop (e.g. after the device was reset)
+	 */
+	void reset();
+
+	/**
+	 *  @brief Snapshot of the statistics
+	 */
+	FOHSoftFlowStats stats();
+
+private:
+	/**
+	 *  @brief Apply one flow control byte
+	 */
+	void _apply(uint8_t c);
+
+	std::atomic<bool> _stopped; /**< Peer sent XOFF */
+	uint64_t _stopNs; /**< When the current stop began */
+	uint64_t _xoffs; /**< XOFF count */
+	uint64_t _xons; /**< XON count */
+	uint64_t _throttledNs; /**< Completed stop time */
+	uint64_t _maxThrottleNs; /**< Longest completed stop */
+
+	std::mutex _lock; /**< Protects state and counters */
+	std::condition_variable _cond; /**< Signalled on XON */
+};
+
+#endif
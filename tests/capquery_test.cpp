@@ -0,0 +1,127 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file tests/capquery_test.cpp
+ * @brief Pattern queries that span chunks of interleaved ports.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "../capture.h"
+#include "../capquery.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+struct Chunk {
+	uint32_t port;
+	const char* data;
+};
+
+static int failures = 0;
+
+/**
+ *  @brief Write a capture of DATA records, one per chunk, 1 ms apart
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+static int writeCapture(const char* path, const std::vector<Chunk>& chunks) {
+	std::string buf(sizeof(FOHCapHeader), 0);
+	fohCapHeader((FOHCapHeader*)&buf[0]);
+	uint64_t ts = ((FOHCapHeader*)&buf[0])->monoNs;
+	for (const Chunk& c : chunks) {
+		size_t len = strlen(c.data);
+		size_t at = buf.size();
+		buf.resize(at + fohCapRecordSize(len));
+		ts += 1000000;
+		fohCapPut(&buf[at], ts, c.port, 0, FOH_CAP_DATA, c.data, len);
+	}
+
+	FILE* f = fopen(path, "wb");
+	if (f == NULL)
+		return -1;
+	size_t n = fwrite(buf.data(), 1, buf.size(), f);
+	return fclose(f) == 0 && n == buf.size() ? 0 : -1;
+}
+
+/**
+ *  @brief Query a capture and compare the hits
+ *
+ *  @param want Port and match position of each expected hit, in file order
+ */
+static void expect(const char* name, const std::vector<Chunk>& chunks, const char* pattern,
+		const std::vector<std::pair<uint32_t, int64_t>>& want) {
+	char path[] = "/tmp/fohcapqXXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0 || writeCapture(path, chunks) < 0) {
+		printf("FAIL %s: can't write capture\n", name);
+		failures++;
+		return;
+	}
+	close(fd);
+
+	FOHCapFile cap;
+	FOHCapQuery q;
+	q.pattern = pattern;
+	std::vector<FOHCapMatch> hits;
+	long n = cap.open(path) == 0 ? cap.query(q, hits, 1) : -1;
+	cap.close();
+	unlink(path);
+	unlink((std::string(path) + ".idx").c_str());
+
+	bool ok = n == (long)want.size();
+	for (size_t i = 0; ok && i < want.size(); i++)
+		ok = hits[i].port == want[i].first && hits[i].at == want[i].second;
+	if (ok == false) {
+		printf("FAIL %s: %ld hits:", name, n);
+		for (size_t i = 0; n > 0 && i < hits.size(); i++)
+			printf(" port %u at %lld", hits[i].port, (long long)hits[i].at);
+		printf("\n");
+		failures++;
+		return;
+	}
+	printf("ok   %s\n", name);
+}
+
+int main() {
+	//A tail pieced together from a short chunk must survive another port
+	//being added
+	expect("tail across a new port", {
+			{ 0, "AB" }, { 7, "zzzz" }, { 0, "CDEF" } }, "ABCD",
+			{ { 0, -2 } });
+
+	expect("interleaved ports", {
+			{ 1, "xxA" }, { 2, "AB" }, { 1, "BC" }, { 3, "ABC" }, { 2, "CD" } }, "ABC",
+			{ { 1, -1 }, { 3, 0 }, { 2, -2 } });
+
+	expect("tail from several short chunks", {
+			{ 5, "A" }, { 9, "q" }, { 5, "B" }, { 12, "qq" }, { 5, "C" } }, "ABC",
+			{ { 5, -2 } });
+
+	expect("no match across ports", {
+			{ 0, "AB" }, { 1, "CD" }, { 0, "x" }, { 1, "AB" } }, "ABCD",
+			{});
+
+	return failures ? 1 : 0;
+}
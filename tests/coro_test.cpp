@@ -0,0 +1,142 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file tests/coro_test.cpp
+ * @brief Concurrent read and write on one FOHAsyncPort.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "../coro.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+//Bytes written while a read waits, several times the pty buffer
+#define TEST_WRITE_BYTES 65536
+
+static int failures = 0;
+
+static FOHTask<FOHReadResult> readLine(FOHAsyncPort* p, uint64_t deadlineNs) {
+	co_return co_await p->readUntil("\n", deadlineNs);
+}
+
+static FOHTask<int> writeAll(FOHAsyncPort* p, const std::vector<uint8_t>* data, uint64_t deadlineNs) {
+	co_return co_await p->write(data->data(), data->size(), deadlineNs);
+}
+
+/**
+ *  @brief Far end: answer the read after replyMs, drain the write after drainMs
+ *
+ *  @return Bytes drained
+ */
+static size_t farEnd(int master, int replyMs, int drainMs) {
+	char buf[4096];
+	size_t got = 0;
+	uint64_t start = fohMonoNs();
+	bool replied = false;
+
+	while ((got < TEST_WRITE_BYTES || replied == false) && fohMonoNs() - start < 3000000000ULL) {
+		uint64_t ms = (fohMonoNs() - start) / 1000000;
+		if (replied == false && ms >= (uint64_t)replyMs) {
+			replied = write(master, "hello\n", 6) == 6;
+			continue;
+		}
+		if (ms < (uint64_t)drainMs) {
+			usleep(1000);
+			continue;
+		}
+		struct pollfd pfd = { master, POLLIN, 0 };
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		ssize_t n = read(master, buf, sizeof(buf));
+		if (n > 0)
+			got += n;
+	}
+	return got;
+}
+
+/**
+ *  @brief Run a read and a write on one port at the same time
+ */
+static void expect(const char* name, int replyMs, int drainMs) {
+	char path[64];
+	int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0 || ptsname_r(master, path, sizeof(path)) != 0) {
+		printf("FAIL %s: can't create a pty pair\n", name);
+		failures++;
+		return;
+	}
+
+	FOHSerial port(path, 115200, 3);
+	if (port.getFd() < 0 || port.setRawMode() < 0) {
+		printf("FAIL %s: can't open %s\n", name, path);
+		failures++;
+		close(master);
+		return;
+	}
+
+	FOHEventLoop loop;
+	std::vector<uint8_t> data(TEST_WRITE_BYTES, 'x');
+	size_t drained = 0;
+	{
+		FOHAsyncPort ap(&loop, &port);
+		uint64_t deadline = fohMonoNs() + 2000000000ULL;
+		FOHTask<FOHReadResult> rd = readLine(&ap, deadline);
+		FOHTask<int> wr = writeAll(&ap, &data, deadline);
+
+		std::thread far([&] { drained = farEnd(master, replyMs, drainMs); });
+		rd.start();
+		wr.start();
+		while ((rd.done() && wr.done()) == false)
+			loop.runOnce(100);
+		far.join();
+
+		FOHReadResult r = rd.result();
+		bool ok = r.status == 1 && r.len == 6 && memcmp(r.data, "hello\n", 6) == 0
+				&& wr.result() == TEST_WRITE_BYTES && drained == TEST_WRITE_BYTES;
+		if (ok)
+			printf("ok   %s\n", name);
+		else {
+			printf("FAIL %s: read status %d len %zu, write %d, drained %zu\n", name, r.status, r.len,
+					wr.result(), drained);
+			failures++;
+		}
+	}
+
+	port.closeSerialPort();
+	close(master);
+}
+
+int main() {
+	//The write waits for EPOLLOUT while the reply arrives
+	expect("reply while the write waits", 100, 300);
+
+	//The read waits for EPOLLIN while the write drains
+	expect("drain while the read waits", 300, 100);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,345 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file tools/fohber.cpp
+ * @brief Bit error rate tester: PRBS through a serial link in loopback.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "../serial.h"
+#include "../prbs.h"
+#include "../cancel.h"
+
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/serial.h>
+#include <mutex>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+
+static void usage() {
+	fprintf(stderr, "usage: fohber [options] <port> [<rx port>]\n"
+			"       fohber [options] -L\n"
+			"  -o N  PRBS order 7, 15, 23 or 31 (default 23)\n"
+			"  -b N  baud (default 115200)\n"
+			"  -p N  parameters as for FOHSerial, 8 data bits (default 3: 8N1)\n"
+			"  -t N  seconds to send (default 10)\n"
+			"  -i N  seconds between reports (default 1, 0: only the summary)\n"
+			"  -c N  bytes per write (default 256)\n"
+			"  -L    internal pty pair as loopback plug instead of a port\n"
+			"  -e N  with -L: flip N bits per million\n"
+			"  -d N  with -L: drop every Nth byte\n"
+			"  -u N  with -L: duplicate every Nth byte\n"
+			"One port needs a loopback plug (TX to RX), with two ports the first\n"
+			"sends to the second. Exit status 1 if any error or slip was seen.\n");
+}
+
+/**
+ *  @brief Loopback plug on the master side of a pty pair, optionally faulty
+ */
+struct BerLoop {
+	int master = -1;
+	char path[64];
+	double bitPpm = 0;
+	long dropEvery = 0;
+	long dupEvery = 0;
+	std::atomic<bool> stop{false};
+
+	/**
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int open() {
+		master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+		if (master < 0)
+			return -1;
+		if (grantpt(master) < 0 || unlockpt(master) < 0 || ptsname_r(master, path, sizeof(path)) != 0) {
+			::close(master);
+			master = -1;
+			return -1;
+		}
+		return 0;
+	}
+
+	void run() {
+		uint8_t in[4096], out[8192];
+		uint64_t pos = 0;
+		//Bits until the next injected error
+		double gap = bitPpm > 0 ? 1e6 / bitPpm : 0;
+		uint64_t nextErr = gap > 0 ? (uint64_t)(gap * drand48() * 2) : UINT64_MAX;
+
+		while (stop.load() == false) {
+			struct pollfd pfd = { master, POLLIN, 0 };
+			if (poll(&pfd, 1, 100) <= 0)
+				continue;
+			ssize_t n = read(master, in, sizeof(in));
+			if (n <= 0)
+				continue;
+
+			size_t m = 0;
+			for (ssize_t i = 0; i < n; i++, pos++) {
+				uint8_t b = in[i];
+				while (nextErr < (pos + 1) * 8) {
+					b ^= 1 << (nextErr % 8);
+					nextErr += 1 + (uint64_t)(gap * drand48() * 2);
+				}
+				if (dropEvery && (pos + 1) % dropEvery == 0)
+					continue;
+				out[m++] = b;
+				if (dupEvery && (pos + 1) % dupEvery == 0)
+					out[m++] = b;
+			}
+
+			for (size_t off = 0; off < m && stop.load() == false;) {
+				ssize_t w = write(master, out + off, m - off);
+				if (w > 0) {
+					off += w;
+				} else if (w < 0 && errno != EAGAIN && errno != EINTR) {
+					break;
+				}
+			}
+		}
+	}
+};
+
+/**
+ *  @brief Counters shared by the threads
+ */
+struct BerState {
+	std::mutex lock;
+	FOHPrbsChecker checker;
+	std::atomic<uint64_t> txBytes{0};
+	FOHCancelToken txStop;
+	FOHCancelToken rxStop;
+
+	BerState(int order) : checker(order) {}
+};
+
+static void writer(FOHSerial* port, BerState* st, int order, size_t chunk) {
+	FOHPrbs gen(order);
+	uint8_t* buf = (uint8_t*)malloc(chunk);
+	while (st->txStop.cancelled() == false) {
+		gen.fill(buf, chunk);
+		struct iovec iov = { buf, chunk };
+		int n = port->writeToSerialPortv(&iov, 1, &st->txStop);
+		if (n > 0)
+			st->txBytes += n;
+		if (n < (int)chunk)
+			break;
+	}
+	free(buf);
+}
+
+static void reader(FOHSerial* port, BerState* st) {
+	uint8_t buf[4096];
+	while (st->rxStop.cancelled() == false) {
+		int n = port->readChunk(buf, sizeof(buf), 100, &st->rxStop);
+		if (n < 0)
+			break;
+		if (n > 0) {
+			std::lock_guard<std::mutex> g(st->lock);
+			st->checker.feed(buf, n);
+		}
+	}
+}
+
+static void header(bool line) {
+	printf("%7s %10s %10s %6s %10s %9s %10s %6s %8s %8s %5s\n",
+			"t[s]", "tx[B/s]", "rx[B/s]", line ? "line%" : "", "bit errs", "BER",
+			"byte errs", "resync", "dropped", "dup", "lock");
+}
+
+static void report(double t, double txRate, double rxRate, unsigned charNs, const FOHPrbsStats& s) {
+	char util[16] = "";
+	if (charNs)
+		snprintf(util, sizeof(util), "%.1f", rxRate * charNs / 1e7);
+	double ber = s.checked ? (double)s.bitErrors / (s.checked * 8) : 0;
+	printf("%7.1f %10.0f %10.0f %6s %10llu %9.2e %10llu %6llu %8llu %8llu %5s\n",
+			t, txRate, rxRate, util, (unsigned long long)s.bitErrors, ber,
+			(unsigned long long)s.byteErrors, (unsigned long long)s.resyncs,
+			(unsigned long long)s.dropped, (unsigned long long)s.duplicated,
+			s.locked ? "yes" : "no");
+	fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+	int order = 23, baud = 115200, param = 3;
+	double seconds = 10, interval = 1;
+	size_t chunk = 256;
+	bool pty = false;
+	BerLoop loop;
+	int opt;
+	while ((opt = getopt(argc, argv, "o:b:p:t:i:c:Le:d:u:h")) != -1) {
+		switch (opt) {
+		case 'o': order = atoi(optarg); break;
+		case 'b': baud = atoi(optarg); break;
+		case 'p': param = atoi(optarg); break;
+		case 't': seconds = atof(optarg); break;
+		case 'i': interval = atof(optarg); break;
+		case 'c': chunk = strtoul(optarg, NULL, 0); break;
+		case 'L': pty = true; break;
+		case 'e': loop.bitPpm = atof(optarg); break;
+		case 'd': loop.dropEvery = atol(optarg); break;
+		case 'u': loop.dupEvery = atol(optarg); break;
+		default:
+			usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+	if (FOHPrbs(order).isValid() == false || chunk == 0 || seconds <= 0
+			|| (pty ? optind != argc : (optind >= argc || argc - optind > 2))) {
+		usage();
+		return 2;
+	}
+	if ((param & 3) != 3) {
+		fprintf(stderr, "fohber: PRBS needs 8 data bits\n");
+		return 2;
+	}
+	if (pty == false && (loop.bitPpm > 0 || loop.dropEvery || loop.dupEvery)) {
+		fprintf(stderr, "fohber: fault injection only with -L\n");
+		return 2;
+	}
+
+	if (pty && loop.open() < 0) {
+		fprintf(stderr, "fohber: can't create a pty pair: %s\n", strerror(errno));
+		return 1;
+	}
+	const char* txPath = pty ? loop.path : argv[optind];
+	const char* rxPath = pty == false && argc - optind == 2 ? argv[optind + 1] : NULL;
+
+	FOHSerial* tx = new FOHSerial(txPath, baud, param);
+	FOHSerial* rx = rxPath ? new FOHSerial(rxPath, baud, param) : tx;
+	if (tx->getFd() < 0 || rx->getFd() < 0 || tx->setRawMode() < 0 || rx->setRawMode() < 0) {
+		fprintf(stderr, "fohber: can't set up %s\n", tx->getFd() < 0 ? txPath : rxPath ? rxPath : txPath);
+		tx->closeSerialPort();
+		delete tx;
+		if (rx != tx) {
+			rx->closeSerialPort();
+			delete rx;
+		}
+		return 1;
+	}
+	tx->discardOutput();
+
+	struct serial_icounter_struct ic0 = {}, ic1 = {};
+	bool haveIc = pty == false && rx->getICounts(&ic0) == 0;
+	unsigned charNs = pty ? 0 : rx->charTimeNs();
+
+	printf("PRBS-%d at %d baud, %s%s%s, %.0f s\n", order, baud, txPath,
+			rxPath ? " -> " : pty ? " (pty loopback)" : " (loopback)", rxPath ? rxPath : "", seconds);
+	if (interval > 0)
+		header(charNs != 0);
+
+	BerState st(order);
+	std::thread loopThread;
+	if (pty)
+		loopThread = std::thread(&BerLoop::run, &loop);
+	std::thread rxThread(reader, rx, &st);
+	std::thread txThread(writer, tx, &st, order, chunk);
+
+	uint64_t t0 = fohMonoNs(), last = t0, lastTx = 0, lastRx = 0;
+	uint64_t end = t0 + (uint64_t)(seconds * 1e9);
+	bool sending = true;
+	uint64_t idleSince = 0, settleEnd = 0;
+	while (true) {
+		usleep(50000);
+		uint64_t now = fohMonoNs();
+		FOHPrbsStats s;
+		{
+			std::lock_guard<std::mutex> g(st.lock);
+			s = st.checker.stats();
+		}
+
+		if (interval > 0 && now - last >= interval * 1e9) {
+			double dt = (now - last) / 1e9;
+			uint64_t txb = st.txBytes.load();
+			report((now - t0) / 1e9, (txb - lastTx) / dt, (s.bytes - lastRx) / dt, charNs, s);
+			last = now;
+			lastTx = txb;
+			lastRx = s.bytes;
+		}
+
+		if (sending && now >= end) {
+			//Let what's queued arrive before the summary
+			sending = false;
+			st.txStop.cancel();
+			txThread.join();
+			tx->drainOutput(5000);
+			now = fohMonoNs();
+			idleSince = now;
+			settleEnd = now + 3000000000ULL;
+			lastRx = s.bytes;
+		} else if (sending == false) {
+			if (s.bytes != lastRx) {
+				idleSince = now;
+				lastRx = s.bytes;
+			}
+			if (now - idleSince >= 300000000ULL || now >= settleEnd)
+				break;
+		}
+	}
+	st.rxStop.cancel();
+	rxThread.join();
+	if (pty) {
+		loop.stop = true;
+		loopThread.join();
+	}
+
+	double secs = seconds;
+	const FOHPrbsStats& s = st.checker.stats();
+	uint64_t txb = st.txBytes.load();
+	printf("\nsent %llu bytes (%.0f B/s), received %llu (%.0f B/s)\n",
+			(unsigned long long)txb, txb / secs, (unsigned long long)s.bytes, s.bytes / secs);
+	printf("checked %llu bytes, %llu unchecked\n", (unsigned long long)s.checked,
+			(unsigned long long)s.unchecked);
+	printf("bit errors %llu (BER %.2e), byte errors %llu\n", (unsigned long long)s.bitErrors,
+			s.checked ? (double)s.bitErrors / (s.checked * 8) : 0, (unsigned long long)s.byteErrors);
+	printf("resyncs %llu: %llu dropped, %llu duplicated, %llu unclassified\n",
+			(unsigned long long)s.resyncs, (unsigned long long)s.dropped,
+			(unsigned long long)s.duplicated, (unsigned long long)s.unknownSlips);
+	if (s.bytes + s.dropped > txb + s.duplicated)
+		printf("received more than was sent: stale data or a foreign source\n");
+	else if (s.bytes + s.dropped < txb + s.duplicated)
+		printf("missing at the end: %llu bytes\n", (unsigned long long)(txb + s.duplicated - s.bytes - s.dropped));
+
+	if (haveIc && rx->getICounts(&ic1) == 0)
+		printf("icounts: rx %d tx %d frame %d overrun %d parity %d brk %d buf_overrun %d\n",
+				ic1.rx - ic0.rx, ic1.tx - ic0.tx, ic1.frame - ic0.frame, ic1.overrun - ic0.overrun,
+				ic1.parity - ic0.parity, ic1.brk - ic0.brk, ic1.buf_overrun - ic0.buf_overrun);
+	else
+		printf("icounts: n/a\n");
+
+	bool clean = s.checked > 0 && s.locked && s.bitErrors == 0 && s.resyncs == 0;
+	tx->closeSerialPort();
+	delete tx;
+	if (rx != tx) {
+		rx->closeSerialPort();
+		delete rx;
+	}
+	if (pty)
+		close(loop.master);
+	return clean ? 0 : 1;
+}
@@ -0,0 +1,527 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file tools/fohping.cpp
+ * @brief Round-trip latency probe for a live serial link.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "../serial.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/serial.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define PING_MAGIC 0xA5 /**< First byte of an echo probe */
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void onSignal(int) {
+	interrupted = 1;
+}
+
+static void usage() {
+	fprintf(stderr, "usage: fohping [options] <port>\n"
+			"       fohping [options] -L\n"
+			"  -q STR  send STR as command and wait for a reply (C escapes allowed)\n"
+			"  -e STR  end of a reply (default \\n)\n"
+			"  -s N    echo probe size in bytes (default 16, without -q)\n"
+			"  -r N    probes per second (default 10, 0: back to back)\n"
+			"  -c N    number of probes (default 100, 0: until interrupted)\n"
+			"  -w N    probes in flight (default 1)\n"
+			"  -T N    reply timeout in ms (default 1000)\n"
+			"  -b N    baud (default 115200)\n"
+			"  -p N    parameters as for FOHSerial (default 3: 8N1)\n"
+			"  -A N    adapter round trip in us, measured before with a loopback plug\n"
+			"  -L      internal pty pair that echoes, instead of a port\n"
+			"  -D N    with -L: device processing time in us\n"
+			"  -v      print every reply\n"
+			"Without -q the far end must echo (loopback plug or device in echo mode).\n");
+}
+
+/**
+ *  @brief Expand C escapes (\r \n \t \\ \xNN)
+ */
+static std::string unescape(const char* s) {
+	std::string out;
+	for (; *s; s++) {
+		if (*s != '\\' || s[1] == 0) {
+			out += *s;
+			continue;
+		}
+		s++;
+		switch (*s) {
+		case 'r': out += '\r'; break;
+		case 'n': out += '\n'; break;
+		case 't': out += '\t'; break;
+		case '0': out += '\0'; break;
+		case 'x': {
+			char hex[3] = { s[1], s[1] ? s[2] : (char)0, 0 };
+			char* end;
+			out += (char)strtoul(hex, &end, 16);
+			s += end - hex;
+			break;
+		}
+		default: out += *s; break;
+		}
+	}
+	return out;
+}
+
+/**
+ *  @brief Echoing far end on the master side of a pty pair
+ */
+struct PingLoop {
+	int master = -1;
+	char path[64];
+	unsigned delayUs = 0;
+	std::atomic<bool> stop{false};
+
+	/**
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int open() {
+		master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+		if (master < 0)
+			return -1;
+		if (grantpt(master) < 0 || unlockpt(master) < 0 || ptsname_r(master, path, sizeof(path)) != 0) {
+			::close(master);
+			master = -1;
+			return -1;
+		}
+		return 0;
+	}
+
+	void run() {
+		char buf[4096];
+		while (stop.load() == false) {
+			struct pollfd pfd = { master, POLLIN, 0 };
+			if (poll(&pfd, 1, 100) <= 0)
+				continue;
+			ssize_t n = read(master, buf, sizeof(buf));
+			if (n <= 0)
+				continue;
+			if (delayUs)
+				usleep(delayUs);
+			for (ssize_t off = 0; off < n;) {
+				ssize_t w = write(master, buf + off, n - off);
+				if (w > 0)
+					off += w;
+				else if (errno != EAGAIN && errno != EINTR)
+					break;
+			}
+		}
+	}
+};
+
+/**
+ *  @brief A probe waiting for its reply
+ */
+struct Probe {
+	uint32_t seq;
+	uint64_t tSend; /**< Before write() */
+	uint64_t tSent; /**< After write() returned */
+	uint64_t tFirst; /**< Wakeup for the first reply byte */
+	uint64_t hostRx; /**< Time spent reading the reply */
+	uint64_t lastChunk; /**< Chunk counted in hostRx last */
+	size_t got; /**< Reply bytes so far */
+};
+
+/**
+ *  @brief Samples of one part of the round trip
+ */
+struct Series {
+	const char* name;
+	std::vector<double> us;
+
+	void row() {
+		if (us.empty())
+			return;
+		std::sort(us.begin(), us.end());
+		double sum = 0;
+		for (double v : us)
+			sum += v;
+		auto q = [&](double p) { return us[std::min(us.size() - 1, (size_t)(p * us.size()))]; };
+		printf("%-15s %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, us.front(), q(0.5), q(0.9),
+				q(0.99), q(0.999), us.back(), sum / us.size());
+	}
+};
+
+static uint8_t echoByte(uint32_t seq, size_t i) {
+	if (i == 0)
+		return PING_MAGIC;
+	if (i < 5)
+		return seq >> (8 * (i - 1));
+	return seq * 31 + i;
+}
+
+/**
+ *  @brief USB latency timer of the adapter behind a port (FTDI and alike)
+ *
+ *	@return Timer in ms when the driver exposes it, -1 otherwise.
+ */
+static int usbLatencyTimer(const char* port) {
+	char real[PATH_MAX], path[PATH_MAX + 64];
+	if (realpath(port, real) == NULL)
+		return -1;
+	const char* name = strrchr(real, '/');
+	snprintf(path, sizeof(path), "/sys/class/tty/%s/device/latency_timer", name ? name + 1 : real);
+	FILE* f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	int ms = -1;
+	if (fscanf(f, "%d", &ms) != 1)
+		ms = -1;
+	fclose(f);
+	return ms;
+}
+
+static void histogram(const std::vector<double>& us) {
+	int buckets[32] = {0}, top = 0, lo = 31, hi = 0;
+	for (double v : us) {
+		int b = v < 1 ? 0 : std::min(31, (int)log2(v) + 1);
+		buckets[b]++;
+		top = std::max(top, buckets[b]);
+		lo = std::min(lo, b);
+		hi = std::max(hi, b);
+	}
+	for (int b = lo; b <= hi && top; b++) {
+		char bar[51];
+		int len = (int)((buckets[b] * 50LL + top - 1) / top);
+		memset(bar, '#', len);
+		bar[len] = 0;
+		printf("  %8.0f - %-8.0f us %8d %s\n", b ? exp2(b - 1) : 0.0, exp2(b), buckets[b], bar);
+	}
+}
+
+int main(int argc, char** argv) {
+	std::string cmd, delim = "\n";
+	size_t size = 16;
+	double rate = 10;
+	long count = 100;
+	size_t window = 1;
+	int timeoutMs = 1000, baud = 115200, param = 3;
+	double adapterUs = -1;
+	bool pty = false, verbose = false;
+	PingLoop loop;
+	int opt;
+	while ((opt = getopt(argc, argv, "q:e:s:r:c:w:T:b:p:A:LD:vh")) != -1) {
+		switch (opt) {
+		case 'q': cmd = unescape(optarg); break;
+		case 'e': delim = unescape(optarg); break;
+		case 's': size = strtoul(optarg, NULL, 0); break;
+		case 'r': rate = atof(optarg); break;
+		case 'c': count = atol(optarg); break;
+		case 'w': window = strtoul(optarg, NULL, 0); break;
+		case 'T': timeoutMs = atoi(optarg); break;
+		case 'b': baud = atoi(optarg); break;
+		case 'p': param = atoi(optarg); break;
+		case 'A': adapterUs = atof(optarg); break;
+		case 'L': pty = true; break;
+		case 'D': loop.delayUs = strtoul(optarg, NULL, 0); break;
+		case 'v': verbose = true; break;
+		default:
+			usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+	if ((pty ? optind != argc : optind != argc - 1) || window == 0 || timeoutMs <= 0 || rate < 0
+			|| (cmd.empty() && size < 5) || delim.empty()) {
+		usage();
+		return 2;
+	}
+	bool echo = cmd.empty();
+
+	if (pty && loop.open() < 0) {
+		fprintf(stderr, "fohping: can't create a pty pair: %s\n", strerror(errno));
+		return 1;
+	}
+	const char* path = pty ? loop.path : argv[optind];
+	FOHSerial* port = new FOHSerial(path, baud, param);
+	if (port->getFd() < 0 || port->setRawMode() < 0) {
+		fprintf(stderr, "fohping: can't set up %s\n", path);
+		port->closeSerialPort();
+		delete port;
+		return 1;
+	}
+	int fd = port->getFd();
+	unsigned charNs = pty ? 0 : port->charTimeNs();
+
+	char pace[32] = "back to back";
+	if (rate > 0)
+		snprintf(pace, sizeof(pace), "%g/s", rate);
+	printf("fohping %s%s, %s, %d baud, %s\n", path, pty ? " (pty)" : "", echo ? "echo" : "command",
+			baud, pace);
+	if (pty == false) {
+		int lt = usbLatencyTimer(path);
+		struct serial_struct ss;
+		bool lowLat = ioctl(fd, TIOCGSERIAL, &ss) == 0 && (ss.flags & ASYNC_LOW_LATENCY);
+		if (lt >= 0)
+			printf("usb latency timer %d ms%s\n", lt, lowLat ? ", low_latency" : "");
+		else if (lowLat)
+			printf("low_latency set\n");
+	}
+
+	std::thread loopThread;
+	if (pty)
+		loopThread = std::thread(&PingLoop::run, &loop);
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	port->discardOutput();
+	tcflush(fd, TCIFLUSH);
+
+	Series rtt { "round trip", {} }, first { "first byte", {} }, host { "host", {} }, wire { "wire", {} },
+			rest { echo ? "adapter" : adapterUs >= 0 ? "adapter" : "adapter+device", {} }, device { "device", {} };
+	std::deque<Probe> out;
+	std::vector<uint8_t> frame(echo ? size : cmd.size());
+	std::string line;
+	bool resync = false; //Echo: discard input up to the next reply header
+	std::vector<uint8_t> hunt; //Resync: candidate header (PING_MAGIC, seq)
+	uint64_t huntWake = 0; //Its first byte's wakeup
+	uint64_t sent = 0, received = 0, lost = 0, corrupt = 0, unsolicited = 0;
+	uint64_t periodNs = rate > 0 ? (uint64_t)(1e9 / rate) : 0;
+	uint64_t tStart = fohMonoNs(), nextSend = tStart, tLast = tStart, chunks = 0;
+	uint64_t timeoutNs = (uint64_t)timeoutMs * 1000000;
+	uint8_t buf[4096];
+
+	if (echo == false)
+		memcpy(frame.data(), cmd.data(), cmd.size());
+
+	auto done = [&](uint64_t tDone, size_t rxLen) {
+		Probe& p = out.front();
+		double r = (tDone - p.tSend) / 1e3;
+		double h = ((p.tSent - p.tSend) + p.hostRx) / 1e3;
+		double w = (frame.size() + rxLen) * (double)charNs / 1e3;
+		double a = std::max(0.0, r - h - w);
+		rtt.us.push_back(r);
+		first.us.push_back((p.tFirst - p.tSend) / 1e3);
+		host.us.push_back(h);
+		if (charNs)
+			wire.us.push_back(w);
+		if (adapterUs >= 0 && echo == false) {
+			rest.us.push_back(std::min(a, adapterUs));
+			device.us.push_back(std::max(0.0, a - adapterUs));
+		} else {
+			rest.us.push_back(a);
+		}
+		if (verbose)
+			printf("%zu bytes seq=%u time=%.1f us\n", rxLen, p.seq, r);
+		received++;
+		tLast = tDone;
+		out.pop_front();
+	};
+
+	while (interrupted == 0) {
+		uint64_t now = fohMonoNs();
+		bool more = count == 0 || sent < (uint64_t)count;
+		if (more == false && out.empty())
+			break;
+
+		if (more && out.size() < window && now >= nextSend) {
+			Probe p = {};
+			p.seq = sent;
+			if (echo)
+				for (size_t i = 0; i < size; i++)
+					frame[i] = echoByte(p.seq, i);
+			struct iovec iov = { frame.data(), frame.size() };
+			p.tSend = fohMonoNs();
+			if (port->writeToSerialPortv(&iov, 1) != (int)frame.size()) {
+				fprintf(stderr, "fohping: write failed\n");
+				break;
+			}
+			p.tSent = fohMonoNs();
+			p.lastChunk = UINT64_MAX;
+			out.push_back(p);
+			sent++;
+			if (periodNs) {
+				nextSend += periodNs;
+				if (nextSend + periodNs < p.tSent)
+					nextSend = p.tSent;
+			}
+			continue;
+		}
+
+		while (out.empty() == false && now - out.front().tSend > timeoutNs) {
+			if (verbose)
+				printf("seq=%u timeout\n", out.front().seq);
+			lost++;
+			out.pop_front();
+			line.clear();
+			//A late reply would be taken for the next probe's
+			if (echo)
+				resync = true;
+			else
+				tcflush(fd, TCIFLUSH);
+		}
+
+		//Sleep until data, the next send or the oldest probe's timeout
+		uint64_t until = now + 100000000ULL;
+		if (more && out.size() < window)
+			until = std::min(until, nextSend);
+		if (out.empty() == false)
+			until = std::min(until, out.front().tSend + timeoutNs + 1);
+		uint64_t waitNs = until > now ? until - now : 0;
+		struct timespec ts = { (time_t)(waitNs / 1000000000ULL), (long)(waitNs % 1000000000ULL) };
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (ppoll(&pfd, 1, &ts, NULL) <= 0)
+			continue;
+
+		uint64_t tWake = fohMonoNs();
+		int n = port->readChunk(buf, sizeof(buf), 0);
+		uint64_t tRead = fohMonoNs();
+		if (n < 0) {
+			fprintf(stderr, "fohping: read failed\n");
+			break;
+		}
+		chunks++;
+
+		for (int i = 0; i < n; i++) {
+			if (resync) {
+				//PING_MAGIC also occurs in seq and payload bytes, so a header
+				//only counts when its seq belongs to a waiting probe
+				if (hunt.empty()) {
+					if (buf[i] != PING_MAGIC)
+						continue;
+					huntWake = tWake;
+				}
+				hunt.push_back(buf[i]);
+				if (hunt.size() < 5)
+					continue;
+
+				uint32_t seq = hunt[1] | hunt[2] << 8 | hunt[3] << 16 | (uint32_t)hunt[4] << 24;
+				auto it = std::find_if(out.begin(), out.end(), [&](const Probe& p) { return p.seq == seq; });
+				if (it == out.end()) {
+					//False lock, the next candidate may start within it
+					auto m = std::find(hunt.begin() + 1, hunt.end(), (uint8_t)PING_MAGIC);
+					hunt.erase(hunt.begin(), m);
+					continue;
+				}
+
+				//Older probes missed their reply
+				for (; out.begin() != it; it = out.begin()) {
+					if (verbose)
+						printf("seq=%u lost\n", out.front().seq);
+					lost++;
+					out.pop_front();
+				}
+				Probe& p = out.front();
+				p.tFirst = huntWake;
+				p.hostRx += tRead - tWake;
+				p.lastChunk = chunks;
+				p.got = hunt.size();
+				hunt.clear();
+				resync = false;
+				if (p.got == size)
+					done(tRead, size);
+				continue;
+			}
+			if (out.empty()) {
+				if (echo || ((line += (char)buf[i]).size() >= delim.size()
+						&& line.compare(line.size() - delim.size(), delim.size(), delim) == 0)) {
+					unsolicited++;
+					line.clear();
+				}
+				continue;
+			}
+
+			Probe& p = out.front();
+			if (p.got == 0)
+				p.tFirst = tWake;
+			if (p.lastChunk != chunks) {
+				p.hostRx += tRead - tWake;
+				p.lastChunk = chunks;
+			}
+			p.got++;
+
+			if (echo) {
+				if (buf[i] != echoByte(p.seq, p.got - 1)) {
+					if (verbose)
+						printf("seq=%u corrupt\n", p.seq);
+					corrupt++;
+					out.pop_front();
+					resync = true;
+					//The bad byte may already start the next reply
+					if (buf[i] == PING_MAGIC)
+						i--;
+				} else if (p.got == size) {
+					done(tRead, size);
+				}
+			} else {
+				line += (char)buf[i];
+				if (line.size() >= delim.size() && line.compare(line.size() - delim.size(), delim.size(), delim) == 0) {
+					done(tRead, line.size());
+					line.clear();
+				}
+			}
+		}
+	}
+
+	if (pty) {
+		loop.stop = true;
+		loopThread.join();
+	}
+	port->closeSerialPort();
+	delete port;
+	if (pty)
+		close(loop.master);
+
+	lost += out.size();
+	printf("\n%llu sent, %llu received, %llu lost, %llu corrupt", (unsigned long long)sent,
+			(unsigned long long)received, (unsigned long long)lost, (unsigned long long)corrupt);
+	if (unsolicited)
+		printf(", %llu unsolicited", (unsigned long long)unsolicited);
+	printf("\n");
+	if (received == 0)
+		return 1;
+
+	printf("%.1f replies/s over %.2f s, window %zu\n", received / ((tLast - tStart) / 1e9),
+			(tLast - tStart) / 1e9, window);
+	printf("\n%-15s %9s %9s %9s %9s %9s %9s %9s\n", "[us]", "min", "p50", "p90", "p99", "p99.9", "max", "mean");
+	std::vector<double> rttUs = rtt.us;
+	rtt.row();
+	first.row();
+	host.row();
+	wire.row();
+	rest.row();
+	device.row();
+	printf("\nround trip distribution\n");
+	histogram(rttUs);
+	if (window > 1)
+		printf("\nwith more than one probe in flight, replies queue behind each other\n");
+
+	return lost || corrupt ? 1 : 0;
+}
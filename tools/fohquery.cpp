@@ -0,0 +1,171 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file tools/fohquery.cpp
+ * @brief Search capture files by time, port, byte pattern or sample value.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "../capquery.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static void usage() {
+	fprintf(stderr, "usage: fohquery [options] <capture>\n"
+			"  -f <s>       from, seconds after capture start\n"
+			"  -t <s>       to, seconds after capture start\n"
+			"  -p <port>    only this port\n"
+			"  -d rx|tx     only this direction\n"
+			"  -s <text>    search raw data for text\n"
+			"  -x <hex>     search raw data for bytes, e.g. 0d0a\n"
+			"  -c <ch>      search samples of a channel\n"
+			"  -v <lo:hi>   sample value range (with -c)\n"
+			"  -j <n>       threads (default: one per core)\n"
+			"  -n <n>       stop after n hits\n"
+			"  -D           dump the data of each hit\n"
+			"  -i           only build or update the index\n"
+			"Without -s, -x or -c all records in range are listed.\n");
+}
+
+static int parseHex(const char* s, std::string& out) {
+	out.clear();
+	size_t n = strlen(s);
+	if (n % 2 != 0)
+		return -1;
+	for (size_t i = 0; i < n; i += 2) {
+		char b[3] = { s[i], s[i + 1], 0 };
+		char* end;
+		long v = strtol(b, &end, 16);
+		if (*end != '\0')
+			return -1;
+		out.push_back((char)v);
+	}
+	return 0;
+}
+
+static void dump(const char* d, size_t len) {
+	for (size_t i = 0; i < len; i += 16) {
+		printf("    %06zx ", i);
+		for (size_t k = i; k < i + 16; k++) {
+			if (k < len)
+				printf(" %02x", (unsigned char)d[k]);
+			else
+				printf("   ");
+		}
+		printf("  ");
+		for (size_t k = i; k < i + 16 && k < len; k++)
+			putchar(d[k] >= 32 && d[k] < 127 ? d[k] : '.');
+		putchar('\n');
+	}
+}
+
+int main(int argc, char** argv) {
+	FOHCapQuery q;
+	double from = -1, to = -1;
+	int threads = 0, opt;
+	long limit = 0;
+	bool dumpData = false, indexOnly = false;
+
+	while ((opt = getopt(argc, argv, "f:t:p:d:s:x:c:v:j:n:Dih")) != -1) {
+		switch (opt) {
+			case 'f': from = atof(optarg); break;
+			case 't': to = atof(optarg); break;
+			case 'p': q.port = atoi(optarg); break;
+			case 'd': q.dir = strcmp(optarg, "tx") == 0 ? FOH_DIR_TX : FOH_DIR_RX; break;
+			case 's': q.pattern = optarg; break;
+			case 'x':
+				if (parseHex(optarg, q.pattern) < 0) {
+					fprintf(stderr, "fohquery: bad hex pattern\n");
+					return 2;
+				}
+				break;
+			case 'c': q.channel = atoi(optarg); break;
+			case 'v':
+				if (sscanf(optarg, "%lf:%lf", &q.minValue, &q.maxValue) != 2) {
+					fprintf(stderr, "fohquery: bad value range\n");
+					return 2;
+				}
+				break;
+			case 'j': threads = atoi(optarg); break;
+			case 'n': limit = atol(optarg); break;
+			case 'D': dumpData = true; break;
+			case 'i': indexOnly = true; break;
+			default:
+				usage();
+				return opt == 'h' ? 0 : 2;
+		}
+	}
+	if (optind >= argc) {
+		usage();
+		return 2;
+	}
+
+	FOHCapFile f;
+	if (f.open(argv[optind]) < 0) {
+		fprintf(stderr, "fohquery: %s: not a capture file\n", argv[optind]);
+		return 1;
+	}
+	if (indexOnly) {
+		printf("%zu index entries, %lu of %lu bytes\n", f.index().size(), f.covered(), f.size());
+		return 0;
+	}
+
+	uint64_t start = f.header()->monoNs;
+	if (from >= 0)
+		q.fromNs = start + (uint64_t)(from * 1e9);
+	if (to >= 0)
+		q.toNs = start + (uint64_t)(to * 1e9);
+
+	std::vector<FOHCapMatch> hits;
+	if (f.query(q, hits, threads, limit) < 0) {
+		fprintf(stderr, "fohquery: query failed\n");
+		return 1;
+	}
+
+	for (size_t i = 0; i < hits.size(); i++) {
+		const FOHCapMatch& m = hits[i];
+		int64_t rel = (int64_t)(m.tsNs - start);
+		time_t wall = (f.header()->realNs + rel) / 1000000000LL;
+		struct tm tm;
+		char when[32];
+		localtime_r(&wall, &tm);
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+
+		const FOHCapRecord* r = f.record(m.offset);
+		printf("%12.6f %s port %u %s @%lu", rel / 1e9, when, m.port, m.dir == FOH_DIR_TX ? "tx" : "rx", m.offset);
+		if (m.type == FOH_CAP_SAMPLES && q.channel >= 0)
+			printf(" sample %ld ch %u = %g\n", (long)m.at, m.channel, m.value);
+		else if (m.type == FOH_CAP_MARK)
+			printf(" mark %.*s\n", (int)strnlen((const char*)(r + 1), r->len), (const char*)(r + 1));
+		else if (q.pattern.empty() == false)
+			printf(" match at %ld of %u\n", (long)m.at, r->len);
+		else
+			printf(" %s %u bytes\n", m.type == FOH_CAP_SAMPLES ? "samples" : "data", r->len);
+
+		if (dumpData && m.type == FOH_CAP_DATA)
+			dump((const char*)(r + 1), r->len);
+	}
+	return 0;
+}
@@ -0,0 +1,119 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file tools/fohrecover.cpp
+ * @brief Salvage the complete records of a crashed capture journal.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "../journal.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage() {
+	fprintf(stderr, "usage: fohrecover [-c] [-n] <journal> [<output>]\n"
+			"  -c  cut at the last commit marker instead of the last complete record\n"
+			"  -n  only report, change nothing\n"
+			"Without output the journal is truncated in place.\n");
+}
+
+/**
+ *  @brief Copy the first len bytes of a file
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+static int copyPrefix(const char* from, const char* to, uint64_t len) {
+	int in = open(from, O_RDONLY | O_CLOEXEC);
+	if (in < 0)
+		return -1;
+	int out = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out < 0) {
+		close(in);
+		return -1;
+	}
+
+	char buf[1 << 16];
+	int ret = 0;
+	while (len > 0) {
+		ssize_t n = read(in, buf, len < sizeof(buf) ? len : sizeof(buf));
+		if (n <= 0 || write(out, buf, n) != n) {
+			ret = -1;
+			break;
+		}
+		len -= n;
+	}
+	if (fsync(out) < 0)
+		ret = -1;
+	close(in);
+	close(out);
+	return ret;
+}
+
+int main(int argc, char** argv) {
+	bool toCommit = false, dryRun = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "cnh")) != -1) {
+		if (opt == 'c') {
+			toCommit = true;
+		} else if (opt == 'n') {
+			dryRun = true;
+		} else {
+			usage();
+			return opt == 'h' ? 0 : 2;
+		}
+	}
+	if (optind >= argc) {
+		usage();
+		return 2;
+	}
+	const char* path = argv[optind];
+	const char* output = optind + 1 < argc ? argv[optind + 1] : NULL;
+
+	FOHJournalScan s;
+	if (fohJournalScan(path, &s) < 0) {
+		fprintf(stderr, "fohrecover: %s: not a capture file\n", path);
+		return 1;
+	}
+
+	uint64_t cut = toCommit ? s.committedBytes : s.validBytes;
+	printf("%s: %lu bytes, %lu complete records (%lu bytes), %lu commits (last at %lu)\n",
+			path, s.fileBytes, s.records, s.validBytes, s.commits, s.committedBytes);
+	printf("keeping %lu bytes, discarding %lu\n", cut, s.fileBytes - cut);
+
+	if (dryRun)
+		return 0;
+
+	if (output != NULL) {
+		if (copyPrefix(path, output, cut) < 0) {
+			fprintf(stderr, "fohrecover: %s: %s\n", output, strerror(errno));
+			return 1;
+		}
+	} else if (cut < s.fileBytes) {
+		if (truncate(path, cut) < 0) {
+			fprintf(stderr, "fohrecover: %s: %s\n", path, strerror(errno));
+			return 1;
+		}
+	}
+	return 0;
+}
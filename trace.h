@@ -0,0 +1,125 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file trace.h
+ * @brief USDT (SystemTap SDT) tracepoints for perf and bpftrace.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_TRACE_H
+#define FOH_TRACE_H
+
+/**
+ *  Static user-level tracepoints, provider "foh":
+ *
+ *  port_open(fd, baud)                   port opened (again, after a reconnect)
+ *  port_close(fd)                        port closed
+ *  chunk_rx(fd, bytes)                   read() returned data
+ *  write_submit(fd, bytes)               writev() about to be called
+ *  write_done(fd, written)               writev() returned (-1 on error)
+ *  timeout(fd, timeoutMs)                wait for the port timed out
+ *  frame_complete(port, tsNs, samples)   line decoded
+ *  tx_frame_done(prio, bytes, latencyNs) queued frame completely handed over
+ *
+ *  A probe is a single nop plus an ELF note, so it costs nothing until a
+ *  tracer attaches, e.g.
+ *
+ *      bpftrace -e 'usdt:./app:foh:write_done { @[arg1] = count(); }'
+ *      perf buildid-cache --add ./app; perf record -e sdt_foh:timeout ./app
+ *
+ *  <sys/sdt.h> (systemtap-sdt-dev) is used when installed. Otherwise the
+ *  same notes are emitted here on x86-64 and aarch64; elsewhere, or with
+ *  FOH_NO_TRACE defined, the probes compile to nothing.
+ */
+
+#if defined(FOH_NO_TRACE)
+#define FOH_TRACE_NONE 1
+#elif defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define FOH_TRACE_SDT 1
+#endif
+#endif
+
+#if defined(FOH_TRACE_SDT)
+
+#define FOH_TRACE1(name, a) DTRACE_PROBE1(foh, name, a)
+#define FOH_TRACE2(name, a, b) DTRACE_PROBE2(foh, name, a, b)
+#define FOH_TRACE3(name, a, b, c) DTRACE_PROBE3(foh, name, a, b, c)
+
+#elif !defined(FOH_TRACE_NONE) && defined(__GNUC__) && (defined(__x86_64__) || defined(__aarch64__))
+
+#include <type_traits>
+
+//Argument size as the note wants it: negative for signed types
+template <typename T>
+struct FOHTraceSize {
+	typedef typename std::decay<T>::type D;
+	static const int value = (std::is_pointer<D>::value || std::is_signed<D>::value == false ? 1 : -1) * (int)sizeof(D);
+};
+
+#define _FOH_TRACE_SZ(a) FOHTraceSize<decltype(a)>::value
+
+//Layout of a .note.stapsdt entry, version 3 (see systemtap's sdt.h)
+#define _FOH_TRACE_ASM(name, args) \
+	"990:	nop\n" \
+	".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+	".balign 4\n" \
+	".4byte 992f-991f, 994f-993f, 3\n" \
+	"991:	.asciz \"stapsdt\"\n" \
+	"992:	.balign 4\n" \
+	"993:	.8byte 990b\n" \
+	".8byte _.stapsdt.base\n" \
+	".8byte 0\n" \
+	".asciz \"foh\"\n" \
+	".asciz \"" #name "\"\n" \
+	".asciz \"" args "\"\n" \
+	"994:	.balign 4\n" \
+	".popsection\n" \
+	".ifndef _.stapsdt.base\n" \
+	".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+	".weak _.stapsdt.base\n" \
+	".hidden _.stapsdt.base\n" \
+	"_.stapsdt.base: .space 1\n" \
+	".size _.stapsdt.base, 1\n" \
+	".popsection\n" \
+	".endif\n"
+
+#define FOH_TRACE1(name, a) \
+	__asm__ __volatile__(_FOH_TRACE_ASM(name, "%c[s0]@%[a0]") \
+		:: [s0] "n" (_FOH_TRACE_SZ(a)), [a0] "nor" (a))
+#define FOH_TRACE2(name, a, b) \
+	__asm__ __volatile__(_FOH_TRACE_ASM(name, "%c[s0]@%[a0] %c[s1]@%[a1]") \
+		:: [s0] "n" (_FOH_TRACE_SZ(a)), [a0] "nor" (a), [s1] "n" (_FOH_TRACE_SZ(b)), [a1] "nor" (b))
+#define FOH_TRACE3(name, a, b, c) \
+	__asm__ __volatile__(_FOH_TRACE_ASM(name, "%c[s0]@%[a0] %c[s1]@%[a1] %c[s2]@%[a2]") \
+		:: [s0] "n" (_FOH_TRACE_SZ(a)), [a0] "nor" (a), [s1] "n" (_FOH_TRACE_SZ(b)), [a1] "nor" (b), \
+		[s2] "n" (_FOH_TRACE_SZ(c)), [a2] "nor" (c))
+
+#else
+
+#define FOH_TRACE1(name, a) do { (void)(a); } while (0)
+#define FOH_TRACE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define FOH_TRACE3(name, a, b, c) do { (void)(a); (void)(b); (void)(c); } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,423 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file trigger.cpp
+ * @brief Triggered capture with pre- and post-trigger window.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "trigger.h"
+#include "serial.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+//Writer period; the ring has to hold what arrives in between
+#define FOH_TRIG_PERIOD_MS 20
+//Time after the window end the writer waits for late stamped data
+#define FOH_TRIG_SLACK_NS 100000000ULL
+
+/**
+ *  @param prefix Path prefix of the capture files
+ *  @param preNs Time saved before a trigger
+ *  @param postNs Time saved after a trigger
+ *  @param ringBytes Ring size per port
+ */
+FOHTriggerCapture::FOHTriggerCapture(const char* prefix, uint64_t preNs, uint64_t postNs, size_t ringBytes)
+	: _prefix(prefix), _preNs(preNs), _postNs(postNs), _ringBytes(ringBytes), _trigReq(0), _busy(false),
+	  _stop(false), _fd(-1), _startNs(0), _endNs(0), _fileBad(false), _triggers(0), _captures(0), _written(0), _lost(0),
+	  _dropped(0), _failed(0), _failedSeen(0) {
+	_thread = std::thread(&FOHTriggerCapture::_run, this);
+}
+
+FOHTriggerCapture::~FOHTriggerCapture() {
+	{
+		std::lock_guard<std::mutex> l(_wakeLock);
+		_stop.store(true);
+	}
+	_wake.notify_one();
+	_thread.join();
+
+	for (size_t i = 0; i < _ports.size(); i++) {
+		if (_ports[i] == NULL)
+			continue;
+		delete[] _ports[i]->ring;
+		delete _ports[i];
+	}
+}
+
+/**
+ *  @brief Record a port (before data flows)
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHTriggerCapture::addPort(int port) {
+	if (port < 0)
+		return -1;
+	if ((size_t)port >= _ports.size())
+		_ports.resize(port + 1, NULL);
+	if (_ports[port] != NULL)
+		return 0;
+
+	_port* p = new _port;
+	p->ring = new char[_ringBytes];
+	p->head = p->tail = p->readPos = 0;
+	p->thrChannel = -1;
+	p->level = 0;
+	p->rising = true;
+	p->haveLast = false;
+	p->last = 0;
+	_ports[port] = p;
+	return 0;
+}
+
+/**
+ *  @brief Trigger on a byte pattern in the raw data of a port
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHTriggerCapture::setPattern(int port, const void* pattern, size_t len) {
+	_port* p = _get(port);
+	if (p == NULL)
+		return -1;
+
+	std::lock_guard<std::mutex> l(p->lock);
+	p->pattern.assign((const char*)pattern, len);
+	p->patTail.clear();
+	return 0;
+}
+
+/**
+ *  @brief Trigger when a decoded value crosses a level
+ *
+ *  @param port Port number
+ *  @param channel Channel to watch
+ *  @param level Trigger level
+ *  @param rising Trigger on rising (true) or falling (false) crossings
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHTriggerCapture::setThreshold(int port, int channel, double level, bool rising) {
+	_port* p = _get(port);
+	if (p == NULL)
+		return -1;
+
+	std::lock_guard<std::mutex> l(p->lock);
+	p->thrChannel = channel;
+	p->level = level;
+	p->rising = rising;
+	p->haveLast = false;
+	return 0;
+}
+
+/**
+ *  @brief Trigger now or at a given time
+ *
+ *  @param tsNs Trigger time (0: now)
+ */
+void FOHTriggerCapture::trigger(uint64_t tsNs) {
+	if (tsNs == 0)
+		tsNs = fohMonoNs();
+
+	_triggers.fetch_add(1, std::memory_order_relaxed);
+	_busy.store(true);
+
+	//Keep the earliest unhandled trigger
+	uint64_t cur = _trigReq.load();
+	while ((cur == 0 || tsNs < cur) && _trigReq.compare_exchange_weak(cur, tsNs) == false)
+		;
+	_wake.notify_one();
+}
+
+/**
+ *  @brief Store a chunk in the ring of its port
+ *
+ *	@return 0 on success, -1 if the chunk was dropped.
+ */
+int FOHTriggerCapture::push(int port, int dir, uint64_t tsNs, const void* data, size_t len) {
+	_port* p = _get(port);
+	if (p == NULL)
+		return -1;
+
+	size_t size = fohCapRecordSize(len);
+	if (size > _ringBytes) {
+		_dropped.fetch_add(1, std::memory_order_relaxed);
+		return -1;
+	}
+
+	FOHCapRecord h;
+	memset(&h, 0, sizeof(h));
+	h.tsNs = tsNs;
+	h.port = port;
+	h.len = len;
+	h.dir = dir;
+	h.type = FOH_CAP_DATA;
+	h.crc = fohCapCrc(&h, data);
+
+	static const char zeros[FOH_CAP_ALIGN] = { 0 };
+	bool hit = false;
+	{
+		std::lock_guard<std::mutex> l(p->lock);
+
+		while (p->head + size - p->tail > _ringBytes) {
+			FOHCapRecord old;
+			_ringCopy(p, p->tail, &old, sizeof(old));
+			p->tail += fohCapRecordSize(old.len);
+		}
+		_ringStore(p, p->head, &h, sizeof(h));
+		_ringStore(p, p->head + sizeof(h), data, len);
+		_ringStore(p, p->head + sizeof(h) + len, zeros, size - sizeof(h) - len);
+		p->head += size;
+
+		size_t pl = p->pattern.size();
+		if (pl > 0) {
+			const char* d = (const char*)data;
+			hit = memmem(d, len, p->pattern.data(), pl) != NULL;
+			if (hit == false && p->patTail.empty() == false) {
+				std::string edge = p->patTail;
+				edge.append(d, std::min(len, pl - 1));
+				hit = memmem(edge.data(), edge.size(), p->pattern.data(), pl) != NULL;
+			}
+
+			if (len >= pl - 1) {
+				p->patTail.assign(d + len - (pl - 1), pl - 1);
+			} else {
+				p->patTail.append(d, len);
+				if (p->patTail.size() > pl - 1)
+					p->patTail.erase(0, p->patTail.size() - (pl - 1));
+			}
+		}
+	}
+
+	if (hit)
+		trigger(tsNs);
+	return 0;
+}
+
+/**
+ *  @brief Check decoded samples against the thresholds
+ */
+int FOHTriggerCapture::pushSamples(const FOHSample* s, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		_port* p = _get(s[i].port);
+		if (p == NULL)
+			continue;
+
+		bool hit = false;
+		{
+			std::lock_guard<std::mutex> l(p->lock);
+			if (p->thrChannel != (int)s[i].channel)
+				continue;
+
+			double v = s[i].value;
+			if (p->haveLast)
+				hit = p->rising ? (p->last < p->level && v >= p->level)
+						: (p->last > p->level && v <= p->level);
+			p->last = v;
+			p->haveLast = true;
+		}
+		if (hit)
+			trigger(s[i].hostNs);
+	}
+	return 0;
+}
+
+/**
+ *  @brief Wait until running captures are complete
+ *
+ *	@return 0 when nothing is pending, 1 on timeout, -1 if a capture
+ *	        failed since the previous flush().
+ */
+int FOHTriggerCapture::flush(int timeoutMs) {
+	uint64_t end = fohMonoNs() + (uint64_t)timeoutMs * 1000000ULL;
+	while (_busy.load() || _trigReq.load() != 0) {
+		if (fohMonoNs() >= end)
+			return 1;
+		usleep(1000);
+	}
+
+	uint64_t failed = _failed.load();
+	return _failedSeen.exchange(failed) != failed ? -1 : 0;
+}
+
+FOHTriggerStats FOHTriggerCapture::stats() {
+	FOHTriggerStats s;
+	s.triggers = _triggers.load();
+	s.captures = _captures.load();
+	s.bytesWritten = _written.load();
+	s.lostBytes = _lost.load();
+	s.droppedChunks = _dropped.load();
+	s.failedCaptures = _failed.load();
+	return s;
+}
+
+FOHTriggerCapture::_port* FOHTriggerCapture::_get(int port) {
+	if (port < 0 || (size_t)port >= _ports.size())
+		return NULL;
+	return _ports[port];
+}
+
+void FOHTriggerCapture::_ringCopy(_port* p, uint64_t pos, void* dst, size_t n) {
+	size_t off = pos % _ringBytes;
+	size_t first = std::min(n, _ringBytes - off);
+	memcpy(dst, p->ring + off, first);
+	memcpy((char*)dst + first, p->ring, n - first);
+}
+
+void FOHTriggerCapture::_ringStore(_port* p, uint64_t pos, const void* src, size_t n) {
+	size_t off = pos % _ringBytes;
+	size_t first = std::min(n, _ringBytes - off);
+	memcpy(p->ring + off, src, first);
+	memcpy(p->ring, (const char*)src + first, n - first);
+}
+
+/**
+ *  @brief Open a capture file and rewind the rings for the pre-trigger window
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHTriggerCapture::_begin(uint64_t trigNs) {
+	std::string path = _prefix + "-" + std::to_string(trigNs) + ".fohcap";
+	_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (_fd < 0) {
+		_failed.fetch_add(1);
+		return -1;
+	}
+	_fileBad = false;
+
+	_startNs = trigNs > _preNs ? trigNs - _preNs : 0;
+	_endNs = trigNs + _postNs;
+
+	FOHCapHeader hdr;
+	fohCapHeader(&hdr);
+	_out.resize(sizeof(hdr) + fohCapRecordSize(7));
+	memcpy(_out.data(), &hdr, sizeof(hdr));
+	fohCapPut(_out.data() + sizeof(hdr), trigNs, 0, 0, FOH_CAP_MARK, "trigger", 7);
+	if (write(_fd, _out.data(), _out.size()) == (ssize_t)_out.size())
+		_written.fetch_add(_out.size());
+	else
+		_fileBad = true;
+
+	for (size_t i = 0; i < _ports.size(); i++) {
+		if (_ports[i] == NULL)
+			continue;
+		std::lock_guard<std::mutex> l(_ports[i]->lock);
+		_ports[i]->readPos = _ports[i]->tail;
+	}
+	return 0;
+}
+
+/**
+ *  @brief Write the new records inside the window, in time order
+ *
+ *  @param final Close the file regardless of the window
+ */
+void FOHTriggerCapture::_sweep(bool final) {
+	uint64_t now = fohMonoNs();
+	std::vector<std::pair<uint64_t, const FOHCapRecord*>> recs;
+
+	for (size_t i = 0; i < _ports.size(); i++) {
+		_port* p = _ports[i];
+		if (p == NULL)
+			continue;
+
+		{
+			std::lock_guard<std::mutex> l(p->lock);
+			if (p->readPos < p->tail) {
+				_lost.fetch_add(p->tail - p->readPos);
+				p->readPos = p->tail;
+			}
+			p->scratch.resize(p->head - p->readPos);
+			_ringCopy(p, p->readPos, p->scratch.data(), p->scratch.size());
+			p->readPos = p->head;
+		}
+
+		for (size_t off = 0; off < p->scratch.size();) {
+			const FOHCapRecord* r = (const FOHCapRecord*)(p->scratch.data() + off);
+			if (r->tsNs >= _startNs && r->tsNs <= _endNs)
+				recs.push_back(std::make_pair(r->tsNs, r));
+			off += fohCapRecordSize(r->len);
+		}
+	}
+
+	std::stable_sort(recs.begin(), recs.end(), [](const std::pair<uint64_t, const FOHCapRecord*>& a,
+			const std::pair<uint64_t, const FOHCapRecord*>& b) {
+		return a.first < b.first;
+	});
+
+	_out.clear();
+	for (size_t i = 0; i < recs.size(); i++) {
+		const char* r = (const char*)recs[i].second;
+		_out.insert(_out.end(), r, r + fohCapRecordSize(recs[i].second->len));
+	}
+
+	size_t done = 0;
+	while (done < _out.size()) {
+		ssize_t n = write(_fd, _out.data() + done, _out.size() - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	_written.fetch_add(done);
+	if (done < _out.size())
+		_fileBad = true;
+
+	if (final || now > _endNs + FOH_TRIG_SLACK_NS) {
+		if (close(_fd) != 0)
+			_fileBad = true;
+		_fd = -1;
+		if (_fileBad)
+			_failed.fetch_add(1);
+		else
+			_captures.fetch_add(1);
+	}
+}
+
+void FOHTriggerCapture::_run() {
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> l(_wakeLock);
+			_wake.wait_for(l, std::chrono::milliseconds(FOH_TRIG_PERIOD_MS), [this] {
+				return _stop.load() || _trigReq.load() != 0;
+			});
+		}
+
+		uint64_t req = _trigReq.exchange(0);
+		if (req != 0) {
+			if (_fd < 0)
+				_begin(req);
+			else
+				_endNs = std::max(_endNs, req + _postNs);
+		}
+
+		bool stop = _stop.load();
+		if (_fd >= 0)
+			_sweep(stop);
+		_busy.store(_fd >= 0);
+
+		if (stop)
+			break;
+	}
+}
@@ -0,0 +1,176 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file trigger.h
+ * @brief Triggered capture with pre- and post-trigger window.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_TRIGGER_H
+#define FOH_TRIGGER_H
+
+#include "sink.h"
+#include "capture.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ *  @brief Triggered capture counters (snapshot)
+ */
+struct FOHTriggerStats {
+	uint64_t triggers; /**< Triggers fired (including retriggers) */
+	uint64_t captures; /**< Capture files completed */
+	uint64_t bytesWritten; /**< Bytes written to capture files */
+	uint64_t lostBytes; /**< Ring data overwritten before it was written out */
+	uint64_t droppedChunks; /**< Chunks larger than the ring */
+	uint64_t failedCaptures; /**< Capture files that couldn't be created or written */
+};
+
+/**
+ *  @brief Sink keeping recent data and saving it around trigger events
+ *
+ *  Every port keeps a bounded ring of capture records. A trigger (pattern
+ *  in the raw data, a decoded value crossing a level, or trigger()) makes
+ *  the writer thread save preNs before to postNs after the trigger time
+ *  into a new capture file <prefix>-<trigger ns>.fohcap. Triggers during a
+ *  capture extend it.
+ *
+ *  The receive path only copies into the ring and checks the trigger
+ *  conditions; file I/O is done by the writer thread, which reads the
+ *  rings behind the receive path. The ring has to hold the pre-trigger
+ *  window plus what arrives in one writer period (FOH_TRIG_PERIOD_MS);
+ *  what is overwritten before it is written out is counted as lost.
+ */
+class FOHTriggerCapture : public FOHSink {
+public:
+	/**
+	 *  @param prefix Path prefix of the capture files
+	 *  @param preNs Time saved before a trigger
+	 *  @param postNs Time saved after a trigger
+	 *  @param ringBytes Ring size per port
+	 */
+	FOHTriggerCapture(const char* prefix, uint64_t preNs, uint64_t postNs, size_t ringBytes = 4 << 20);
+	~FOHTriggerCapture();
+
+	/**
+	 *  @brief Record a port (before data flows)
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int addPort(int port);
+
+	/**
+	 *  @brief Trigger on a byte pattern in the raw data of a port
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int setPattern(int port, const void* pattern, size_t len);
+
+	/**
+	 *  @brief Trigger when a decoded value crosses a level
+	 *
+	 *  @param port Port number
+	 *  @param channel Channel to watch
+	 *  @param level Trigger level
+	 *  @param rising Trigger on rising (true) or falling (false) crossings
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int setThreshold(int port, int channel, double level, bool rising);
+
+	/**
+	 *  @brief Trigger now or at a given time
+	 *
+	 *  @param tsNs Trigger time (0: now)
+	 */
+	void trigger(uint64_t tsNs = 0);
+
+	int push(int port, int dir, uint64_t tsNs, const void* data, size_t len) override;
+	int pushSamples(const FOHSample* s, size_t n) override;
+
+	/**
+	 *  @brief Wait until running captures are complete
+	 *
+	 *	@return 0 when nothing is pending, 1 on timeout, -1 if a capture
+	 *	        failed since the previous flush().
+	 */
+	int flush(int timeoutMs) override;
+
+	FOHTriggerStats stats();
+
+private:
+	struct _port {
+		std::mutex lock; /**< Ring and trigger state */
+		char* ring; /**< Records */
+		uint64_t head; /**< Write position (absolute) */
+		uint64_t tail; /**< Oldest record (absolute) */
+		uint64_t readPos; /**< Writer position (absolute) */
+		std::string pattern; /**< Trigger pattern */
+		std::string patTail; /**< Last bytes for matches across chunks */
+		int thrChannel; /**< Threshold channel, -1: none */
+		double level; /**< Threshold */
+		bool rising; /**< Crossing direction */
+		bool haveLast; /**< last is valid */
+		double last; /**< Previous value of the channel */
+		std::vector<char> scratch; /**< Writer copy of new records */
+	};
+
+	_port* _get(int port);
+	void _ringCopy(_port* p, uint64_t pos, void* dst, size_t n);
+	void _ringStore(_port* p, uint64_t pos, const void* src, size_t n);
+	int _begin(uint64_t trigNs);
+	void _sweep(bool final);
+	void _run();
+
+	std::string _prefix; /**< File prefix */
+	uint64_t _preNs; /**< Pre-trigger window */
+	uint64_t _postNs; /**< Post-trigger window */
+	size_t _ringBytes; /**< Ring size */
+	std::vector<_port*> _ports; /**< By port number */
+
+	std::atomic<uint64_t> _trigReq; /**< Earliest unhandled trigger, 0: none */
+	std::atomic<bool> _busy; /**< Capture running or trigger pending */
+	std::atomic<bool> _stop; /**< Ends the writer */
+	std::mutex _wakeLock; /**< For _wake */
+	std::condition_variable _wake; /**< Wakes the writer */
+	std::thread _thread; /**< Writer */
+
+	int _fd; /**< Current capture file, -1: none */
+	uint64_t _startNs; /**< Window start */
+	uint64_t _endNs; /**< Window end */
+	bool _fileBad; /**< A write to the current file failed */
+	std::vector<char> _out; /**< File buffer */
+
+	std::atomic<uint64_t> _triggers; /**< Counter */
+	std::atomic<uint64_t> _captures; /**< Counter */
+	std::atomic<uint64_t> _written; /**< Counter */
+	std::atomic<uint64_t> _lost; /**< Counter */
+	std::atomic<uint64_t> _dropped; /**< Counter */
+	std::atomic<uint64_t> _failed; /**< Counter */
+	std::atomic<uint64_t> _failedSeen; /**< _failed at the previous flush() */
+};
+
+#endif
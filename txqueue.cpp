@@ -0,0 +1,452 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file txqueue.cpp
+ * @brief Priority transmit queues with a bounded kernel output queue.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#include "txqueue.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <string.h>
+
+//Character time assumed when the port can't tell (115200 8N1)
+#define FOH_TX_DEFAULT_CHAR_NS 86806
+
+/**
+ *  @brief Create queues for a port
+ *
+ *  @param port Port to transmit on
+ *  @param outqLimit Maximum bytes kept in the kernel output queue
+ */
+FOHTxQueue::FOHTxQueue(FOHSerial* port, size_t outqLimit) {
+	_port = port;
+	_outqLimit = outqLimit ? outqLimit : 1;
+	_maxFrame = 0;
+	_curPrio = -1;
+	_curOff = 0;
+	_curLeft = 0;
+	_servicing = false;
+	_closed = false;
+	_budget = NULL;
+	_policy = FOH_BUDGET_BLOCK;
+	_blockMs = -1;
+	_flow = NULL;
+	_latHist.store(NULL, std::memory_order_relaxed);
+	memset(_pending, 0, sizeof _pending);
+	memset(_stats, 0, sizeof _stats);
+}
+
+/**
+ *  @brief Charge queued bytes to a memory budget
+ *
+ *  When the budget is exhausted, FOH_BUDGET_DROP_NEWEST rejects the new
+ *  frame, FOH_BUDGET_DROP_OLDEST discards the oldest frames of the lowest
+ *  class first (never urgent ones, the new frame is rejected when only
+ *  those are left), FOH_BUDGET_BLOCK (and FOH_BUDGET_PAUSE_DEVICE, which
+ *  has no meaning for transmit) makes enqueue() wait up to blockMs.
+ *  Call before any frame is queued.
+ *
+ *  @param budget Budget to charge (NULL: unbounded)
+ *  @param policy What to do when the budget is exhausted (see FOHBudgetPolicy)
+ *  @param blockMs Longest wait in enqueue() for the blocking policies (-1: forever)
+ */
+void FOHTxQueue::setBudget(FOHMemBudget* budget, int policy, int blockMs) {
+	std::lock_guard<std::mutex> l(_lock);
+	_budget = budget;
+	_policy = policy;
+	_blockMs = blockMs;
+}
+
+/**
+ *  @brief Charge a new frame to the budget, applying the policy
+ */
+bool FOHTxQueue::_charge(size_t len) {
+	if (_budget->tryCharge(len))
+		return true;
+
+	if (_policy == FOH_BUDGET_DROP_NEWEST) {
+		_budget->noteDropped(len);
+		return false;
+	}
+
+	if (_policy == FOH_BUDGET_DROP_OLDEST) {
+		std::lock_guard<std::mutex> l(_lock);
+
+		//Make room from the bulk end, the frame being written and urgent
+		//frames stay
+		while (!_budget->tryCharge(len)) {
+			int p;
+			for (p = FOH_TX_PRIOS - 1; p > FOH_TX_URGENT && _q[p].empty(); p--);
+			if (p == FOH_TX_URGENT) {
+				_budget->noteDropped(len);
+				return false;
+			}
+
+			size_t n = _q[p].front().data.size();
+			_q[p].pop_front();
+			_pending[p] -= n;
+			_budget->release(n);
+			_budget->noteDropped(n);
+		}
+		return true;
+	}
+
+	return _budget->charge(len, _blockMs);
+}
+
+/**
+ *  @brief Queue a frame (copied)
+ *
+ *  @param prio Priority class (see FOHTxPrio)
+ *  @param data Frame bytes
+ *  @param len Frame length
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHTxQueue::enqueue(int prio, const void* data, size_t len) {
+	struct iovec iov;
+	iov.iov_base = (void*)data;
+	iov.iov_len = len;
+
+	return enqueuev(prio, &iov, 1);
+}
+
+/**
+ *  @brief Queue a frame gathered from segments (copied into one frame)
+ *
+ *  @param prio Priority class (see FOHTxPrio)
+ *  @param iov Array of segments
+ *  @param iovcnt Number of segments
+ *
+ *	@return 0 on success, -1 otherwise.
+ */
+int FOHTxQueue::enqueuev(int prio, const struct iovec* iov, int iovcnt) {
+	if (prio < 0 || prio >= FOH_TX_PRIOS || iov == NULL || iovcnt <= 0)
+		return -1;
+
+	_frame f;
+	size_t len = 0;
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (len == 0 || _closed.load(std::memory_order_relaxed))
+		return -1;
+	if (_budget && !_charge(len))
+		return -1;
+
+	f.data.reserve(len);
+	for (int i = 0; i < iovcnt; i++)
+		f.data.insert(f.data.end(), (const uint8_t*)iov[i].iov_base, (const uint8_t*)iov[i].iov_base + iov[i].iov_len);
+	f.queuedNs = fohMonoNs();
+
+	std::lock_guard<std::mutex> l(_lock);
+	if (_closed) {
+		if (_budget)
+			_budget->release(len);
+		return -1;
+	}
+	if (len > _maxFrame)
+		_maxFrame = len;
+	_pending[prio] += len;
+	_q[prio].push_back(std::move(f));
+	_cond.notify_one();
+
+	return 0;
+}
+
+/**
+ *  @brief Move queued frames to the port
+ *
+ *  Returns once every queued frame has been handed to the kernel, or
+ *  when timeoutMs has passed (0: one pass without waiting).
+ *
+ *  @param timeoutMs Time limit in milliseconds
+ *
+ *	@return Bytes handed to the kernel when successful, -1 otherwise
+ *	        (errno EBUSY: another thread is in service() or discard()).
+ */
+int FOHTxQueue::service(int timeoutMs) {
+	//The started frame isn't locked, so only one thread may work on it
+	if (_servicing.exchange(true, std::memory_order_acquire)) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	int r = _service(timeoutMs);
+	_servicing.store(false, std::memory_order_release);
+	return r;
+}
+
+int FOHTxQueue::_service(int timeoutMs) {
+	uint64_t deadline = fohMonoNs() + (uint64_t)(timeoutMs > 0 ? timeoutMs : 0) * 1000000ULL;
+	uint64_t ct = _port->charTimeNs();
+	int total = 0;
+	int outq, w;
+
+	if (ct == 0)
+		ct = FOH_TX_DEFAULT_CHAR_NS;
+
+	for (;;) {
+		outq = _port->outputQueueBytes();
+		if (outq < 0)
+			return total ? total : -1;
+
+		//Kernel queue full: sleep until enough has drained (or time is up)
+		if ((size_t)outq >= _outqLimit) {
+			uint64_t now = fohMonoNs();
+			if (now >= deadline)
+				return total;
+
+			uint64_t wait = (outq - _outqLimit + 1) * ct;
+			if (wait > deadline - now)
+				wait = deadline - now;
+
+			struct timespec ts;
+			ts.tv_sec = wait / 1000000000ULL;
+			ts.tv_nsec = wait % 1000000000ULL;
+			nanosleep(&ts, NULL);
+			continue;
+		}
+
+		//Peer sent XOFF: hold back at the frame boundary
+		if (_curPrio < 0 && _flow && _flow->stopped()) {
+			uint64_t now = fohMonoNs();
+			if (now >= deadline)
+				return total;
+			_flow->waitResume((deadline - now + 999999) / 1000000);
+			continue;
+		}
+
+		//At a frame boundary, take the highest class with data
+		if (_curPrio < 0) {
+			std::unique_lock<std::mutex> l(_lock);
+			int p;
+
+			for (;;) {
+				for (p = 0; p < FOH_TX_PRIOS && _q[p].empty(); p++);
+				if (p < FOH_TX_PRIOS)
+					break;
+
+				//Everything handed over, or nothing arrives in time
+				uint64_t now = fohMonoNs();
+				if (total > 0 || _closed || now >= deadline)
+					return total;
+				_cond.wait_for(l, std::chrono::nanoseconds(deadline - now));
+			}
+
+			_cur = std::move(_q[p].front());
+			_q[p].pop_front();
+			_pending[p] -= _cur.data.size();
+			_curPrio = p;
+			_curOff = 0;
+			_curLeft.store(_cur.data.size(), std::memory_order_relaxed);
+		}
+
+		//Never put more than outqLimit bytes in front of the next frame
+		size_t n = _cur.data.size() - _curOff;
+		if (n > _outqLimit - outq)
+			n = _outqLimit - outq;
+
+		struct iovec iov;
+		iov.iov_base = &_cur.data[_curOff];
+		iov.iov_len = n;
+
+		w = _port->writeToSerialPortv(&iov, 1);
+		if (w < 0)
+			return total ? total : -1;
+
+		_curOff += w;
+		total += w;
+		_curLeft.store(_cur.data.size() - _curOff, std::memory_order_relaxed);
+
+		if (_curOff == _cur.data.size()) {
+			_complete(_curPrio, _cur, outq + w);
+			_curPrio = -1;
+		}
+	}
+}
+
+/**
+ *  @brief Account a frame that was completely handed over
+ */
+void FOHTxQueue::_complete(int prio, const _frame& f, int outq) {
+	uint64_t ct = _port->charTimeNs();
+	if (ct == 0)
+		ct = FOH_TX_DEFAULT_CHAR_NS;
+
+	//Its last byte leaves once the kernel queue in front of it is out
+	uint64_t lat = fohMonoNs() - f.queuedNs + outq * ct;
+	FOH_TRACE3(tx_frame_done, prio, f.data.size(), lat);
+
+	std::lock_guard<std::mutex> l(_lock);
+	//Under the lock, so setLatencyHistogram(NULL) waits for this to end
+	FOHHistogram* h = _latHist.load(std::memory_order_relaxed);
+	if (h)
+		h->observe(lat);
+	if (_budget)
+		_budget->release(f.data.size());
+
+	FOHTxStats& s = _stats[prio];
+	s.frames++;
+	s.bytes += f.data.size();
+	s.sumLatencyNs += lat;
+	if (lat > s.maxLatencyNs)
+		s.maxLatencyNs = lat;
+	if (prio == FOH_TX_URGENT && lat > (_maxFrame + _outqLimit + f.data.size()) * ct)
+		s.overBound++;
+}
+
+/**
+ *  @brief Record the latency of every sent frame
+ *
+ *  Once this returns, the previous histogram isn't touched any more.
+ *
+ *  @param h Histogram in ns (NULL: off)
+ */
+void FOHTxQueue::setLatencyHistogram(FOHHistogram* h) {
+	std::lock_guard<std::mutex> l(_lock);
+	_latHist.store(h, std::memory_order_relaxed);
+}
+
+/**
+ *  @brief Stop accepting frames, enqueue() fails from now on
+ *
+ *  Frames already queued can still be sent with service().
+ */
+void FOHTxQueue::close() {
+	std::lock_guard<std::mutex> l(_lock);
+	_closed = true;
+	_cond.notify_all();
+}
+
+/**
+ *  @brief Discard everything not yet handed to the kernel
+ *
+ *  Nothing is discarded while another thread is in service(); 0 is
+ *  returned with errno EBUSY then.
+ *
+ *  @return Bytes discarded
+ */
+size_t FOHTxQueue::discard() {
+	if (_servicing.exchange(true, std::memory_order_acquire)) {
+		errno = EBUSY;
+		return 0;
+	}
+
+	std::unique_lock<std::mutex> l(_lock);
+	size_t n = 0;
+	size_t charged;
+
+	for (int p = 0; p < FOH_TX_PRIOS; p++) {
+		n += _pending[p];
+		_pending[p] = 0;
+		_q[p].clear();
+	}
+	charged = n;
+
+	//A started frame was charged in full
+	if (_curPrio >= 0) {
+		n += _cur.data.size() - _curOff;
+		charged += _cur.data.size();
+		_curPrio = -1;
+		_curLeft.store(0, std::memory_order_relaxed);
+	}
+	if (_budget)
+		_budget->release(charged);
+	l.unlock();
+
+	_servicing.store(false, std::memory_order_release);
+	return n;
+}
+
+/**
+ *  @brief Bytes still queued in a class (not yet handed to the kernel)
+ */
+size_t FOHTxQueue::pending(int prio) {
+	if (prio < 0 || prio >= FOH_TX_PRIOS)
+		return 0;
+
+	std::lock_guard<std::mutex> l(_lock);
+	return _pending[prio];
+}
+
+/**
+ *  @brief Bytes still queued in all classes
+ */
+size_t FOHTxQueue::pendingTotal() {
+	std::lock_guard<std::mutex> l(_lock);
+	size_t n = 0;
+
+	for (int p = 0; p < FOH_TX_PRIOS; p++)
+		n += _pending[p];
+
+	return n;
+}
+
+/**
+ *  @brief Bytes not yet handed to the kernel, including the started frame
+ *
+ *  Call from the thread that runs service().
+ */
+size_t FOHTxQueue::unsentBytes() {
+	std::lock_guard<std::mutex> l(_lock);
+	size_t n = _curLeft.load(std::memory_order_relaxed);
+
+	for (int p = 0; p < FOH_TX_PRIOS; p++)
+		n += _pending[p];
+
+	return n;
+}
+
+/**
+ *  @brief Worst case wait of an urgent frame
+ *
+ *  One frame time of the largest frame queued so far plus the time to
+ *  drain outqLimit bytes, plus the urgent frame's own transmit time.
+ *
+ *  @param urgentLen Length of the urgent frame
+ *
+ *  @return Bound in nanoseconds
+ */
+uint64_t FOHTxQueue::latencyBoundNs(size_t urgentLen) {
+	uint64_t ct = _port->charTimeNs();
+	if (ct == 0)
+		ct = FOH_TX_DEFAULT_CHAR_NS;
+
+	std::lock_guard<std::mutex> l(_lock);
+	return (_maxFrame + _outqLimit + urgentLen) * ct;
+}
+
+/**
+ *  @brief Copy of the statistics of a class
+ */
+FOHTxStats FOHTxQueue::stats(int prio) {
+	FOHTxStats s;
+	memset(&s, 0, sizeof s);
+	if (prio < 0 || prio >= FOH_TX_PRIOS)
+		return s;
+
+	std::lock_guard<std::mutex> l(_lock);
+	return _stats[prio];
+}
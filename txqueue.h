@@ -0,0 +1,249 @@
+/**
+ * Copyright (C) 2018 Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software
+ * and associated documentation files (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge, publish, distribute,
+ * sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+ * PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+ * FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT
+ * OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ * 
+ * @file txqueue.h
+ * @brief Priority transmit queues with a bounded kernel output queue.
+ * @author Dario Dorando (Faseroptik Henning GmbH)
+ * 
+ */
+
+#ifndef FOH_TXQUEUE_H
+#define FOH_TXQUEUE_H
+
+#include "serial.h"
+#include "budget.h"
+#include "softflow.h"
+
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+class FOHHistogram;
+
+/**
+ *  @brief Transmit priority classes, lower value is sent first
+ */
+enum FOHTxPrio {
+	FOH_TX_URGENT = 0, /**< Stop/abort commands */
+	FOH_TX_NORMAL = 1, /**< Regular commands */
+	FOH_TX_BULK = 2, /**< Large transfers */
+	FOH_TX_PRIOS = 3 /**< Number of classes */
+};
+
+/**
+ *  @brief Per priority transmit statistics
+ */
+struct FOHTxStats {
+	uint64_t frames; /**< Frames handed to the kernel */
+	uint64_t bytes; /**< Bytes handed to the kernel */
+	uint64_t sumLatencyNs; /**< Sum of frame latencies */
+	uint64_t maxLatencyNs; /**< Worst frame latency seen */
+	uint64_t overBound; /**< Frames slower than latencyBoundNs() */
+};
+
+/**
+ *  @brief Frame queues in front of a serial port
+ *
+ *  Frames are queued per priority class and only written while the kernel
+ *  output queue (TIOCOUTQ) holds fewer than outqLimit bytes, so little data
+ *  is ever committed ahead of a frame that arrives later. A frame that has
+ *  started is always finished first; the next frame is then taken from the
+ *  highest non-empty class. An urgent frame therefore waits at most for the
+ *  rest of the current frame plus the kernel queue to drain.
+ *
+ *  Latency is measured from enqueue() until the frame's last byte is
+ *  expected to leave the wire (hand-off time plus the kernel queue in front
+ *  of it at the port's character time).
+ *
+ *  enqueue() may be called from any thread, service() and discard() from
+ *  one thread at a time (a concurrent call fails with EBUSY).
+ */
+class FOHTxQueue {
+public:
+	/**
+	 *  @brief Create queues for a port
+	 *
+	 *  @param port Port to transmit on
+	 *  @param outqLimit Maximum bytes kept in the kernel output queue
+	 */
+	FOHTxQueue(FOHSerial* port, size_t outqLimit = 64);
+
+	/**
+	 *  @brief Charge queued bytes to a memory budget
+	 *
+	 *  When the budget is exhausted, FOH_BUDGET_DROP_NEWEST rejects the new
+	 *  frame, FOH_BUDGET_DROP_OLDEST discards the oldest frames of the lowest
+	 *  class first (never urgent ones, the new frame is rejected when only
+	 *  those are left), FOH_BUDGET_BLOCK (and FOH_BUDGET_PAUSE_DEVICE, which
+	 *  has no meaning for transmit) makes enqueue() wait up to blockMs.
+	 *  Call before any frame is queued.
+	 *
+	 *  @param budget Budget to charge (NULL: unbounded)
+	 *  @param policy What to do when the budget is exhausted (see FOHBudgetPolicy)
+	 *  @param blockMs Longest wait in enqueue() for the blocking policies (-1: forever)
+	 */
+	void setBudget(FOHMemBudget* budget, int policy, int blockMs = -1);
+
+	/**
+	 *  @brief Honour user space XON/XOFF
+	 *
+	 *  While the peer has sent XOFF, service() finishes the current frame
+	 *  and then waits before starting the next one.
+	 *
+	 *  @param flow User space flow control of the port (NULL: off)
+	 */
+	void setSoftFlow(FOHSoftFlow* flow) { _flow = flow; }
+
+	/**
+	 *  @brief Record the latency of every sent frame
+	 *
+	 *  Once this returns, the previous histogram isn't touched any more.
+	 *
+	 *  @param h Histogram in ns (NULL: off)
+	 */
+	void setLatencyHistogram(FOHHistogram* h);
+
+	/**
+	 *  @brief Queue a frame (copied)
+	 *
+	 *  @param prio Priority class (see FOHTxPrio)
+	 *  @param data Frame bytes
+	 *  @param len Frame length
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int enqueue(int prio, const void* data, size_t len);
+
+	/**
+	 *  @brief Queue a frame gathered from segments (copied into one frame)
+	 *
+	 *  @param prio Priority class (see FOHTxPrio)
+	 *  @param iov Array of segments
+	 *  @param iovcnt Number of segments
+	 *
+	 *	@return 0 on success, -1 otherwise.
+	 */
+	int enqueuev(int prio, const struct iovec* iov, int iovcnt);
+
+	/**
+	 *  @brief Move queued frames to the port
+	 *
+	 *  Returns once every queued frame has been handed to the kernel, or
+	 *  when timeoutMs has passed (0: one pass without waiting).
+	 *
+	 *  @param timeoutMs Time limit in milliseconds
+	 *
+	 *	@return Bytes handed to the kernel when successful, -1 otherwise
+	 *	        (errno EBUSY: another thread is in service() or discard()).
+	 */
+	int service(int timeoutMs);
+
+	/**
+	 *  @brief Stop accepting frames, enqueue() fails from now on
+	 *
+	 *  Frames already queued can still be sent with service().
+	 */
+	void close();
+
+	/**
+	 *  @brief Discard everything not yet handed to the kernel
+	 *
+	 *  Nothing is discarded while another thread is in service(); 0 is
+	 *  returned with errno EBUSY then.
+	 *
+	 *  @return Bytes discarded
+	 */
+	size_t discard();
+
+	/**
+	 *  @brief Bytes still queued in a class (not yet handed to the kernel)
+	 */
+	size_t pending(int prio);
+
+	/**
+	 *  @brief Bytes still queued in all classes
+	 */
+	size_t pendingTotal();
+
+	/**
+	 *  @brief Bytes not yet handed to the kernel, including the started frame
+	 */
+	size_t unsentBytes();
+
+	/**
+	 *  @brief Worst case wait of an urgent frame
+	 *
+	 *  One frame time of the largest frame queued so far plus the time to
+	 *  drain outqLimit bytes, plus the urgent frame's own transmit time.
+	 *
+	 *  @param urgentLen Length of the urgent frame
+	 *
+	 *  @return Bound in nanoseconds
+	 */
+	uint64_t latencyBoundNs(size_t urgentLen);
+
+	/**
+	 *  @brief Copy of the statistics of a class
+	 */
+	FOHTxStats stats(int prio);
+
+private:
+	struct _frame {
+		std::vector<uint8_t> data; /**< Frame bytes */
+		uint64_t queuedNs; /**< Enqueue timestamp */
+	};
+
+	/**
+	 *  @brief Account a frame that was completely handed over
+	 */
+	void _complete(int prio, const _frame& f, int outq);
+
+	/**
+	 *  @brief Charge a new frame to the budget, applying the policy
+	 */
+	bool _charge(size_t len);
+	int _service(int timeoutMs);
+
+	FOHSerial* _port; /**< Port to transmit on */
+	size_t _outqLimit; /**< Kernel output queue bound */
+	size_t _maxFrame; /**< Largest frame queued so far */
+	std::deque<_frame> _q[FOH_TX_PRIOS]; /**< Queued frames */
+	size_t _pending[FOH_TX_PRIOS]; /**< Queued bytes */
+	FOHTxStats _stats[FOH_TX_PRIOS]; /**< Statistics */
+	FOHMemBudget* _budget; /**< Budget for queued bytes */
+	int _policy; /**< Overflow policy */
+	int _blockMs; /**< Longest wait of a blocking enqueue() */
+	FOHSoftFlow* _flow; /**< User space XON/XOFF, or NULL */
+	std::atomic<FOHHistogram*> _latHist; /**< Latency histogram, or NULL */
+
+	_frame _cur; /**< Frame currently being written */
+	int _curPrio; /**< Class of _cur, -1 if none */
+	std::atomic<size_t> _curLeft; /**< Bytes of _cur not written yet, set with _lock held when taken */
+	std::atomic<bool> _servicing; /**< A thread is in service() or discard() */
+	std::atomic<bool> _closed; /**< close() was called, also read without _lock */
+	size_t _curOff; /**< Bytes of _cur already written */
+
+	std::mutex _lock; /**< Protects queues and statistics */
+	std::condition_variable _cond; /**< Signalled on enqueue */
+};
+
+#endif